@@ -4,17 +4,33 @@
 #ifndef ESP8266THING_H
 #define ESP8266THING_H
 
-#include "RadiationWatch.h"
-
 #define DISABLE_SERIAL_OUTPUT 1
 
 // The onboard LED controls for the ESP8266 seem counter-intuitive (high for off), so map them to explicit labels
 #define LED_OFF HIGH
 #define LED_ON LOW
 
-// RadiationWatch
+// Radiation Watch Type 5 sensor, read through lib/dual-detector
 #define SIG_PIN 12 
 #define NS_PIN 4
+// Optional second sensor; defining both fuses the two pulse streams (see lib/dual-detector)
+//#define SIG2_PIN 13
+//#define NS2_PIN 14
+#define CPM_PER_USVH 53.032 // Type 5 conversion factor (as in the RadiationWatch library); converts rates and pulse counts to a dose
+
+// Local Prometheus scrape endpoint, http://<device ip>:METRICS_PORT/metrics (see lib/metrics-server); comment out to disable
+#define METRICS_PORT 9100
+
+// Send the QoS 0 state and diagnostic updates as MQTT-SN datagrams to a gateway (LOCAL_ENV_MQTTSN_GATEWAY_HOST) instead of
+// over the broker connection (see lib/mqttsn-client); discovery, retained and QoS 1 messages stay on TCP. Comment out to disable
+//#define MQTTSN_GATEWAY_PORT 1885
+
+// Degrade the broker connection for bench testing (see lib/fault-client): NETWORK_PROFILE_WEAK_WIFI | NETWORK_PROFILE_FLAKY
+//#define NETWORK_FAULT_PROFILE NETWORK_PROFILE_WEAK_WIFI
+
+// Upper bound for each of the MQTT client's read and write buffers (allocated for the lifetime of the program); they are sized
+// to the largest message each way, computed at compile time in radthing.cpp
+#define MQTT_BUFFER_LIMIT 1024
 
 #define DEVICE_ID "esp8266thing"
 #define DEVICE_NAME "RadiationWatcher"
@@ -22,8 +38,4 @@
 #define DEVICE_MODEL "ESP8266 Thing Dev"
 #define DEVICE_VERSION "20221127.1800"
 
-// *********************************************************************************************************************
-// *** Must Declare ***
-extern RadiationWatch radiationWatch;
-
 #endif
\ No newline at end of file
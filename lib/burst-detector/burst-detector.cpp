@@ -0,0 +1,50 @@
+#include <climits>
+#include "burst-detector.h"
+
+void ICACHE_FLASH_ATTR burstDetectorReset(burst_detector &d, uint8_t sensors){
+  for (uint8_t i = 0; i < BURST_PULSES * BURST_SENSORS_MAX; i++)
+  {
+    d.timestamps[i] = 0;
+  }
+  d.pulses = BURST_PULSES * (sensors < 1 ? 1 : (sensors > BURST_SENSORS_MAX ? BURST_SENSORS_MAX : sensors));
+  d.next = 0;
+  d.count = 0;
+  d.last_burst = 0;
+  d.active = false;
+}
+
+// Called once per released pulse from loop(), not from the interrupt, so it needs no IRAM
+bool ICACHE_FLASH_ATTR burstDetectorPulse(burst_detector &d, unsigned long now){
+  d.timestamps[d.next] = now;
+  d.next = (d.next + 1) % d.pulses;
+  if(d.count < d.pulses){
+    d.count++;
+  }
+
+  // once full, the slot to be overwritten next holds the oldest of the last d.pulses pulses
+  if(d.count < d.pulses || now - d.timestamps[d.next] > BURST_WINDOW_MS){
+    return false;
+  }
+  d.last_burst = now;
+  if(d.active){
+    return false; // already alarming; just extends the hold time
+  }
+  d.active = true;
+  return true;
+}
+
+unsigned long ICACHE_FLASH_ATTR burstDetectorDueIn(const burst_detector &d, unsigned long now){
+  if(!d.active){
+    return ULONG_MAX;
+  }
+  unsigned long held = now - d.last_burst;
+  return held > BURST_HOLD_MS ? 0 : BURST_HOLD_MS + 1 - held;
+}
+
+bool ICACHE_FLASH_ATTR burstDetectorExpired(burst_detector &d, unsigned long now){
+  if(d.active && now - d.last_burst > BURST_HOLD_MS){
+    d.active = false;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,47 @@
+#ifndef BURST_DETECTOR_H
+#define BURST_DETECTOR_H
+
+#include <Arduino.h>
+
+/*
+  Sliding window burst detector over pulse timestamps.
+  A burst is BURST_PULSES pulses within BURST_WINDOW_MS. The window is sized against the expected background rate
+  (BURST_EXPECTED_CPM) so that random Poisson clustering practically never trips it:
+
+    false alarms/yr ~= r * P(Poisson(r*T) >= N-1) * seconds/yr, with r = cpm/60
+
+    background  2 CPM : ~0.0006 per year
+    background  3 CPM : ~0.015 per year
+    background  4 CPM : ~0.14 per year
+    background  5 CPM : ~0.8 per year
+
+  while a real spike is caught as soon as the window fills: median ~4.8s (95% within ~12s) at 100 CPM, ~1.5s
+  (~2.7s) at 300 CPM, ~0.5s at 1000 CPM. tools/bench/burst-replay.cpp measures both against these figures.
+  The alarm is held for BURST_HOLD_MS after the last pulse that completed a burst window.
+
+  With several sensors fused into one stream (see lib/dual-detector) the stream runs at the sum of their rates, so the
+  threshold scales with the number of sensors (burstDetectorReset()): the same per sensor rate trips it, in about the
+  same time, and the background alone trips it even less often than with one sensor.
+*/
+
+#define BURST_EXPECTED_CPM 5    // upper end of normal background for the Type 5 sensor
+#define BURST_PULSES 8          // N pulses...
+#define BURST_WINDOW_MS 5000    // ...within T milliseconds (8 in 5s = 96 CPM, ~20x the expected rate)
+#define BURST_HOLD_MS 60000     // milliseconds the alarm stays on after the last burst window
+#define BURST_SENSORS_MAX 2     // sensors a single detector can be fed from
+
+struct burst_detector{
+  unsigned long timestamps[BURST_PULSES * BURST_SENSORS_MAX]; // ring of the most recent pulse times (millis)
+  uint8_t pulses = BURST_PULSES;            // pulses within BURST_WINDOW_MS that make a burst: BURST_PULSES per sensor
+  uint8_t next;                             // slot to be overwritten next, which is also the oldest timestamp once full
+  uint8_t count;                            // pulses recorded (saturates at pulses)
+  unsigned long last_burst;                 // millis() of the last pulse that completed a burst window
+  volatile bool active;                     // alarm state
+};
+
+void burstDetectorReset(burst_detector &d, uint8_t sensors = 1); // sensors feeding the detector, 1..BURST_SENSORS_MAX
+bool burstDetectorPulse(burst_detector &d, unsigned long now);    // O(1); returns true when the alarm turns on
+bool burstDetectorExpired(burst_detector &d, unsigned long now);  // returns true when the alarm turns off
+unsigned long burstDetectorDueIn(const burst_detector &d, unsigned long now); // milliseconds until it expires; ULONG_MAX while off
+
+#endif
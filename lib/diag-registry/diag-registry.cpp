@@ -0,0 +1,198 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "diag-registry.h"
+#include "utils.h"
+
+// millis() of the last publication of the non-retained [0] and retained [1] groups
+static unsigned long last_group_publish[2] = { 0, 0 };
+
+/**
+ * @brief Runtime state for each declared field, all of it yet to be sampled.
+ */
+std::vector<diag_field> ICACHE_FLASH_ATTR getDiagnosticFields(const diag_spec* specs, size_t count){
+  std::vector<diag_field> fields(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    fields[i].spec = &specs[i];
+    fields[i].measurement = NAN;
+    fields[i].published_measurement = NAN;
+    fields[i].published_null = false;
+    fields[i].last_sample = 0;
+    fields[i].sampled = false;
+    fields[i].dirty = false;
+  }
+  return fields;
+}
+
+/**
+ * @brief Sample every field that is due. A fact is sampled once (or after invalidateDiagnosticFacts()),
+ * a measurement every sample_period milliseconds. Only marks a field dirty when its value changed
+ * (facts) or moved beyond its deadband since last published (measurements).
+ *
+ * @param now Current millis()
+ */
+void ICACHE_FLASH_ATTR sampleDiagnostics(unsigned long now){
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    diag_field &f = diag_fields[i];
+    const diag_spec &d = *f.spec;
+    bool due = !f.sampled || (d.sample_period > 0 && now - f.last_sample >= d.sample_period);
+    if(!due){
+      continue;
+    }
+    f.last_sample = now;
+    f.sampled = true;
+
+    if(d.read_fact != nullptr){
+      std::string value = d.read_fact();
+      value = value.length() <= d.width ? "\""+value+"\"" : "null"; // never wider than diagPayloadMaxLength() allows for
+      if(value != f.value){
+        f.value = value;
+        f.dirty = true;
+      }
+    }
+    else {
+      float m = d.read_measurement();
+      f.measurement = m;
+      f.value = to_string(m, d.format);
+      bool null = f.value.length() > d.width;
+      if(null){
+        f.value = "null";
+      }
+      if(null ? !f.published_null : std::isnan(f.published_measurement) || std::fabs(m - f.published_measurement) > d.deadband){
+        f.dirty = true;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Whether the given group has anything worth publishing.
+ * The non-retained group is also due once DIAG_HEARTBEAT has passed since it was last published.
+ */
+bool ICACHE_FLASH_ATTR diagnosticsPending(bool retained, unsigned long now){
+  bool any_sampled = false;
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    if(diag_fields[i].spec->retained != retained || !diag_fields[i].sampled){
+      continue;
+    }
+    if(diag_fields[i].dirty){
+      return true;
+    }
+    any_sampled = true;
+  }
+  return any_sampled && !retained && now - last_group_publish[0] >= DIAG_HEARTBEAT;
+}
+
+/**
+ * @brief Time until sampleDiagnostics() or a publication has something to do: a field yet to be sampled or
+ * published (ie. held up by the link) is due now, a measurement once its sample_period has passed, the
+ * non-retained group once DIAG_HEARTBEAT has.
+ *
+ * @param now Current millis()
+ * @return Milliseconds, 0 if due now
+ */
+unsigned long ICACHE_FLASH_ATTR diagnosticsDueIn(unsigned long now){
+  unsigned long due = ULONG_MAX;
+  bool any_sampled = false;
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    const diag_field &f = diag_fields[i];
+    if(!f.sampled || f.dirty){
+      return 0;
+    }
+    unsigned long period = f.spec->sample_period;
+    if(period > 0){
+      due = std::min(due, now - f.last_sample >= period ? 0 : period - (now - f.last_sample));
+    }
+    any_sampled = any_sampled || !f.spec->retained;
+  }
+  if(any_sampled){
+    unsigned long since = now - last_group_publish[0];
+    due = std::min(due, since >= DIAG_HEARTBEAT ? 0 : DIAG_HEARTBEAT - since);
+  }
+  return due;
+}
+
+/**
+ * @brief Json object with every sampled field of the group, built in a single allocation of its exact length.
+ */
+std::string ICACHE_FLASH_ATTR buildDiagnosticPayload(bool retained){
+  size_t length = 4; // "{ " ... " }"
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    const diag_field &f = diag_fields[i];
+    if(f.spec->retained == retained && f.sampled){
+      length += 2 + 1 + strlen(f.spec->attr) + 3 + f.value.length(); // , "attr": value
+    }
+  }
+  std::string payload;
+  payload.reserve(length);
+  payload += "{ ";
+  bool first = true;
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    const diag_field &f = diag_fields[i];
+    if(f.spec->retained != retained || !f.sampled){
+      continue;
+    }
+    if(!first){
+      payload += ", ";
+    }
+    payload += '"';
+    payload += f.spec->attr;
+    payload += "\": ";
+    payload += f.value;
+    first = false;
+  }
+  payload += " }";
+  return payload;
+}
+
+/**
+ * @brief Every sampled field of the group went out with the payload: nothing is dirty any more, measurements are
+ * compared against what was sent from now on, and their published hooks run (ie. a worst case starts over).
+ *
+ * @param now Current millis()
+ */
+void ICACHE_FLASH_ATTR markDiagnosticsPublished(bool retained, unsigned long now){
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    diag_field &f = diag_fields[i];
+    if(f.spec->retained != retained || !f.sampled){
+      continue;
+    }
+    f.dirty = false;
+    if(f.spec->read_measurement != nullptr){
+      f.published_null = f.value == "null";
+      f.published_measurement = f.published_null ? NAN : strtof(f.value.c_str(), nullptr); // compare against what was actually sent
+      if(f.spec->published != nullptr){
+        f.spec->published(f.measurement);
+      }
+    }
+  }
+  last_group_publish[retained ? 1 : 0] = now;
+}
+
+void ICACHE_FLASH_ATTR invalidateDiagnosticFacts(){
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    if(diag_fields[i].spec->read_fact != nullptr){
+      diag_fields[i].sampled = false;
+    }
+  }
+}
+
+size_t ICACHE_FLASH_ATTR countDiagnosticFields(bool facts){
+  size_t count = 0;
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    if((diag_fields[i].spec->read_fact != nullptr) == facts){
+      count++;
+    }
+  }
+  return count;
+}
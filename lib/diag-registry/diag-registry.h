@@ -0,0 +1,133 @@
+#ifndef DIAG_REGISTRY_H
+#define DIAG_REGISTRY_H
+
+#include <vector>
+#include <string>
+#include "utils.h"
+
+/*
+  Change-driven diagnostics.
+  Each diagnostic field is sampled on its own period and only causes a publication when it actually changed:
+  - facts (IP address, MAC, firmware version) are sampled once and cached until invalidated (ie. after a network
+    reconnect); they are meant to be published retained so the broker keeps them
+  - measurements (RSSI, counters) are re-sampled every sample_period and only republished once they move by more
+    than their deadband (or DIAG_HEARTBEAT has passed, so that a restarted Home Assistant eventually sees them again)
+  - a measurement over a period (a worst case, a rate) is not reset by its sampler but by its published hook, once the
+    value has gone out; a sample held back by the deadband is not lost, the period just goes on
+  Fields are grouped into two payloads by their retained flag; a payload always carries all fields of its group
+  so value templates never see a missing key.
+
+  Fields are declared in a constexpr array of diag_spec (see diagFact() and diagMeasurement()); validDiagnostics()
+  checks the declaration at compile time and diagPayloadMaxLength() gives the worst case length of a group's payload
+  from the declared value widths. A sampled value wider than its declared width is published as null.
+*/
+
+#define DIAG_HEARTBEAT 3600000 // milliseconds; republish non-retained measurements at least this often even if unchanged
+
+// *********************************************************************************************************************
+// *** Data Types ***
+struct diag_spec{
+  const char* attr;               // Name of json attribute within diagnostic message payload (also used as discovery sensor id)
+  const char* icon;               // https://materialdesignicons.com/
+  const char* unit;               // ppm, ticks, meters, C, F, (anything); empty if unitless
+  const char* state_class;        // measurement | total | total_increasing (measurements only)
+  bool retained;                  // published retained (facts) or not (measurements)
+  std::string (*read_fact)();     // sampler for a fact; nullptr for measurements
+  float (*read_measurement)();    // sampler for a measurement; nullptr for facts
+  const char* format;             // printf format of a measurement, ie "%.0f"
+  unsigned int width;             // maximum formatted length of the value (characters, without the quotes of a fact)
+  unsigned long sample_period;    // milliseconds between samples; 0 = sample once and cache until invalidated
+  float deadband;                 // a measurement is only republished once it changes by more than this
+  void (*published)(float value); // called with the sampled measurement once it is published (ie. to start a new period); may be nullptr
+};
+
+struct diag_field{
+  const diag_spec* spec;          // declaration
+
+  // runtime state
+  std::string value;              // last sampled value, formatted (and quoted for facts) ready for the payload
+  float measurement;              // last sampled measurement, as read
+  float published_measurement;    // last published measurement, used for the deadband comparison; NAN if there is none
+  bool published_null;            // the last publication carried null (the value was too wide), not published_measurement
+  unsigned long last_sample;      // millis() of last sample
+  bool sampled;                   // value holds a sample
+  bool dirty;                     // value changed since last publication
+};
+
+constexpr diag_spec diagFact(const char* attr, const char* icon, std::string (*read)(), unsigned int width){
+  return { attr, icon, "", "", true, read, nullptr, nullptr, width, 0 /* cached */, 0, nullptr };
+}
+
+constexpr diag_spec diagMeasurement(const char* attr, const char* icon, const char* unit, const char* state_class, float (*read)(), const char* format, unsigned int width, unsigned long sample_period, float deadband, void (*published)(float) = nullptr){
+  return { attr, icon, unit, state_class, false, nullptr, read, format, width, sample_period, deadband, published };
+}
+
+constexpr bool diagStrEqual(const char* a, const char* b){
+  while(*a != '\0' && *a == *b){
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+// Every attribute unique, exactly one sampler, a format for measurements, and room for "null" in the width
+constexpr bool validDiagnostics(const diag_spec* specs, size_t count){
+  for (size_t i = 0; i < count; i++)
+  {
+    if(specs[i].attr == nullptr || (specs[i].read_fact == nullptr) == (specs[i].read_measurement == nullptr) || specs[i].width < 4){
+      return false;
+    }
+    if(specs[i].read_measurement != nullptr && specs[i].format == nullptr){
+      return false;
+    }
+    for (size_t j = i + 1; j < count; j++)
+    {
+      if(diagStrEqual(specs[i].attr, specs[j].attr)){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Worst case length of the payload built by buildDiagnosticPayload() for the retained (or non-retained) group
+constexpr size_t diagPayloadMaxLength(const diag_spec* specs, size_t count, bool retained){
+  size_t length = 4; // "{ " ... " }"
+  bool first = true;
+  for (size_t i = 0; i < count; i++)
+  {
+    if(specs[i].retained != retained){
+      continue;
+    }
+    length += (first ? 0 : 2) + 1 + constStrLength(specs[i].attr) + 3 + specs[i].width + (specs[i].read_fact != nullptr ? 2 : 0); // , "attr": value
+    first = false;
+  }
+  return length;
+}
+
+// Longest value of one of the string members over all fields, ie. diagMaxLength(specs, count, &diag_spec::icon)
+constexpr size_t diagMaxLength(const diag_spec* specs, size_t count, const char* diag_spec::*member){
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    length = constMax(length, constStrLength(specs[i].*member));
+  }
+  return length;
+}
+
+// *********************************************************************************************************************
+// *** Must Declare ***
+extern std::vector<diag_field> diag_fields;
+
+// *** Provided in library ***
+std::vector<diag_field> getDiagnosticFields(const diag_spec* specs, size_t count); // runtime registry for the declared fields
+
+void sampleDiagnostics(unsigned long now);                  // sample all fields that are due
+bool diagnosticsPending(bool retained, unsigned long now);  // true if the retained (or non-retained) group should be published
+unsigned long diagnosticsDueIn(unsigned long now);          // milliseconds until a field is to be sampled or a group published
+std::string buildDiagnosticPayload(bool retained);          // json object with every field of the group
+void markDiagnosticsPublished(bool retained, unsigned long now);
+void invalidateDiagnosticFacts();                           // force cached facts to be re-sampled (ie. IP after reconnect)
+size_t countDiagnosticFields(bool facts);                   // number of facts (or measurements) in the registry
+
+#endif
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <climits>
+#include <coredecls.h> // esp_schedule()
+#include "dual-detector.h"
+
+struct pulse_queue{
+  volatile unsigned long times[DUAL_QUEUE];   // micros() of each queued pulse
+  volatile uint8_t head;                      // next to release
+  volatile uint8_t tail;                      // next free slot
+};
+
+// Noise on a sensor's NS pin: the last active period, or the one still going on
+struct noise_gate{
+  volatile unsigned long rose;                // micros() the NS pin went active
+  volatile unsigned long fell;                // micros() it went inactive again
+  volatile bool active;                       // NS pin active now
+  volatile bool seen;                         // any noise since boot
+};
+
+static pulse_queue queues[2];
+static pulse_queue noise_events;            // NS pins going active, either sensor
+static noise_gate gates[2];
+static uint8_t noise_pins[2];
+static uint8_t sensors = 1;
+static dual_detector_callback pulse_callback = nullptr;
+static dual_detector_callback noise_callback = nullptr;
+static uint32_t coincidences = 0;
+static volatile uint32_t overflows = 0;
+static volatile uint32_t queued = 0;        // events pushed since boot
+static uint32_t noise_gated = 0;
+
+static uint16_t slots[DUAL_SLOTS];          // released pulses per DUAL_SLOT_MS
+static uint8_t slot = 0;                    // slot being filled
+static uint8_t slots_used = 1;              // slots holding history, including the current one
+static unsigned long slot_started = 0;      // millis() the current slot started
+
+static void IRAM_ATTR onSignal1(){ dualDetectorRecord(0, micros()); }
+static void IRAM_ATTR onSignal2(){ dualDetectorRecord(1, micros()); }
+static void IRAM_ATTR onNoise1(){ dualDetectorNoise(0, digitalRead(noise_pins[0]) == HIGH, micros()); }
+static void IRAM_ATTR onNoise2(){ dualDetectorNoise(1, digitalRead(noise_pins[1]) == HIGH, micros()); }
+
+static void ICACHE_FLASH_ATTR begin(uint8_t count, dual_detector_callback on_pulse, dual_detector_callback on_noise){
+  pulse_callback = on_pulse;
+  noise_callback = on_noise;
+  sensors = count;
+  for (uint8_t i = 0; i < DUAL_SLOTS; i++)
+  {
+    slots[i] = 0;
+  }
+  slot = 0;
+  slots_used = 1;
+  slot_started = millis();
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    gates[i].active = false;
+    gates[i].seen = false;
+  }
+}
+
+// same pin setup as RadiationWatch: pulses are active low, noise active high
+static void ICACHE_FLASH_ATTR attachSensor(uint8_t sensor, uint8_t sig, uint8_t ns){
+  noise_pins[sensor] = ns;
+  pinMode(sig, INPUT);
+  pinMode(ns, INPUT);
+  attachInterrupt(digitalPinToInterrupt(sig), sensor == 0 ? onSignal1 : onSignal2, FALLING);
+  attachInterrupt(digitalPinToInterrupt(ns), sensor == 0 ? onNoise1 : onNoise2, CHANGE);
+}
+
+void ICACHE_FLASH_ATTR dualDetectorBegin(uint8_t sig, uint8_t ns, dual_detector_callback on_pulse, dual_detector_callback on_noise){
+  begin(1, on_pulse, on_noise);
+  attachSensor(0, sig, ns);
+}
+
+void ICACHE_FLASH_ATTR dualDetectorBegin(uint8_t sig1, uint8_t ns1, uint8_t sig2, uint8_t ns2, dual_detector_callback on_pulse, dual_detector_callback on_noise){
+  begin(2, on_pulse, on_noise);
+  attachSensor(0, sig1, ns1);
+  attachSensor(1, sig2, ns2);
+}
+
+// Called from the interrupts; false if the queue is full. Wakes loop() if it is idle, so the event is not left
+// waiting for the idle to run out.
+static bool IRAM_ATTR push(pulse_queue &q, unsigned long now_micros){
+  uint8_t next = (q.tail + 1) % DUAL_QUEUE;
+  if(next == q.head){
+    overflows++;
+    return false;
+  }
+  q.times[q.tail] = now_micros;
+  q.tail = next;
+  queued++;
+  esp_schedule();
+  return true;
+}
+
+void IRAM_ATTR dualDetectorRecord(uint8_t sensor, unsigned long now_micros){
+  push(queues[sensor], now_micros);
+}
+
+void IRAM_ATTR dualDetectorNoise(uint8_t sensor, bool active, unsigned long now_micros){
+  noise_gate &g = gates[sensor];
+  if(active == g.active){
+    return;
+  }
+  if(active){
+    g.rose = now_micros;
+    g.seen = true;
+    push(noise_events, now_micros);
+  }
+  else {
+    g.fell = now_micros;
+  }
+  g.active = active;
+}
+
+// Pulse of the sensor at t during its noise, or within NOISE_GATE_US either side of it
+static bool ICACHE_FLASH_ATTR noiseGated(uint8_t sensor, unsigned long t){
+  const noise_gate &g = gates[sensor];
+  if(!g.seen || (long)(t - g.rose) < -(long)NOISE_GATE_US){
+    return false;
+  }
+  return g.active || (long)(t - g.fell) <= (long)NOISE_GATE_US;
+}
+
+static void ICACHE_FLASH_ATTR advanceSlots(unsigned long now_millis){
+  while(now_millis - slot_started >= DUAL_SLOT_MS){
+    slot_started += DUAL_SLOT_MS;
+    slot = (slot + 1) % DUAL_SLOTS;
+    slots[slot] = 0;
+    if(slots_used < DUAL_SLOTS){
+      slots_used++;
+    }
+  }
+}
+
+/**
+ * @brief Merge both queues oldest first. The oldest pulse is released once COINCIDENCE_WINDOW_US has passed
+ * without the other sensor firing; if the other sensor's oldest pulse is within the window, both are dropped.
+ * A pulse close to noise on its own sensor's NS pin is dropped on its own.
+ */
+void ICACHE_FLASH_ATTR dualDetectorLoop(unsigned long now_micros, unsigned long now_millis){
+  advanceSlots(now_millis);
+
+  while(true){
+    pulse_queue &a = queues[0];
+    pulse_queue &b = queues[1];
+    bool has_a = a.head != a.tail;
+    bool has_b = b.head != b.tail;
+    if(!has_a && !has_b){
+      break;
+    }
+    unsigned long ta = has_a ? a.times[a.head] : 0;
+    unsigned long tb = has_b ? b.times[b.head] : 0;
+
+    if(has_a && has_b){
+      // signed difference, so micros() wrapping between the two is handled
+      long apart = (long)(ta - tb);
+      if(apart <= (long)COINCIDENCE_WINDOW_US && apart >= -(long)COINCIDENCE_WINDOW_US){
+        a.head = (a.head + 1) % DUAL_QUEUE;
+        b.head = (b.head + 1) % DUAL_QUEUE;
+        coincidences++;
+        continue;
+      }
+    }
+
+    pulse_queue &oldest = (!has_b || (has_a && (long)(ta - tb) < 0)) ? a : b;
+    unsigned long t = oldest.times[oldest.head];
+    if(now_micros - t <= COINCIDENCE_WINDOW_US){
+      break; // the other sensor may still fire within the window
+    }
+    oldest.head = (oldest.head + 1) % DUAL_QUEUE;
+    if(noiseGated(&oldest == &a ? 0 : 1, t)){
+      noise_gated++;
+      continue;
+    }
+    slots[slot]++;
+    if(pulse_callback != nullptr){
+      pulse_callback(t);
+    }
+  }
+
+  while(noise_events.head != noise_events.tail){
+    unsigned long t = noise_events.times[noise_events.head];
+    noise_events.head = (noise_events.head + 1) % DUAL_QUEUE;
+    if(noise_callback != nullptr){
+      noise_callback(t);
+    }
+  }
+}
+
+/**
+ * @brief Time until dualDetectorLoop() next has something to do: noise to report straight away, or the window of the
+ * oldest queued pulse to pass.
+ *
+ * @param now_micros Current micros()
+ * @return Microseconds, 0 if due now; ULONG_MAX if nothing is queued
+ */
+unsigned long ICACHE_FLASH_ATTR dualDetectorDueIn(unsigned long now_micros){
+  if(noise_events.head != noise_events.tail){
+    return 0;
+  }
+  unsigned long due = ULONG_MAX;
+  for (uint8_t i = 0; i < sensors; i++)
+  {
+    const pulse_queue &q = queues[i];
+    if(q.head == q.tail){
+      continue;
+    }
+    unsigned long waited = now_micros - q.times[q.head];
+    due = std::min(due, waited > COINCIDENCE_WINDOW_US ? 0UL : COINCIDENCE_WINDOW_US + 1 - waited);
+  }
+  return due;
+}
+
+uint32_t ICACHE_FLASH_ATTR dualDetectorQueued(){
+  return queued;
+}
+
+uint32_t ICACHE_FLASH_ATTR dualDetectorCount(){
+  uint32_t count = 0;
+  for (uint8_t i = 0; i < slots_used; i++)
+  {
+    count += slots[(slot + DUAL_SLOTS - i) % DUAL_SLOTS];
+  }
+  return count;
+}
+
+unsigned long ICACHE_FLASH_ATTR dualDetectorIntegrationTime(){
+  return (slots_used - 1) * (unsigned long)DUAL_SLOT_MS + (millis() - slot_started);
+}
+
+double ICACHE_FLASH_ATTR dualDetectorCpm(){
+  double minutes = dualDetectorIntegrationTime() / 60000.0;
+  return minutes > 0 ? dualDetectorCount() / (double)sensors / minutes : 0;
+}
+
+uint32_t ICACHE_FLASH_ATTR dualDetectorCoincidences(){
+  return coincidences;
+}
+
+uint32_t ICACHE_FLASH_ATTR dualDetectorOverflows(){
+  return overflows;
+}
+
+uint32_t ICACHE_FLASH_ATTR dualDetectorNoiseGated(){
+  return noise_gated;
+}
@@ -0,0 +1,58 @@
+#ifndef DUAL_DETECTOR_H
+#define DUAL_DETECTOR_H
+
+#include <Arduino.h>
+
+/*
+  One or two Type 5 sensors, fused into one pulse stream.
+  The pulse path owns the sensors' SIG/NS pins rather than RadiationWatch: that library calls its callbacks from its
+  loop(), without the time of the pulse, and keeps its interrupt state in static members, so it can only drive one
+  sensor.
+
+  - each sensor's pulses are timestamped in its own interrupt and queued; the callbacks get that timestamp, so
+    intervals between pulses are measured at the pin rather than at whenever loop() gets round to them
+  - the queues are merged oldest first in dualDetectorLoop(); a pulse is only released once COINCIDENCE_WINDOW_US has
+    passed, so that a pulse of the other sensor within the window can still cancel it
+  - pulses of both sensors within COINCIDENCE_WINDOW_US of each other are rejected as a pair: a shock or electrical
+    interference reaching both boards at once, not two independent gamma rays
+  - a sensor's pulses while its NS (noise) pin is active, or within NOISE_GATE_US of it, are discarded, as
+    RadiationWatch does: vibration that only reaches one board
+  - released pulses are counted in DUAL_SLOTS slots of DUAL_SLOT_MS for the combined rate
+  - every queued pulse or noise event calls esp_schedule(), which ends an idle esp_delay() of loop() early; the caller
+    then idles again until dualDetectorDueIn(), when the pulse's window has passed
+
+  With two independent sensors the count in a given window doubles, so the relative (Poisson) error of the rate
+  shrinks by sqrt(2) ~ 1.4 for the same integration time. Rates are reported per sensor (combined count / sensors) so
+  that the single sensor dose conversion still applies.
+  The window also rejects genuine chance coincidences, at 2 * r1 * r2 * window: at 2 CPM per sensor and 20ms that is
+  about 0.4 pulses per hour of 240, or 0.2%.
+  With one sensor there is nothing to coincide with; pulses are still held for the window, for the noise gate.
+*/
+
+#define COINCIDENCE_WINDOW_US 20000   // pulses of both sensors closer than this are rejected as a pair
+#define NOISE_GATE_US 20000           // pulses this close to noise on their sensor's NS pin are discarded; at most COINCIDENCE_WINDOW_US,
+                                      // so noise that follows a pulse has been seen by the time the pulse is released
+static_assert(NOISE_GATE_US <= COINCIDENCE_WINDOW_US, "noise after a pulse must be seen before the pulse is released");
+#define DUAL_QUEUE 32                 // pulses per sensor waiting for the coincidence window to pass, and noise events;
+                                      // at 10,000 CPM a window and a loop() pass hold 5 on average, 16 overflowed now and then
+#define DUAL_SLOTS 60                 // combined rate history...
+#define DUAL_SLOT_MS 5000             // ...of 60 x 5s = 5 minutes
+
+typedef void (*dual_detector_callback)(unsigned long event_micros);  // micros() of the pulse or noise, taken in its interrupt
+
+void dualDetectorBegin(uint8_t sig, uint8_t ns, dual_detector_callback on_pulse, dual_detector_callback on_noise);  // one sensor
+void dualDetectorBegin(uint8_t sig1, uint8_t ns1, uint8_t sig2, uint8_t ns2, dual_detector_callback on_pulse, dual_detector_callback on_noise);
+void dualDetectorRecord(uint8_t sensor, unsigned long now_micros);  // queue a pulse of sensor 0 or 1 (called by the interrupts)
+void dualDetectorNoise(uint8_t sensor, bool active, unsigned long now_micros); // NS pin of sensor 0 or 1 changed (called by the interrupts)
+void dualDetectorLoop(unsigned long now_micros, unsigned long now_millis); // release pulses whose window has passed; call every loop()
+unsigned long dualDetectorDueIn(unsigned long now_micros);  // microseconds until dualDetectorLoop() has work; ULONG_MAX if nothing is queued
+uint32_t dualDetectorQueued();              // pulses and noise events queued since boot; changes when an interrupt has queued one
+
+uint32_t dualDetectorCount();               // released pulses within the rate history
+unsigned long dualDetectorIntegrationTime();  // milliseconds covered by the rate history
+double dualDetectorCpm();                   // per sensor counts per minute
+uint32_t dualDetectorCoincidences();        // pulse pairs rejected since boot
+uint32_t dualDetectorOverflows();           // pulses and noise events lost to a full queue since boot
+uint32_t dualDetectorNoiseGated();          // pulses discarded for noise on their sensor since boot
+
+#endif
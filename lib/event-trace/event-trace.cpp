@@ -0,0 +1,90 @@
+#include <algorithm>
+#include "event-trace.h"
+
+static trace_record ring[TRACE_RECORDS];
+static uint16_t ring_next = 0;          // slot to be overwritten next, which is also the oldest record once full
+static uint16_t ring_count = 0;         // records held (saturates at TRACE_RECORDS)
+static volatile bool dumping = false;   // ring frozen while a dump is in progress
+static uint16_t dump_chunk = 0;
+static uint32_t dump_id = 0;
+static uint64_t dump_epoch_us = 0;      // wall-clock time of dump_id
+
+void ICACHE_FLASH_ATTR traceBegin(){
+  ring_next = 0;
+  ring_count = 0;
+  dumping = false;
+}
+
+void ICACHE_FLASH_ATTR traceEvent(uint8_t event, uint16_t arg){
+  if(dumping){
+    return;
+  }
+  trace_record &r = ring[ring_next];
+  r.cycles = ESP.getCycleCount();
+  r.millis = millis();
+  r.event = event;
+  r.reserved = 0;
+  r.arg = arg;
+  ring_next = (ring_next + 1) % TRACE_RECORDS;
+  if(ring_count < TRACE_RECORDS){
+    ring_count++;
+  }
+}
+
+void ICACHE_FLASH_ATTR traceDumpRequest(unsigned long now, uint64_t now_epoch_us){
+  if(dumping){
+    return; // already in progress
+  }
+  dump_chunk = 0;
+  dump_id = now;
+  dump_epoch_us = now_epoch_us;
+  dumping = true;
+}
+
+static uint16_t ICACHE_FLASH_ATTR dumpChunks(){
+  return ring_count == 0 ? 1 : (ring_count + TRACE_DUMP_CHUNK - 1) / TRACE_DUMP_CHUNK; // an empty trace still gets a (header only) reply
+}
+
+size_t ICACHE_FLASH_ATTR traceBuildDumpChunk(uint8_t *buffer, size_t size){
+  if(!dumping){
+    return 0;
+  }
+  uint16_t first = dump_chunk * TRACE_DUMP_CHUNK;
+  uint16_t n = std::min<uint16_t>(TRACE_DUMP_CHUNK, ring_count - first);
+  size_t length = sizeof(trace_dump_header) + n * sizeof(trace_record);
+  if(size < length){
+    return 0;
+  }
+
+  trace_dump_header header;
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.cpu_mhz = ESP.getCpuFreqMHz();
+  header.records = n;
+  header.chunk = dump_chunk;
+  header.chunks = dumpChunks();
+  header.dump_id = dump_id;
+  header.dump_epoch_us = dump_epoch_us;
+  memcpy(buffer, &header, sizeof(header));
+
+  uint16_t oldest = ring_count < TRACE_RECORDS ? 0 : ring_next;
+  for (uint16_t i = 0; i < n; i++)
+  {
+    memcpy(buffer + sizeof(header) + i * sizeof(trace_record), &ring[(oldest + first + i) % TRACE_RECORDS], sizeof(trace_record));
+  }
+  return length;
+}
+
+bool ICACHE_FLASH_ATTR traceDumping(){
+  return dumping;
+}
+
+void ICACHE_FLASH_ATTR traceDumpChunkSent(){
+  if(!dumping){
+    return;
+  }
+  dump_chunk++;
+  if(dump_chunk >= dumpChunks()){
+    dumping = false; // resume recording; the dumped events stay in the ring
+  }
+}
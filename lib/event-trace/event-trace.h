@@ -0,0 +1,25 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <Arduino.h>
+#include "trace-format.h"
+
+/*
+  In-RAM ring of the last TRACE_RECORDS events (see trace-format.h), each stamped with the CPU cycle counter.
+  Recording is a handful of stores, cheap enough for the pulse path. The oldest events are overwritten.
+  On request the ring is frozen and dumped in chunks of TRACE_DUMP_CHUNK records, one chunk per call so the dump
+  is interleaved with normal work; recording resumes once the last chunk has been sent.
+  Convert a captured dump with tools/trace2chrome and open it in chrome://tracing or https://ui.perfetto.dev
+*/
+
+#define TRACE_RECORDS 128         // 1.5KB of RAM
+#define TRACE_DUMP_CHUNK 40       // records per dump message (24 + 480 bytes)
+
+void traceBegin();
+void traceEvent(uint8_t event, uint16_t arg);   // O(1); safe from the pulse path; ignored while a dump is in progress
+void traceDumpRequest(unsigned long now, uint64_t now_epoch_us); // freeze the ring and start a dump; now_epoch_us dates it (0 if unknown)
+size_t traceBuildDumpChunk(uint8_t *buffer, size_t size); // current chunk of the dump in progress; 0 if none
+void traceDumpChunkSent();                      // advance to the next chunk (the same chunk is rebuilt until called)
+bool traceDumping();                            // a dump is in progress
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+/*
+  Binary layout of the event trace, shared by the firmware (event-trace.cpp) and the host converter
+  (tools/trace2chrome.cpp). Plain fixed width fields only, little endian (both the ESP8266 and x86/ARM hosts are).
+
+  A dump is published as one or more MQTT messages, each a trace_dump_header followed by header.records records.
+  Records are oldest first across the chunks of a dump.
+*/
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x52545452          // "RTTR"
+#define TRACE_VERSION 2
+
+enum trace_event_type : uint8_t {
+  TRACE_PULSE = 1,                      // radiation pulse
+  TRACE_NOISE,                          // noise event
+  TRACE_PUBLISH_BEGIN,                  // arg: trace_channel
+  TRACE_PUBLISH_END,                    // arg: trace_channel, high bit set if the publish failed
+  TRACE_PUBACK,                         // QoS 1 publish acknowledged by the broker; arg: trace_channel
+  TRACE_WIFI_STATE,                     // arg: wl_status_t
+  TRACE_BROKER_CONNECT,                 // arg: 1 connected, 0 attempt failed
+  TRACE_OVERRUN,                        // loop() pass took too long; arg: milliseconds
+};
+
+enum trace_channel : uint16_t {         // what was being published
+  TRACE_CHANNEL_STATE = 0,
+  TRACE_CHANNEL_ALARM,
+  TRACE_CHANNEL_ROLLUP,
+  TRACE_CHANNEL_DIAGNOSTICS,
+  TRACE_CHANNEL_OTHER,
+  TRACE_CHANNEL_INTERVALS,              // interval histograms
+};
+
+#define TRACE_PUBLISH_FAILED 0x8000
+
+struct trace_record{
+  uint32_t cycles;                      // CPU cycle counter; wraps every ~53s at 80MHz
+  uint32_t millis;                      // millis(); lets the reader unwrap the cycle counter across long gaps
+  uint8_t event;                        // trace_event_type
+  uint8_t reserved;
+  uint16_t arg;                         // event specific
+};
+
+struct trace_dump_header{
+  uint32_t magic;                       // TRACE_MAGIC
+  uint8_t version;                      // TRACE_VERSION
+  uint8_t cpu_mhz;                      // cycle counter frequency
+  uint16_t records;                     // records following this header
+  uint16_t chunk;                       // index of this message within the dump
+  uint16_t chunks;                      // messages in the dump
+  uint32_t dump_id;                     // millis() when the dump was requested; tells dumps apart
+  uint64_t dump_epoch_us;               // wall-clock time (microseconds since 1970) at millis() == dump_id; 0 if the clock was not set
+};
+
+static_assert(sizeof(trace_record) == 12, "trace_record layout is shared with the host converter");
+static_assert(sizeof(trace_dump_header) == 24, "trace_dump_header layout is shared with the host converter");
+
+#endif
@@ -0,0 +1,85 @@
+#include "fault-client.h"
+
+FaultInjectingClient::FaultInjectingClient(Client &client, const network_profile &profile)
+  : _client(client), _profile(profile), _connected_at(0), _losses(0), _disconnects(0) {
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::connect(IPAddress ip, uint16_t port){
+  delay(_profile.rtt_ms); // SYN / SYN-ACK
+  int result = _client.connect(ip, port);
+  _connected_at = millis();
+  return result;
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::connect(const char *host, uint16_t port){
+  delay(_profile.rtt_ms);
+  int result = _client.connect(host, port);
+  _connected_at = millis();
+  return result;
+}
+
+// Drop the connection once it has been up for disconnect_every_ms
+bool ICACHE_FLASH_ATTR FaultInjectingClient::expired(){
+  if(_profile.disconnect_every_ms == 0 || !_client.connected() || millis() - _connected_at < _profile.disconnect_every_ms){
+    return false;
+  }
+  _disconnects++;
+  _client.stop();
+  return true;
+}
+
+void ICACHE_FLASH_ATTR FaultInjectingClient::degrade(size_t size){
+  unsigned long wait = _profile.rtt_ms;
+  if(_profile.bytes_per_sec > 0){
+    wait += (size * 1000UL) / _profile.bytes_per_sec;
+  }
+  if(_profile.loss_percent > 0 && random(100) < _profile.loss_percent){
+    _losses++;
+    wait += FAULT_RETRANSMIT_MS;
+  }
+  delay(wait);
+}
+
+size_t ICACHE_FLASH_ATTR FaultInjectingClient::write(uint8_t b){
+  return write(&b, 1);
+}
+
+size_t ICACHE_FLASH_ATTR FaultInjectingClient::write(const uint8_t *buf, size_t size){
+  if(expired()){
+    return 0;
+  }
+  degrade(size);
+  return _client.write(buf, size);
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::available(){
+  return expired() ? 0 : _client.available();
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::read(){
+  return _client.read();
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::read(uint8_t *buf, size_t size){
+  return _client.read(buf, size);
+}
+
+int ICACHE_FLASH_ATTR FaultInjectingClient::peek(){
+  return _client.peek();
+}
+
+void ICACHE_FLASH_ATTR FaultInjectingClient::flush(){
+  _client.flush();
+}
+
+void ICACHE_FLASH_ATTR FaultInjectingClient::stop(){
+  _client.stop();
+}
+
+uint8_t ICACHE_FLASH_ATTR FaultInjectingClient::connected(){
+  return expired() ? 0 : _client.connected();
+}
+
+FaultInjectingClient::operator bool(){
+  return connected();
+}
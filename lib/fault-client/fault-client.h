@@ -0,0 +1,61 @@
+#ifndef FAULT_CLIENT_H
+#define FAULT_CLIENT_H
+
+#include <ESP8266WiFi.h>
+
+/*
+  Network fault injection for bench testing the MQTT connectivity paths (initMQTTClient, connectMQTTBroker,
+  publishDiscoveryMessages, assertConnectivity) against a real broker under a degraded link.
+  Wraps the client passed to MQTTClient::begin() and degrades it according to a network_profile:
+    - rtt_ms              : added round trip latency on every write
+    - bytes_per_sec       : bandwidth limit on writes (0 = unlimited)
+    - loss_percent        : chance that a write suffers a TCP retransmission timeout (FAULT_RETRANSMIT_MS)
+    - disconnect_every_ms : connection is dropped after being up this long (0 = never)
+  Like lwIP itself, the delays block the caller; that is exactly the behaviour being tested.
+*/
+
+#define FAULT_RETRANSMIT_MS 1000 // delay modelling a lost segment being retransmitted
+
+struct network_profile{
+  unsigned long rtt_ms;
+  unsigned long bytes_per_sec;
+  uint8_t loss_percent;
+  unsigned long disconnect_every_ms;
+};
+
+const network_profile NETWORK_PROFILE_GOOD = { 0, 0, 0, 0 };
+const network_profile NETWORK_PROFILE_WEAK_WIFI = { 150, 20000, 5, 0 };
+const network_profile NETWORK_PROFILE_FLAKY = { 300, 5000, 10, 600000 };
+
+class FaultInjectingClient : public Client {
+  public:
+    FaultInjectingClient(Client &client, const network_profile &profile);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override;
+
+    unsigned long injectedLosses() const { return _losses; }
+    unsigned long injectedDisconnects() const { return _disconnects; }
+
+  private:
+    bool expired();
+    void degrade(size_t size);
+
+    Client &_client;
+    network_profile _profile;
+    unsigned long _connected_at;
+    unsigned long _losses;
+    unsigned long _disconnects;
+};
+
+#endif
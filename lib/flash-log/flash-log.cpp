@@ -0,0 +1,163 @@
+#include <climits>
+#include "flash-log.h"
+#include <spi_flash.h>
+
+// Reserved by the linker script (eagle.flash.512k.ld) for the EEPROM emulation
+extern "C" uint32_t _EEPROM_start;
+
+#define FLASH_LOG_SLOTS (SPI_FLASH_SEC_SIZE / sizeof(flash_log_record))
+#define FLASH_LOG_ERASED 0xFFFFFFFF
+#define FLASH_LOG_MAGIC 0x52414431    // "RAD1"; seeds the CRC so records of an incompatible format never validate
+
+static uint32_t sector = 0;                   // flash sector holding the log
+static uint32_t head = 0;                     // next free slot
+static flash_log_record current;              // values as they should be persisted
+static bool dirty = false;                    // current differs from what is in flash
+static bool urgent_pending = false;           // a change that should be written after FLASH_LOG_SETTLE rather than FLASH_LOG_INTERVAL
+static unsigned long changed_at = 0;          // millis() of the first unwritten change
+static unsigned long last_write = 0;          // millis() of the last write
+static unsigned long writes = 0;              // records written since boot
+
+static uint32_t ICACHE_FLASH_ATTR crc32(const uint8_t *data, size_t length, uint32_t crc){
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t ICACHE_FLASH_ATTR recordCrc(const flash_log_record &r){
+  return crc32(reinterpret_cast<const uint8_t*>(&r), offsetof(flash_log_record, crc), FLASH_LOG_MAGIC);
+}
+
+static uint32_t ICACHE_FLASH_ATTR slotAddress(uint32_t slot){
+  return sector * SPI_FLASH_SEC_SIZE + slot * sizeof(flash_log_record);
+}
+
+static bool ICACHE_FLASH_ATTR readSlot(uint32_t slot, flash_log_record &r){
+  return ESP.flashRead(slotAddress(slot), reinterpret_cast<uint32_t*>(&r), sizeof(r));
+}
+
+static bool ICACHE_FLASH_ATTR slotErased(uint32_t slot){
+  uint32_t sequence = 0;
+  ESP.flashRead(slotAddress(slot), &sequence, sizeof(sequence));
+  return sequence == FLASH_LOG_ERASED;
+}
+
+/**
+ * @brief Locate the head of the log and restore the most recent valid record.
+ * Slots are always filled in order, so written slots form a prefix of the sector and the head can be found with a
+ * binary search for the first erased slot.
+ *
+ * @param values Receives the restored values (left untouched if nothing valid was found)
+ * @return true If a valid record was restored
+ */
+bool ICACHE_FLASH_ATTR flashLogBegin(uint32_t values[FLASH_LOG_VALUES]){
+  sector = ((uint32_t)(uintptr_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE;
+
+  uint32_t lo = 0, hi = FLASH_LOG_SLOTS;
+  while(lo < hi){
+    uint32_t mid = (lo + hi) / 2;
+    if(slotErased(mid)){
+      hi = mid;
+    }
+    else {
+      lo = mid + 1;
+    }
+  }
+  head = lo;
+
+  // newest first; skip a record torn by a power loss mid-write
+  for (uint32_t slot = head; slot > 0; slot--)
+  {
+    flash_log_record r;
+    if(readSlot(slot - 1, r) && r.crc == recordCrc(r)){
+      current = r;
+      for (uint8_t i = 0; i < FLASH_LOG_VALUES; i++)
+      {
+        values[i] = r.values[i];
+      }
+      return true;
+    }
+  }
+
+  current.sequence = 0;
+  for (uint8_t i = 0; i < FLASH_LOG_VALUES; i++)
+  {
+    current.values[i] = values[i]; // defaults provided by the caller
+  }
+  return false;
+}
+
+/**
+ * @brief Update a value; it is written by flashLogLoop() once due.
+ *
+ * @param index Value slot, 0..FLASH_LOG_VALUES-1
+ * @param value New value
+ * @param urgent Write after FLASH_LOG_SETTLE instead of waiting for FLASH_LOG_INTERVAL (ie. user settings)
+ */
+void ICACHE_FLASH_ATTR flashLogSet(uint8_t index, uint32_t value, bool urgent){
+  if(index >= FLASH_LOG_VALUES || current.values[index] == value){
+    return;
+  }
+  current.values[index] = value;
+  if(!dirty){
+    changed_at = millis();
+  }
+  dirty = true;
+  urgent_pending = urgent_pending || urgent;
+}
+
+bool ICACHE_FLASH_ATTR flashLogLoop(unsigned long now){
+  if(!dirty){
+    return false;
+  }
+  bool due = urgent_pending ? (now - changed_at >= FLASH_LOG_SETTLE) : (now - last_write >= FLASH_LOG_INTERVAL);
+  if(!due){
+    return false;
+  }
+
+  if(head >= FLASH_LOG_SLOTS){
+    // sector full; start over (this is the only erase, once every FLASH_LOG_SLOTS writes)
+    if(!ESP.flashEraseSector(sector)){
+      changed_at = now; // retry after the settle time
+      urgent_pending = true;
+      return false;
+    }
+    head = 0;
+  }
+
+  current.sequence++;
+  current.crc = recordCrc(current);
+  bool ok = ESP.flashWrite(slotAddress(head), reinterpret_cast<uint32_t*>(&current), sizeof(current));
+  head++; // even a failed write may have programmed some bits, never reuse the slot
+  if(ok){
+    dirty = false;
+    urgent_pending = false;
+    last_write = now;
+    writes++;
+  }
+  else {
+    // retry in the next slot after the settle time
+    changed_at = now;
+    urgent_pending = true;
+  }
+  return ok;
+}
+
+unsigned long ICACHE_FLASH_ATTR flashLogDueIn(unsigned long now){
+  if(!dirty){
+    return ULONG_MAX;
+  }
+  unsigned long waited = urgent_pending ? now - changed_at : now - last_write;
+  unsigned long wait = urgent_pending ? FLASH_LOG_SETTLE : FLASH_LOG_INTERVAL;
+  return waited >= wait ? 0 : wait - waited;
+}
+
+unsigned long ICACHE_FLASH_ATTR flashLogWrites(){
+  return writes;
+}
@@ -0,0 +1,38 @@
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <Arduino.h>
+
+/*
+  Tiny append-only, wear-levelled record log in a single raw flash sector.
+  eagle.flash.512k.ld leaves no room for SPIFFS/LittleFS, but still reserves the 4KB EEPROM sector, which is used here
+  directly (do not also use the EEPROM library).
+
+  - every record is a complete snapshot of FLASH_LOG_VALUES 32-bit values, so the latest record is all that is needed
+  - records are appended to the sector (256 slots of 16 bytes) and the sector is only erased once it is full,
+    so each erase cycle is spread over 256 writes
+  - each record carries a sequence number and a CRC32; a torn write (power loss mid-write) fails the CRC and the
+    previous record is used instead
+  - restore at boot is a binary search for the first erased slot (8 reads), independent of how full the log is
+  - writes are coalesced: values are only written if they changed, and at most once per FLASH_LOG_INTERVAL
+    (or after FLASH_LOG_SETTLE for changes flagged as urgent, ie. user settings)
+  Note a power loss during a sector erase loses the log; with a single sector there is nowhere to keep a second copy.
+*/
+
+#define FLASH_LOG_VALUES 2            // 32-bit values per record
+#define FLASH_LOG_INTERVAL 600000     // milliseconds; minimum time between routine writes (6 per hour at most)
+#define FLASH_LOG_SETTLE 5000         // milliseconds; delay before writing an urgent change (coalesces bursts of changes)
+
+struct flash_log_record{
+  uint32_t sequence;                  // increases with every write; 0xFFFFFFFF marks an erased slot
+  uint32_t values[FLASH_LOG_VALUES];
+  uint32_t crc;                       // CRC32 over sequence and values
+};
+
+bool flashLogBegin(uint32_t values[FLASH_LOG_VALUES]);  // locate the log head and restore the latest values; false if none found
+void flashLogSet(uint8_t index, uint32_t value, bool urgent);
+bool flashLogLoop(unsigned long now);                    // write pending changes when due; true if a record was written
+unsigned long flashLogDueIn(unsigned long now);          // milliseconds until a pending change is due; ULONG_MAX if none
+unsigned long flashLogWrites();                          // records written since boot
+
+#endif
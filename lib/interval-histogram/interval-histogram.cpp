@@ -0,0 +1,56 @@
+#include "interval-histogram.h"
+
+void ICACHE_FLASH_ATTR intervalHistogramBegin(interval_histogram &h){
+  intervalHistogramClear(h);
+  h.last_micros = 0;
+  h.started = false;
+}
+
+// now_micros is the event's interrupt timestamp; the event itself is counted later, from loop()
+void ICACHE_FLASH_ATTR intervalHistogramEvent(interval_histogram &h, unsigned long now_micros){
+  if(h.started){
+    uint32_t interval = now_micros - h.last_micros;
+    int log2 = 31 - __builtin_clz(interval | 1);
+    int bucket = log2 - INTERVAL_HIST_FIRST_LOG2;
+    if(bucket < 0){
+      bucket = 0;
+    }
+    else if(bucket >= INTERVAL_HIST_BUCKETS){
+      bucket = INTERVAL_HIST_BUCKETS - 1;
+    }
+    h.counts[bucket]++;
+  }
+  h.last_micros = now_micros;
+  h.started = true;
+}
+
+void ICACHE_FLASH_ATTR intervalHistogramClear(interval_histogram &h){
+  for (uint8_t i = 0; i < INTERVAL_HIST_BUCKETS; i++)
+  {
+    h.counts[i] = 0;
+  }
+}
+
+void ICACHE_FLASH_ATTR intervalHistogramRemove(interval_histogram &h, const interval_histogram &sent){
+  for (uint8_t i = 0; i < INTERVAL_HIST_BUCKETS; i++)
+  {
+    h.counts[i] -= sent.counts[i];
+  }
+}
+
+// Built in a single allocation of INTERVAL_HIST_ARRAY_MAX_LENGTH
+std::string ICACHE_FLASH_ATTR buildIntervalHistogramArray(const interval_histogram &h){
+  std::string array;
+  array.reserve(INTERVAL_HIST_ARRAY_MAX_LENGTH);
+  array += '[';
+  for (uint8_t i = 0; i < INTERVAL_HIST_BUCKETS; i++)
+  {
+    if(i > 0){
+      array += ',';
+    }
+    char buf[12]; // an int, sign included
+    array.append(buf, snprintf(buf, sizeof(buf), "%d", (int)h.counts[i]));
+  }
+  array += ']';
+  return array;
+}
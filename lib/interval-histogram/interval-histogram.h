@@ -0,0 +1,32 @@
+#ifndef INTERVAL_HISTOGRAM_H
+#define INTERVAL_HISTOGRAM_H
+
+#include <Arduino.h>
+#include <string>
+
+/*
+  Fixed size histogram of the time between events (pulses or noise), in log2 buckets of microseconds.
+  Bucket i counts intervals in [2^(FIRST_LOG2+i), 2^(FIRST_LOG2+i+1)) us; the first and last buckets also take
+  everything below and above. Recording an event is O(1) (a count leading zeros and an increment), so the cost
+  is the same at 1 CPM as at 10,000 CPM, unlike keeping the raw timestamps.
+  For a random (Poisson) source the counts rise with the bucket width up to around the mean interval and then
+  drop off sharply; excess counts in the shortest buckets point to ringing or electrical noise.
+*/
+
+#define INTERVAL_HIST_FIRST_LOG2 6      // first bucket starts at 64us (below the sensor's pulse width)
+#define INTERVAL_HIST_BUCKETS 22        // last bucket starts at 2^27us (~134s)
+#define INTERVAL_HIST_ARRAY_MAX_LENGTH (2 + INTERVAL_HIST_BUCKETS * 12 - 1) // buildIntervalHistogramArray(); counts of up to 11 characters, comma separated
+
+struct interval_histogram{
+  uint32_t counts[INTERVAL_HIST_BUCKETS];
+  unsigned long last_micros;            // micros() of the previous event
+  bool started;                         // last_micros is valid
+};
+
+void intervalHistogramBegin(interval_histogram &h);
+void intervalHistogramEvent(interval_histogram &h, unsigned long now_micros);  // O(1); safe from the pulse path
+void intervalHistogramClear(interval_histogram &h);   // zero the counts; the interval to the next event still counts
+void intervalHistogramRemove(interval_histogram &h, const interval_histogram &sent); // take out the counts of an earlier copy, keep those since
+std::string buildIntervalHistogramArray(const interval_histogram &h);  // "[0,0,1,4,...]"
+
+#endif
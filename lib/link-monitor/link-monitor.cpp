@@ -0,0 +1,272 @@
+#include "link-monitor.h"
+#include <limits.h>
+
+// MQTT control packet types (upper nibble of the fixed header)
+#define PACKET_PUBLISH 3
+#define PACKET_PUBACK 4
+#define PACKET_PINGREQ 12
+#define PACKET_PINGRESP 13
+
+// packet_parser stages
+#define STAGE_HEADER 0
+#define STAGE_LENGTH 1
+#define STAGE_BODY 2
+
+#define NO_PACKET_ID 0xFFFF // body offset of a packet without an identifier
+
+LinkMonitorClient::LinkMonitorClient(Client &client)
+  : _client(client), _tx(), _rx(), _ping_pending(false), _ping_sent_at(0), _publish_pending(false), _publish_sent_at(0), _publish_id(0),
+    _connects(0), _connected_at(0), _last_rx_at(0), _rtt_ewma_us(0), _rtt_max_us(0), _rtt_samples(0), _keep_alive(0), _keep_alive_connects(0) {
+}
+
+// Offset of the packet identifier within the body, once it is known
+static uint16_t ICACHE_FLASH_ATTR packetIdOffset(uint8_t header, uint16_t position, uint16_t topic_length){
+  switch(header >> 4){
+    case PACKET_PUBLISH:
+      return ((header >> 1) & 0x03) > 0 && position >= 2 ? 2 + topic_length : NO_PACKET_ID; // after the topic; QoS 0 has none
+    case PACKET_PUBACK:
+      return 0;
+  }
+  return NO_PACKET_ID;
+}
+
+/*
+  Follow the packet stream one way. Consumes bytes up to the end of the next complete packet and returns true, or
+  consumes everything and returns false if the packet continues in a later read or write. Only the fixed header and the
+  first few bytes of the body are looked at; the rest of a packet is skipped in one step.
+*/
+bool ICACHE_FLASH_ATTR LinkMonitorClient::advance(packet_parser &p, const uint8_t *&buf, size_t &size){
+  while(size > 0){
+    if(p.stage == STAGE_BODY){
+      uint16_t id_at = packetIdOffset(p.header, p.position, p.topic_length);
+      bool interesting = p.position < 2 || (id_at != NO_PACKET_ID && p.position >= id_at && p.position <= id_at + 1);
+      if(!interesting){
+        size_t skip = id_at != NO_PACKET_ID && p.position < id_at ? id_at - p.position : p.remaining; // to the packet identifier, or to the end
+        skip = skip < p.remaining ? skip : p.remaining;
+        skip = skip < size ? skip : size;
+        buf += skip;
+        size -= skip;
+        p.remaining -= skip;
+        p.position = p.position + skip < 0xFFFF ? p.position + skip : 0xFFFF;
+      }
+      else{
+        uint8_t b = *buf++;
+        size--;
+        if((p.header >> 4) == PACKET_PUBLISH && p.position < 2){
+          p.topic_length = (p.topic_length << 8) | b;
+        }
+        if(id_at != NO_PACKET_ID && p.position == id_at){
+          p.packet_id = b << 8;
+        }
+        if(id_at != NO_PACKET_ID && p.position == id_at + 1){
+          p.packet_id |= b;
+        }
+        p.position++;
+        p.remaining--;
+      }
+      if(p.remaining == 0){
+        p.stage = STAGE_HEADER;
+        return true;
+      }
+      continue;
+    }
+
+    uint8_t b = *buf++;
+    size--;
+    if(p.stage == STAGE_HEADER){
+      p.header = b;
+      p.length_bytes = 0;
+      p.remaining = 0;
+      p.position = 0;
+      p.topic_length = 0;
+      p.packet_id = 0;
+      p.stage = STAGE_LENGTH;
+    }
+    else{ // remaining length, 7 bits per byte, least significant first
+      p.remaining |= (uint32_t)(b & 0x7F) << (7 * p.length_bytes);
+      p.length_bytes++;
+      if((b & 0x80) == 0 || p.length_bytes == 4){
+        p.stage = STAGE_BODY;
+        if(p.remaining == 0){
+          p.stage = STAGE_HEADER;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::connecting(int result){
+  if(result <= 0){
+    return;
+  }
+  _connects++;
+  _connected_at = millis();
+  _last_rx_at = _connected_at;
+  _tx = packet_parser();
+  _rx = packet_parser();
+  _ping_pending = false;
+  _publish_pending = false;
+}
+
+// started: micros() when the write began, so a write that blocks (ie. on a full send buffer) counts towards the round trip
+void ICACHE_FLASH_ATTR LinkMonitorClient::sent(const uint8_t *buf, size_t size, unsigned long started){
+  while(advance(_tx, buf, size)){
+    switch(_tx.header >> 4){
+      case PACKET_PINGREQ:
+        _ping_pending = true;
+        _ping_sent_at = started;
+        break;
+      case PACKET_PUBLISH:
+        if(((_tx.header >> 1) & 0x03) == 1){
+          _publish_pending = true;
+          _publish_sent_at = started;
+          _publish_id = _tx.packet_id;
+        }
+        break;
+    }
+  }
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::received(const uint8_t *buf, size_t size){
+  _last_rx_at = millis();
+  while(advance(_rx, buf, size)){
+    unsigned long now = micros();
+    switch(_rx.header >> 4){
+      case PACKET_PINGRESP:
+        if(_ping_pending){
+          _ping_pending = false;
+          sample(now - _ping_sent_at);
+        }
+        break;
+      case PACKET_PUBACK:
+        if(_publish_pending && _rx.packet_id == _publish_id){
+          _publish_pending = false;
+          sample(now - _publish_sent_at);
+        }
+        break;
+    }
+  }
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::sample(unsigned long rtt_us){
+  if(_rtt_samples == 0){
+    _rtt_ewma_us = rtt_us;
+  }
+  else{
+    _rtt_ewma_us += ((long)rtt_us - (long)_rtt_ewma_us) / LINK_RTT_EWMA_WEIGHT;
+  }
+  _rtt_max_us = rtt_us > _rtt_max_us ? rtt_us : _rtt_max_us;
+  _rtt_samples++;
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::rttMaxPublished(float published_ms){
+  if(_rtt_max_us / 1000.0f <= published_ms){
+    _rtt_max_us = 0;
+  }
+}
+
+/**
+ * @brief How long the reader may leave an outstanding PINGRESP or PUBACK unread: the round trip is timestamped when
+ * the reply is read, not when it arrives, so it is late by up to that long.
+ *
+ * @return unsigned long Milliseconds: LINK_RTT_POLL_MS, or 1/LINK_RTT_POLL_SHARE of the time waited so far if longer;
+ * ULONG_MAX if no reply is outstanding (or the connection is gone, and with it the reply)
+ */
+unsigned long ICACHE_FLASH_ATTR LinkMonitorClient::replyPollMillis(){
+  if((!_ping_pending && !_publish_pending) || !_client.connected()){
+    return ULONG_MAX;
+  }
+  unsigned long sent_at = _ping_pending ? _ping_sent_at : _publish_sent_at;
+  unsigned long waited_ms = (micros() - sent_at) / 1000;
+  return waited_ms / LINK_RTT_POLL_SHARE > LINK_RTT_POLL_MS ? waited_ms / LINK_RTT_POLL_SHARE : LINK_RTT_POLL_MS;
+}
+
+/**
+ * @brief Keep-alive interval for the next CONNECT.
+ * Called before every connection attempt, but only the first call after a connection ended looks at how that
+ * connection went; failed attempts in between leave the interval as it is.
+ *
+ * @return uint16_t Seconds, between LINK_KEEPALIVE_MIN and LINK_KEEPALIVE_MAX
+ */
+uint16_t ICACHE_FLASH_ATTR LinkMonitorClient::keepAlive(){
+  if(_keep_alive == 0){
+    _keep_alive = LINK_KEEPALIVE_INITIAL;
+  }
+  else if(_connects != _keep_alive_connects){
+    bool stable = _last_rx_at - _connected_at >= LINK_STABLE_MS && _rtt_ewma_us <= LINK_RTT_POOR_MS * 1000UL;
+    if(stable){
+      _keep_alive = _keep_alive * 2 < LINK_KEEPALIVE_MAX ? _keep_alive * 2 : LINK_KEEPALIVE_MAX;
+    }
+    else{
+      _keep_alive = LINK_KEEPALIVE_MIN;
+    }
+  }
+  _keep_alive_connects = _connects;
+  return _keep_alive;
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::connect(IPAddress ip, uint16_t port){
+  int result = _client.connect(ip, port);
+  connecting(result);
+  return result;
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::connect(const char *host, uint16_t port){
+  int result = _client.connect(host, port);
+  connecting(result);
+  return result;
+}
+
+size_t ICACHE_FLASH_ATTR LinkMonitorClient::write(uint8_t b){
+  return write(&b, 1);
+}
+
+size_t ICACHE_FLASH_ATTR LinkMonitorClient::write(const uint8_t *buf, size_t size){
+  unsigned long started = micros();
+  size_t written = _client.write(buf, size);
+  sent(buf, written, started); // only what was actually written; the client writes the rest again
+  return written;
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::available(){
+  return _client.available();
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::read(){
+  int b = _client.read();
+  if(b >= 0){
+    uint8_t byte = b;
+    received(&byte, 1);
+  }
+  return b;
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::read(uint8_t *buf, size_t size){
+  int n = _client.read(buf, size);
+  if(n > 0){
+    received(buf, n);
+  }
+  return n;
+}
+
+int ICACHE_FLASH_ATTR LinkMonitorClient::peek(){
+  return _client.peek();
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::flush(){
+  _client.flush();
+}
+
+void ICACHE_FLASH_ATTR LinkMonitorClient::stop(){
+  _client.stop();
+}
+
+uint8_t ICACHE_FLASH_ATTR LinkMonitorClient::connected(){
+  return _client.connected();
+}
+
+LinkMonitorClient::operator bool(){
+  return (bool)_client;
+}
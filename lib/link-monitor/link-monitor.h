@@ -0,0 +1,95 @@
+#ifndef LINK_MONITOR_H
+#define LINK_MONITOR_H
+
+#include <ESP8266WiFi.h>
+
+/*
+  Broker link quality monitor.
+  Wraps the client passed to MQTTClient::begin() (like lib/fault-client) and follows the MQTT packets going through it,
+  without touching their content:
+    - PINGREQ -> PINGRESP (the client's own keep-alive) and QoS 1 PUBLISH -> PUBACK (matched by packet id) are
+      timestamped; each round trip updates a smoothed RTT (EWMA, weight 1/LINK_RTT_EWMA_WEIGHT as TCP does) and a max
+    - a reply is only seen when the client next reads; replyPollMillis() tells the caller's idle loop how soon to look
+      (see LINK_RTT_POLL_MS), so a round trip is not stretched to the idle period
+    - every TCP connect after the first one counts as a reconnect, and the lifetime of the previous connection
+      (from connect to the last byte received) is kept
+
+  keepAlive() picks the keep-alive interval for the next CONNECT from that history. MQTT fixes the keep-alive for
+  the duration of a connection, so it adapts from one connection to the next:
+    - a connection lost before LINK_STABLE_MS, or a smoothed RTT above LINK_RTT_POOR_MS, means a flaky link: drop to
+      LINK_KEEPALIVE_MIN so a dead connection is noticed (and the last will published) quickly
+    - a connection that held for LINK_STABLE_MS on a healthy RTT doubles the interval, up to LINK_KEEPALIVE_MAX, to
+      save airtime and modem wake-ups
+*/
+
+#define LINK_KEEPALIVE_MIN 10       // seconds; also the 256dpi client's default
+#define LINK_KEEPALIVE_INITIAL 30   // seconds; first connection, nothing known about the link yet
+#define LINK_KEEPALIVE_MAX 120      // seconds
+#define LINK_STABLE_MS 900000       // a connection that lasts this long counts as stable
+#define LINK_RTT_POOR_MS 500        // smoothed round trip time above which the link counts as flaky
+#define LINK_RTT_EWMA_WEIGHT 8      // each new sample moves the smoothed RTT by 1/8 of the difference
+#define LINK_RTT_POLL_MS 2          // look for an outstanding reply this often at first...
+#define LINK_RTT_POLL_SHARE 8       // ...then every 1/8 of the time waited so far, so a sample is at most 1/8 late
+
+class LinkMonitorClient : public Client {
+  public:
+    LinkMonitorClient(Client &client);
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override;
+
+    unsigned long replyPollMillis();                        // milliseconds until the reader should look for an outstanding reply; ULONG_MAX if none
+    uint16_t keepAlive();                                   // seconds; keep-alive for the next CONNECT (see above), decided once per connection
+    float rttMillis() const { return _rtt_ewma_us / 1000.0f; } // smoothed round trip time; 0 until the first sample
+    float rttMaxMillis() const { return _rtt_max_us / 1000.0f; } // worst round trip since the last rttMaxPublished()
+    void rttMaxPublished(float published_ms);               // published_ms went out: start over, unless a worse one came since
+    unsigned long rttSamples() const { return _rtt_samples; }
+    unsigned long reconnects() const { return _connects > 0 ? _connects - 1 : 0; }
+    uint16_t currentKeepAlive() const { return _keep_alive; }
+
+  private:
+    struct packet_parser{               // position within the packet stream one way
+      uint8_t stage;                    // fixed header, remaining length or body
+      uint8_t header;                   // fixed header byte of the current packet
+      uint8_t length_bytes;             // remaining length bytes decoded so far
+      uint32_t remaining;               // body bytes of the current packet still to come
+      uint16_t position;                // body bytes seen so far (saturates; only the start of the body is of interest)
+      uint16_t topic_length;            // PUBLISH only
+      uint16_t packet_id;               // PUBLISH (QoS > 0) and PUBACK
+    };
+
+    static bool advance(packet_parser &p, const uint8_t *&buf, size_t &size);
+    void connecting(int result);
+    void sent(const uint8_t *buf, size_t size, unsigned long started);
+    void received(const uint8_t *buf, size_t size);
+    void sample(unsigned long rtt_us);
+
+    Client &_client;
+    packet_parser _tx;
+    packet_parser _rx;
+    bool _ping_pending;                 // PINGREQ sent, PINGRESP outstanding
+    unsigned long _ping_sent_at;        // micros()
+    bool _publish_pending;              // QoS 1 PUBLISH sent, PUBACK outstanding
+    unsigned long _publish_sent_at;     // micros()
+    uint16_t _publish_id;
+    unsigned long _connects;            // successful TCP connects
+    unsigned long _connected_at;        // millis() of the current (or last) TCP connection
+    unsigned long _last_rx_at;          // millis() of the last byte received on it
+    unsigned long _rtt_ewma_us;
+    unsigned long _rtt_max_us;
+    unsigned long _rtt_samples;
+    uint16_t _keep_alive;               // seconds; 0 until the first call of keepAlive()
+    unsigned long _keep_alive_connects; // _connects when _keep_alive was decided
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "metrics-server.h"
+
+enum metrics_client_state { METRICS_IDLE, METRICS_REQUEST, METRICS_BODY };
+
+static WiFiServer* server = nullptr;
+static metrics_writer write_metric = nullptr;
+static WiFiClient client;
+static metrics_client_state state = METRICS_IDLE;
+static unsigned long client_since = 0;          // millis() the current client was accepted
+static char request[METRICS_REQUEST_MAX + 1];   // request line, ie "GET /metrics HTTP/1.1"
+static size_t request_length = 0;
+static size_t next_family = 0;
+static unsigned long scrapes = 0;
+
+void ICACHE_FLASH_ATTR metricsServerBegin(uint16_t port, metrics_writer writer){
+  if(server == nullptr){
+    server = new WiFiServer(port);
+  }
+  write_metric = writer;
+  server->begin();
+}
+
+static void ICACHE_FLASH_ATTR closeClient(){
+  client.stop();
+  state = METRICS_IDLE;
+}
+
+// Read whatever part of the request line has arrived; true once it is complete
+static bool ICACHE_FLASH_ATTR readRequestLine(){
+  while(client.available() > 0){
+    int c = client.read();
+    if(c == '\n' || c < 0){
+      return c == '\n';
+    }
+    if(c != '\r' && request_length < METRICS_REQUEST_MAX){
+      request[request_length++] = (char)c;
+    }
+  }
+  return false;
+}
+
+static void ICACHE_FLASH_ATTR respond(){
+  request[request_length] = '\0';
+  while(client.available() > 0){
+    client.read(); // headers are not used; drain what has arrived so the socket closes cleanly
+  }
+  if(strncmp(request, "GET " METRICS_PATH " ", strlen("GET " METRICS_PATH " ")) != 0){
+    client.print(F("HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n"));
+    closeClient();
+    return;
+  }
+  client.print(F("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"));
+  next_family = 0;
+  state = METRICS_BODY;
+}
+
+void ICACHE_FLASH_ATTR metricsServerLoop(unsigned long now){
+  if(server == nullptr){
+    return;
+  }
+  if(state != METRICS_IDLE && (!client.connected() || now - client_since > METRICS_CLIENT_TIMEOUT)){
+    closeClient();
+  }
+
+  switch(state){
+    case METRICS_IDLE:
+      client = server->available();
+      if(client){
+        client_since = now;
+        request_length = 0;
+        state = METRICS_REQUEST;
+      }
+      break;
+
+    case METRICS_REQUEST:
+      if(readRequestLine()){
+        respond();
+      }
+      break;
+
+    case METRICS_BODY:
+      while(client.availableForWrite() >= METRICS_WRITE_MIN){
+        if(!write_metric(client, next_family++)){
+          scrapes++;
+          closeClient(); // flushes what is left in the send buffer
+          break;
+        }
+      }
+      break;
+  }
+}
+
+bool ICACHE_FLASH_ATTR metricsServerBusy(){
+  return state != METRICS_IDLE;
+}
+
+unsigned long ICACHE_FLASH_ATTR metricsScrapes(){
+  return scrapes;
+}
+
+void ICACHE_FLASH_ATTR writeMetricHeader(Print &out, const char* name, const char* type, const char* help){
+  out.print(F("# HELP "));
+  out.print(name);
+  out.print(' ');
+  out.print(help);
+  out.print(F("\n# TYPE "));
+  out.print(name);
+  out.print(' ');
+  out.print(type);
+  out.print('\n');
+}
+
+void ICACHE_FLASH_ATTR writeMetricValue(Print &out, const char* name, const char* labels, double value, int decimals){
+  out.print(name);
+  if(labels != nullptr){
+    out.print('{');
+    out.print(labels);
+    out.print('}');
+  }
+  out.print(' ');
+  out.print(value, decimals);
+  out.print('\n');
+}
@@ -0,0 +1,35 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/*
+  Minimal pull-based HTTP endpoint serving GET /metrics in the Prometheus text format (version 0.0.4).
+  Served cooperatively from loop(), one step per call, so it never holds up pulse handling:
+  - one client at a time; further connections wait in the listen backlog
+  - the request line is read as it arrives (no blocking reads); headers are ignored
+  - the body is produced one metric family at a time, only while the socket send buffer has room for it, and is
+    printed straight from the counters into the socket; nothing is built up in RAM
+  - HTTP/1.0 with Connection: close, so the end of the body is the end of the connection (no Content-Length)
+  The metrics themselves are supplied by the caller as a callback that writes family `index` and returns false once
+  there are no more.
+*/
+
+#define METRICS_PATH "/metrics"
+#define METRICS_CLIENT_TIMEOUT 5000   // milliseconds; a scrape that takes longer is dropped
+#define METRICS_WRITE_MIN 256         // bytes of free send buffer needed before writing the next metric family
+#define METRICS_REQUEST_MAX 64        // bytes of the request line kept (method and path)
+
+typedef bool (*metrics_writer)(Print &out, size_t index); // write metric family index; false if index is past the end
+
+void metricsServerBegin(uint16_t port, metrics_writer writer);
+void metricsServerLoop(unsigned long now);      // advance the current scrape by one step; call every loop()
+unsigned long metricsScrapes();                 // scrapes served since boot
+bool metricsServerBusy();                       // a scrape is in progress
+
+// Helpers for the writer
+void writeMetricHeader(Print &out, const char* name, const char* type, const char* help);
+void writeMetricValue(Print &out, const char* name, const char* labels, double value, int decimals); // labels may be nullptr
+
+#endif
@@ -1,7 +1,13 @@
 //#include <Arduino.h>
 #include "mqtt-ha-helper.h"
+#include "wifi-helper.h"
+#include "utils.h"
 
-void ICACHE_FLASH_ATTR initMQTTClient(const IPAddress broker, int port, const char *lwt_topic)
+static unsigned int mqtt_failed_attempts = 0; // consecutive failed broker connection attempts
+static bool mqtt_connected_since_boot = false; // a connection was made, so the next attempt is a reconnect
+
+// net is normally the global wificlient, but may be a wrapper around it (ie. for fault injection)
+void ICACHE_FLASH_ATTR initMQTTClient(const IPAddress broker, int port, const char *lwt_topic, Client &net)
 {
   Serial.print(F("Initalize MQTT client for broker:"));
   Serial.print(broker); // IPAddress
@@ -12,12 +18,13 @@ void ICACHE_FLASH_ATTR initMQTTClient(const IPAddress broker, int port, const ch
   // Note: Local domain names (e.g. "Computer.local" on OSX) are not supported
   // by Arduino. You need to set the IP address directly.
   // https://github.com/256dpi/arduino-mqtt/blob/master/src/MQTTClient.h#L101
-  mqttclient.begin(broker, port, wificlient);
+  mqttclient.begin(broker, port, net);
 
   // https://github.com/256dpi/arduino-mqtt/blob/master/src/MQTTClient.cpp#L199
   mqttclient.onMessage(messageReceived);
 
   mqttclient.setWill(lwt_topic, "offline", RETAINED, QOS_1);
+  mqttclient.setTimeout(MQTT_COMMAND_TIMEOUT);
 
   Serial.println(F("Done"));
 }
@@ -30,10 +37,13 @@ bool ICACHE_FLASH_ATTR connectMQTTBroker(const char *client_id, const char *user
     Serial.print(F("\nAttempting to connect to MQTT broker... "));
     if(mqttclient.connect(client_id, username, password)){
         Serial.println(F("Connected!"));
+        mqtt_failed_attempts = 0;
+        mqtt_connected_since_boot = true;
         return true;
     }
     else{
         Serial.println(F("Failed!"));
+        mqtt_failed_attempts++;
         return false;
     }
   }
@@ -42,6 +52,28 @@ bool ICACHE_FLASH_ATTR connectMQTTBroker(const char *client_id, const char *user
   }
 }
 
+/*
+  Milliseconds to wait before a broker connection attempt, for a device with the given history:
+    - the first connection since boot: none
+    - the first attempt after the connection was lost: a random delay of up to MQTT_ATTEMPT_COOLDOWN ("full jitter").
+      A broker restart drops the whole fleet at the same moment; without it, every device would CONNECT at once.
+    - after a failed attempt: capped exponential backoff from MQTT_ATTEMPT_COOLDOWN up to MQTT_ATTEMPT_COOLDOWN_MAX,
+      with jitter (see backoffDelay())
+  rng_state is the device's random state, seeded from its MAC address (deviceSeed()).
+*/
+unsigned long ICACHE_FLASH_ATTR mqttBackoffDelay(unsigned int failed_attempts, bool reconnecting, uint32_t &rng_state){
+  if(failed_attempts > 0){
+    return backoffDelay(failed_attempts - 1, MQTT_ATTEMPT_COOLDOWN, MQTT_ATTEMPT_COOLDOWN_MAX, rng_state);
+  }
+  return reconnecting ? jitterDelay(MQTT_ATTEMPT_COOLDOWN, rng_state) : 0;
+}
+
+// Delay before the next broker connection attempt of this device (see mqttBackoffDelay())
+unsigned long ICACHE_FLASH_ATTR mqttReconnectDelay(){
+  static uint32_t rng_state = deviceSeed();
+  return mqttBackoffDelay(mqtt_failed_attempts, mqtt_connected_since_boot, rng_state);
+}
+
 // Returns TRUE if a NEW broker connection was established
 // Runs until connection to MQTT broker is established
 // bool assertMQTTConnectivity(const char *client_id, const char *username, const char *password){    
@@ -68,6 +100,21 @@ void ICACHE_FLASH_ATTR publishOnline(const char* availability_topic){
     mqttclient.publish(availability_topic, "online", RETAINED, QOS_1);     
 }
 
+/**
+ * @brief Check whether the TCP send buffer currently has room for a PUBLISH packet of the given size.
+ * mqttclient.publish() will block inside lwIP until the whole packet has been written, which on a poor link
+ * can take seconds. Callers publishing idempotent snapshots should check first and hold on to (or merge) the 
+ * update rather than block.
+ *
+ * @param topic_length Length of the topic string
+ * @param payload_length Length of the payload
+ * @param qos QoS of the publish (QoS 1 and 2 add a packet identifier)
+ * @return true If the packet fits in the available send buffer space
+ */
+bool ICACHE_FLASH_ATTR hasPublishCapacity(size_t topic_length, size_t payload_length, int qos){
+  return (size_t)wificlient.availableForWrite() >= mqttPacketLength(topic_length, payload_length, qos);
+}
+
 /**
  * @brief Subscribe to each of the provided topics (string)
  *
@@ -75,7 +122,7 @@ void ICACHE_FLASH_ATTR publishOnline(const char* availability_topic){
  * @return true If ALL subscriptions were successful
  * @return false If any subscription failed
  */
-bool ICACHE_FLASH_ATTR subscribeTopics(std::vector<std::string> topicVector)
+bool ICACHE_FLASH_ATTR subscribeTopics(const std::vector<std::string> &topicVector)
 {
   bool completeSuccess = true;
   Serial.println(F("Subscribing to topics..."));
@@ -109,18 +156,18 @@ std::string ICACHE_FLASH_ATTR buildDiagnosticTopic(const std::string device_type
   return topic;
 }
 
+std::string ICACHE_FLASH_ATTR buildFactTopic(const std::string device_type, const std::string device_id){
+  // {HA_TOPIC_BASE}/{device_type}/{device_id}/facts --> homeassistant/sensor/esp8266thing/facts
+  std::string topic = HA_TOPIC_BASE+"/"+device_type+"/"+device_id+"/facts";
+  return topic;
+}
+
 std::string ICACHE_FLASH_ATTR buildStateTopic(const std::string device_type, const std::string device_id){
   // {HA_TOPIC_BASE}/{device_type}/{device_id}/state --> homeassistant/sensor/esp8266thing/state
   std::string topic = HA_TOPIC_BASE+"/"+device_type+"/"+device_id+"/state";
   return topic;  
 }
 
-std::string ICACHE_FLASH_ATTR buildDiscoveryTopic(const std::string device_type, const std::string device_id, const std::string sensor_id){
-  // {HA_TOPIC_BASE}/{device_type}/{device_id}/{sensor_id}/config --> homeassistant/sensor/esp8266thing/temp/config
-  std::string topic = HA_TOPIC_BASE+"/"+device_type+"/"+device_id+"/"+sensor_id+"/config";
-  return topic;
-}
-
 std::string ICACHE_FLASH_ATTR buildSetterTopic(const std::string device_type, const std::string device_id, const std::string control_name){
   // {HA_TOPIC_BASE}/{device_type}/{device_id}/{control_name}/set --> homeassistant/sensor/esp8266thing/refresh_rate/set
   std::string topic = HA_TOPIC_BASE+"/"+device_type+"/"+device_id+"/"+control_name+"/set";
@@ -133,52 +180,128 @@ std::string ICACHE_FLASH_ATTR buildGetterTopic(const std::string device_type, co
   return topic;
 }
 
-std::string ICACHE_FLASH_ATTR buildDevicePayload(const std::string device_name, const std::string identifier, const std::string manufacturer, const std::string model, const std::string firmware_version){
-  std::string payload = "{\"name\": \""+device_name+"\", \"identifiers\": \""+identifier+"\", \"mf\": \""+manufacturer+"\", \"mdl\": \""+model+"\", \"sw\": \""+firmware_version+"\"}"; 
-  return payload;
+std::string ICACHE_FLASH_ATTR buildEntityStateTopic(const std::string device_type, const std::string device_id, const std::string sensor_id){
+  // {HA_TOPIC_BASE}/{device_type}/{device_id}/{sensor_id}/state --> homeassistant/binary_sensor/esp8266thing/radiation_burst/state
+  std::string topic = HA_TOPIC_BASE+"/"+device_type+"/"+device_id+"/"+sensor_id+"/state";
+  return topic;
 }
 
-std::string ICACHE_FLASH_ATTR buildShortDevicePayload(const std::string device_name, const std::string identifier){
-  std::string payload = "{\"name\": \""+device_name+"\", \"ids\": \""+identifier+"\"}"; 
-  return payload;
+// Append each part (string_view, std::string, phase_string or string literal) to the buffer (a phase_string, or a
+// std::string for the v1 builders)
+template <class String, class... Parts>
+static void put(String &out, const Parts&... parts){
+  ((out += parts), ...);
+}
+
+// "key":"value",
+static void ICACHE_FLASH_ATTR putField(phase_string &out, const char* key, std::string_view value){
+  put(out, key, "\"", value, "\",");
+}
+
+/*
+  Common topic prefix (ending on a level boundary) of the topics in one discovery payload, to be sent once as "~".
+  Empty in verbose mode, or if the topics share nothing worth factoring out. A view into the first topic, nothing is copied.
+*/
+static std::string_view ICACHE_FLASH_ATTR discoveryBaseTopic(std::string_view a, std::string_view b, std::string_view c = std::string_view()){
+#if HA_DISCOVERY_COMPACT
+  size_t boundary = 0;
+  for (size_t i = 0; i < a.length() && i < b.length() && a[i] == b[i] && (c.empty() || (i < c.length() && a[i] == c[i])); i++)
+  {
+    if(a[i] == '/'){
+      boundary = i;
+    }
+  }
+  return boundary > 8 ? a.substr(0, boundary) : std::string_view(); // "~/" costs more than it saves for short prefixes
+#else
+  (void)a; (void)b; (void)c;
+  return std::string_view();
+#endif
+}
+
+// "key":"topic", with the topic relative to the base topic when it has one
+static void ICACHE_FLASH_ATTR putTopicField(phase_string &out, const char* key, std::string_view base, std::string_view topic){
+  if(!base.empty() && topic.substr(0, base.length()) == base){
+    put(out, key, "\"~", topic.substr(base.length()), "\",");
+  }
+  else {
+    putField(out, key, topic);
+  }
+}
+
+// Opening brace and the "~" base topic, if there is one
+static void ICACHE_FLASH_ATTR openPayload(phase_string &out, std::string_view base){
+  out += '{';
+  if(!base.empty()){
+    putField(out, "\"~\":", base);
+  }
+}
+
+// Every field is written with a trailing comma; the last one becomes the closing brace
+static void ICACHE_FLASH_ATTR closePayload(phase_string &out){
+  out.back() = '}';
+}
+
+// Fields every discovery payload has, in this order
+static void ICACHE_FLASH_ATTR putEntityFields(phase_string &out, std::string_view base, std::string_view avail_topic, std::string_view device_id, std::string_view entity_id, std::string_view device_payload, std::string_view icon){
+  putTopicField(out, HA_KEY("availability_topic", "avty_t"), base, avail_topic);
+  put(out, HA_KEY("unique_id", "uniq_id"), "\"", device_id, "_", entity_id, "\",");
+  put(out, HA_KEY("device", "dev"), device_payload, ",");
+  put(out, HA_KEY("name", "name"), "\"", device_id, " ", entity_id, "\",");
+  putField(out, HA_KEY("icon", "ic"), icon);
+}
+
+// {HA_TOPIC_BASE}/{device_type}/{device_id}/{entity_id}/{leaf}
+template <class String>
+static void ICACHE_FLASH_ATTR putEntityTopic(String &out, std::string_view device_type, std::string_view device_id, std::string_view entity_id, const char* leaf){
+  put(out, HA_TOPIC_BASE, "/", device_type, "/", device_id, "/", entity_id, "/", leaf);
+}
+
+void ICACHE_FLASH_ATTR appendDevicePayload(phase_string &out, std::string_view device_name, std::string_view identifier, std::string_view manufacturer, std::string_view model, std::string_view firmware_version){
+  put(out, "{\"name\":\"", device_name, "\",", HA_KEY("identifiers", "ids"), "\"", identifier, "\",\"mf\":\"", manufacturer, "\",\"mdl\":\"", model, "\",\"sw\":\"", firmware_version, "\"}");
+}
+
+void ICACHE_FLASH_ATTR appendShortDevicePayload(phase_string &out, std::string_view device_name, std::string_view identifier){
+  put(out, "{\"name\":\"", device_name, "\",\"ids\":\"", identifier, "\"}");
+}
+
+void ICACHE_FLASH_ATTR appendDiscoveryTopic(phase_string &out, std::string_view device_type, std::string_view device_id, std::string_view sensor_id){
+  // {HA_TOPIC_BASE}/{device_type}/{device_id}/{sensor_id}/config --> homeassistant/sensor/esp8266thing/temp/config
+  putEntityTopic(out, device_type, device_id, sensor_id, "config");
 }
 
 /**
- * @brief Create a MQTT payload necessary for automatic discovery within Home Assistant.
+ * @brief Append a MQTT payload necessary for automatic discovery within Home Assistant.
  * 
- * @param device_class https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
+ * @param out Buffer the payload is appended to
+ * @param state_class measurement | total | total_increasing
+ * @param device_class https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes (omitted if empty)
  * @param device_id Unique identifier for this device
- * @param json_attr top-tier json attribute this sensor references
+ * @param json_attr top-tier json attribute this sensor references (also the sensor id)
+ * @param value_path path of the value within the state payload, read by a plain value_template (ie. "frequency_details.cpm")
  * @param has_sub_attr flag that indicates json_attr has sub-attributes. Will define a key called "<json_attr>_details", so sensor details must use that.
  * @param icon https://materialdesignicons.com/
  * @param unit see supported units column under https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
- * @param identifier Unique device identifer. Generally use wireless MAC address.
+ * @param device_payload Multiple attributes provided by appendDevicePayload() or appendShortDevicePayload()
  * @param avail_topic Availability topic for this sensor (on a device with many sensors this will be shared)
  * @param state_topic State topic for this sensor (on a device with many sensors this will generally be shared)
- * @return std::string 
  */
-std::string ICACHE_FLASH_ATTR buildDiscoveryPayload(const std::string device_class, const std::string device_id, const std::string json_attr, bool has_sub_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
-  std::string payload = "{\
-\"device_class\":\""+device_class+"\",\
-\"unit_of_measurement\":\""+unit+"\",\
-\"state_class\":\"measurement\",\
-\"availability_topic\":\""+avail_topic+"\",\
-\"unique_id\":\""+device_id+"_"+json_attr+"\",\
-\"device\":"+device_payload+",\
-\"name\":\""+device_id+" "+json_attr+"\",\
-\"icon\":\""+icon+"\",\
-\"state_topic\":\""+state_topic+"\",\
-\"value_template\":\"{{ value_json."+json_attr+" }}\"";
+void ICACHE_FLASH_ATTR appendDiscoveryPayload(phase_string &out, std::string_view state_class, std::string_view device_class, std::string_view device_id, std::string_view json_attr, std::string_view value_path, bool has_sub_attr, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  const std::string_view base = discoveryBaseTopic(avail_topic, state_topic);
+  openPayload(out, base);
+  if(!device_class.empty()){
+    putField(out, HA_KEY("device_class", "dev_cla"), device_class);
+  }
+  putField(out, HA_KEY("unit_of_measurement", "unit_of_meas"), unit);
+  putField(out, HA_KEY("state_class", "stat_cla"), state_class);
+  putEntityFields(out, base, avail_topic, device_id, json_attr, device_payload, icon);
+  putTopicField(out, HA_KEY("state_topic", "stat_t"), base, state_topic);
+  put(out, HA_KEY("value_template", "val_tpl"), "\"{{ value_json.", value_path, " }}\",");
 
   if(has_sub_attr){
-    payload = payload + ",\
-\"json_attributes_topic\": \""+state_topic+"\",\
-\"json_attributes_template\": \"{{ value_json."+json_attr+"_details | tojson }}\"";
+    putTopicField(out, HA_KEY("json_attributes_topic", "json_attr_t"), base, state_topic);
+    put(out, HA_KEY("json_attributes_template", "json_attr_tpl"), "\"{{ value_json.", json_attr, "_details | tojson }}\",");
   }
-
-  payload = payload + "}";
-
-  return payload;
+  closePayload(out);
 }
 
 /**
@@ -187,6 +310,7 @@ std::string ICACHE_FLASH_ATTR buildDiscoveryPayload(const std::string device_cla
  * The component type (such as 'number', 'switch') is defined in the config topic (not used here).
  * See https://www.home-assistant.io/docs/mqtt/discovery
  * 
+ * @param out Buffer the payload is appended to
  * @param device_id A unique device ID
  * @param config_attr A unique label used in the name and unique_id.
  * @param custom_settings A string with quoted key-value pairs separated by colons and commas just as JSON dictates 
@@ -194,70 +318,82 @@ std::string ICACHE_FLASH_ATTR buildDiscoveryPayload(const std::string device_cla
  * See https://www.home-assistant.io/docs/mqtt/discovery
  * @param icon https://materialdesignicons.com/
  * @param unit Specific to the quantity that the control is setting (ie volume, minutes, etc)
- * @param device_payload Unique device identifer. Multiple attributes provided by buildDevicePayload()
+ * @param device_payload Unique device identifer. Multiple attributes provided by appendDevicePayload()
  * @param avail_topic Availability topic for this control (on a device with many controls and/or sensors this will be shared)
  * @param state_topic The getter state topic for the state of this control. The topic payload should only be the value to be reflected by the HA UI.
  * @param command_topic The setter state topic to update the state of this control. The topic payload should only contain the value to set. 
- * @return std::string 
  */
-std::string ICACHE_FLASH_ATTR buildDiscoveryConfigPayload(const std::string device_id, const std::string config_attr, const std::string custom_settings, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic, const std::string command_topic){
-  std::string payload = "{\
-\"entity_category\": \"config\",\
-\"unit_of_measurement\": \""+unit+"\",\
-\"availability_topic\":\""+avail_topic+"\",\
-\"unique_id\":\""+device_id+"_"+config_attr+"\",\
-\"device\":"+device_payload+",\
-\"name\":\""+device_id+" "+config_attr+"\",\
-\"icon\":\""+icon+"\",\
-\"state_topic\":\""+state_topic+"\",\
-\"command_topic\": \""+command_topic+"\"";
-
-  if(custom_settings.length() > 0){
-    payload = payload + ", "+custom_settings;
+void ICACHE_FLASH_ATTR appendDiscoveryConfigPayload(phase_string &out, std::string_view device_id, std::string_view config_attr, std::string_view custom_settings, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic, std::string_view command_topic){
+  const std::string_view base = discoveryBaseTopic(state_topic, command_topic, avail_topic);
+  openPayload(out, base);
+  putField(out, HA_KEY("entity_category", "ent_cat"), "config");
+  putField(out, HA_KEY("unit_of_measurement", "unit_of_meas"), unit);
+  putEntityFields(out, base, avail_topic, device_id, config_attr, device_payload, icon);
+  putTopicField(out, HA_KEY("state_topic", "stat_t"), base, state_topic);
+  putTopicField(out, HA_KEY("command_topic", "cmd_t"), base, command_topic);
+
+  if(!custom_settings.empty()){
+    put(out, custom_settings, ",");
   }
-  payload = payload + "}";
+  closePayload(out);
+}
 
-  return payload;
+void ICACHE_FLASH_ATTR appendDiscoveryDiagnosticMeasurementPayload(phase_string &out, std::string_view state_class, std::string_view device_class, std::string_view device_id, std::string_view diag_attr, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  // If device_class or unit_of_measurement is not provided, do not include in payload (not even if value is set to None or empty string)
+  const std::string_view base = discoveryBaseTopic(avail_topic, state_topic);
+  openPayload(out, base);
+  if(!device_class.empty()){
+    putField(out, HA_KEY("device_class", "dev_cla"), device_class);
+  }
+  if(!unit.empty()){
+    putField(out, HA_KEY("unit_of_measurement", "unit_of_meas"), unit);
+  }
+  putField(out, HA_KEY("state_class", "stat_cla"), state_class);
+  putField(out, HA_KEY("entity_category", "ent_cat"), "diagnostic");
+  putEntityFields(out, base, avail_topic, device_id, diag_attr, device_payload, icon);
+  putTopicField(out, HA_KEY("state_topic", "stat_t"), base, state_topic);
+  put(out, HA_KEY("value_template", "val_tpl"), "\"{{ value_json.", diag_attr, " }}\",");
+  closePayload(out);
 }
 
-std::string ICACHE_FLASH_ATTR buildDiscoveryDiagnosticMeasurementPayload(const std::string state_class, const std::string device_class, const std::string device_id, const std::string diag_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
+void ICACHE_FLASH_ATTR appendDiscoveryDiagnosticFactPayload(phase_string &out, std::string_view device_id, std::string_view diag_attr, std::string_view icon, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  const std::string_view base = discoveryBaseTopic(avail_topic, state_topic);
+  openPayload(out, base);
+  putField(out, HA_KEY("entity_category", "ent_cat"), "diagnostic");
+  putEntityFields(out, base, avail_topic, device_id, diag_attr, device_payload, icon);
+  putTopicField(out, HA_KEY("state_topic", "stat_t"), base, state_topic);
+  put(out, HA_KEY("value_template", "val_tpl"), "\"{{ value_json.", diag_attr, " }}\",");
+  closePayload(out);
+}
 
-// If device_class or unit_of_measurement is not provided, do not include in payload (not even if value is set to None or empty string)
-// std:string cannot be a null pointer, it will always have a value.
-
-std::string payload = "{ ";
-if(!device_class.empty()){
-  payload = payload + "\"device_class\":\""+device_class+"\",";
-}
-if(!unit.empty()){
-  payload = payload + "\"unit_of_measurement\": \""+unit+"\",";
-}
-payload = payload + "\
-\"state_class\":\""+state_class+"\",\
-\"entity_category\": \"diagnostic\",\
-\"availability_topic\":\""+avail_topic+"\",\
-\"unique_id\":\""+device_id+"_"+diag_attr+"\",\
-\"device\":"+device_payload+",\
-\"name\":\""+device_id+" "+diag_attr+"\",\
-\"icon\":\""+icon+"\",\
-\"state_topic\":\""+state_topic+"\",\
-\"value_template\":\"{{ value_json."+diag_attr+" }}\" }";
-  
-  return payload;  
+/**
+ * @brief Discovery payload for a binary sensor. The state topic carries just "ON" or "OFF" (the Home Assistant defaults), 
+ * so no value template is needed.
+ * 
+ * @param out Buffer the payload is appended to
+ * @param device_class https://www.home-assistant.io/integrations/binary_sensor/#device-class
+ * @param device_id Unique identifier for this device
+ * @param sensor_id A unique label used in the name and unique_id
+ * @param icon https://materialdesignicons.com/
+ * @param device_payload Multiple attributes provided by appendDevicePayload() or appendShortDevicePayload()
+ * @param avail_topic Availability topic for this sensor (on a device with many sensors this will be shared)
+ * @param state_topic State topic dedicated to this binary sensor
+ */
+void ICACHE_FLASH_ATTR appendDiscoveryBinaryPayload(phase_string &out, std::string_view device_class, std::string_view device_id, std::string_view sensor_id, std::string_view icon, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  const std::string_view base = discoveryBaseTopic(avail_topic, state_topic);
+  openPayload(out, base);
+  putField(out, HA_KEY("device_class", "dev_cla"), device_class);
+  putEntityFields(out, base, avail_topic, device_id, sensor_id, device_payload, icon);
+  putTopicField(out, HA_KEY("state_topic", "stat_t"), base, state_topic);
+  closePayload(out);
 }
 
-std::string ICACHE_FLASH_ATTR buildDiscoveryDiagnosticFactPayload(const std::string device_id, const std::string diag_attr, const std::string icon, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
-  std::string payload = "{\
-\"entity_category\": \"diagnostic\",\
-\"availability_topic\":\""+avail_topic+"\",\
-\"unique_id\":\""+device_id+"_"+diag_attr+"\",\
-\"device\":"+device_payload+",\
-\"name\":\""+device_id+" "+diag_attr+"\",\
-\"icon\":\""+icon+"\",\
-\"state_topic\":\""+state_topic+"\",\
-\"value_template\":\"{{ value_json."+diag_attr+" }}\" }";
-  
-  return payload;  
+// Start a message in place, with room for the largest payload so it never reallocates
+static void ICACHE_FLASH_ATTR resetDiscoveryMessage(discovery_config &disc){
+  disc.topic.clear();
+  disc.payload.clear();
+  disc.topic.reserve(DISCOVERY_TOPIC_RESERVE);
+  disc.payload.reserve(DISCOVERY_PAYLOAD_RESERVE);
 }
 
 /**
@@ -267,11 +403,12 @@ std::string ICACHE_FLASH_ATTR buildDiscoveryDiagnosticFactPayload(const std::str
  * The topic names could be generated within this method, but to save memory they are created once by the main program and passed in.
  */
 // build discovery message - step 4 of 4
-discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic){
-    discovery_config disc;
-    disc.topic = buildDiscoveryTopic(disc_meta.device_type, device_id, disc_meta.device_class /*sensor_id*/); 
-    disc.payload = buildDiscoveryPayload(disc_meta.device_class, device_id, disc_meta.device_class /*json_attr*/, disc_meta.has_sub_attr, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, state_topic);
-    return disc;  
+void ICACHE_FLASH_ATTR buildDiscoveryMessage(discovery_config &disc, const discovery_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  const phase_string &json_attr = disc_meta.json_attr.empty() ? disc_meta.device_class : disc_meta.json_attr;
+  const phase_string &value_path = disc_meta.value_path.empty() ? json_attr : disc_meta.value_path;
+  resetDiscoveryMessage(disc);
+  appendDiscoveryTopic(disc.topic, disc_meta.device_type, device_id, json_attr /*sensor_id*/);
+  appendDiscoveryPayload(disc.payload, disc_meta.state_class, disc_meta.device_class, device_id, json_attr, value_path, disc_meta.has_sub_attr, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, state_topic);
 }
 
 /** 
@@ -280,28 +417,147 @@ discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_metadata disc_m
  * Since these messages are shorter in nature, use the fully defined device payload
 */
 // build discovery configuration/control message - step 4 of 4
+void ICACHE_FLASH_ATTR buildDiscoveryMessage(discovery_config &disc, const discovery_config_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic){
+  resetDiscoveryMessage(disc);
+  // getter and setter topics are only needed inside the payload; build them in the topic buffer, ahead of the discovery topic
+  putEntityTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.control_name, "get");
+  const size_t get_length = disc.topic.length();
+  putEntityTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.control_name, "set");
+  const std::string_view topics = disc.topic;
+  appendDiscoveryConfigPayload(disc.payload, device_id, disc_meta.control_name, disc_meta.custom_settings, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, topics.substr(0, get_length), topics.substr(get_length));
+  disc.topic.clear();
+  appendDiscoveryTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.control_name);
+}
+
+void ICACHE_FLASH_ATTR buildDiscoveryMessage(discovery_config &disc, const discovery_measured_diagnostic_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  resetDiscoveryMessage(disc);
+  appendDiscoveryTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.diag_attr /*sensor_id*/);
+  appendDiscoveryDiagnosticMeasurementPayload(disc.payload, disc_meta.state_class, disc_meta.device_class, device_id, disc_meta.diag_attr, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, state_topic);
+}
+
+void ICACHE_FLASH_ATTR buildDiscoveryMessage(discovery_config &disc, const discovery_fact_diagnostic_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic){
+  resetDiscoveryMessage(disc);
+  appendDiscoveryTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.diag_attr /*sensor_id*/);
+  appendDiscoveryDiagnosticFactPayload(disc.payload, device_id, disc_meta.diag_attr, disc_meta.icon, device_payload, avail_topic, state_topic);
+}
+
+void ICACHE_FLASH_ATTR buildDiscoveryMessage(discovery_config &disc, const discovery_binary_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic){
+  resetDiscoveryMessage(disc);
+  // the state topic is only needed inside the payload; build it in the topic buffer first
+  putEntityTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.sensor_id, "state");
+  appendDiscoveryBinaryPayload(disc.payload, disc_meta.device_class, device_id, disc_meta.sensor_id, disc_meta.icon, device_payload, avail_topic, disc.topic);
+  disc.topic.clear();
+  appendDiscoveryTopic(disc.topic, disc_meta.device_type, device_id, disc_meta.sensor_id);
+}
+
+// *********************************************************************************************************************
+// v1 API: the same builders taking std::string by value and returning a new std::string, as before the phase arena.
+// Kept for compatibility; each is a wrapper around its append*() or buildDiscoveryMessage() counterpart.
+
+static std::string ICACHE_FLASH_ATTR toStdString(const phase_string &s){
+  return std::string(s.data(), s.size());
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryTopic(const std::string device_type, const std::string device_id, const std::string sensor_id){
+  std::string topic;
+  topic.reserve(HA_TOPIC_BASE.length() + device_type.length() + device_id.length() + sensor_id.length() + 10); // "////config"
+  putEntityTopic(topic, device_type, device_id, sensor_id, "config"); // as appendDiscoveryTopic(), without the copy out
+  return topic;
+}
+
+std::string ICACHE_FLASH_ATTR buildDevicePayload(const std::string device_name, const std::string identifier, const std::string manufacturer, const std::string model, const std::string firmware_version){
+  phase_string payload;
+  appendDevicePayload(payload, device_name, identifier, manufacturer, model, firmware_version);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildShortDevicePayload(const std::string device_name, const std::string identifier){
+  phase_string payload;
+  appendShortDevicePayload(payload, device_name, identifier);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryPayload(const std::string state_class, const std::string device_class, const std::string device_id, const std::string json_attr, const std::string value_path, bool has_sub_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
+  phase_string payload;
+  appendDiscoveryPayload(payload, state_class, device_class, device_id, json_attr, value_path, has_sub_attr, icon, unit, device_payload, avail_topic, state_topic);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryConfigPayload(const std::string device_id, const std::string config_attr, const std::string custom_settings, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic, const std::string command_topic){
+  phase_string payload;
+  appendDiscoveryConfigPayload(payload, device_id, config_attr, custom_settings, icon, unit, device_payload, avail_topic, state_topic, command_topic);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryDiagnosticMeasurementPayload(const std::string state_class, const std::string device_class, const std::string device_id, const std::string diag_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
+  phase_string payload;
+  appendDiscoveryDiagnosticMeasurementPayload(payload, state_class, device_class, device_id, diag_attr, icon, unit, device_payload, avail_topic, state_topic);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryDiagnosticFactPayload(const std::string device_id, const std::string diag_attr, const std::string icon, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
+  phase_string payload;
+  appendDiscoveryDiagnosticFactPayload(payload, device_id, diag_attr, icon, device_payload, avail_topic, state_topic);
+  return toStdString(payload);
+}
+
+std::string ICACHE_FLASH_ATTR buildDiscoveryBinaryPayload(const std::string device_class, const std::string device_id, const std::string sensor_id, const std::string icon, const std::string device_payload, const std::string avail_topic, const std::string state_topic){
+  phase_string payload;
+  appendDiscoveryBinaryPayload(payload, device_class, device_id, sensor_id, icon, device_payload, avail_topic, state_topic);
+  return toStdString(payload);
+}
+
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic){
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, device_id, device_payload, avail_topic, state_topic);
+  return disc;
+}
+
 discovery_config ICACHE_FLASH_ATTR getDiscoveryConfigMessage(discovery_config_metadata disc_meta, const std::string device_id, std::string device_payload, const std::string avail_topic){
   discovery_config disc;
-  const std::string sensor_id = disc_meta.control_name;
-  const std::string get_topic = buildGetterTopic(disc_meta.device_type, device_id, disc_meta.control_name);
-  const std::string set_topic = buildSetterTopic(disc_meta.device_type, device_id, disc_meta.control_name);  
-  disc.topic = buildDiscoveryTopic(disc_meta.device_type, device_id, sensor_id);
-  disc.payload = buildDiscoveryConfigPayload(device_id, disc_meta.control_name, disc_meta.custom_settings, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, get_topic, set_topic);
+  buildDiscoveryMessage(disc, disc_meta, device_id, device_payload, avail_topic);
   return disc;
 }
 
 discovery_config ICACHE_FLASH_ATTR getDiscoveryMeasuredDiagnosticMessage(discovery_measured_diagnostic_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic){
-    discovery_config disc;
-    disc.topic = buildDiscoveryTopic(disc_meta.device_type, device_id, disc_meta.diag_attr /*sensor_id*/); 
-    disc.payload = buildDiscoveryDiagnosticMeasurementPayload(disc_meta.state_class, disc_meta.device_class, device_id, disc_meta.diag_attr, disc_meta.icon, disc_meta.unit, device_payload, avail_topic, state_topic);
-    return disc;  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, device_id, device_payload, avail_topic, state_topic);
+  return disc;
 }
 
 discovery_config ICACHE_FLASH_ATTR getDiscoveryFactDiagnosticMessage(discovery_fact_diagnostic_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic){
-    discovery_config disc;
-    disc.topic = buildDiscoveryTopic(disc_meta.device_type, device_id, disc_meta.diag_attr /*sensor_id*/); 
-    disc.payload = buildDiscoveryDiagnosticFactPayload(device_id, disc_meta.diag_attr, disc_meta.icon, device_payload, avail_topic, state_topic);
-    return disc;  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, device_id, device_payload, avail_topic, state_topic);
+  return disc;
+}
+
+discovery_config ICACHE_FLASH_ATTR getDiscoveryBinaryMessage(discovery_binary_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic){
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, device_id, device_payload, avail_topic);
+  return disc;
+}
+
+/**
+ * @brief Publish one discovery message (retained, QoS 1; returns once acknowledged).
+ * A message that does not fit the client's write buffer can never be sent, so it is reported and given up on instead of
+ * being retried forever. With the buffer sized from discoveryPayloadMaxLength() this does not happen.
+ *
+ * @return true If done with the message (published, or given up on)
+ */
+static bool ICACHE_FLASH_ATTR publishDiscoveryConfig(const discovery_config &disc){
+  Serial.print(disc.topic.c_str());
+  if (mqttclient.publish(disc.topic.c_str(), disc.payload.c_str(), RETAINED, QOS_1))
+  {
+    Serial.println(F("... OK"));
+    return true;
+  }
+  if (mqttclient.lastError() == LWMQTT_BUFFER_TOO_SHORT)
+  {
+    Serial.printf("... Skipped, %u byte payload does not fit the MQTT write buffer\n", (unsigned)disc.payload.length());
+    return true;
+  }
+  Serial.println(F("... Failed"));
+  return false;
 }
 
 /**
@@ -312,161 +568,125 @@ discovery_config ICACHE_FLASH_ATTR getDiscoveryFactDiagnosticMessage(discovery_f
 // build discovery and discovery config/control message - step 2 of 4
 int ICACHE_FLASH_ATTR publishDiscoveryMessages()
 {
-  int pending_discovery_count = discovery_metadata_list.size() + discovery_config_metadata_list.size() + discovery_measured_diagnostic_metadata_list.size() + discovery_fact_diagnostic_metadata_list.size();
+  int pending_discovery_count = discovery_metadata_list.size() + discovery_config_metadata_list.size() + discovery_measured_diagnostic_metadata_list.size() + discovery_fact_diagnostic_metadata_list.size() + discovery_binary_metadata_list.size();
   
   // Metadata is different for discovery_metadata and discovery_config_metadata but both can create a discovery_config with topic and payload
   for (size_t i = 0; i < discovery_metadata_list.size(); i++)
   {
+    size_t arena_mark = phaseArenaMark(); // topic and payload are built in the arena, above the metadata lists
     if (!discovery_metadata_list[i].published)
     {
       // generate topic and payload one at a time
       discovery_config disc = getDiscoveryMessage(discovery_metadata_list[i]); // build discovery message - step 3
       
       Serial.print(F("\nPublishing discovery message to "));
-      Serial.print(disc.topic.c_str());
-      if (!mqttclient.publish(disc.topic.c_str(), disc.payload.c_str(), RETAINED, QOS_1))
-      { // should return true if successfully sent and since QoS=1 ACK should also be received
-        Serial.println(F("... Failed"));
-      }
-      else
+      if (publishDiscoveryConfig(disc))
       {
-        Serial.println(F("... OK"));
         discovery_metadata_list[i].published = true;
         pending_discovery_count--; // just published
-
-        // TODO: delete all attributes except published flag to same RAM? (note: this is done after all messages have been published)    
       }
     }
     else{
         pending_discovery_count--; // previously published
     }
+    phaseArenaRewind(arena_mark); // the message is gone, so is everything built for it
   }
   
   for (size_t i = 0; i < discovery_config_metadata_list.size(); i++)
   {
+    size_t arena_mark = phaseArenaMark();
     if (!discovery_config_metadata_list[i].published)
     {
       // generate topic and payload one at a time
       discovery_config disc = getDiscoveryMessage(discovery_config_metadata_list[i]); // build discovery configuration/control message - step 3
       
       Serial.print(F("\nPublishing configuration/control discovery message to "));
-      Serial.print(disc.topic.c_str());
-      if (!mqttclient.publish(disc.topic.c_str(), disc.payload.c_str(), RETAINED, QOS_1))
-      { // should return true if successfully sent and since QoS=1 ACK should also be received
-        Serial.println(F("... Failed"));
-      }
-      else
+      if (publishDiscoveryConfig(disc))
       {
-        Serial.println(F("... OK"));
         discovery_config_metadata_list[i].published = true;
         pending_discovery_count--; // just published 
-
-        // TODO: delete all attributes except published flag to same RAM? (note: this is done after all messages have been published)
       }
     }
     else{
         pending_discovery_count--; // previously published
     }
+    phaseArenaRewind(arena_mark); // the message is gone, so is everything built for it
   }  
   
   for (size_t i = 0; i < discovery_measured_diagnostic_metadata_list.size(); i++)
   {
+    size_t arena_mark = phaseArenaMark();
     if (!discovery_measured_diagnostic_metadata_list[i].published)
     {
       // generate topic and payload one at a time
       discovery_config disc = getDiscoveryMessage(discovery_measured_diagnostic_metadata_list[i]); // build discovery measured diagnostic message - step 3
       
       Serial.print(F("\nPublishing measured diagnostic discovery message to "));
-      Serial.print(disc.topic.c_str());
-      if (!mqttclient.publish(disc.topic.c_str(), disc.payload.c_str(), RETAINED, QOS_1))
-      { // should return true if successfully sent and since QoS=1 ACK should also be received
-        Serial.println(F("... Failed"));
-      }
-      else
+      if (publishDiscoveryConfig(disc))
       {
-        Serial.println(F("... OK"));
         discovery_measured_diagnostic_metadata_list[i].published = true;
         pending_discovery_count--; // just published 
-
-        // TODO: delete all attributes except published flag to same RAM? (note: this is done after all messages have been published)
       }
     }
     else{
         pending_discovery_count--; // previously published
     }
+    phaseArenaRewind(arena_mark); // the message is gone, so is everything built for it
   } 
   
   for (size_t i = 0; i < discovery_fact_diagnostic_metadata_list.size(); i++)
   {
+    size_t arena_mark = phaseArenaMark();
     if (!discovery_fact_diagnostic_metadata_list[i].published)
     {
       // generate topic and payload one at a time
       discovery_config disc = getDiscoveryMessage(discovery_fact_diagnostic_metadata_list[i]); // build discovery diagnostic fact message - step 3
       
       Serial.print(F("\nPublishing diagnostic fact discovery message to "));
-      Serial.print(disc.topic.c_str());
-      if (!mqttclient.publish(disc.topic.c_str(), disc.payload.c_str(), RETAINED, QOS_1))
-      { // should return true if successfully sent and since QoS=1 ACK should also be received
-        Serial.println(F("... Failed"));
-      }
-      else
+      if (publishDiscoveryConfig(disc))
       {
-        Serial.println(F("... OK"));
         discovery_fact_diagnostic_metadata_list[i].published = true;
         pending_discovery_count--; // just published 
-
-        // TODO: delete all attributes except published flag to same RAM? (note: this is done after all messages have been published)
       }
     }
     else{
         pending_discovery_count--; // previously published
     }
+    phaseArenaRewind(arena_mark); // the message is gone, so is everything built for it
   }
   
-  return pending_discovery_count;
-}
-
-void ICACHE_FLASH_ATTR purgeDiscoveryMetadata(){
-  for (size_t i = 0; i < discovery_metadata_list.size(); i++)
+  for (size_t i = 0; i < discovery_binary_metadata_list.size(); i++)
   {
-    if (discovery_metadata_list[i].published)
+    size_t arena_mark = phaseArenaMark();
+    if (!discovery_binary_metadata_list[i].published)
     {
-      discovery_metadata_list[i].device_type.clear();
-      discovery_metadata_list[i].device_class.clear();
-      discovery_metadata_list[i].icon.clear();
-      discovery_metadata_list[i].unit.clear();       
-    }
-  }
-  for (size_t i = 0; i < discovery_config_metadata_list.size(); i++)
-  {
-    if (discovery_config_metadata_list[i].published)
-    {
-      discovery_config_metadata_list[i].control_name.clear();
-      discovery_config_metadata_list[i].custom_settings.clear();
-      discovery_config_metadata_list[i].device_type.clear();
-      discovery_config_metadata_list[i].icon.clear();
-      discovery_config_metadata_list[i].unit.clear();
-    }
-  }  
-  for (size_t i = 0; i < discovery_measured_diagnostic_metadata_list.size(); i++)
-  {
-    if (discovery_measured_diagnostic_metadata_list[i].published)
-    {
-      discovery_measured_diagnostic_metadata_list[i].device_type.clear();
-      discovery_measured_diagnostic_metadata_list[i].device_class.clear();
-      discovery_measured_diagnostic_metadata_list[i].state_class.clear();
-      discovery_measured_diagnostic_metadata_list[i].diag_attr.clear();
-      discovery_measured_diagnostic_metadata_list[i].icon.clear();
-      discovery_measured_diagnostic_metadata_list[i].unit.clear();
+      // generate topic and payload one at a time
+      discovery_config disc = getDiscoveryMessage(discovery_binary_metadata_list[i]); // build discovery binary sensor message - step 3
+      
+      Serial.print(F("\nPublishing binary sensor discovery message to "));
+      if (publishDiscoveryConfig(disc))
+      {
+        discovery_binary_metadata_list[i].published = true;
+        pending_discovery_count--; // just published 
+      }
     }
-  }   
-  for (size_t i = 0; i < discovery_fact_diagnostic_metadata_list.size(); i++)
-  {
-    if (discovery_fact_diagnostic_metadata_list[i].published)
-    {
-      discovery_fact_diagnostic_metadata_list[i].device_type.clear();            
-      discovery_fact_diagnostic_metadata_list[i].diag_attr.clear();
-      discovery_fact_diagnostic_metadata_list[i].icon.clear();      
+    else{
+        pending_discovery_count--; // previously published
     }
-  }  
-}
\ No newline at end of file
+    phaseArenaRewind(arena_mark); // the message is gone, so is everything built for it
+  }
+  
+  return pending_discovery_count;
+}
+
+/**
+ * @brief Release the metadata lists, storage included (clear() would keep it). Call once every message is published and
+ * before the phase arena they were built in is ended.
+ */
+void ICACHE_FLASH_ATTR purgeDiscoveryMetadata(){
+  phase_vector<discovery_metadata>().swap(discovery_metadata_list);
+  phase_vector<discovery_config_metadata>().swap(discovery_config_metadata_list);
+  phase_vector<discovery_measured_diagnostic_metadata>().swap(discovery_measured_diagnostic_metadata_list);
+  phase_vector<discovery_fact_diagnostic_metadata>().swap(discovery_fact_diagnostic_metadata_list);
+  phase_vector<discovery_binary_metadata>().swap(discovery_binary_metadata_list);
+}
@@ -5,11 +5,41 @@
 #include <MQTT.h>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <phase-arena.h>
+#include "utils.h"
 
-// Not used by this library, but meant to be used by the users of this library between calls to connectMQTTBroker()
-#define MQTT_ATTEMPT_COOLDOWN 10000 // milliseconds between MQTT broker connection attempts
+// Not used by this library directly, but by mqttReconnectDelay() which is meant to be used by the users of this library before each call to connectMQTTBroker()
+#define MQTT_ATTEMPT_COOLDOWN 10000 // milliseconds; spread of the first reconnect, then the first retry; doubles with each failed attempt (with jitter)
+#define MQTT_ATTEMPT_COOLDOWN_MAX 300000 // upper bound of the time between MQTT broker connection attempts
+// How long the client waits for a CONNACK, SUBACK or PUBACK before it gives up and drops the connection. The library's
+// default of 1 s is shorter than a single TCP retransmission plus the round trip, so one lost segment on a weak link
+// would otherwise cost a reconnect.
+#define MQTT_COMMAND_TIMEOUT 3000 // milliseconds
 
-const std::string HA_TOPIC_BASE = "homeassistant";
+#define HA_DISCOVERY_PREFIX "homeassistant"
+const std::string HA_TOPIC_BASE = HA_DISCOVERY_PREFIX;
+
+// Discovery payloads use Home Assistant's abbreviated keys (ie. "stat_t" for "state_topic") and factor the common topic
+// prefix out into the "~" base topic; 14% off the retained config messages (16534 -> 14267 bytes over the firmware's 39,
+// see tools/bench/discovery-compact.cpp): names, ids, templates and the device block cannot be abbreviated. 0 for the verbose form.
+#ifndef HA_DISCOVERY_COMPACT
+#define HA_DISCOVERY_COMPACT 1
+#endif
+
+#if HA_DISCOVERY_COMPACT
+#define HA_KEY(verbose, abbreviated) "\"" abbreviated "\":"
+#else
+#define HA_KEY(verbose, abbreviated) "\"" verbose "\":"
+#endif
+
+#define DISCOVERY_TOPIC_RESERVE 160   // bytes reserved for a discovery topic (also holds a control's getter and setter topics while its payload is built)
+// Bytes reserved for a discovery payload; large enough for the worst case (see the discovery*PayloadLength() bounds), so it is built without reallocating
+#if HA_DISCOVERY_COMPACT
+#define DISCOVERY_PAYLOAD_RESERVE 640
+#else
+#define DISCOVERY_PAYLOAD_RESERVE 768
+#endif
 
 // *** MQTT Related Constants ***
 const bool RETAINED = true;
@@ -25,82 +55,245 @@ const byte MQTT_SUB_ERR = 2;
 // *********************************************************************************************************************
 // *** Data Types ***
 struct discovery_metadata{
-  std::string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity  
-  std::string device_class;       // https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
+  phase_string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity  
+  phase_string device_class;       // https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes ; may be empty
+  phase_string json_attr;          // top-tier json attribute in the state payload, also the sensor id; if empty the device_class is used
+  phase_string value_path;         // path of the value within the state payload (ie. "frequency_details.cpm"); if empty json_attr is used
+  phase_string state_class = "measurement"; // measurement | total | total_increasing
   bool has_sub_attr;              // if true, adds json_attributes_topic (same as state topic) and json_attributes_template which will parse out the <attrib>_details field and apply all contents found
-  std::string icon;               // https://materialdesignicons.com/
-  std::string unit;               // see supported units for device_class (can make up your own unit as well) https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
+  phase_string icon;               // https://materialdesignicons.com/
+  phase_string unit;               // see supported units for device_class (can make up your own unit as well) https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes
+  phase_string state_topic;        // state topic carrying json_attr; if empty the shared sensor state topic is used
   bool published = false;         // publication success flag
 };
 
 struct discovery_config_metadata{
-  std::string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
-  std::string control_name;       // internal label for control (no spaces)
-  std::string custom_settings;    // JSON snippet with escaped quotes - contents depend on device_type - ie. "\"min\": 1, \"max\": 10000"
-  std::string icon;               // https://materialdesignicons.com/
-  std::string unit;               // ppm, ticks, meters, C, F, (anything)
+  phase_string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
+  phase_string control_name;       // internal label for control (no spaces)
+  phase_string custom_settings;    // JSON snippet with escaped quotes - contents depend on device_type - ie. "\"min\": 1, \"max\": 10000"
+  phase_string icon;               // https://materialdesignicons.com/
+  phase_string unit;               // ppm, ticks, meters, C, F, (anything)
   bool published = false;         // publication success flag
 };
 
 // Diagnostic can either be a fact (like IP address) or a measurable value (like RSSI)
 
 struct discovery_measured_diagnostic_metadata{
-  std::string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
-  std::string device_class;       // battery | date | duration | timestamp | ... In some cases may be "None" - https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes    
-  std::string state_class = "measurement"; // measurement | total | total_increasing
-  std::string diag_attr;          // Name of json attribute within diagnostic message payload
-  std::string icon;               // https://materialdesignicons.com/
-  std::string unit;               // ppm, ticks, meters, C, F, (anything)
+  phase_string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
+  phase_string device_class;       // battery | date | duration | timestamp | ... In some cases may be "None" - https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes    
+  phase_string state_class = "measurement"; // measurement | total | total_increasing
+  phase_string diag_attr;          // Name of json attribute within diagnostic message payload
+  phase_string icon;               // https://materialdesignicons.com/
+  phase_string unit;               // ppm, ticks, meters, C, F, (anything)
   bool published = false;         // publication success flag
 };
 
 struct discovery_fact_diagnostic_metadata{  
-  std::string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
-  std::string diag_attr;          // Name of json attribute within diagnostic message payload
-  std::string icon;               // https://materialdesignicons.com/  
+  phase_string device_type;        // Entity such as number | switch | light | sensor ...  https://developers.home-assistant.io/docs/core/entity
+  phase_string diag_attr;          // Name of json attribute within diagnostic message payload
+  phase_string icon;               // https://materialdesignicons.com/  
+  bool published = false;         // publication success flag
+};
+
+// Two-state entity (binary_sensor) with its own state topic; payload is "ON" or "OFF"
+struct discovery_binary_metadata{
+  phase_string device_type;        // Entity such as binary_sensor  https://developers.home-assistant.io/docs/core/entity
+  phase_string device_class;       // safety | problem | ...  https://www.home-assistant.io/integrations/binary_sensor/#device-class
+  phase_string sensor_id;          // internal label for the entity (no spaces), also used in its state topic
+  phase_string icon;               // https://materialdesignicons.com/
   bool published = false;         // publication success flag
 };
 
 struct discovery_config{          // Home Assistant MQTT Discovery https://www.home-assistant.io/docs/mqtt/discovery/
-  std::string topic;              // discovery topic in the form <discovery_prefix>/<component>/[<node_id>/]<object_id>/config
-  std::string payload;            // discovery details
+  phase_string topic;              // discovery topic in the form <discovery_prefix>/<component>/[<node_id>/]<object_id>/config
+  phase_string payload;            // discovery details
 };
 
+// *********************************************************************************************************************
+// *** Compile-time sizing ***
+// Worst case lengths of the packets, topics and payloads built by this library, mirroring the builders below, so that the
+// main program can size the MQTT client buffers from its own declarations.
+
+#define HA_LITERAL_LENGTH(s) (sizeof(s) - 1)
+#define HA_KEY_LENGTH(verbose, abbreviated) HA_LITERAL_LENGTH(HA_KEY(verbose, abbreviated))
+#define MAC_ADDRESS_LENGTH 17 // "AA:BB:CC:DD:EE:FF", the device identifier
+
+// Fixed header (control byte and 1..4 byte remaining length) around the rest of a packet
+constexpr size_t mqttFramedLength(size_t remaining_length){
+  return 1 + (remaining_length < 128 ? 1 : (remaining_length < 16384 ? 2 : (remaining_length < 2097152 ? 3 : 4))) + remaining_length;
+}
+
+// PUBLISH as serialized by lwmqtt into the client's write (or read) buffer: topic length prefix, topic, packet id (QoS > 0), payload
+constexpr size_t mqttPacketLength(size_t topic_length, size_t payload_length, int qos){
+  return mqttFramedLength(2 + topic_length + (qos > QOS_0 ? 2 : 0) + payload_length);
+}
+
+// CONNECT: protocol name, level, flags and keep alive (10), then the client id, will topic and payload, username and password
+constexpr size_t mqttConnectPacketLength(size_t client_id, size_t will_topic, size_t will_payload, size_t username, size_t password){
+  return mqttFramedLength(10 + 2 + client_id + 2 + will_topic + 2 + will_payload + 2 + username + 2 + password);
+}
+
+// SUBSCRIBE to a single topic: packet id, topic length prefix, topic, requested QoS
+constexpr size_t mqttSubscribePacketLength(size_t topic_length){
+  return mqttFramedLength(2 + 2 + topic_length + 1);
+}
+
+// {HA_TOPIC_BASE}/{device_type}/{device_id}/{leaf}, ie. buildStateTopic() with the leaf "state"
+constexpr size_t haTopicLength(size_t device_type, size_t device_id, size_t leaf){
+  return HA_LITERAL_LENGTH(HA_DISCOVERY_PREFIX) + 1 + device_type + 1 + device_id + 1 + leaf;
+}
+
+constexpr size_t haTopicLength(const char* device_type, const char* device_id, const char* leaf){
+  return haTopicLength(constStrLength(device_type), constStrLength(device_id), constStrLength(leaf));
+}
+
+// {HA_TOPIC_BASE}/{device_type}/{device_id}/{entity_id}/{leaf}, ie. buildEntityStateTopic(), buildSetterTopic(), appendDiscoveryTopic()
+constexpr size_t haEntityTopicLength(size_t device_type, size_t device_id, size_t entity_id, size_t leaf){
+  return haTopicLength(device_type, device_id, entity_id + 1 + leaf);
+}
+
+constexpr size_t haEntityTopicLength(const char* device_type, const char* device_id, const char* entity_id, const char* leaf){
+  return haEntityTopicLength(constStrLength(device_type), constStrLength(device_id), constStrLength(entity_id), constStrLength(leaf));
+}
+
+// appendDevicePayload() and appendShortDevicePayload()
+constexpr size_t devicePayloadLength(size_t device_name, size_t identifier, size_t manufacturer, size_t model, size_t firmware_version){
+  return HA_LITERAL_LENGTH("{\"name\":\"\",") + HA_KEY_LENGTH("identifiers", "ids") + HA_LITERAL_LENGTH("\"\",\"mf\":\"\",\"mdl\":\"\",\"sw\":\"\"}")
+    + device_name + identifier + manufacturer + model + firmware_version;
+}
+
+constexpr size_t shortDevicePayloadLength(size_t device_name, size_t identifier){
+  return HA_LITERAL_LENGTH("{\"name\":\"\",\"ids\":\"\"}") + device_name + identifier;
+}
+
+// Longest value of each part over all the discovery messages of a device
+struct discovery_bounds{
+  size_t device_type;             // component, ie. "binary_sensor"
+  size_t device_id;
+  size_t entity_id;               // sensor id, control name or diagnostic attribute
+  size_t value_path;              // value path of a sensor's value template
+  size_t device_class;
+  size_t state_class;
+  size_t icon;
+  size_t unit;
+  size_t custom_settings;         // json snippet of a control
+  size_t device_payload;          // see devicePayloadLength()
+  size_t topic;                   // availability, state, getter or setter topic referenced by a payload
+};
+
+// "key":"value",
+constexpr size_t discoveryFieldLength(size_t key, size_t value){
+  return key + 1 + value + 2;
+}
+
+// "key":"{{ value_json.<path><suffix> }}",
+constexpr size_t discoveryTemplateLength(size_t key, size_t path, size_t suffix){
+  return discoveryFieldLength(key, HA_LITERAL_LENGTH("{{ value_json. }}") + path + suffix);
+}
+
+// Fields every discovery payload has, see putEntityFields()
+constexpr size_t discoveryEntityFieldsLength(const discovery_bounds &b){
+  return discoveryFieldLength(HA_KEY_LENGTH("availability_topic", "avty_t"), b.topic)
+    + discoveryFieldLength(HA_KEY_LENGTH("unique_id", "uniq_id"), b.device_id + 1 + b.entity_id)
+    + HA_KEY_LENGTH("device", "dev") + b.device_payload + 1
+    + discoveryFieldLength(HA_KEY_LENGTH("name", "name"), b.device_id + 1 + b.entity_id)
+    + discoveryFieldLength(HA_KEY_LENGTH("icon", "ic"), b.icon);
+}
+
+/*
+  Worst case of each appendDiscovery*Payload(). Each starts with "{" and every field ends on a comma, the last one of which
+  becomes the closing brace. Topics are counted in full: the "~" base topic is only used when it is longer than 8 characters
+  and replaces it in at least two topics, so it never makes a payload longer.
+*/
+constexpr size_t discoverySensorPayloadLength(const discovery_bounds &b){
+  return 1 + discoveryFieldLength(HA_KEY_LENGTH("device_class", "dev_cla"), b.device_class)
+    + discoveryFieldLength(HA_KEY_LENGTH("unit_of_measurement", "unit_of_meas"), b.unit)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_class", "stat_cla"), b.state_class)
+    + discoveryEntityFieldsLength(b)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_topic", "stat_t"), b.topic)
+    + discoveryTemplateLength(HA_KEY_LENGTH("value_template", "val_tpl"), constMax(b.value_path, b.entity_id), 0)
+    + discoveryFieldLength(HA_KEY_LENGTH("json_attributes_topic", "json_attr_t"), b.topic)
+    + discoveryTemplateLength(HA_KEY_LENGTH("json_attributes_template", "json_attr_tpl"), b.entity_id, HA_LITERAL_LENGTH("_details | tojson"));
+}
+
+constexpr size_t discoveryConfigPayloadLength(const discovery_bounds &b){
+  return 1 + discoveryFieldLength(HA_KEY_LENGTH("entity_category", "ent_cat"), HA_LITERAL_LENGTH("config"))
+    + discoveryFieldLength(HA_KEY_LENGTH("unit_of_measurement", "unit_of_meas"), b.unit)
+    + discoveryEntityFieldsLength(b)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_topic", "stat_t"), b.topic)
+    + discoveryFieldLength(HA_KEY_LENGTH("command_topic", "cmd_t"), b.topic)
+    + b.custom_settings + 1;
+}
+
+constexpr size_t discoveryDiagnosticMeasurementPayloadLength(const discovery_bounds &b){
+  return 1 + discoveryFieldLength(HA_KEY_LENGTH("device_class", "dev_cla"), b.device_class)
+    + discoveryFieldLength(HA_KEY_LENGTH("unit_of_measurement", "unit_of_meas"), b.unit)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_class", "stat_cla"), b.state_class)
+    + discoveryFieldLength(HA_KEY_LENGTH("entity_category", "ent_cat"), HA_LITERAL_LENGTH("diagnostic"))
+    + discoveryEntityFieldsLength(b)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_topic", "stat_t"), b.topic)
+    + discoveryTemplateLength(HA_KEY_LENGTH("value_template", "val_tpl"), b.entity_id, 0);
+}
+
+constexpr size_t discoveryDiagnosticFactPayloadLength(const discovery_bounds &b){
+  return 1 + discoveryFieldLength(HA_KEY_LENGTH("entity_category", "ent_cat"), HA_LITERAL_LENGTH("diagnostic"))
+    + discoveryEntityFieldsLength(b)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_topic", "stat_t"), b.topic)
+    + discoveryTemplateLength(HA_KEY_LENGTH("value_template", "val_tpl"), b.entity_id, 0);
+}
+
+constexpr size_t discoveryBinaryPayloadLength(const discovery_bounds &b){
+  return 1 + discoveryFieldLength(HA_KEY_LENGTH("device_class", "dev_cla"), b.device_class)
+    + discoveryEntityFieldsLength(b)
+    + discoveryFieldLength(HA_KEY_LENGTH("state_topic", "stat_t"), b.topic);
+}
+
+constexpr size_t discoveryTopicMaxLength(const discovery_bounds &b){
+  return haEntityTopicLength(b.device_type, b.device_id, b.entity_id, HA_LITERAL_LENGTH("config"));
+}
+
 // *********************************************************************************************************************
 // *** Must Declare ***
 extern MQTTClient mqttclient;
 extern WiFiClient wificlient;
-extern std::vector<discovery_metadata> discovery_metadata_list;                                         // list of data used to construct discovery_config for sensor discovery
-extern std::vector<discovery_config_metadata> discovery_config_metadata_list;                           // list of data used to construct discovery_config for config/control discovery
-extern std::vector<discovery_measured_diagnostic_metadata> discovery_measured_diagnostic_metadata_list; // list of data used to construct discovery_config for measured diagnostics discovery (like RSSI) 
-extern std::vector<discovery_fact_diagnostic_metadata> discovery_fact_diagnostic_metadata_list;         // list of data used to construct discovery_config for diagnostic facts discovery (like IP address)
+extern phase_vector<discovery_metadata> discovery_metadata_list;                                         // list of data used to construct discovery_config for sensor discovery
+extern phase_vector<discovery_config_metadata> discovery_config_metadata_list;                           // list of data used to construct discovery_config for config/control discovery
+extern phase_vector<discovery_measured_diagnostic_metadata> discovery_measured_diagnostic_metadata_list; // list of data used to construct discovery_config for measured diagnostics discovery (like RSSI) 
+extern phase_vector<discovery_fact_diagnostic_metadata> discovery_fact_diagnostic_metadata_list;         // list of data used to construct discovery_config for diagnostic facts discovery (like IP address)
+extern phase_vector<discovery_binary_metadata> discovery_binary_metadata_list;                           // list of data used to construct discovery_config for binary sensor discovery (like alarms)
 
 
 // *** Must Implement ***
 
 // Main program must implement
-std::vector<discovery_metadata> getAllDiscoveryMessagesMetadata();                                      // define specific sensor discovery facts that are to be discoverable (build discovery message - step 1 of 4)
-discovery_config getDiscoveryMessage(discovery_metadata disc_meta);                                     // build discovery message - step 3 of 4
+phase_vector<discovery_metadata> getAllDiscoveryMessagesMetadata();                                      // define specific sensor discovery facts that are to be discoverable (build discovery message - step 1 of 4)
+discovery_config getDiscoveryMessage(const discovery_metadata &disc_meta);                                  // build discovery message - step 3 of 4
+
+phase_vector<discovery_config_metadata> getAllDiscoveryConfigMessagesMetadata();                         // define specific device configuration/control discovery facts that are to be discoverable
+discovery_config getDiscoveryMessage(const discovery_config_metadata &disc_meta);                           // build discovery config/control message - step 3 of 4; convert config/control discovery facts to discovery topic and payload
 
-std::vector<discovery_config_metadata> getAllDiscoveryConfigMessagesMetadata();                         // define specific device configuration/control discovery facts that are to be discoverable
-discovery_config getDiscoveryMessage(discovery_config_metadata disc_meta);                              // build discovery config/control message - step 3 of 4; convert config/control discovery facts to discovery topic and payload
+phase_vector<discovery_measured_diagnostic_metadata> getAllDiscoveryMeasuredDiagnosticMessagesMetadata();// define specific device measurable diagnostics that are to be discoverable
+discovery_config getDiscoveryMessage(const discovery_measured_diagnostic_metadata &disc_meta);              // build discovery measurable diagnostic message - step 3 of 4; convert measurable diagnostic discovery facts to discovery topic and payload
 
-std::vector<discovery_measured_diagnostic_metadata> getAllDiscoveryMeasuredDiagnosticMessagesMetadata();// define specific device measurable diagnostics that are to be discoverable
-discovery_config getDiscoveryMessage(discovery_measured_diagnostic_metadata disc_meta);                 // build discovery measurable diagnostic message - step 3 of 4; convert measurable diagnostic discovery facts to discovery topic and payload
+phase_vector<discovery_fact_diagnostic_metadata> getAllDiscoveryFactDiagnosticMessagesMetadata();        // define specific device measurable diagnostics that are to be discoverable
+discovery_config getDiscoveryMessage(const discovery_fact_diagnostic_metadata &disc_meta);                  // build discovery measurable diagnostic message - step 3 of 4; convert measurable diagnostic discovery facts to discovery topic and payload
 
-std::vector<discovery_fact_diagnostic_metadata> getAllDiscoveryFactDiagnosticMessagesMetadata();        // define specific device measurable diagnostics that are to be discoverable
-discovery_config getDiscoveryMessage(discovery_fact_diagnostic_metadata disc_meta);                     // build discovery measurable diagnostic message - step 3 of 4; convert measurable diagnostic discovery facts to discovery topic and payload
+phase_vector<discovery_binary_metadata> getAllDiscoveryBinaryMessagesMetadata();                         // define specific binary sensors (alarms) that are to be discoverable
+discovery_config getDiscoveryMessage(const discovery_binary_metadata &disc_meta);                           // build discovery binary sensor message - step 3 of 4
 
 void messageReceived(String &topic, String &payload);                                                   // handler for each subscribed topic
 
 // Provided in library
 // Connectivity and basic operations
-void initMQTTClient(const IPAddress broker, int port, const char *lwt_topic); 
+void initMQTTClient(const IPAddress broker, int port, const char *lwt_topic, Client &net = wificlient); 
 bool connectMQTTBroker(const char *client_id, const char *username, const char *password);
+unsigned long mqttReconnectDelay();
+unsigned long mqttBackoffDelay(unsigned int failed_attempts, bool reconnecting, uint32_t &rng_state); // the policy behind mqttReconnectDelay()
 void indicateMQTTProblem(byte return_code);
 void publish(String &topic, String &payload);
 void publishOnline(const char* availability_topic);
-bool subscribeTopics(std::vector<std::string> topicVector);
+bool hasPublishCapacity(size_t topic_length, size_t payload_length, int qos);
+bool subscribeTopics(const std::vector<std::string> &topicVector);
 int publishDiscoveryMessages();                                                                         // build discovery message - step 2 of 4
 void purgeDiscoveryMetadata();
 
@@ -108,22 +301,49 @@ void purgeDiscoveryMetadata();
 std::string buildAvailabilityTopic(const std::string device_type, const std::string device_id);
 std::string buildStateTopic(const std::string device_type, const std::string device_id);
 std::string buildDiagnosticTopic(const std::string device_type, const std::string device_id);
-std::string buildDiscoveryTopic(const std::string device_type, const std::string device_id, const std::string sensor_id);
+std::string buildFactTopic(const std::string device_type, const std::string device_id);
 std::string buildSetterTopic(const std::string device_type, const std::string device_id, const std::string control_name);
 std::string buildGetterTopic(const std::string device_type, const std::string device_id, const std::string control_name);
+std::string buildEntityStateTopic(const std::string device_type, const std::string device_id, const std::string sensor_id);
+
+// Payload builders, v2: arguments are views (no copies), output is appended to a caller's buffer
+void appendDevicePayload(phase_string &out, std::string_view device_name, std::string_view identifier, std::string_view manufacturer, std::string_view model, std::string_view firmware_version);
+void appendShortDevicePayload(phase_string &out, std::string_view device_name, std::string_view identifier);
+void appendDiscoveryTopic(phase_string &out, std::string_view device_type, std::string_view device_id, std::string_view sensor_id);
+void appendDiscoveryPayload(phase_string &out, std::string_view state_class, std::string_view device_class, std::string_view device_id, std::string_view json_attr, std::string_view value_path, bool has_sub_attr, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void appendDiscoveryConfigPayload(phase_string &out, std::string_view device_id, std::string_view config_attr, std::string_view custom_settings, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic, std::string_view command_topic);
+void appendDiscoveryDiagnosticMeasurementPayload(phase_string &out, std::string_view state_class, std::string_view device_class, std::string_view device_id, std::string_view diag_attr, std::string_view icon, std::string_view unit, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void appendDiscoveryDiagnosticFactPayload(phase_string &out, std::string_view device_id, std::string_view diag_attr, std::string_view icon, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void appendDiscoveryBinaryPayload(phase_string &out, std::string_view device_class, std::string_view device_id, std::string_view sensor_id, std::string_view icon, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
 
-// Payload builders
+// Discovery message builders, v2: build into an existing discovery_config (reused buffers, nothing copied) - step 4 of 4
+void buildDiscoveryMessage(discovery_config &disc, const discovery_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void buildDiscoveryMessage(discovery_config &disc, const discovery_config_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic);
+void buildDiscoveryMessage(discovery_config &disc, const discovery_measured_diagnostic_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void buildDiscoveryMessage(discovery_config &disc, const discovery_fact_diagnostic_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic, std::string_view state_topic);
+void buildDiscoveryMessage(discovery_config &disc, const discovery_binary_metadata &disc_meta, std::string_view device_id, std::string_view device_payload, std::string_view avail_topic);
+
+/*
+  v1 builders: the signatures from before the phase arena, taking and returning std::string. Each is a wrapper around its
+  v2 counterpart above, so the output is the same; it is built in a phase_string and copied out into the std::string.
+  Note the data types did change with the arena: the metadata structs and discovery_config hold phase_string and the
+  metadata lists are phase_vector. A phase_string does not convert to std::string implicitly; use .c_str(), or
+  std::string(s.data(), s.size()), where code assigned those members to a std::string.
+*/
+std::string buildDiscoveryTopic(const std::string device_type, const std::string device_id, const std::string sensor_id);
 std::string buildShortDevicePayload(const std::string device_name, const std::string identifier);   // build discovery message - part of step 3
 std::string buildDevicePayload(const std::string device_name, const std::string identifier, const std::string manufacturer, const std::string model, const std::string version);  // build discovery message - part of step 4
-std::string buildDiscoveryPayload(const std::string device_class, const std::string device_id, const std::string json_attr, bool has_sub_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic);  // build discovery message - part of step 4
+std::string buildDiscoveryPayload(const std::string state_class, const std::string device_class, const std::string device_id, const std::string json_attr, const std::string value_path, bool has_sub_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic);  // build discovery message - part of step 4
 std::string buildDiscoveryConfigPayload(const std::string device_id, const std::string config_attr, const std::string custom_settings, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic, const std::string command_topic); // build discovery configuration/control message 
 std::string buildDiscoveryDiagnosticMeasurementPayload(const std::string state_class, const std::string device_class, const std::string device_id, const std::string diag_attr, const std::string icon, const std::string unit, const std::string device_payload, const std::string avail_topic, const std::string state_topic);
 std::string buildDiscoveryDiagnosticFactPayload(const std::string device_id, const std::string diag_attr, const std::string icon, const std::string device_payload, const std::string avail_topic, const std::string state_topic);
+std::string buildDiscoveryBinaryPayload(const std::string device_class, const std::string device_id, const std::string sensor_id, const std::string icon, const std::string device_payload, const std::string avail_topic, const std::string state_topic);
 
-// For generating topic and payload for sensor discovery messages                   
+// For generating topic and payload for sensor discovery messages, v1 (wrappers around buildDiscoveryMessage())
 discovery_config getDiscoveryMessage(discovery_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic); // build discovery message - step 4 of 4
 discovery_config getDiscoveryConfigMessage(discovery_config_metadata disc_meta, const std::string device_id, std::string device_payload, const std::string avail_topic); // build discovery config/control message - step 4 of 4
 discovery_config getDiscoveryMeasuredDiagnosticMessage(discovery_measured_diagnostic_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic);
 discovery_config getDiscoveryFactDiagnosticMessage(discovery_fact_diagnostic_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic, std::string state_topic);
+discovery_config getDiscoveryBinaryMessage(discovery_binary_metadata disc_meta, std::string device_id, std::string device_payload, std::string avail_topic);
 
 #endif
\ No newline at end of file
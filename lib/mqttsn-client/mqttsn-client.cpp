@@ -0,0 +1,66 @@
+#include <WiFiUdp.h>
+#include "mqttsn-client.h"
+
+#define MQTTSN_PUBLISH 0x0C
+#define MQTTSN_FLAG_QOS_M1 0x60           // QoS -1: publish without a connection
+#define MQTTSN_FLAG_TOPIC_PREDEFINED 0x01
+
+static WiFiUDP udp;
+static IPAddress gateway_ip;
+static uint16_t gateway_port = 0;
+static unsigned long published = 0;
+static unsigned long failed = 0;
+
+void ICACHE_FLASH_ATTR mqttsnBegin(IPAddress gateway, uint16_t port){
+  gateway_ip = gateway;
+  gateway_port = port;
+}
+
+/**
+ * @brief Send one update to the gateway as a QoS -1 PUBLISH. Returns as soon as the datagram is queued; there is no
+ * acknowledgement to wait for.
+ *
+ * @param topic_id Topic id predefined at the gateway
+ * @param payload Message data (not necessarily terminated)
+ * @param length Bytes of payload, at most MQTTSN_PAYLOAD_MAX
+ * @return true if the datagram was handed to the network stack
+ */
+bool ICACHE_FLASH_ATTR mqttsnPublish(uint16_t topic_id, const char* payload, size_t length){
+  if(gateway_port == 0 || length > MQTTSN_PAYLOAD_MAX || !udp.beginPacket(gateway_ip, gateway_port)){
+    failed++;
+    return false;
+  }
+  size_t total = mqttsnPacketLength(length);
+  uint8_t header[9];
+  size_t n = 0;
+  if(total <= 255){
+    header[n++] = total;
+  }
+  else {
+    header[n++] = 0x01;
+    header[n++] = total >> 8;
+    header[n++] = total & 0xFF;
+  }
+  header[n++] = MQTTSN_PUBLISH;
+  header[n++] = MQTTSN_FLAG_QOS_M1 | MQTTSN_FLAG_TOPIC_PREDEFINED;
+  header[n++] = topic_id >> 8;
+  header[n++] = topic_id & 0xFF;
+  header[n++] = 0; // message id, only used from QoS 1 up
+  header[n++] = 0;
+  udp.write(header, n);
+  udp.write((const uint8_t*)payload, length);
+  if(udp.endPacket() != 1){
+    failed++;
+    return false;
+  }
+  published++;
+  return true;
+}
+
+unsigned long ICACHE_FLASH_ATTR mqttsnPublished(){
+  return published;
+}
+
+unsigned long ICACHE_FLASH_ATTR mqttsnFailed(){
+  return failed;
+}
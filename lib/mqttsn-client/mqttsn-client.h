@@ -0,0 +1,29 @@
+#ifndef MQTTSN_CLIENT_H
+#define MQTTSN_CLIENT_H
+
+#include <ESP8266WiFi.h>
+
+/*
+  Minimal MQTT-SN 1.2 publisher over UDP, for the QoS 0 updates that do not need the broker's TCP connection.
+  It only sends PUBLISH with QoS -1 and a predefined topic id: no CONNECT, no REGISTER, no acknowledgement. Each update
+  is a single datagram to the gateway, which publishes it to the broker under the topic it has configured for the id
+  (see tools/mqttsn-gateway.py for a host-side stand-in). Nothing is retransmitted and nothing waits on the link, so a
+  lossy link costs the lost update and nothing else; with QoS 0 that was all it ever promised, and the next snapshot
+  replaces it. Over TCP the same loss stalls every later byte until the segment is retransmitted.
+
+    length (1 byte, or 0x01 + 2 bytes beyond 255) | PUBLISH 0x0C | flags | topic id (2) | msg id (2, 0) | data
+*/
+
+#define MQTTSN_PAYLOAD_MAX 1400  // keeps a datagram within one frame; IP fragments would multiply the loss
+
+// Length of the PUBLISH datagram for a payload (without the UDP/IP headers)
+constexpr size_t mqttsnPacketLength(size_t payload_length){
+  return payload_length + 7 <= 255 ? payload_length + 7 : payload_length + 9;
+}
+
+void mqttsnBegin(IPAddress gateway, uint16_t port);
+bool mqttsnPublish(uint16_t topic_id, const char* payload, size_t length); // false if the datagram could not be handed to the network stack
+unsigned long mqttsnPublished();                                            // datagrams sent since boot
+unsigned long mqttsnFailed();                                               // ... and not sent (no buffer, no network, too long)
+
+#endif
@@ -0,0 +1,71 @@
+#include <Arduino.h>
+#include "phase-arena.h"
+
+static char* block = nullptr;       // arena of the current phase; nullptr outside a phase
+static size_t block_size = 0;
+static size_t top = 0;              // offset of the first free byte
+static size_t peak = 0;
+static unsigned long overflows = 0;
+
+bool ICACHE_FLASH_ATTR phaseArenaBegin(size_t size){
+  if(block != nullptr){
+    return true;
+  }
+  block = static_cast<char*>(malloc(size));
+  block_size = block != nullptr ? size : 0;
+  top = 0;
+  peak = 0;
+  overflows = 0;
+  return block != nullptr;
+}
+
+void ICACHE_FLASH_ATTR phaseArenaEnd(){
+  free(block);
+  block = nullptr;
+  block_size = 0;
+  top = 0;
+}
+
+size_t ICACHE_FLASH_ATTR phaseArenaMark(){
+  return top;
+}
+
+void ICACHE_FLASH_ATTR phaseArenaRewind(size_t mark){
+  if(mark < top){
+    top = mark;
+  }
+}
+
+size_t ICACHE_FLASH_ATTR phaseArenaPeak(){
+  return peak;
+}
+
+unsigned long ICACHE_FLASH_ATTR phaseArenaOverflows(){
+  return overflows;
+}
+
+void* ICACHE_FLASH_ATTR phaseArenaAllocate(size_t bytes, size_t align){
+  if(block != nullptr){
+    size_t start = (top + align - 1) & ~(align - 1);
+    if(start + bytes <= block_size){
+      top = start + bytes;
+      if(top > peak){
+        peak = top;
+      }
+      return block + start;
+    }
+    overflows++;
+  }
+  return ::operator new(bytes);
+}
+
+void ICACHE_FLASH_ATTR phaseArenaDeallocate(void* p, size_t bytes){
+  char* c = static_cast<char*>(p);
+  if(block != nullptr && c >= block && c < block + block_size){
+    if(c + bytes == block + top){
+      top = c - block; // most recent allocation; anything else waits for a rewind or the end of the phase
+    }
+    return;
+  }
+  ::operator delete(p);
+}
@@ -0,0 +1,58 @@
+#ifndef PHASE_ARENA_H
+#define PHASE_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+  Bump allocator for a phase of the program whose allocations all die together (ie. discovery at startup).
+  Everything built during the phase (metadata lists, topics, payloads) is carved out of a single block taken from the
+  heap when the phase begins, and the block is handed back in one piece when it ends. The general heap sees one
+  allocation and one free instead of hundreds of small ones released in scattered order, so it is not fragmented
+  before the device even starts measuring.
+  - freeing only reclaims the most recent allocation (enough for a string or vector that grows and is then dropped);
+    phaseArenaMark()/phaseArenaRewind() reclaim everything allocated after the mark (ie. per discovery message)
+  - when there is no active phase, or the block is full, allocations fall back to the general heap, so containers
+    using phase_allocator are always safe to use; phaseArenaOverflows() tells whether PHASE_ARENA_SIZE is too small
+  - every phase_string/phase_vector with arena memory must be destroyed (or swapped out empty) before phaseArenaEnd()
+*/
+
+#define PHASE_ARENA_SIZE 12288  // bytes; the whole discovery phase (~7KB of metadata lists plus ~4KB for the message being built)
+
+bool phaseArenaBegin(size_t size = PHASE_ARENA_SIZE);  // take the block from the heap; false if not available
+void phaseArenaEnd();                                   // hand the block back to the heap
+size_t phaseArenaMark();                                // current fill level
+void phaseArenaRewind(size_t mark);                     // release everything allocated since the mark
+size_t phaseArenaPeak();                                // highest fill level of the last phase
+unsigned long phaseArenaOverflows();                    // allocations of the last phase that went to the heap instead
+
+void* phaseArenaAllocate(size_t bytes, size_t align);
+void phaseArenaDeallocate(void* p, size_t bytes);
+
+// std allocator adapter, so standard containers can be backed by the arena
+template <class T>
+struct phase_allocator{
+  typedef T value_type;
+
+  phase_allocator() noexcept {}
+  template <class U> phase_allocator(const phase_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n){
+    return static_cast<T*>(phaseArenaAllocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* p, size_t n) noexcept {
+    phaseArenaDeallocate(p, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const phase_allocator<T>&, const phase_allocator<U>&) noexcept { return true; }
+template <class T, class U>
+bool operator!=(const phase_allocator<T>&, const phase_allocator<U>&) noexcept { return false; }
+
+typedef std::basic_string<char, std::char_traits<char>, phase_allocator<char>> phase_string;
+template <class T> using phase_vector = std::vector<T, phase_allocator<T>>;
+
+#endif
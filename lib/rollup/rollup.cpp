@@ -0,0 +1,79 @@
+#include <algorithm>
+#include "rollup.h"
+
+static const unsigned long ROLLUP_PERIODS[ROLLUP_TIERS] = { 60000UL, 3600000UL, 86400000UL };
+
+static void ICACHE_FLASH_ATTR clearStats(rollup_stats &s){
+  s.pulses = 0;
+  s.cpm_min = 0;
+  s.cpm_max = 0;
+  s.samples = 0;
+}
+
+static void ICACHE_FLASH_ATTR addSample(rollup_stats &s, float cpm_min, float cpm_max, uint32_t samples){
+  if(samples == 0){
+    return;
+  }
+  s.cpm_min = s.samples == 0 ? cpm_min : std::min(s.cpm_min, cpm_min);
+  s.cpm_max = s.samples == 0 ? cpm_max : std::max(s.cpm_max, cpm_max);
+  s.samples += samples;
+}
+
+void ICACHE_FLASH_ATTR rollupBegin(rollup &r, unsigned long now, uint32_t pulse_total){
+  for (uint8_t i = 0; i < ROLLUP_TIERS; i++)
+  {
+    r.tiers[i].period = ROLLUP_PERIODS[i];
+    r.tiers[i].started = now;
+    clearStats(r.tiers[i].open);
+    clearStats(r.tiers[i].closed);
+    r.tiers[i].pending = false;
+  }
+  r.pulse_total = pulse_total;
+  r.last_sample = now;
+}
+
+/**
+ * @brief Fold new pulses into the minute window, sample the CPM when due and close (and cascade) any window
+ * whose period has passed. If loop() was held up past a boundary, the late pulses count towards the closing
+ * window and the next one starts on the boundary, so windows do not drift.
+ */
+void ICACHE_FLASH_ATTR rollupLoop(rollup &r, unsigned long now, uint32_t pulse_total, float cpm){
+  r.tiers[ROLLUP_MINUTE].open.pulses += pulse_total - r.pulse_total;
+  r.pulse_total = pulse_total;
+
+  if(now - r.last_sample >= ROLLUP_SAMPLE_PERIOD){
+    r.last_sample = now;
+    addSample(r.tiers[ROLLUP_MINUTE].open, cpm, cpm, 1);
+  }
+
+  for (uint8_t i = 0; i < ROLLUP_TIERS; i++)
+  {
+    rollup_window &w = r.tiers[i];
+    if(now - w.started < w.period){
+      break; // a longer window cannot close before a shorter one
+    }
+    w.closed = w.open;
+    w.pending = true;
+    clearStats(w.open);
+    w.started += w.period * ((now - w.started) / w.period);
+
+    if(i + 1 < ROLLUP_TIERS){
+      rollup_stats &up = r.tiers[i + 1].open;
+      up.pulses += w.closed.pulses;
+      addSample(up, w.closed.cpm_min, w.closed.cpm_max, w.closed.samples);
+    }
+  }
+}
+
+// The minute window ends first; longer windows only close along with it
+unsigned long ICACHE_FLASH_ATTR rollupDueIn(const rollup &r, unsigned long now){
+  unsigned long sampled = now - r.last_sample;
+  unsigned long open = now - r.tiers[ROLLUP_MINUTE].started;
+  unsigned long sample_due = sampled >= ROLLUP_SAMPLE_PERIOD ? 0 : ROLLUP_SAMPLE_PERIOD - sampled;
+  unsigned long window_due = open >= r.tiers[ROLLUP_MINUTE].period ? 0 : r.tiers[ROLLUP_MINUTE].period - open;
+  return std::min(sample_due, window_due);
+}
+
+float ICACHE_FLASH_ATTR rollupMeanCpm(const rollup_window &w){
+  return w.closed.pulses * 60000.0f / w.period;
+}
@@ -0,0 +1,46 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <Arduino.h>
+
+/*
+  Fixed memory minute/hour/day rollups of the pulse stream.
+  Each tier keeps one open window and the last completed one. The minute window is fed directly: the exact pulse
+  count, plus the instantaneous CPM sampled every ROLLUP_SAMPLE_PERIOD for its min/max. When a window completes it
+  cascades into the next tier (pulses add up, min of the minimums, max of the maximums), so an hour never has to
+  look at more than 60 minutes and a day at more than 24 hours.
+  The mean CPM and the integrated dose come from the pulse count, so they are exact rather than an average of averages.
+  Windows are aligned to boot time; the caller dates a completed window by its end (the start of the open one).
+*/
+
+#define ROLLUP_SAMPLE_PERIOD 1000   // milliseconds between instantaneous CPM samples
+
+enum rollup_tier { ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_DAY, ROLLUP_TIERS };
+
+struct rollup_stats{
+  uint32_t pulses;                  // pulses within the window
+  float cpm_min;                    // lowest CPM sample
+  float cpm_max;                    // highest CPM sample
+  uint32_t samples;                 // CPM samples folded into min/max
+};
+
+struct rollup_window{
+  unsigned long period;             // milliseconds
+  unsigned long started;            // millis() at the start of the open window
+  rollup_stats open;                // window being accumulated
+  rollup_stats closed;              // last completed window
+  bool pending;                     // closed holds a window that has not been published yet
+};
+
+struct rollup{
+  rollup_window tiers[ROLLUP_TIERS];
+  uint32_t pulse_total;             // pulse count at the last update
+  unsigned long last_sample;        // millis() of the last CPM sample
+};
+
+void rollupBegin(rollup &r, unsigned long now, uint32_t pulse_total);
+void rollupLoop(rollup &r, unsigned long now, uint32_t pulse_total, float cpm); // cheap; call every loop()
+unsigned long rollupDueIn(const rollup &r, unsigned long now); // milliseconds until the next CPM sample or window end
+float rollupMeanCpm(const rollup_window &w);  // mean CPM of the last completed window
+
+#endif
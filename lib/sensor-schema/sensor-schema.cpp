@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include <cmath>
+#include "sensor-schema.h"
+#include "utils.h"
+
+// "key": value; a value that is not available, or formats wider than its declared width, is written as null so the
+// payload never outgrows schemaPayloadMaxLength()
+static void ICACHE_FLASH_ATTR appendField(std::string &payload, const sensor_field &f){
+  double value = f.read();
+  char buf[SCHEMA_WIDTH_MAX + 1];
+  int length = std::isnan(value) ? -1 : snprintf(buf, sizeof(buf), f.format, value);
+  payload += '"';
+  payload += f.key;
+  payload += "\": ";
+  if(length < 0 || (unsigned int)length > f.width){
+    payload += "null";
+  }
+  else {
+    payload.append(buf, length);
+  }
+}
+
+/**
+ * @brief Serialize the current value of every field; nested fields go into "<parent>_details".
+ * Built in a single allocation of the worst case length.
+ */
+std::string ICACHE_FLASH_ATTR buildSchemaPayload(const sensor_field* fields, size_t count){
+  std::string payload;
+  payload.reserve(schemaPayloadMaxLength(fields, count));
+  payload += '{';
+  bool first = true;
+  for (size_t i = 0; i < count; i++)
+  {
+    if(fields[i].parent != nullptr){
+      continue;
+    }
+    if(!first){
+      payload += ", ";
+    }
+    appendField(payload, fields[i]);
+    first = false;
+    if(!schemaHasChildren(fields, count, i)){
+      continue;
+    }
+    payload += ", \"";
+    payload += fields[i].key;
+    payload += "_details\": {";
+    bool first_child = true;
+    for (size_t j = 0; j < count; j++)
+    {
+      if(fields[j].parent != nullptr && schemaStrEqual(fields[j].parent, fields[i].key)){
+        if(!first_child){
+          payload += ", ";
+        }
+        appendField(payload, fields[j]);
+        first_child = false;
+      }
+    }
+    payload += '}';
+  }
+  payload += '}';
+  return payload;
+}
+
+/**
+ * @brief Discovery metadata for every field declared as an entity, with the value path matching buildSchemaPayload().
+ */
+phase_vector<discovery_metadata> ICACHE_FLASH_ATTR getSchemaDiscoveryMetadata(const sensor_field* fields, size_t count, size_t reserve_extra){
+  phase_vector<discovery_metadata> dm;
+  dm.reserve(count + reserve_extra); // grown in place, a bump allocator cannot reuse the storage a reallocation leaves behind
+  for (size_t i = 0; i < count; i++)
+  {
+    const sensor_field &f = fields[i];
+    if(!f.entity){
+      continue;
+    }
+    discovery_metadata m;
+    m.device_type = "sensor";
+    m.device_class = f.device_class;
+    m.json_attr = f.key;
+    m.value_path = f.parent == nullptr ? phase_string(f.key) : phase_string(f.parent)+"_details."+f.key;
+    m.state_class = f.state_class;
+    m.has_sub_attr = f.parent == nullptr && schemaHasChildren(fields, count, i);
+    m.icon = f.icon;
+    m.unit = f.unit;
+    dm.push_back(m);
+  }
+  return dm;
+}
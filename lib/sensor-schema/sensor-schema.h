@@ -0,0 +1,136 @@
+#ifndef SENSOR_SCHEMA_H
+#define SENSOR_SCHEMA_H
+
+#include <string>
+#include <vector>
+#include <mqtt-ha-helper.h>
+
+/*
+  Compile-time description of the sensor state payload. One constexpr array of sensor_field drives both
+  - the state serializer (buildSchemaPayload), and
+  - the discovery entities and their value templates (getSchemaDiscoveryMetadata)
+  so a key can not be renamed in one and forgotten in the other.
+
+  A field either sits at the top level of the payload or under a top level field, in which case it is written to
+  "<parent>_details" (the has_sub_attr convention of buildDiscoveryPayload()) and read with the value path
+  "<parent>_details.<key>":
+
+    {"frequency": 0.0461, "frequency_details": {"dose": 0.04, "cpm": 2.30}, "dose_total": 12.3456}
+
+  A value that is not available (ie. a timestamp before the clock was set) is read as NAN and written as null, so
+  the width of a field must leave room for it. A value that formats wider than its declared width is written as null
+  too, so the payload never outgrows schemaPayloadMaxLength().
+  The array is walked with plain loops over constant data; there is no runtime type information involved.
+  validSchema() checks the declaration at compile time (use it in a static_assert), and schemaPayloadMaxLength()
+  gives the worst case payload length from the declared value widths; schemaMaxLength() and schemaValuePathMaxLength()
+  feed the discovery payload bounds (see discovery_bounds).
+*/
+
+#define SCHEMA_WIDTH_MAX 31 // widest value a field may declare; formatted into a fixed buffer
+
+struct sensor_field{
+  const char* key;                // json key, also the sensor id of its discovery entity
+  const char* parent;             // key of the top level field this one is nested under; nullptr for top level
+  const char* format;             // printf format of the value
+  unsigned int width;             // maximum formatted length of the value (characters)
+  double (*read)();               // current value
+  bool entity;                    // announced as a discovery entity of its own
+  const char* device_class;       // https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes ; may be empty
+  const char* state_class;        // measurement | total | total_increasing
+  const char* icon;               // https://materialdesignicons.com/
+  const char* unit;
+};
+
+constexpr bool schemaStrEqual(const char* a, const char* b){
+  while(*a != '\0' && *a == *b){
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+constexpr size_t schemaStrLength(const char* s){
+  size_t n = 0;
+  while(s[n] != '\0'){
+    n++;
+  }
+  return n;
+}
+
+constexpr bool schemaHasChildren(const sensor_field* fields, size_t count, size_t index){
+  for (size_t i = 0; i < count; i++)
+  {
+    if(fields[i].parent != nullptr && schemaStrEqual(fields[i].parent, fields[index].key)){
+      return true;
+    }
+  }
+  return false;
+}
+
+// Every key unique, every parent a declared top level field, every field readable and formatted, with room for null
+// and no wider than SCHEMA_WIDTH_MAX
+constexpr bool validSchema(const sensor_field* fields, size_t count){
+  for (size_t i = 0; i < count; i++)
+  {
+    if(fields[i].key == nullptr || fields[i].format == nullptr || fields[i].read == nullptr || fields[i].width < 4 || fields[i].width > SCHEMA_WIDTH_MAX){
+      return false;
+    }
+    for (size_t j = i + 1; j < count; j++)
+    {
+      if(schemaStrEqual(fields[i].key, fields[j].key)){
+        return false;
+      }
+    }
+    if(fields[i].parent != nullptr){
+      bool found = false;
+      for (size_t j = 0; j < count; j++)
+      {
+        found = found || (fields[j].parent == nullptr && schemaStrEqual(fields[j].key, fields[i].parent));
+      }
+      if(!found){
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Worst case length of the payload built by buildSchemaPayload()
+constexpr size_t schemaPayloadMaxLength(const sensor_field* fields, size_t count){
+  size_t length = 2; // {}
+  for (size_t i = 0; i < count; i++)
+  {
+    length += 2 + schemaStrLength(fields[i].key) + 2 + fields[i].width + 2; // "key": value,<space>
+    if(fields[i].parent == nullptr && schemaHasChildren(fields, count, i)){
+      length += 2 + schemaStrLength(fields[i].key) + 8 + 2 + 3 + 2; // "key_details": { ... },<space>
+    }
+  }
+  return length;
+}
+
+// Longest value of one of the string members over all fields, ie. schemaMaxLength(fields, count, &sensor_field::icon)
+constexpr size_t schemaMaxLength(const sensor_field* fields, size_t count, const char* sensor_field::*member){
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    const char* s = fields[i].*member;
+    length = s != nullptr && schemaStrLength(s) > length ? schemaStrLength(s) : length;
+  }
+  return length;
+}
+
+// Longest value path of the discovery entities, see getSchemaDiscoveryMetadata()
+constexpr size_t schemaValuePathMaxLength(const sensor_field* fields, size_t count){
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t path = schemaStrLength(fields[i].key) + (fields[i].parent == nullptr ? 0 : schemaStrLength(fields[i].parent) + 9); // <parent>_details.<key>
+    length = path > length ? path : length;
+  }
+  return length;
+}
+
+std::string buildSchemaPayload(const sensor_field* fields, size_t count);
+phase_vector<discovery_metadata> getSchemaDiscoveryMetadata(const sensor_field* fields, size_t count, size_t reserve_extra = 0); // reserve_extra: room for entries the caller appends
+
+#endif
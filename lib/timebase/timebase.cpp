@@ -0,0 +1,80 @@
+#include <time.h>
+#include <sys/time.h>
+#include <coredecls.h> // settimeofday_cb()
+#include "timebase.h"
+
+void ICACHE_FLASH_ATTR timebaseReset(timebase &tb){
+  tb.anchor_epoch_us = 0;
+  tb.anchor_mono_us = 0;
+  tb.drift_ppb = 0;
+  tb.offset_us = 0;
+  tb.syncs = 0;
+}
+
+bool ICACHE_FLASH_ATTR timebaseSynced(const timebase &tb){
+  return tb.syncs > 0;
+}
+
+uint64_t ICACHE_FLASH_ATTR timebaseEpochMicros(const timebase &tb, uint64_t mono_us){
+  if(tb.syncs == 0){
+    return 0;
+  }
+  int64_t elapsed = (int64_t)(mono_us - tb.anchor_mono_us); // negative for a time captured before the last sync
+  return tb.anchor_epoch_us + elapsed + elapsed * tb.drift_ppb / 1000000000LL;
+}
+
+double ICACHE_FLASH_ATTR timebaseEpochSeconds(const timebase &tb, uint64_t mono_us){
+  return tb.syncs == 0 ? NAN : timebaseEpochMicros(tb, mono_us) / 1000000.0;
+}
+
+/**
+ * @brief Apply a reference time from the server: update the drift estimate from how far the extrapolation was off,
+ * then re-anchor on the reference.
+ *
+ * @param epoch_us Server time, microseconds since 1970
+ * @param mono_us Local time (micros64()) at which epoch_us was current
+ */
+void ICACHE_FLASH_ATTR timebaseSync(timebase &tb, uint64_t epoch_us, uint64_t mono_us){
+  if(tb.syncs > 0){
+    int64_t offset = (int64_t)(timebaseEpochMicros(tb, mono_us) - epoch_us); // positive when the local clock ran fast
+    int64_t interval = (int64_t)(mono_us - tb.anchor_mono_us);
+    tb.offset_us = offset > INT32_MAX ? INT32_MAX : (offset < INT32_MIN ? INT32_MIN : (int32_t)offset);
+    bool step = (offset < 0 ? -offset : offset) > interval / 1000000 * TIMEBASE_DRIFT_MAX_PPM;
+    if(interval >= (int64_t)TIMEBASE_DRIFT_MIN_INTERVAL && !step){
+      int64_t drift = tb.drift_ppb - offset * 1000000000LL / interval / TIMEBASE_DRIFT_GAIN;
+      const int64_t limit = TIMEBASE_DRIFT_MAX_PPM * 1000LL;
+      tb.drift_ppb = drift > limit ? limit : (drift < -limit ? -limit : drift);
+    }
+  }
+  tb.anchor_epoch_us = epoch_us;
+  tb.anchor_mono_us = mono_us;
+  tb.syncs++;
+}
+
+static timebase *sntp_timebase = nullptr;
+
+// Called by the core whenever the system time was set, ie. on every SNTP reply
+static void ICACHE_FLASH_ATTR timeSet(){
+  timeval tv;
+  gettimeofday(&tv, nullptr);
+  uint64_t mono = micros64(); // read together; the core's system time has run on the local clock since it was set
+  if(sntp_timebase != nullptr && tv.tv_sec > 0){
+    timebaseSync(*sntp_timebase, (uint64_t)tv.tv_sec * 1000000ULL + tv.tv_usec, mono);
+  }
+}
+
+void ICACHE_FLASH_ATTR timebaseBegin(timebase &tb, const char* server){
+  timebaseReset(tb);
+  sntp_timebase = &tb;
+  settimeofday_cb(timeSet);
+  configTime(0, 0, server); // UTC; the core's SNTP client polls the server about once an hour
+}
+
+uint64_t ICACHE_FLASH_ATTR timebaseMonoMicros(unsigned long micros_at){
+  uint64_t now = micros64(); // same counter as micros(), extended to 64 bits
+  return now - (uint32_t)((uint32_t)now - (uint32_t)micros_at);
+}
+
+uint64_t ICACHE_FLASH_ATTR timebaseNow(const timebase &tb){
+  return timebaseEpochMicros(tb, micros64());
+}
@@ -0,0 +1,47 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <Arduino.h>
+
+/*
+  Wall-clock timebase, so a reading can carry the time it was taken rather than being dated by its arrival at the broker.
+  Local time comes from micros64() (microseconds since boot; the core extends the 32 bit counter, so it does not wrap).
+  Each SNTP reply anchors it to the epoch. Between replies the epoch is extrapolated from the last anchor, corrected
+  for the drift of the local oscillator against the server:
+    - at every sync the extrapolation is compared with the server time; the difference (offset) divided by the time
+      since the previous sync is the rate error still left, which nudges the drift estimate by 1/TIMEBASE_DRIFT_GAIN
+    - syncs closer together than TIMEBASE_DRIFT_MIN_INTERVAL only re-anchor (network jitter would swamp the rate),
+      and an offset implying more than TIMEBASE_DRIFT_MAX_PPM is taken as a step of the server clock, not as drift
+  A crystal is typically off by 10-50 ppm, ie. up to 180ms an hour; corrected, the error between hourly syncs stays
+  at the level of the network jitter.
+
+  Times in the past (ie. a pulse captured by micros() in the interrupt handler) convert the same way, as long as
+  they are given on the micros64() scale; see timebaseMonoMicros().
+  The core part (sync, conversion) is plain arithmetic on the values passed in; only timebaseBegin() and
+  timebaseNow() touch the hardware and SNTP.
+*/
+
+#define TIMEBASE_DRIFT_MIN_INTERVAL 900000000ULL  // microseconds; 15 minutes between syncs before their offset counts as drift
+#define TIMEBASE_DRIFT_MAX_PPM 500                // larger rate errors are clock steps
+#define TIMEBASE_DRIFT_GAIN 2                     // share (1/n) of the measured rate error applied per sync
+
+struct timebase{
+  uint64_t anchor_epoch_us;         // epoch (microseconds since 1970) of the last sync
+  uint64_t anchor_mono_us;          // local time (micros64()) of the last sync
+  int32_t drift_ppb;                // local clock rate error, parts per billion; positive when the local clock runs slow
+  int32_t offset_us;                // extrapolated minus server time at the last sync (the error before correcting)
+  uint32_t syncs;                   // server replies applied; 0 = the epoch is unknown
+};
+
+void timebaseReset(timebase &tb);
+void timebaseSync(timebase &tb, uint64_t epoch_us, uint64_t mono_us); // server time epoch_us was current at local time mono_us
+bool timebaseSynced(const timebase &tb);
+uint64_t timebaseEpochMicros(const timebase &tb, uint64_t mono_us);  // epoch of a local time; 0 before the first sync
+double timebaseEpochSeconds(const timebase &tb, uint64_t mono_us);   // same in seconds; NAN before the first sync
+
+// *** ESP8266 ***
+void timebaseBegin(timebase &tb, const char* server); // start the core's SNTP client; every reply is passed to timebaseSync()
+uint64_t timebaseMonoMicros(unsigned long micros_at); // micros() captured up to ~71 minutes ago, on the micros64() scale
+uint64_t timebaseNow(const timebase &tb);             // epoch microseconds now; 0 before the first sync
+
+#endif
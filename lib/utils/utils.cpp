@@ -4,10 +4,6 @@
     Intent is to be able to copy this unchanged to similar new projects.
 */
 #include <cstdio>
-#include <cassert>
-#include <sstream>
-#include <iostream>
-#include <iomanip>
 #include "utils.h"
 
 
@@ -127,59 +123,96 @@ char *dtostrf (double val, signed char width, unsigned char prec, char *sout) {
 }  
 */
 
-// https://stackoverflow.com/questions/4668760/converting-an-int-to-stdstring
+/**
+ * @brief Write the decimal digits of a value (no terminator).
+ * Used instead of iostreams, which would pull the whole locale and stream machinery (and its static initializers) into flash.
+ *
+ * @param out Buffer with room for at least 10 characters
+ * @return char* One past the last digit written
+ */
+char* putDecimal(char* out, uint32_t value){
+  char digits[10];
+  size_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (n > 0) {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+/**
+ * @brief Write a byte as two lowercase hex digits (no terminator).
+ *
+ * @return char* One past the last digit written
+ */
+char* putHex(char* out, uint8_t value){
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  *out++ = HEX_DIGITS[value >> 4];
+  *out++ = HEX_DIGITS[value & 0x0f];
+  return out;
+}
+
 std::string to_string( int x ) {
-  int length = snprintf( NULL, 0, "%d", x );
-  assert( length >= 0 );
-  char* buf = new char[length + 1];
-  snprintf( buf, length + 1, "%d", x );
-  std::string str( buf );
-  delete[] buf;
-  return str;
+  char buf[11]; // "-2147483648"
+  char* end = buf;
+  if (x < 0) {
+    *end++ = '-';
+    end = putDecimal(end, 0u - (uint32_t)x);
+  }
+  else {
+    end = putDecimal(end, (uint32_t)x);
+  }
+  return std::string(buf, end - buf);
 }
 
 /**
- * @brief Convert a float to a std::string
+ * @brief Convert a float (or double) to a std::string
+ * Takes a double so that values like epoch timestamps keep their precision; a float is promoted exactly, as printf would.
  * 
  * @param x float to be formatted and converted to std::string
  * @param format Should be related to float like "%4.2f" or "%3.1g"
  * @return std::string 
  */
-std::string to_string( float x, const char* format) {
-  int length = snprintf( NULL, 0, format, x );
-  assert( length >= 0 );
-  char* buf = new char[length + 1];
-  snprintf( buf, length + 1, format, x );
-  std::string str( buf );
-  delete[] buf;
+std::string to_string( double x, const char* format) {
+  char buf[32]; // plenty for any sensible format; formatted a second time straight into the string otherwise
+  int length = snprintf( buf, sizeof(buf), format, x );
+  if (length < 0) {
+    return std::string();
+  }
+  if ((size_t)length < sizeof(buf)) {
+    return std::string(buf, length);
+  }
+  std::string str(length, '\0');
+  snprintf( &str[0], length + 1, format, x );
   return str;
 }
 
-// https://gist.github.com/miguelmota/4fc9b46cf21111af5fa613555c14de92
+// "5c:cf:7f:ae:de:0a"
 std::string uint8_to_hex_string(const uint8_t *v, const size_t s) {
-  std::stringstream ss;
-
-  ss << std::hex << std::setfill('0');
-
-  for (unsigned int i = 0; i < s; i++) {
-    if(i>0){ ss << ":"; }    
-    ss << std::hex << std::setw(2) << static_cast<int>(v[i]);
+  std::string str;
+  str.reserve(s * 3);
+  for (size_t i = 0; i < s; i++) {
+    char hex[2];
+    if (i > 0) { str += ':'; }
+    putHex(hex, v[i]);
+    str.append(hex, 2);
   }
-
-  return ss.str();
+  return str;
 }
 
+// Least significant byte first (lwIP's ip_addr_t), "10.0.0.2"
 std::string uint32_to_ip(uint32_t ip_as_int)
 {
-    std::stringstream ss;    
-    ss << (ip_as_int & 0xff);
-    ss << ".";
-    ss << ((ip_as_int >> 8) & 0xff);    
-    ss << ".";
-    ss << ((ip_as_int >> 16) & 0xff);
-    ss << ".";
-    ss << (ip_as_int >> 24);
-    return ss.str();
+  char buf[15]; // "255.255.255.255"
+  char* end = buf;
+  for (uint8_t i = 0; i < 4; i++) {
+    if (i > 0) { *end++ = '.'; }
+    end = putDecimal(end, (ip_as_int >> (8 * i)) & 0xff);
+  }
+  return std::string(buf, end - buf);
 }
 
 /**
@@ -190,6 +223,62 @@ bool sufficientChange(uint16_t test, uint16_t last, float percent_threshold){
 }
 
 
+/**
+ * @brief FNV-1a hash; used to derive a per-device seed (ie. from the MAC address)
+ */
+uint32_t hash32(const uint8_t *data, size_t length){
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/**
+ * @brief Capped exponential backoff with jitter ("equal jitter"): the delay doubles with every attempt up to cap,
+ * and a random half of it is added so that many devices failing at the same moment (ie. after a broker restart) 
+ * spread their retries out instead of reconnecting in lock step.
+ * 
+ * @param attempt Number of consecutive failed attempts so far (0 for the first retry)
+ * @param base Delay for the first retry; the result is between base/2 and base
+ * @param cap Upper bound of the delay
+ * @param rng_state Per-device random state (xorshift32); seed with something unique to the device, never 0
+ * @return unsigned long Milliseconds to wait before the next attempt
+ */
+unsigned long backoffDelay(unsigned int attempt, unsigned long base, unsigned long cap, uint32_t &rng_state){
+  unsigned long ceiling = base;
+  for (unsigned int i = 0; i < attempt && ceiling < cap; i++)
+  {
+    ceiling = ceiling * 2;
+  }
+  if(ceiling > cap){
+    ceiling = cap;
+  }
+
+  unsigned long half = ceiling / 2;
+  return half + jitterDelay(ceiling - half, rng_state);
+}
+
+/**
+ * @brief Uniformly random delay ("full jitter"), ie. to spread out the first attempt of many devices that lost their
+ * connection at the same moment.
+ *
+ * @param range Upper bound of the delay
+ * @param rng_state Per-device random state (xorshift32), as for backoffDelay()
+ * @return unsigned long Milliseconds, from 0 to range
+ */
+unsigned long jitterDelay(unsigned long range, uint32_t &rng_state){
+  // xorshift32
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+
+  return rng_state % (range + 1);
+}
+
+
 #ifdef __arm__
 // should use uinstd.h to define sbrk but Due causes a conflict
 extern "C" char* sbrk(int incr);
@@ -18,14 +18,47 @@
 //void replaceStringInline(std::string& subject, const std::string& search, const std::string& replace);
 //std::string map2json(std::map<std::string,std::string> kvp);
 //void replace_value_at_key(std::map<std::string,std::string> m, std::string k, std::string v);
-std::string to_string( float x, const char* format );
+std::string to_string( double x, const char* format );
 std::string to_string( int x );
 //char *dtostrf (double val, signed char width, unsigned char prec, char *sout);
+char* putDecimal(char* out, uint32_t value);     // decimal digits into a fixed buffer, returns the end (no terminator)
+char* putHex(char* out, uint8_t value);          // two hex digits
 std::string uint8_to_hex_string(const uint8_t *v, const size_t s);
 std::string uint32_to_ip(uint32_t ip_as_int);
 
 bool sufficientChange(uint16_t test, uint16_t last, float percent_threshold);
 
+// Compile-time length of a string and maximum of lengths, for sizing buffers from constant declarations
+constexpr size_t constStrLength(const char* s){
+  size_t n = 0;
+  while(s[n] != '\0'){
+    n++;
+  }
+  return n;
+}
+
+constexpr size_t constMax(size_t a){
+  return a;
+}
+
+template <class... Rest>
+constexpr size_t constMax(size_t a, size_t b, Rest... rest){
+  return constMax(a > b ? a : b, rest...);
+}
+
+constexpr size_t constStrMaxLength(const char* const* strings, size_t count){
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    length = constMax(length, constStrLength(strings[i]));
+  }
+  return length;
+}
+
+uint32_t hash32(const uint8_t *data, size_t length);
+unsigned long backoffDelay(unsigned int attempt, unsigned long base, unsigned long cap, uint32_t &rng_state);
+unsigned long jitterDelay(unsigned long range, uint32_t &rng_state);
+
 int freeMemory();
 
 #endif
\ No newline at end of file
@@ -1,7 +1,14 @@
 //#include <Arduino.h>
 #include "wifi-helper.h"
+#include "utils.h"
 
-#define WIFI_ATTEMPT_COOLDOWN 30000 // milliseconds between connection attempts
+#define WIFI_ATTEMPT_COOLDOWN 30000 // milliseconds before the first retry; doubles with each failed attempt (with jitter)
+#define WIFI_ATTEMPT_COOLDOWN_MAX 300000 // upper bound of the time between connection attempts
+
+// Network state as reported by the SDK's station events (see beginNetworkEvents()), so it does not have to be polled
+static volatile bool network_up = false;
+static WiFiEventHandler got_ip_handler;
+static WiFiEventHandler disconnected_handler;
 
 /*
   Attempt to connect to wireless network ONCE, and wait ATTEMPT_DURATION (milliseconds) for 
@@ -34,6 +41,9 @@ bool ICACHE_FLASH_ATTR connectWifi(const char *ssid, const char *passphrase)
 
   // Set WiFi mode to station (as opposed to AP or AP_STA)
   WiFi.mode(WIFI_STA);
+  // Modem sleep: the radio is powered down between beacons while the CPU idles in delay().
+  // Not light sleep, which also suspends the CPU and would miss the sensor's short pulses.
+  WiFi.setSleepMode(WIFI_MODEM_SLEEP);
   // WiFI.begin([ssid], [passkey]) initiates a WiFI connection
   // to the stated [ssid], using the [passkey] as a WPA, WPA2,
   // or WEP passphrase.    
@@ -62,9 +72,20 @@ bool ICACHE_FLASH_ATTR connectWifi(const char *ssid, const char *passphrase)
   
 }
 
+/*
+  Per-device random state for backoff jitter, seeded from the MAC address so that devices that lost the network
+  at the same moment do not retry in lock step.
+*/
+uint32_t ICACHE_FLASH_ATTR deviceSeed(){
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  uint32_t seed = hash32(mac, sizeof(mac));
+  return seed != 0 ? seed : 1; // xorshift state must never be 0
+}
+
 /*
   Continuously tries to connect to the wireless network.
-  Will wait ATTEMPT_COOLDOWN milliseconds between attempts. 
+  Waits a jittered, exponentially growing cooldown between attempts (WIFI_ATTEMPT_COOLDOWN up to WIFI_ATTEMPT_COOLDOWN_MAX). 
 
   WILL BLOCK IF UNABLE TO CONNECT TO NETWORK!
 
@@ -77,16 +98,36 @@ bool ICACHE_FLASH_ATTR assertNetworkConnectivity(const char *ssid, const char *p
     return false; // already connected, no new connection established
   }
   else {
+    static uint32_t rng_state = deviceSeed();
+    unsigned int attempt = 0;
     do {
       if(!connectWifi(ssid, passphrase)){ // each attempt is allowed ATTEMPT_DURATION to establish a connection
-        delay(WIFI_ATTEMPT_COOLDOWN);
+        delay(backoffDelay(attempt++, WIFI_ATTEMPT_COOLDOWN, WIFI_ATTEMPT_COOLDOWN_MAX, rng_state));
       }    
     } 
     while (WiFi.status() != WL_CONNECTED);
+    network_up = true; // the got IP event may not have been delivered yet
     return true; // new connection established
   }
 }
 
+/*
+  Track the connection through the SDK's station events instead of polling WiFi.status(): call once before the first
+  connection attempt, then check networkUp() (a plain flag read) and only call assertNetworkConnectivity() when it is false.
+*/
+void ICACHE_FLASH_ATTR beginNetworkEvents(){
+  got_ip_handler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP &){
+    network_up = true;
+  });
+  disconnected_handler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected &){
+    network_up = false;
+  });
+}
+
+bool ICACHE_FLASH_ATTR networkUp(){
+  return network_up;
+}
+
 void ICACHE_FLASH_ATTR printNetworkDetails()
 {
   // SSID of the network you're attached to
@@ -136,8 +177,13 @@ void ICACHE_FLASH_ATTR printNetworkDetails()
   Serial.println("");
 }
 
-std::string getMAC(){
-  return std::string(WiFi.macAddress().c_str());
+// The station MAC never changes, so it is only read (and converted from an Arduino String) once
+const std::string& getMAC(){
+  static std::string mac;
+  if(mac.empty()){
+    mac = WiFi.macAddress().c_str();
+  }
+  return mac;
 }
 
 std::string getIP(){
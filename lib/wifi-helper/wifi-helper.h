@@ -11,9 +11,12 @@
 // *** Must Implement ***
 bool connectWifi(const char *ssid, const char *passphrase);
 bool assertNetworkConnectivity(const char *ssid, const char *passphrase);
+void beginNetworkEvents();
+bool networkUp();
 void printNetworkDetails();
-std::string getMAC();
+const std::string& getMAC();
 std::string getIP();
 int getRSSI();
+uint32_t deviceSeed();
 
 #endif
\ No newline at end of file
@@ -1,7 +1,21 @@
 //#include <Arduino.h>  appears to be automatically added by framework specified in platformio.ini
-#include "RadiationWatch.h"
 #include <wifi-helper.h>
 #include <mqtt-ha-helper.h>
+#include <diag-registry.h>
+#include <burst-detector.h>
+#include <fault-client.h>
+#include <link-monitor.h>
+#include <flash-log.h>
+#include <rollup.h>
+#include <interval-histogram.h>
+#include <metrics-server.h>
+#include <event-trace.h>
+#include <sensor-schema.h>
+#include <dual-detector.h>
+#include <phase-arena.h>
+#include <timebase.h>
+#include <mqttsn-client.h>
+#include <coredecls.h> // esp_delay()
 #include "radthing.h"
 #include "env.h"
 #include "utils.h"
@@ -20,42 +34,221 @@ In platformio.ini:
 
 // *** Global Variables ***
 WiFiClient wificlient;
-MQTTClient mqttclient(768); // default is 128 bytes;  https://github.com/256dpi/arduino-mqtt#notes
+// mqttclient is defined further down, below the message formats its buffers are sized from
+#ifdef NETWORK_FAULT_PROFILE
+FaultInjectingClient faultclient(wificlient, NETWORK_FAULT_PROFILE); // broker traffic goes through the degraded link
+LinkMonitorClient linkclient(faultclient); // round trips and reconnects of the broker link, as seen by the MQTT client
+#else
+LinkMonitorClient linkclient(wificlient);
+#endif
+
+// Startup timing (milliseconds since boot), reported as diagnostics
+unsigned long network_ready_millis = 0;     // network and broker connected
+unsigned long discovery_millis = 0;         // time spent publishing discovery messages
+unsigned long discovery_messages = 0;       // number of discovery messages published
+unsigned long ready_millis = 0;             // online (all discovery messages published)
+unsigned long heap_block_before_discovery = 0; // largest free heap block before the discovery phase
+unsigned long heap_block_after_discovery = 0;  // ... and after it (lower if discovery left the heap fragmented)
+const unsigned long DISCOVERY_JITTER_MAX = 3000; // milliseconds; upper bound of the per-device delay before discovery
+
+// Idle: when a loop() pass finds no work pending it sleeps (the CPU idles, the modem sleeps between beacons) until the
+// earliest deadline of its schedulers, or until a pulse's interrupt wakes it. MQTT commands and /metrics connections
+// have no interrupt of their own and wait for the next pass, at most LOOP_IDLE_MAX_MS (the rollups sample the CPM once
+// a second anyway), except the broker's reply to a ping, which is looked for sooner (LinkMonitorClient::replyPollMillis()). Work that is due but held up by the link is retried every LOOP_RETRY_MS.
+const unsigned long LOOP_IDLE_MAX_MS = 1000;
+const unsigned long LOOP_RETRY_MS = 10;
+unsigned long long loop_iterations = 0;         // loop() passes since last published (64 bit: until publication, which may be hours)
+unsigned long long idle_micros = 0;             // time spent idle since last published
+
+// Wall-clock time (lib/timebase), kept over SNTP. Readings carry the time they were taken as "ts" (epoch seconds; null
+// until the clock is set), so their publication may be delayed without misdating them.
+#ifndef LOCAL_ENV_NTP_SERVER
+#define LOCAL_ENV_NTP_SERVER "pool.ntp.org"     // or a local NTP server; see sample-env.h
+#endif
+timebase wallclock;
+const unsigned int TIMESTAMP_WIDTH = 14;        // "%.3f" epoch seconds, ie. 1760000000.000
+
+// MQTT-SN transport for the QoS 0 updates (lib/mqttsn-client). The gateway maps the predefined topic ids back to the
+// topics the broker connection would have used (see tools/mqttsn-gateway.py).
+#ifdef MQTTSN_GATEWAY_PORT
+#ifndef LOCAL_ENV_MQTTSN_GATEWAY_HOST
+#define LOCAL_ENV_MQTTSN_GATEWAY_HOST LOCAL_ENV_MQTT_BROKER_HOST // gateway running next to the broker
+#endif
+const uint16_t MQTTSN_STATE_TOPIC_ID = 1;       // STATE_TOPIC
+const uint16_t MQTTSN_DIAGNOSTIC_TOPIC_ID = 2;  // DIAGNOSTIC_TOPIC
+#endif
 
 /*
   Since the fully constructed list of discovery_config (topics and payloads) consumes considerable RAM, reduce it to just the facts.
   Generate each discovery_config one at a time at the point of publishing the message in order to conserve RAM.
   Once everything is successfully published, purge list contents (no longer needed).
+  All of it lives in the phase arena (lib/phase-arena) for the duration of discovery, which is released in one piece afterwards.
 */
-std::vector<discovery_metadata> discovery_metadata_list;                                            // list of data used to construct discovery_config for sensor discovery
-std::vector<discovery_config_metadata> discovery_config_metadata_list;                              // list of data used to construct discovery_config for config/control discovery
-std::vector<discovery_measured_diagnostic_metadata> discovery_measured_diagnostic_metadata_list;    // list of data used to construct discovery_config for sensor measured diagnostics (like RSSI)
-std::vector<discovery_fact_diagnostic_metadata> discovery_fact_diagnostic_metadata_list;            // list of data used to construct discovery_config for fact diagnostics (like IP address)
+phase_vector<discovery_metadata> discovery_metadata_list;                                            // list of data used to construct discovery_config for sensor discovery
+phase_vector<discovery_config_metadata> discovery_config_metadata_list;                            // list of data used to construct discovery_config for config/control discovery
+phase_vector<discovery_measured_diagnostic_metadata> discovery_measured_diagnostic_metadata_list;  // list of data used to construct discovery_config for sensor measured diagnostics (like RSSI)
+phase_vector<discovery_fact_diagnostic_metadata> discovery_fact_diagnostic_metadata_list;          // list of data used to construct discovery_config for fact diagnostics (like IP address)
+phase_vector<discovery_binary_metadata> discovery_binary_metadata_list;                            // list of data used to construct discovery_config for binary sensors (like the radiation burst alarm)
 
 // Last will and testament topic
 const std::string AVAILABILITY_TOPIC = buildAvailabilityTopic("sensor", std::string(DEVICE_ID)); // homeassistant/sensor/esp8266thing/availability
 
 const std::string DIAGNOSTIC_TOPIC = buildDiagnosticTopic("sensor", std::string(DEVICE_ID)); // homeassistant/sensor/esp8266thing/diagnostics
 
+// Diagnostic facts (IP, MAC, firmware version) are published retained to their own topic, and only when they change
+const std::string FACT_TOPIC = buildFactTopic("sensor", std::string(DEVICE_ID)); // homeassistant/sensor/esp8266thing/facts
+
+std::vector<diag_field> diag_fields; // diagnostics registry; see DIAG_FIELDS
+
+// Inter-arrival time histograms are published to a diagnostics sub-topic every INTERVAL_HIST_PERIOD, then cleared
+const std::string INTERVAL_TOPIC = DIAGNOSTIC_TOPIC + "/intervals"; // homeassistant/sensor/esp8266thing/diagnostics/intervals
+const unsigned long INTERVAL_HIST_PERIOD = 60000*15; // 15 minutes
+constexpr size_t INTERVAL_PAYLOAD_MAX_LENGTH = HA_LITERAL_LENGTH("{\"period\": , \"first_bucket_us\": , \"pulses\": , \"noise\": , \"ts\": }") + 2 * 11 + 2 * INTERVAL_HIST_ARRAY_MAX_LENGTH + TIMESTAMP_WIDTH;
+
 // All sensor updates are published in a single complex json payload to a single topic
 const std::string STATE_TOPIC = buildStateTopic("sensor", std::string(DEVICE_ID)); // homeassistant/sensor/esp8266thing/state
 
+// Radiation burst alarm has its own binary_sensor entity and state topic so it is never held up by sensor updates
+constexpr char ALARM_SENSOR_ID[] = "radiation_burst";
+constexpr char ALARM_DEVICE_CLASS[] = "safety"; // on means unsafe
+constexpr char ALARM_ICON[] = "mdi:radioactive-circle";
+const std::string ALARM_TOPIC = buildEntityStateTopic("binary_sensor", std::string(DEVICE_ID), ALARM_SENSOR_ID); // homeassistant/binary_sensor/esp8266thing/radiation_burst/state
+
+// Minute/hour/day rollups are published to one state topic per tier, each when its window completes
+constexpr const char* ROLLUP_TIER_NAMES[ROLLUP_TIERS] = { "1m", "1h", "1d" };
+constexpr size_t ROLLUP_TIER_NAME_MAX = constStrMaxLength(ROLLUP_TIER_NAMES, ROLLUP_TIERS);
+constexpr char ROLLUP_CPM_ICON[] = "mdi:chart-bell-curve";
+constexpr char ROLLUP_CPM_UNIT[] = "CPM";
+constexpr char ROLLUP_DOSE_ICON[] = "mdi:radioactive";
+constexpr char ROLLUP_DOSE_UNIT[] = "uSv";
+std::string ICACHE_FLASH_ATTR buildRollupTopic(uint8_t tier){
+  return buildEntityStateTopic("sensor", std::string(DEVICE_ID), std::string("rollup_")+ROLLUP_TIER_NAMES[tier]); // homeassistant/sensor/esp8266thing/rollup_1h/state
+}
+
+// Refresh rate control; the setting is kept in the flash log so it survives a reboot
+constexpr char REFRESH_RATE_CONTROL[] = "refreshrate";
+constexpr char REFRESH_RATE_SETTINGS[] = "\"min\": 1, \"max\": 60, \"step\": 1"; // must match REFRESH_RATE_MIN and REFRESH_RATE_MAX
+constexpr char REFRESH_RATE_ICON[] = "mdi:refresh-circle";
+constexpr char REFRESH_RATE_UNIT[] = "minutes";
+const std::string REFRESH_RATE_SET_TOPIC = buildSetterTopic("number", std::string(DEVICE_ID), REFRESH_RATE_CONTROL); // homeassistant/number/esp8266thing/refreshrate/set
+const std::string REFRESH_RATE_GET_TOPIC = buildGetterTopic("number", std::string(DEVICE_ID), REFRESH_RATE_CONTROL); // homeassistant/number/esp8266thing/refreshrate/get
+const unsigned long REFRESH_RATE_MIN = 1;       // minutes
+const unsigned long REFRESH_RATE_MAX = 60;      // minutes
+unsigned long refresh_rate = 60000*5;           // 5 minutes; frequency of availability updates in milliseconds
+volatile unsigned long refresh_rate_requested = 0; // minutes; set by messageReceived(), applied in loop()
+bool refresh_rate_announce = true;              // publish the current setting to the getter topic
+
+// Event trace (lib/event-trace); publish "dump" to the command topic to receive the trace on the dump topic
+const std::string TRACE_COMMAND_TOPIC = buildSetterTopic("sensor", std::string(DEVICE_ID), "trace"); // homeassistant/sensor/esp8266thing/trace/set
+const std::string TRACE_DUMP_TOPIC = buildGetterTopic("sensor", std::string(DEVICE_ID), "trace");    // homeassistant/sensor/esp8266thing/trace/get
+const unsigned long LOOP_OVERRUN_MS = 50;      // a loop() pass longer than this is traced as an overrun
+volatile bool trace_dump_requested = false;     // set by messageReceived(), handled in loop()
+
+// Persistent values (lib/flash-log); index into the flash log record
+const uint8_t FLASH_LOG_PULSE_TOTAL = 0;        // pulses per sensor counted over the lifetime of the device
+const uint8_t FLASH_LOG_REFRESH_RATE = 1;       // refresh rate setting in minutes
+unsigned long pulse_total_restored = 0;         // lifetime pulse count (per sensor) at boot
+
 
 // radiation (gamma) [alpha, beta only measurable at close range, without shielding plates]
-// Radiation Watch Type 5 Sensor
-RadiationWatch radiationWatch(SIG_PIN, NS_PIN);
+// Radiation Watch Type 5 Sensor, on SIG_PIN/NS_PIN (and SIG2_PIN/NS2_PIN), read through lib/dual-detector
+volatile unsigned long pulse_count = 0;         // radiation pulses seen since boot
+volatile unsigned long last_pulse_millis = 0;   // time of the most recent radiation pulse
+volatile bool pulse_pending = false;            // set when a pulse has been recorded but not yet published
+
+// Pipeline latency diagnostics; worst case since last sampled, in microseconds
+volatile unsigned long pending_since_micros = 0;  // capture time of the oldest pulse in the pending state update
+unsigned long pulse_wait_max = 0;               // capture until the state update starts publishing
+unsigned long publish_time_max = 0;             // time spent in the state update publish itself
+
+// Backpressure diagnostics; state readings are snapshots so under backpressure only the newest is sent
+volatile unsigned long state_merged = 0;        // pulses folded into an update that was still waiting to be sent
+unsigned long state_dropped = 0;                // updates lost because the publish itself failed
+unsigned long state_published = 0;              // updates handed to the network
+
+interval_histogram pulse_intervals;             // time between radiation pulses
+interval_histogram noise_intervals;             // time between noise events (vibration, electrical interference)
+unsigned long intervals_published_millis = 0;   // millis() of the start of the current histogram period
+rollup rollups;                                 // minute/hour/day aggregates of the pulse stream, fed from loop()
+burst_detector burst;                           // sliding window burst detector fed from onRadiationPulse()
+volatile bool alarm_pending = false;            // alarm state changed (or was never published) and must be sent
 
 /*
+  CPM       : counts (gamma rays) per minute
+  frequency : CPM * 0.02 = Hertz (cycles per second)
+  Dose      : micro-sieverts per hour (uSv/h) +/- error (uSv/h)  
+  Dose total: micro-sieverts (uSv) accumulated over the lifetime of the device, pulses per sensor / (CPM_PER_USVH * 60)
+*/
+#ifdef SIG2_PIN
+const uint8_t SENSOR_COUNT = 2;                 // sensors feeding onRadiationPulse()
+#else
+const uint8_t SENSOR_COUNT = 1;
+#endif
+
+// Pulses per sensor since boot. The fused stream of two sensors counts at twice the rate of one, while the dose
+// conversion (CPM_PER_USVH) is per sensor; the lifetime total in the flash log is kept per sensor too.
+unsigned long ICACHE_FLASH_ATTR sensorPulses(){ return pulse_count / SENSOR_COUNT; }
+
+// Rates come from the fused stream, per sensor, so the single sensor conversion factor applies
+double ICACHE_FLASH_ATTR readCpm(){ return dualDetectorCpm(); }
+double ICACHE_FLASH_ATTR readDose(){ return dualDetectorCpm() / CPM_PER_USVH; }
+double ICACHE_FLASH_ATTR readDoseError(){
+  double minutes = dualDetectorIntegrationTime() / 60000.0;
+  return minutes > 0 ? sqrt((double)dualDetectorCount()) / SENSOR_COUNT / minutes / CPM_PER_USVH : 0;
+}
+double ICACHE_FLASH_ATTR readFrequency(){ return readCpm() * 0.02; }
+double ICACHE_FLASH_ATTR readDoseHigh(){ return readDose() + readDoseError(); }
+double ICACHE_FLASH_ATTR readDoseLow(){ return std::max(readDose() - readDoseError(), 0.0); }
+double ICACHE_FLASH_ATTR readDoseTotal(){ return (pulse_total_restored + pulse_count / (double)SENSOR_COUNT) / (CPM_PER_USVH * 60.0); }
+double ICACHE_FLASH_ATTR readTimestamp(){ return timebaseEpochSeconds(wallclock, micros64()); } // NAN until the clock is set
+
+// "ts" of an event at a millis() timestamp in the past, for the payloads built by hand
+std::string ICACHE_FLASH_ATTR timestampAt(unsigned long at_millis){
+  if(!timebaseSynced(wallclock)){
+    return "null";
+  }
+  return to_string(timebaseEpochSeconds(wallclock, micros64() - (uint64_t)(millis() - at_millis) * 1000), "%.3f");
+}
+
+/*
+  Sensor state schema: generates the state payload (publishSensorData()) and the sensor discovery entities with
+  matching value templates (see sensor-schema.h).
   device_class : https://developers.home-assistant.io/docs/core/entity/sensor?_highlight=device&_highlight=class#available-device-classes
                  https://www.home-assistant.io/integrations/sensor/#device-class
-  has_sub_attr : true if you want to provide sub attributes under the main attribute
   icon : https://materialdesignicons.com/
   unit : (depends on device class, see link above)
 */
-// build discovery message - step 1 of 4
-std::vector<discovery_metadata> ICACHE_FLASH_ATTR getAllDiscoveryMessagesMetadata(){
-  discovery_metadata radiation;
+constexpr sensor_field SENSOR_FIELDS[] = {
+  // key          parent       format   width read            entity device_class state_class          icon               unit
+  // There is no radiation device class; frequency (as it relates to geiger gamma ray cpm) was the closest match.
+  // Must convert count per minute to count per second (Hz).
+  { "frequency",  nullptr,     "%2.4f", 10, readFrequency,  true,  "frequency", "measurement",      "mdi:radioactive", "Hz" },
+  // The frequency_details attributes are also entities of their own, read straight from the state payload by a plain
+  // value_template; saves a template sensor (and its evaluation on every state update) per value on the HA side
+  { "dose",       "frequency", "%3.2f", 8,  readDose,       true,  "",          "measurement",      "mdi:radioactive", "uSv/h" },
+  { "dose_err",   "frequency", "%3.2f", 8,  readDoseError,  true,  "",          "measurement",      "mdi:plus-minus",  "uSv/h" },
+  // upper bound (dose + error), the conservative value for alerts and gauges
+  { "dose_high",  "frequency", "%3.2f", 8,  readDoseHigh,   true,  "",          "measurement",      "mdi:radioactive", "uSv/h" },
+  { "dose_low",   "frequency", "%3.2f", 8,  readDoseLow,    true,  "",          "measurement",      "mdi:radioactive", "uSv/h" },
+  { "cpm",        "frequency", "%4.2f", 10, readCpm,        true,  "",          "measurement",      "mdi:radioactive", "CPM" },
+  // Lifetime cumulative dose, restored from flash at boot; total_increasing lets HA keep long term statistics across resets
+  { "dose_total", nullptr,     "%.4f",  12, readDoseTotal,  true,  "",          "total_increasing", "mdi:radioactive", "uSv" },
+  // When the reading was taken (epoch seconds); not an entity
+  { "ts",         nullptr,     "%.3f",  TIMESTAMP_WIDTH, readTimestamp, false, "", "",                 "",                "" },
+};
+constexpr size_t SENSOR_FIELD_COUNT = sizeof(SENSOR_FIELDS) / sizeof(SENSOR_FIELDS[0]);
+static_assert(validSchema(SENSOR_FIELDS, SENSOR_FIELD_COUNT), "SENSOR_FIELDS: duplicate key, unknown parent, missing format/reader or width outside 4..SCHEMA_WIDTH_MAX");
+
+constexpr size_t STATE_PAYLOAD_MAX_LENGTH = schemaPayloadMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT); // upper bound of the state payload built by publishSensorData()
+
+// Rollup values (see publishRollup()); widths as for the matching SENSOR_FIELDS
+const unsigned int ROLLUP_CPM_WIDTH = 10;       // "%.2f"
+const unsigned int ROLLUP_DOSE_WIDTH = 12;      // "%.4f"
+constexpr size_t ROLLUP_PAYLOAD_MAX_LENGTH = HA_LITERAL_LENGTH("{\"cpm_\": , \"cpm__details\": {\"min\": , \"max\":  }, \"dose_\": , \"ts\": }")
+  + 3 * ROLLUP_TIER_NAME_MAX + 3 * ROLLUP_CPM_WIDTH + ROLLUP_DOSE_WIDTH + TIMESTAMP_WIDTH; // upper bound of a rollup payload built by publishRollup()
 
+// build discovery message - step 1 of 4
+phase_vector<discovery_metadata> ICACHE_FLASH_ATTR getAllDiscoveryMessagesMetadata(){
   // temp.device_class = "temperature";
   // temp.has_sub_attr = false;
   // temp.icon = "mdi:home-thermometer";
@@ -66,151 +259,690 @@ std::vector<discovery_metadata> ICACHE_FLASH_ATTR getAllDiscoveryMessagesMetadat
   // humidity.icon = "mdi:water-percent";
   // humidity.unit = "%";
 
-  // There is no radiation device class; frequency (as it relates to geiger gamma ray cpm) was the closest match
-  // Actual sieverts will be passed as sub-attributes. 
-  radiation.device_type = "sensor";
-  radiation.device_class = "frequency"; 
-  radiation.has_sub_attr = true;
-  radiation.icon = "mdi:radioactive";
-  radiation.unit = "Hz"; // must convert count per minute to count per second (Hz)
-
-  std::vector<discovery_metadata> dm = { radiation };  
+  phase_vector<discovery_metadata> dm = getSchemaDiscoveryMetadata(SENSOR_FIELDS, SENSOR_FIELD_COUNT, 2*ROLLUP_TIERS);
+
+  // Rollups: mean CPM (with the window min/max as attributes) and the dose integrated over the window.
+  // HA can keep long term statistics from these without recording every state update.
+  for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    discovery_metadata cpm;
+    cpm.device_type = "sensor";
+    cpm.device_class = "";
+    cpm.json_attr = phase_string("cpm_")+ROLLUP_TIER_NAMES[tier];
+    cpm.has_sub_attr = true;
+    cpm.icon = ROLLUP_CPM_ICON;
+    cpm.unit = ROLLUP_CPM_UNIT;
+    cpm.state_topic = buildRollupTopic(tier).c_str();
+    dm.push_back(cpm);
+
+    discovery_metadata dose;
+    dose.device_type = "sensor";
+    dose.device_class = "";
+    dose.json_attr = phase_string("dose_")+ROLLUP_TIER_NAMES[tier];
+    dose.state_class = "measurement"; // one value per closed window, not a running total: a window lower than the last is no reset, so not total_increasing
+    dose.has_sub_attr = false;
+    dose.icon = ROLLUP_DOSE_ICON;
+    dose.unit = ROLLUP_DOSE_UNIT;
+    dose.state_topic = cpm.state_topic;
+    dm.push_back(dose);
+  }
   return dm;
 }
 
 // build discovery config/control message - step 1 of 4
-std::vector<discovery_config_metadata> ICACHE_FLASH_ATTR getAllDiscoveryConfigMessagesMetadata(){
-  // discovery_config_metadata refrate;
-
-  // refrate.device_type = "number";
-  // refrate.control_name = "refreshrate";
-  // refrate.custom_settings = "\"min\": 1, \"max\": 60, \"step\": 1";
-  // refrate.icon = "mdi:refresh-circle";
-  // refrate.unit = "minutes";
+phase_vector<discovery_config_metadata> ICACHE_FLASH_ATTR getAllDiscoveryConfigMessagesMetadata(){
+  discovery_config_metadata refrate;
+
+  refrate.device_type = "number";
+  refrate.control_name = REFRESH_RATE_CONTROL;
+  refrate.custom_settings = REFRESH_RATE_SETTINGS;
+  refrate.icon = REFRESH_RATE_ICON;
+  refrate.unit = REFRESH_RATE_UNIT;
   
-  std::vector<discovery_config_metadata> dcm = { };  
+  phase_vector<discovery_config_metadata> dcm = { refrate };  
   return dcm;
 }
 
-std::vector<discovery_measured_diagnostic_metadata> ICACHE_FLASH_ATTR getAllDiscoveryMeasuredDiagnosticMessagesMetadata(){
-  discovery_measured_diagnostic_metadata rssi;
+// MQTT-SN topic id a publication goes out under instead of the broker connection; 0 for the broker connection.
+// Only QoS 0 updates that are not retained qualify: the others need the broker's acknowledgement or memory.
+#ifdef MQTTSN_GATEWAY_PORT
+uint16_t ICACHE_FLASH_ATTR mqttsnTopicId(uint16_t channel, bool retained, int qos){
+  if(!retained && qos == QOS_0){
+    switch(channel){
+      case TRACE_CHANNEL_STATE:
+        return MQTTSN_STATE_TOPIC_ID;
+      case TRACE_CHANNEL_DIAGNOSTICS:
+        return MQTTSN_DIAGNOSTIC_TOPIC_ID;
+    }
+  }
+  return 0;
+}
+#else
+uint16_t ICACHE_FLASH_ATTR mqttsnTopicId(uint16_t, bool, int){
+  return 0;
+}
+#endif
 
-  rssi.device_type = "sensor";
-  rssi.device_class = "";  // battery | date | duration | timestamp | ... In some cases may be "None" - https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes    
-  //rssi.state_class = "measurement";  Accept default
-  rssi.diag_attr = "wifi_rssi";
-  rssi.icon = "mdi:wifi-strength-2";  // https://materialdesignicons.com/
-  rssi.unit = ""; // RSSI is unitless
-  
-  std::vector<discovery_measured_diagnostic_metadata> dmdm = { rssi };  
-  return dmdm;
+// Publish and record it in the event trace. The 256dpi client only returns from a QoS 1 publish once the broker 
+// has acknowledged it, so a successful QoS 1 publish is also traced as its PUBACK.
+bool ICACHE_FLASH_ATTR publishTraced(const char* topic, const char* payload, bool retained, int qos, uint16_t channel){
+  traceEvent(TRACE_PUBLISH_BEGIN, channel);
+  uint16_t topic_id = mqttsnTopicId(channel, retained, qos);
+  bool ok = topic_id != 0 ? mqttsnPublish(topic_id, payload, strlen(payload)) : mqttclient.publish(topic, payload, retained, qos);
+  traceEvent(TRACE_PUBLISH_END, ok ? channel : (channel | TRACE_PUBLISH_FAILED));
+  if(ok && qos > QOS_0){
+    traceEvent(TRACE_PUBACK, channel);
+  }
+  return ok;
 }
 
-std::vector<discovery_fact_diagnostic_metadata> ICACHE_FLASH_ATTR getAllDiscoveryFactDiagnosticMessagesMetadata(){
-  discovery_fact_diagnostic_metadata ip, mac;
-  
-  ip.device_type = "sensor";
-  ip.diag_attr = "wifi_ip";
-  ip.icon = "mdi:ip-network";  
+/*
+  Measurements over a period (a rate, a worst case) are sampled without being reset: a sample held back by the deadband
+  would otherwise be lost. The period starts over only once a sample is published (diag_spec::published).
+*/
+struct diag_rate{
+  unsigned long long sampled;                   // counter at the last sample
+  unsigned long start_millis;                   // start of the period
+  unsigned long sample_millis;                  // time of the last sample
+};
+
+// Rate of a counter per second since the period started
+float ICACHE_FLASH_ATTR sampleRate(unsigned long long counter, diag_rate &r){
+  unsigned long now = millis();
+  r.sampled = counter;
+  r.sample_millis = now;
+  return now - r.start_millis > 0 ? counter * 1000.0f / (now - r.start_millis) : 0;
+}
+
+// The last sample was published: start a new period from it, keeping what was counted since
+void ICACHE_FLASH_ATTR ratePublished(unsigned long long &counter, diag_rate &r){
+  counter -= r.sampled;
+  r.start_millis = r.sample_millis;
+}
+
+// A worst-case latency (microseconds) as milliseconds
+float ICACHE_FLASH_ATTR sampleMaxMillis(unsigned long max_micros){
+  return max_micros / 1000.0f;
+}
 
-  mac.device_type = "sensor";
-  mac.diag_attr = "wifi_mac";
-  mac.icon = "mdi:network-pos";  
+// published_ms went out: start a new period, unless a worse case came since it was sampled
+void ICACHE_FLASH_ATTR maxPublished(unsigned long &max_micros, float published_ms){
+  if(max_micros / 1000.0f <= published_ms){
+    max_micros = 0;
+  }
+}
+
+diag_rate loop_rate = {};                       // loop_iterations' period
+diag_rate idle_rate = {};                       // idle_micros' period
 
+/*
+  Diagnostics registry: each field has its own sampling period and change threshold (deadband).
+  Facts are sampled once and cached (re-sampled after a network reconnect), published retained only when changed.
+  Measurements are published when they move beyond their deadband (or DIAG_HEARTBEAT passes).
+  The measured and fact diagnostic discovery messages are generated from this list.
+  width is the longest formatted value (see diag-registry.h); a counter formatted "%.0f" takes up to 10 characters.
+*/
+constexpr diag_spec DIAG_FIELDS[] = {
+  diagFact("wifi_ip", "mdi:ip-network", getIP, 15),
+  diagFact("wifi_mac", "mdi:network-pos", []() -> std::string { return getMAC(); }, MAC_ADDRESS_LENGTH),
+  diagFact("fw_version", "mdi:tag-outline", []() -> std::string { return DEVICE_VERSION; }, HA_LITERAL_LENGTH(DEVICE_VERSION)),
+  // RSSI is unitless; only worth reporting when it moves by more than a few dB
+  diagMeasurement("wifi_rssi", "mdi:wifi-strength-2", "", "measurement", []() -> float { return getRSSI(); }, "%.0f", 4, 60000, 4),
+  // state updates folded into a newer one because the send buffer was full (see processPulses())
+  diagMeasurement("state_merged", "mdi:call-merge", "", "total_increasing", []() -> float { return state_merged; }, "%.0f", 10, 60000, 0),
+  // state updates lost because the publish failed
+  diagMeasurement("state_dropped", "mdi:delete-clock", "", "total_increasing", []() -> float { return state_dropped; }, "%.0f", 10, 60000, 0),
+  // pipeline throughput and per-stage latency (worst case since last published), to find the sustainable pulse rate
+  diagMeasurement("pulses", "mdi:counter", "", "total_increasing", []() -> float { return pulse_count; }, "%.0f", 10, 60000, 10),
+  diagMeasurement("pulse_wait_max", "mdi:timer-sand", "ms", "measurement", []() -> float { return sampleMaxMillis(pulse_wait_max); }, "%.1f", 9, 60000, 5,
+    [](float ms) { maxPublished(pulse_wait_max, ms); }),
+  diagMeasurement("publish_time_max", "mdi:timer-outline", "ms", "measurement", []() -> float { return sampleMaxMillis(publish_time_max); }, "%.1f", 9, 60000, 5,
+    [](float ms) { maxPublished(publish_time_max, ms); }),
+  // loop() passes per second and share of time spent idle (a proxy for CPU load and current draw)
+  diagMeasurement("loop_rate", "mdi:sync", "Hz", "measurement", []() -> float { return sampleRate(loop_iterations, loop_rate); }, "%.0f", 7, 60000, 10,
+    [](float) { ratePublished(loop_iterations, loop_rate); }),
+  diagMeasurement("idle", "mdi:sleep", "%", "measurement", []() -> float { return sampleRate(idle_micros, idle_rate) / 10000.0f; }, "%.0f", 4, 60000, 2,
+    [](float) { ratePublished(idle_micros, idle_rate); }),
+  // startup: time to connect, time to online, discovery throughput (sampled once per boot)
+  diagMeasurement("connect_time", "mdi:timer-play-outline", "ms", "measurement", []() -> float { return network_ready_millis; }, "%.0f", 10, 0, 0),
+  diagMeasurement("ready_time", "mdi:timer-check-outline", "ms", "measurement", []() -> float { return ready_millis; }, "%.0f", 10, 0, 0),
+  diagMeasurement("discovery_rate", "mdi:speedometer", "msg/s", "measurement", []() -> float { return discovery_millis > 0 ? discovery_messages * 1000.0f / discovery_millis : 0; }, "%.1f", 8, 0, 0),
+  // largest free heap block either side of discovery; equal when discovery left the heap as it found it
+  diagMeasurement("heap_block_pre", "mdi:memory", "B", "measurement", []() -> float { return heap_block_before_discovery; }, "%.0f", 6, 0, 0),
+  diagMeasurement("heap_block_post", "mdi:memory", "B", "measurement", []() -> float { return heap_block_after_discovery; }, "%.0f", 6, 0, 0),
+  // flash log records written since boot (flash wear)
+  diagMeasurement("flash_writes", "mdi:content-save-outline", "", "total_increasing", []() -> float { return flashLogWrites(); }, "%.0f", 10, 60000, 0),
+  // broker link: smoothed and worst PINGREQ/PUBACK round trip, reconnects since boot and the keep-alive picked from them
+  diagMeasurement("link_rtt", "mdi:timer-sync-outline", "ms", "measurement", []() -> float { return linkclient.rttMillis(); }, "%.1f", 9, 60000, 20),
+  diagMeasurement("link_rtt_max", "mdi:timer-alert-outline", "ms", "measurement", []() -> float { return linkclient.rttMaxMillis(); }, "%.1f", 9, 60000, 50,
+    [](float ms) { linkclient.rttMaxPublished(ms); }),
+  diagMeasurement("reconnects", "mdi:lan-disconnect", "", "total_increasing", []() -> float { return linkclient.reconnects(); }, "%.0f", 10, 60000, 0),
+  diagMeasurement("keep_alive", "mdi:heart-pulse", "s", "measurement", []() -> float { return linkclient.currentKeepAlive(); }, "%.0f", 4, 60000, 0),
+  // wall clock: how far off it had drifted at the last SNTP reply, and the estimated rate error of the local oscillator
+  diagMeasurement("clock_offset", "mdi:clock-alert-outline", "ms", "measurement", []() -> float { return wallclock.offset_us / 1000.0f; }, "%.1f", 10, 60000, 1),
+  diagMeasurement("clock_drift", "mdi:clock-fast", "ppm", "measurement", []() -> float { return wallclock.drift_ppb / 1000.0f; }, "%.1f", 6, 60000, 0.5),
+  // pulses discarded for noise on their own sensor's NS pin (shocks reaching only one sensor)
+  diagMeasurement("noise_gated", "mdi:vibrate", "", "total_increasing", []() -> float { return dualDetectorNoiseGated(); }, "%.0f", 10, 60000, 0),
+#ifdef SIG2_PIN
+  // pulse pairs rejected by the coincidence window (shocks or interference reaching both sensors)
+  diagMeasurement("coincidences", "mdi:vector-intersection", "", "total_increasing", []() -> float { return dualDetectorCoincidences(); }, "%.0f", 10, 60000, 0),
+#endif
+};
+constexpr size_t DIAG_FIELD_COUNT = sizeof(DIAG_FIELDS) / sizeof(DIAG_FIELDS[0]);
+static_assert(validDiagnostics(DIAG_FIELDS, DIAG_FIELD_COUNT), "DIAG_FIELDS: duplicate attribute, missing sampler or format, or width below 4");
 
-  std::vector<discovery_fact_diagnostic_metadata> dfdm = { ip, mac };  
+/*
+  Worst case size of every message, in both directions, from the declarations above: the payload formats with their value
+  widths, the discovery templates and the topics. The MQTT client's buffers are sized to the largest packet each way, so
+  a declaration that grows a message grows the buffer with it, and one that outgrows MQTT_BUFFER_LIMIT fails to compile.
+*/
+constexpr size_t DEVICE_ID_LENGTH = HA_LITERAL_LENGTH(DEVICE_ID);
+constexpr size_t ROLLUP_ENTITY_MAX = HA_LITERAL_LENGTH("rollup_") + ROLLUP_TIER_NAME_MAX;
+const size_t COMMAND_PAYLOAD_MAX_LENGTH = 32; // longest command accepted on a subscribed topic; anything longer makes the client drop the connection
+
+constexpr size_t AVAILABILITY_TOPIC_LENGTH = haTopicLength("sensor", DEVICE_ID, "availability");
+constexpr size_t STATE_TOPIC_LENGTH = haTopicLength("sensor", DEVICE_ID, "state");
+constexpr size_t DIAGNOSTIC_TOPIC_LENGTH = haTopicLength("sensor", DEVICE_ID, "diagnostics");
+constexpr size_t FACT_TOPIC_LENGTH = haTopicLength("sensor", DEVICE_ID, "facts");
+constexpr size_t INTERVAL_TOPIC_LENGTH = haTopicLength("sensor", DEVICE_ID, "diagnostics/intervals");
+constexpr size_t ROLLUP_TOPIC_LENGTH = haEntityTopicLength(HA_LITERAL_LENGTH("sensor"), DEVICE_ID_LENGTH, ROLLUP_ENTITY_MAX, HA_LITERAL_LENGTH("state"));
+constexpr size_t ALARM_TOPIC_LENGTH = haEntityTopicLength("binary_sensor", DEVICE_ID, ALARM_SENSOR_ID, "state");
+constexpr size_t REFRESH_RATE_TOPIC_LENGTH = haEntityTopicLength("number", DEVICE_ID, REFRESH_RATE_CONTROL, "set"); // same for "get"
+constexpr size_t TRACE_TOPIC_LENGTH = haEntityTopicLength("sensor", DEVICE_ID, "trace", "set");                     // same for "get"
+
+// Discovery messages by kind, each part at its longest (see discovery_bounds)
+constexpr discovery_bounds SENSOR_DISCOVERY_BOUNDS = {
+  HA_LITERAL_LENGTH("sensor"),
+  DEVICE_ID_LENGTH,
+  constMax(schemaMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT, &sensor_field::key), HA_LITERAL_LENGTH("dose_") + ROLLUP_TIER_NAME_MAX),
+  constMax(schemaValuePathMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT), HA_LITERAL_LENGTH("dose_") + ROLLUP_TIER_NAME_MAX),
+  schemaMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT, &sensor_field::device_class),
+  constMax(schemaMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT, &sensor_field::state_class), HA_LITERAL_LENGTH("total_increasing")),
+  constMax(schemaMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT, &sensor_field::icon), constStrLength(ROLLUP_CPM_ICON), constStrLength(ROLLUP_DOSE_ICON)),
+  constMax(schemaMaxLength(SENSOR_FIELDS, SENSOR_FIELD_COUNT, &sensor_field::unit), constStrLength(ROLLUP_CPM_UNIT), constStrLength(ROLLUP_DOSE_UNIT)),
+  0,
+  devicePayloadLength(HA_LITERAL_LENGTH(DEVICE_NAME), MAC_ADDRESS_LENGTH, HA_LITERAL_LENGTH(DEVICE_MANUFACTURER), HA_LITERAL_LENGTH(DEVICE_MODEL), HA_LITERAL_LENGTH(DEVICE_VERSION)),
+  constMax(AVAILABILITY_TOPIC_LENGTH, STATE_TOPIC_LENGTH, ROLLUP_TOPIC_LENGTH)
+};
+constexpr discovery_bounds CONTROL_DISCOVERY_BOUNDS = {
+  HA_LITERAL_LENGTH("number"),
+  DEVICE_ID_LENGTH,
+  constStrLength(REFRESH_RATE_CONTROL),
+  0,
+  0,
+  0,
+  constStrLength(REFRESH_RATE_ICON),
+  constStrLength(REFRESH_RATE_UNIT),
+  constStrLength(REFRESH_RATE_SETTINGS),
+  SENSOR_DISCOVERY_BOUNDS.device_payload,
+  constMax(AVAILABILITY_TOPIC_LENGTH, REFRESH_RATE_TOPIC_LENGTH)
+};
+constexpr discovery_bounds DIAGNOSTIC_DISCOVERY_BOUNDS = {
+  HA_LITERAL_LENGTH("sensor"),
+  DEVICE_ID_LENGTH,
+  diagMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, &diag_spec::attr),
+  0,
+  0,
+  diagMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, &diag_spec::state_class),
+  diagMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, &diag_spec::icon),
+  diagMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, &diag_spec::unit),
+  0,
+  shortDevicePayloadLength(HA_LITERAL_LENGTH(DEVICE_NAME), MAC_ADDRESS_LENGTH),
+  constMax(AVAILABILITY_TOPIC_LENGTH, DIAGNOSTIC_TOPIC_LENGTH, FACT_TOPIC_LENGTH)
+};
+constexpr discovery_bounds ALARM_DISCOVERY_BOUNDS = {
+  HA_LITERAL_LENGTH("binary_sensor"),
+  DEVICE_ID_LENGTH,
+  constStrLength(ALARM_SENSOR_ID),
+  0,
+  constStrLength(ALARM_DEVICE_CLASS),
+  0,
+  constStrLength(ALARM_ICON),
+  0,
+  0,
+  DIAGNOSTIC_DISCOVERY_BOUNDS.device_payload,
+  constMax(AVAILABILITY_TOPIC_LENGTH, ALARM_TOPIC_LENGTH)
+};
+constexpr size_t DISCOVERY_PAYLOAD_MAX_LENGTH = constMax(discoverySensorPayloadLength(SENSOR_DISCOVERY_BOUNDS), discoveryConfigPayloadLength(CONTROL_DISCOVERY_BOUNDS),
+  discoveryDiagnosticMeasurementPayloadLength(DIAGNOSTIC_DISCOVERY_BOUNDS), discoveryDiagnosticFactPayloadLength(DIAGNOSTIC_DISCOVERY_BOUNDS), discoveryBinaryPayloadLength(ALARM_DISCOVERY_BOUNDS));
+constexpr size_t DISCOVERY_TOPIC_MAX_LENGTH = constMax(discoveryTopicMaxLength(SENSOR_DISCOVERY_BOUNDS), discoveryTopicMaxLength(CONTROL_DISCOVERY_BOUNDS),
+  discoveryTopicMaxLength(DIAGNOSTIC_DISCOVERY_BOUNDS), discoveryTopicMaxLength(ALARM_DISCOVERY_BOUNDS));
+static_assert(DISCOVERY_PAYLOAD_MAX_LENGTH <= DISCOVERY_PAYLOAD_RESERVE, "a discovery payload can outgrow DISCOVERY_PAYLOAD_RESERVE and reallocate while it is built");
+static_assert(constMax(DISCOVERY_TOPIC_MAX_LENGTH, discoveryTopicMaxLength(CONTROL_DISCOVERY_BOUNDS) + 2 * REFRESH_RATE_TOPIC_LENGTH) <= DISCOVERY_TOPIC_RESERVE,
+  "a discovery topic (or a control's, with its getter and setter topics) can outgrow DISCOVERY_TOPIC_RESERVE");
+
+// Outgoing packets
+constexpr size_t CONNECT_PACKET_LENGTH = mqttConnectPacketLength(DEVICE_ID_LENGTH, AVAILABILITY_TOPIC_LENGTH, HA_LITERAL_LENGTH("offline"),
+  HA_LITERAL_LENGTH(LOCAL_ENV_MQTT_USERNAME), HA_LITERAL_LENGTH(LOCAL_ENV_MQTT_PASSWORD));
+constexpr size_t SUBSCRIBE_PACKET_LENGTH = mqttSubscribePacketLength(constMax(REFRESH_RATE_TOPIC_LENGTH, TRACE_TOPIC_LENGTH));
+constexpr size_t DISCOVERY_PACKET_LENGTH = mqttPacketLength(DISCOVERY_TOPIC_MAX_LENGTH, DISCOVERY_PAYLOAD_MAX_LENGTH, QOS_1);
+constexpr size_t AVAILABILITY_PACKET_LENGTH = mqttPacketLength(AVAILABILITY_TOPIC_LENGTH, HA_LITERAL_LENGTH("online"), QOS_1);
+constexpr size_t STATE_PACKET_LENGTH = mqttPacketLength(STATE_TOPIC_LENGTH, STATE_PAYLOAD_MAX_LENGTH, QOS_0);
+constexpr size_t ROLLUP_PACKET_LENGTH = mqttPacketLength(ROLLUP_TOPIC_LENGTH, ROLLUP_PAYLOAD_MAX_LENGTH, QOS_1);
+constexpr size_t DIAGNOSTIC_PACKET_LENGTH = mqttPacketLength(DIAGNOSTIC_TOPIC_LENGTH, diagPayloadMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, NOT_RETAINED), QOS_0);
+constexpr size_t FACT_PACKET_LENGTH = mqttPacketLength(FACT_TOPIC_LENGTH, diagPayloadMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, RETAINED), QOS_1);
+constexpr size_t INTERVAL_PACKET_LENGTH = mqttPacketLength(INTERVAL_TOPIC_LENGTH, INTERVAL_PAYLOAD_MAX_LENGTH, QOS_0);
+constexpr size_t ALARM_PACKET_LENGTH = mqttPacketLength(ALARM_TOPIC_LENGTH, HA_LITERAL_LENGTH("OFF"), QOS_1);
+constexpr size_t REFRESH_RATE_PACKET_LENGTH = mqttPacketLength(REFRESH_RATE_TOPIC_LENGTH, 11, QOS_1); // to_string(int)
+constexpr size_t TRACE_DUMP_PACKET_LENGTH = mqttPacketLength(TRACE_TOPIC_LENGTH, sizeof(trace_dump_header) + TRACE_DUMP_CHUNK * sizeof(trace_record), QOS_0);
+
+// Incoming: commands on the subscribed topics (acknowledgements are only a few bytes)
+constexpr size_t COMMAND_PACKET_LENGTH = mqttPacketLength(constMax(REFRESH_RATE_TOPIC_LENGTH, TRACE_TOPIC_LENGTH), COMMAND_PAYLOAD_MAX_LENGTH, QOS_1);
+
+static_assert(CONNECT_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "MQTT CONNECT (client id, last will and credentials) can not fit MQTT_BUFFER_LIMIT");
+static_assert(DISCOVERY_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "a discovery message can not fit MQTT_BUFFER_LIMIT");
+static_assert(STATE_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "the state payload (SENSOR_FIELDS) can not fit MQTT_BUFFER_LIMIT");
+static_assert(ROLLUP_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "a rollup payload can not fit MQTT_BUFFER_LIMIT");
+static_assert(DIAGNOSTIC_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "the diagnostic measurements (DIAG_FIELDS) can not fit MQTT_BUFFER_LIMIT");
+static_assert(FACT_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "the diagnostic facts (DIAG_FIELDS) can not fit MQTT_BUFFER_LIMIT");
+static_assert(INTERVAL_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "the interval histograms can not fit MQTT_BUFFER_LIMIT");
+static_assert(TRACE_DUMP_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "a trace dump chunk (TRACE_DUMP_CHUNK) can not fit MQTT_BUFFER_LIMIT");
+static_assert(COMMAND_PACKET_LENGTH <= MQTT_BUFFER_LIMIT, "a command can not fit MQTT_BUFFER_LIMIT");
+#ifdef MQTTSN_GATEWAY_PORT
+static_assert(constMax(STATE_PAYLOAD_MAX_LENGTH, diagPayloadMaxLength(DIAG_FIELDS, DIAG_FIELD_COUNT, NOT_RETAINED)) <= MQTTSN_PAYLOAD_MAX,
+  "the state or diagnostic payload can not fit a single MQTT-SN datagram");
+#endif
+
+constexpr size_t MQTT_WRITE_BUFFER_SIZE = constMax(CONNECT_PACKET_LENGTH, SUBSCRIBE_PACKET_LENGTH, DISCOVERY_PACKET_LENGTH, AVAILABILITY_PACKET_LENGTH,
+  STATE_PACKET_LENGTH, ROLLUP_PACKET_LENGTH, DIAGNOSTIC_PACKET_LENGTH, FACT_PACKET_LENGTH, INTERVAL_PACKET_LENGTH, ALARM_PACKET_LENGTH,
+  REFRESH_RATE_PACKET_LENGTH, TRACE_DUMP_PACKET_LENGTH);
+constexpr size_t MQTT_READ_BUFFER_SIZE = COMMAND_PACKET_LENGTH;
+
+MQTTClient mqttclient(MQTT_READ_BUFFER_SIZE, MQTT_WRITE_BUFFER_SIZE); // default is 128 bytes each way;  https://github.com/256dpi/arduino-mqtt#notes
+
+phase_vector<discovery_measured_diagnostic_metadata> ICACHE_FLASH_ATTR getAllDiscoveryMeasuredDiagnosticMessagesMetadata(){
+  phase_vector<discovery_measured_diagnostic_metadata> dmdm;
+  dmdm.reserve(countDiagnosticFields(false));
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    if(diag_fields[i].spec->read_measurement == nullptr){
+      continue;
+    }
+    discovery_measured_diagnostic_metadata measured;
+    measured.device_type = "sensor";
+    measured.device_class = "";  // battery | date | duration | timestamp | ... In some cases may be "None" - https://developers.home-assistant.io/docs/core/entity/sensor/#available-device-classes    
+    measured.state_class = diag_fields[i].spec->state_class;
+    measured.diag_attr = diag_fields[i].spec->attr;
+    measured.icon = diag_fields[i].spec->icon;  // https://materialdesignicons.com/
+    measured.unit = diag_fields[i].spec->unit;
+    dmdm.push_back(measured);
+  }
+  return dmdm;
+}
+
+phase_vector<discovery_fact_diagnostic_metadata> ICACHE_FLASH_ATTR getAllDiscoveryFactDiagnosticMessagesMetadata(){
+  phase_vector<discovery_fact_diagnostic_metadata> dfdm;
+  dfdm.reserve(countDiagnosticFields(true));
+  for (size_t i = 0; i < diag_fields.size(); i++)
+  {
+    if(diag_fields[i].spec->read_fact == nullptr){
+      continue;
+    }
+    discovery_fact_diagnostic_metadata fact;
+    fact.device_type = "sensor";
+    fact.diag_attr = diag_fields[i].spec->attr;
+    fact.icon = diag_fields[i].spec->icon;
+    dfdm.push_back(fact);
+  }
   return dfdm;
 }
 
+phase_vector<discovery_binary_metadata> ICACHE_FLASH_ATTR getAllDiscoveryBinaryMessagesMetadata(){
+  discovery_binary_metadata alarm;
+
+  alarm.device_type = "binary_sensor";
+  alarm.device_class = ALARM_DEVICE_CLASS;
+  alarm.sensor_id = ALARM_SENSOR_ID;
+  alarm.icon = ALARM_ICON;
+
+  phase_vector<discovery_binary_metadata> dbm = { alarm };  
+  return dbm;
+}
+
 /* If the buildShortDevicePayload() is used, and there are no config/controls that use the full device payload, then HA will never see it.
    So the full device payload is used for both kinds of discovery message. The short version is used for diagnostic messages because they 
    are always accompanied by sensor and/or control messages. */
 
+// Device block of a discovery payload; full (with manufacturer, model and version) or short (name and id only)
+phase_string ICACHE_FLASH_ATTR discoveryDevicePayload(bool full){
+  phase_string device_payload;
+  if(full){
+    appendDevicePayload(device_payload, DEVICE_NAME, getMAC(), DEVICE_MANUFACTURER, DEVICE_MODEL, DEVICE_VERSION);
+  }
+  else {
+    appendShortDevicePayload(device_payload, DEVICE_NAME, getMAC());
+  }
+  return device_payload;
+}
+
 // build discovery message - step 3 of 4
-discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_metadata disc_meta){
-    return getDiscoveryMessage(disc_meta, DEVICE_ID, buildDevicePayload(DEVICE_NAME, getMAC(), DEVICE_MANUFACTURER, DEVICE_MODEL, DEVICE_VERSION), AVAILABILITY_TOPIC, STATE_TOPIC);
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(const discovery_metadata &disc_meta){
+  discovery_config disc;
+  const std::string_view state_topic = disc_meta.state_topic.empty() ? std::string_view(STATE_TOPIC) : std::string_view(disc_meta.state_topic);
+  buildDiscoveryMessage(disc, disc_meta, DEVICE_ID, discoveryDevicePayload(true), AVAILABILITY_TOPIC, state_topic);
+  return disc;
 }
 
 // build discovery config/control message - step 3 of 4
-discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_config_metadata disc_meta){  
-  return getDiscoveryConfigMessage(disc_meta, DEVICE_ID, buildDevicePayload(DEVICE_NAME, getMAC(), DEVICE_MANUFACTURER, DEVICE_MODEL, DEVICE_VERSION), AVAILABILITY_TOPIC);
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(const discovery_config_metadata &disc_meta){  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, DEVICE_ID, discoveryDevicePayload(true), AVAILABILITY_TOPIC);
+  return disc;
 }
 
 // build discovery measured diagnostic message - step 3 of 4
-discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_measured_diagnostic_metadata disc_meta){  
-  return getDiscoveryMeasuredDiagnosticMessage(disc_meta, DEVICE_ID, buildShortDevicePayload(DEVICE_NAME, getMAC()), AVAILABILITY_TOPIC, DIAGNOSTIC_TOPIC);
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(const discovery_measured_diagnostic_metadata &disc_meta){  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, DEVICE_ID, discoveryDevicePayload(false), AVAILABILITY_TOPIC, DIAGNOSTIC_TOPIC);
+  return disc;
 }
 
 // build discovery diagnostic fact message - step 3 of 4
-discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(discovery_fact_diagnostic_metadata disc_meta){  
-  return getDiscoveryFactDiagnosticMessage(disc_meta, DEVICE_ID, buildShortDevicePayload(DEVICE_NAME, getMAC()), AVAILABILITY_TOPIC, DIAGNOSTIC_TOPIC);
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(const discovery_fact_diagnostic_metadata &disc_meta){  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, DEVICE_ID, discoveryDevicePayload(false), AVAILABILITY_TOPIC, FACT_TOPIC);
+  return disc;
 }
 
-/*
-  CPM       : counts (gamma rays) per minute
-  frequency : CPM * 0.02 = Hertz (cycles per second)
-  Dose      : micro-sieverts per hour (uSv/h) +/- error (uSv/h)  
-*/
-void ICACHE_FLASH_ATTR publishSensorData(){
+// build discovery binary sensor message - step 3 of 4
+discovery_config ICACHE_FLASH_ATTR getDiscoveryMessage(const discovery_binary_metadata &disc_meta){  
+  discovery_config disc;
+  buildDiscoveryMessage(disc, disc_meta, DEVICE_ID, discoveryDevicePayload(false), AVAILABILITY_TOPIC);
+  return disc;
+}
 
-// payload size is 91 characters
-      std::string payload = "{\
-\"frequency\": "+to_string((radiationWatch.cpm() * 0.02), "%2.4f")+", \
-\"frequency_details\": {\"dose\": "+to_string(radiationWatch.uSvh(), "%3.2f")+", \
-\"dose_err\": "+to_string(radiationWatch.uSvhError(), "%3.2f")+", \
-\"cpm\": "+to_string(radiationWatch.cpm(), "%4.2f")+" }}";
+// State payload generated from SENSOR_FIELDS
+bool ICACHE_FLASH_ATTR publishSensorData(){
+
+      // A full send buffer would block the publish; the reading is a snapshot so let the caller retry with a newer one instead.
+      // Checked before the payload is built so that a congested link does not cost an allocation per loop() iteration.
+      // A datagram (MQTTSN_GATEWAY_PORT) never waits for the link.
+      if(mqttsnTopicId(TRACE_CHANNEL_STATE, NOT_RETAINED, QOS_0) == 0 && !hasPublishCapacity(STATE_TOPIC.length(), STATE_PAYLOAD_MAX_LENGTH, QOS_0)){
+        return false;
+      }
+
+      std::string payload = buildSchemaPayload(SENSOR_FIELDS, SENSOR_FIELD_COUNT);
 
       const char* payload_ch = payload.c_str();
 
       Serial.print(F("Publishing sensor readings: "));  
       Serial.println(payload_ch);
 
-      mqttclient.publish(STATE_TOPIC.c_str(), payload_ch, NOT_RETAINED, QOS_0); 
+      if(publishTraced(STATE_TOPIC.c_str(), payload_ch, NOT_RETAINED, QOS_0, TRACE_CHANNEL_STATE)){
+        state_published++;
+      }
+      else {
+        state_dropped++;
+      }
+      return true;
 }
 
-void ICACHE_FLASH_ATTR publishDiagnosticData(){
+/*
+  Rollup of one completed window, stamped with the time the window ended:
+  {"cpm_1h": 5.12, "cpm_1h_details": {"min": 3.10, "max": 8.00}, "dose_1h": 0.0965, "ts": 1760000000.000}
+*/
+bool ICACHE_FLASH_ATTR publishRollup(uint8_t tier){
+      const rollup_window &w = rollups.tiers[tier];
+      const std::string topic = buildRollupTopic(tier);
+      if(!hasPublishCapacity(topic.length(), ROLLUP_PAYLOAD_MAX_LENGTH, QOS_1)){
+        return false; // retried on the next pass
+      }
+      const std::string name = ROLLUP_TIER_NAMES[tier];
+      float mean = rollupMeanCpm(w);
       std::string payload = "{\
-\"wifi_rssi\": "+to_string(getRSSI())+", \
-\"wifi_ip\": \""+getIP()+"\", \
-\"wifi_mac\": \""+getMAC()+"\" }";
+\"cpm_"+name+"\": "+to_string(mean, "%.2f")+", \
+\"cpm_"+name+"_details\": {\"min\": "+to_string(w.closed.samples > 0 ? w.closed.cpm_min : mean, "%.2f")+", \
+\"max\": "+to_string(w.closed.samples > 0 ? w.closed.cpm_max : mean, "%.2f")+" }, \
+\"dose_"+name+"\": "+to_string(w.closed.pulses / (CPM_PER_USVH * 60.0), "%.4f")+", \
+\"ts\": "+timestampAt(w.started)+"}"; // the open window started when this one ended
+
+      const char* payload_ch = payload.c_str();
+
+      Serial.print(F("Publishing rollup: "));  
+      Serial.println(payload_ch);
+
+      return publishTraced(topic.c_str(), payload_ch, NOT_RETAINED, QOS_1, TRACE_CHANNEL_ROLLUP);
+}
+
+// Publish every rollup window that completed since the last call
+void ICACHE_FLASH_ATTR processRollups(){
+  rollupLoop(rollups, millis(), sensorPulses(), readCpm()); // per sensor, like the CPM samples
+  for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    if(rollups.tiers[tier].pending && publishRollup(tier)){
+      rollups.tiers[tier].pending = false;
+    }
+  }
+}
+
+#ifdef METRICS_PORT
+/*
+  Metric families served on the local /metrics endpoint, one per call (see metrics-server.h).
+  Printed straight from the counters into the socket.
+*/
+bool ICACHE_FLASH_ATTR writeMetric(Print &out, size_t index){
+  switch(index){
+    case 0:
+      writeMetricHeader(out, "radthing_pulses_total", "counter", "Radiation pulses since boot");
+      writeMetricValue(out, "radthing_pulses_total", nullptr, pulse_count, 0);
+      return true;
+    case 1:
+      writeMetricHeader(out, "radthing_lifetime_pulses_total", "counter", "Radiation pulses per sensor over the lifetime of the device");
+      writeMetricValue(out, "radthing_lifetime_pulses_total", nullptr, pulse_total_restored + sensorPulses(), 0);
+      return true;
+    case 2:
+      writeMetricHeader(out, "radthing_cpm", "gauge", "Counts per minute, sensor running estimate");
+      writeMetricValue(out, "radthing_cpm", nullptr, readCpm(), 2);
+      return true;
+    case 3:
+      writeMetricHeader(out, "radthing_window_cpm", "gauge", "Mean counts per minute over the last completed rollup window");
+      writeMetricValue(out, "radthing_window_cpm", "window=\"1m\"", rollupMeanCpm(rollups.tiers[ROLLUP_MINUTE]), 2);
+      writeMetricValue(out, "radthing_window_cpm", "window=\"1h\"", rollupMeanCpm(rollups.tiers[ROLLUP_HOUR]), 2);
+      writeMetricValue(out, "radthing_window_cpm", "window=\"1d\"", rollupMeanCpm(rollups.tiers[ROLLUP_DAY]), 2);
+      return true;
+    case 4:
+      writeMetricHeader(out, "radthing_dose_usvh", "gauge", "Dose rate in micro-sieverts per hour");
+      writeMetricValue(out, "radthing_dose_usvh", nullptr, readDose(), 3);
+      return true;
+    case 5:
+      writeMetricHeader(out, "radthing_dose_error_usvh", "gauge", "Dose rate error in micro-sieverts per hour");
+      writeMetricValue(out, "radthing_dose_error_usvh", nullptr, readDoseError(), 3);
+      return true;
+    case 6:
+      writeMetricHeader(out, "radthing_wifi_rssi_dbm", "gauge", "Wi-Fi received signal strength");
+      writeMetricValue(out, "radthing_wifi_rssi_dbm", nullptr, getRSSI(), 0);
+      return true;
+    case 7:
+      writeMetricHeader(out, "radthing_heap_free_bytes", "gauge", "Free heap");
+      writeMetricValue(out, "radthing_heap_free_bytes", nullptr, ESP.getFreeHeap(), 0);
+      writeMetricHeader(out, "radthing_heap_max_block_bytes", "gauge", "Largest allocatable heap block");
+      writeMetricValue(out, "radthing_heap_max_block_bytes", nullptr, ESP.getMaxFreeBlockSize(), 0);
+      return true;
+    case 8:
+      writeMetricHeader(out, "radthing_state_updates_total", "counter", "Sensor state updates by outcome");
+      writeMetricValue(out, "radthing_state_updates_total", "outcome=\"published\"", state_published, 0);
+      writeMetricValue(out, "radthing_state_updates_total", "outcome=\"merged\"", state_merged, 0);
+      writeMetricValue(out, "radthing_state_updates_total", "outcome=\"dropped\"", state_dropped, 0);
+      return true;
+    case 9:
+      writeMetricHeader(out, "radthing_uptime_seconds", "counter", "Seconds since boot");
+      writeMetricValue(out, "radthing_uptime_seconds", nullptr, millis() / 1000, 0);
+      return true;
+    case 10:
+      writeMetricHeader(out, "radthing_broker_rtt_ms", "gauge", "Smoothed round trip time to the MQTT broker");
+      writeMetricValue(out, "radthing_broker_rtt_ms", nullptr, linkclient.rttMillis(), 1);
+      writeMetricHeader(out, "radthing_broker_reconnects_total", "counter", "MQTT broker reconnects since boot");
+      writeMetricValue(out, "radthing_broker_reconnects_total", nullptr, linkclient.reconnects(), 0);
+      return true;
+  }
+  return false;
+}
+#endif
+
+// Publish one group of the diagnostics registry if any of its fields changed
+void ICACHE_FLASH_ATTR publishDiagnosticGroup(const std::string &topic, bool retained, unsigned long now){
+      if(!diagnosticsPending(retained, now)){
+        return;
+      }
+      std::string payload = buildDiagnosticPayload(retained);
 
       const char* payload_ch = payload.c_str();
 
       Serial.print(F("Publishing diagnostic readings: "));  
       Serial.println(payload_ch);
 
-      mqttclient.publish(DIAGNOSTIC_TOPIC.c_str(), payload_ch, NOT_RETAINED, QOS_0);   
+      if(publishTraced(topic.c_str(), payload_ch, retained, retained ? QOS_1 : QOS_0, TRACE_CHANNEL_DIAGNOSTICS)){
+        markDiagnosticsPublished(retained, now);
+      }
+}
+
+// Cheap to call often; only fields that are due are sampled and only changed groups are published
+void ICACHE_FLASH_ATTR publishDiagnosticData(){
+      unsigned long now = millis();
+      sampleDiagnostics(now);
+      publishDiagnosticGroup(FACT_TOPIC, RETAINED, now);
+      publishDiagnosticGroup(DIAGNOSTIC_TOPIC, NOT_RETAINED, now);
 }
 
-void ICACHE_FLASH_ATTR onRadiationPulse()
+/*
+  Hot/cold split:
+  Only the interrupt side of the pulse path is in IRAM (lib/dual-detector: it timestamps and queues the pulse), so an
+  interrupt never waits for an instruction cache refill from SPI flash. This callback runs later, from loop() via
+  dualDetectorLoop(), once the coincidence window has passed; it lives in flash with the rest of loop() and IRAM is
+  left for the SDK. It still only records the pulse: formatting and publishing are deferred to processPulses().
+  pulse_micros is the time of the pulse, taken in the pin's interrupt.
+*/
+void ICACHE_FLASH_ATTR onRadiationPulse(unsigned long pulse_micros)
 {
-  digitalWrite(LED_BUILTIN, LED_ON);
+  unsigned long now = millis();
+  traceEvent(TRACE_PULSE, 0);
+  intervalHistogramEvent(pulse_intervals, pulse_micros);
+  pulse_count++;
+  last_pulse_millis = now;
+  if(burstDetectorPulse(burst, now)){
+    alarm_pending = true;
+  }
+  if(pulse_pending){
+    state_merged++; // previous update not sent yet; the next publish carries both
+  }
+  else {
+    pending_since_micros = pulse_micros;
+  }
+  pulse_pending = true;
 
-  Serial.print(radiationWatch.uSvh());
-  Serial.print(" uSv/h +/- ");
-  Serial.println(radiationWatch.uSvhError());
+  digitalWrite(LED_BUILTIN, LED_ON); // turned off again once the reading has been published
+}
+
+/*
+  Alarm fast path: publish a change of the burst alarm state straight away.
+  Deliberately bypasses the backpressure handling in processPulses(); this is the one message worth blocking for.
+*/
+void ICACHE_FLASH_ATTR processAlarm()
+{
+  if(burstDetectorExpired(burst, millis())){
+    alarm_pending = true;
+  }
+  if(!alarm_pending){
+    return;
+  }
+  bool active = burst.active;
+  Serial.print(F("Publishing radiation burst alarm: "));
+  Serial.println(active ? "ON" : "OFF");
+  if(publishTraced(ALARM_TOPIC.c_str(), active ? "ON" : "OFF", RETAINED, QOS_1, TRACE_CHANNEL_ALARM)){
+    alarm_pending = false; // otherwise retried on the next pass
+  }
+}
+
+// Publish the reading for any pulse recorded since the last call.
+// If the send buffer is full the update stays pending and is retried on the next call, by which time it 
+// will carry the newest reading; it never blocks loop() waiting for the link.
+void ICACHE_FLASH_ATTR processPulses()
+{
+  if(!pulse_pending){
+    return;
+  }
 
   // Build MQTT payload and publish
-  publishSensorData(); // radiationWatch is a global var  
+  unsigned long start = micros();
+  if(!publishSensorData()){
+    return; // backpressure; still pending
+  }
+  pulse_pending = false;
+  pulse_wait_max = std::max(pulse_wait_max, start - pending_since_micros);
+  publish_time_max = std::max(publish_time_max, micros() - start);
+
+  Serial.print(readDose());
+  Serial.print(" uSv/h +/- ");
+  Serial.println(readDoseError());
 
   digitalWrite(LED_BUILTIN, LED_OFF);
 }
 
-#ifndef DISABLE_SERIAL_OUTPUT
-void ICACHE_FLASH_ATTR onNoise()
+// Called from loop() like onRadiationPulse(), once a noise event has left the detector's queue
+void ICACHE_FLASH_ATTR onNoise(unsigned long noise_micros)
 {
+  traceEvent(TRACE_NOISE, 0);
+  intervalHistogramEvent(noise_intervals, noise_micros);
+#ifndef DISABLE_SERIAL_OUTPUT
   Serial.println("Noise!");
-}
 #endif
+}
+
+/*
+  Interval histograms, counts per log2 bucket of microseconds (see interval-histogram.h), stamped with the end of the period:
+  {"period": 900, "first_bucket_us": 64, "pulses": [0,0,...], "noise": [0,0,...], "ts": 1760000000.000}
+*/
+void ICACHE_FLASH_ATTR processIntervalHistograms(){
+  unsigned long now = millis();
+  if(now - intervals_published_millis < INTERVAL_HIST_PERIOD){
+    return;
+  }
+  if(!hasPublishCapacity(INTERVAL_TOPIC.length(), INTERVAL_PAYLOAD_MAX_LENGTH, QOS_0)){
+    return; // retried on the next pass; the period is stretched rather than the counts lost
+  }
+
+  // take a consistent copy of both histograms; the counts are only taken out of the live ones once published
+  noInterrupts();
+  interval_histogram pulses = pulse_intervals;
+  interval_histogram noise = noise_intervals;
+  interrupts();
+
+  std::string payload = "{\"period\": "+to_string((int)((now - intervals_published_millis) / 1000))+", \
+\"first_bucket_us\": "+to_string(1 << INTERVAL_HIST_FIRST_LOG2)+", \
+\"pulses\": "+buildIntervalHistogramArray(pulses)+", \
+\"noise\": "+buildIntervalHistogramArray(noise)+", \
+\"ts\": "+timestampAt(now)+"}";
+
+  const char* payload_ch = payload.c_str();
+
+  Serial.print(F("Publishing interval histograms: "));  
+  Serial.println(payload_ch);
+
+  if(!publishTraced(INTERVAL_TOPIC.c_str(), payload_ch, NOT_RETAINED, QOS_0, TRACE_CHANNEL_INTERVALS)){
+    return; // retried on the next pass, with whatever was counted since added in
+  }
+  noInterrupts();
+  intervalHistogramRemove(pulse_intervals, pulses);
+  intervalHistogramRemove(noise_intervals, noise);
+  interrupts();
+  intervals_published_millis = now;
+}
 
 void ICACHE_FLASH_ATTR initRadiationWatch(){
   Serial.println(F("Initialize RadiationWatch sensor..."));
-  radiationWatch.setup();
+  burstDetectorReset(burst, SENSOR_COUNT); // the fused stream of two sensors needs twice the pulses for the same per sensor rate
+  rollupBegin(rollups, millis(), sensorPulses());
+  intervalHistogramBegin(pulse_intervals);
+  intervalHistogramBegin(noise_intervals);
+  intervals_published_millis = millis();
+  alarm_pending = true; // publish the initial (off) state once connected
+
   // Register the callback
-  radiationWatch.registerRadiationCallback(&onRadiationPulse); 
-   
-#ifndef DISABLE_SERIAL_OUTPUT
-  radiationWatch.registerNoiseCallback(&onNoise);
+#ifdef SIG2_PIN
+  Serial.println(F("Second sensor enabled; fusing both pulse streams"));
+  dualDetectorBegin(SIG_PIN, NS_PIN, SIG2_PIN, NS2_PIN, &onRadiationPulse, &onNoise);
+#else
+  dualDetectorBegin(SIG_PIN, NS_PIN, &onRadiationPulse, &onNoise);
 #endif
 }
 
@@ -222,22 +954,132 @@ void ICACHE_FLASH_ATTR messageReceived(String &topic, String &payload) {
   // sending and receiving acknowledgments. Instead, change a global variable,
   // or push to a queue and handle it in the loop after calling `mqttclient.loop()`.
 
-  // Normally we only care about listening to the ".../refresh_rate/set" topic
-  // However, early on we want to check the ".../refresh_rate/get" topic to see if a previously saved setting is available.
-  // After checking, we will then unsubscribe from the ".../refresh_rate/get" topic. 
-  // String set_rate_topic_str = String(SUB_RATE_TOPIC);
-  // String get_rate_topic_str = String(PUB_RATE_TOPIC);  
-  // if ((set_rate_topic_str.equals(topic)) || (get_rate_topic_str.equals(topic))){
-  // }
+  if (topic.equals(TRACE_COMMAND_TOPIC.c_str()) && payload.equals("dump")){
+    trace_dump_requested = true;
+  }
+
+  // The saved setting comes from the flash log, so only the ".../refreshrate/set" topic is of interest
+  if (topic.equals(REFRESH_RATE_SET_TOPIC.c_str())){
+    long minutes = payload.toInt();
+    if (minutes >= (long)REFRESH_RATE_MIN && minutes <= (long)REFRESH_RATE_MAX){
+      refresh_rate_requested = minutes;
+    }
+  }
+}
+
+// Apply a refresh rate change requested through the number control, persist it and report it back
+void ICACHE_FLASH_ATTR processRefreshRate(){
+  if (refresh_rate_requested != 0){
+    unsigned long minutes = refresh_rate_requested;
+    refresh_rate_requested = 0;
+    refresh_rate = minutes * 60000;
+    flashLogSet(FLASH_LOG_REFRESH_RATE, minutes, true); // user setting; written after FLASH_LOG_SETTLE
+    refresh_rate_announce = true;
+  }
+  if (refresh_rate_announce){
+    std::string minutes = to_string((int)(refresh_rate / 60000));
+    if (mqttclient.publish(REFRESH_RATE_GET_TOPIC.c_str(), minutes.c_str(), RETAINED, QOS_1)){
+      refresh_rate_announce = false; // otherwise retried on the next pass
+    }
+  }
+}
+
+// Send the event trace, one chunk per call so normal work carries on in between
+void ICACHE_FLASH_ATTR processTraceDump(){
+  static uint8_t chunk[sizeof(trace_dump_header) + TRACE_DUMP_CHUNK * sizeof(trace_record)];
+  if (trace_dump_requested){
+    trace_dump_requested = false;
+    traceDumpRequest(millis(), timebaseNow(wallclock)); // dated, so the dump lines up with the "ts" of the readings
+  }
+  size_t length = traceBuildDumpChunk(chunk, sizeof(chunk));
+  if (length == 0 || !hasPublishCapacity(TRACE_DUMP_TOPIC.length(), length, QOS_0)){
+    return;
+  }
+  if (mqttclient.publish(TRACE_DUMP_TOPIC.c_str(), (const char*)chunk, (int)length, NOT_RETAINED, QOS_0)){
+    traceDumpChunkSent(); // otherwise the same chunk is retried on the next pass
+  }
+}
+
+// Anything for loop() to do straight away; otherwise it idles
+bool ICACHE_FLASH_ATTR workPending(){
+  bool rollup_pending = false;
+  for (uint8_t tier = 0; tier < ROLLUP_TIERS; tier++)
+  {
+    rollup_pending = rollup_pending || rollups.tiers[tier].pending;
+  }
+  return pulse_pending || alarm_pending || rollup_pending || refresh_rate_requested != 0 || refresh_rate_announce 
+    || trace_dump_requested || traceDumping()
+#ifdef METRICS_PORT
+    || metricsServerBusy()
+#endif
+    ;
+}
+
+unsigned long lastMillis = 0;                   // millis() of the last availability update
+
+// Milliseconds until the earliest deadline of loop()'s schedulers, at most LOOP_IDLE_MAX_MS; LOOP_RETRY_MS if one has
+// passed already (its work is waiting on the link)
+unsigned long ICACHE_FLASH_ATTR idleMillis(unsigned long now){
+  unsigned long since_intervals = now - intervals_published_millis;
+  unsigned long since_online = now - lastMillis;
+  unsigned long due = std::min({
+    LOOP_IDLE_MAX_MS,
+    dualDetectorDueIn(micros()) / 1000 + 1, // rounded up; released once the window has passed
+    burstDetectorDueIn(burst, now),
+    rollupDueIn(rollups, now),
+    diagnosticsDueIn(now),
+    flashLogDueIn(now),
+    linkclient.replyPollMillis(), // a PINGRESP read late would count as a slow link
+    since_intervals >= INTERVAL_HIST_PERIOD ? 0 : INTERVAL_HIST_PERIOD - since_intervals,
+    since_online > refresh_rate ? 0 : refresh_rate + 1 - since_online,
+  });
+  return due > 0 ? due : LOOP_RETRY_MS;
+}
+
+/*
+  Idle until the next deadline. A pulse (or noise) queued by the detector's interrupt ends the idle early (see
+  dualDetectorQueued()), so loop() goes on to wait for just its coincidence window. esp_delay() yields to the Wi-Fi
+  stack meanwhile, as delay() does.
+*/
+void ICACHE_FLASH_ATTR idle(){
+  uint32_t queued = dualDetectorQueued(); // before the deadlines are taken, so no pulse slips in between
+  unsigned long idle_start = micros();
+  esp_delay(idleMillis(millis()), [queued](){ return dualDetectorQueued() == queued; });
+  idle_micros += micros() - idle_start;
+}
+
+// Record Wi-Fi status changes in the event trace
+void ICACHE_FLASH_ATTR traceWiFiState(){
+  static wl_status_t last_status = WL_IDLE_STATUS;
+  wl_status_t status = WiFi.status();
+  if (status != last_status){
+    last_status = status;
+    traceEvent(TRACE_WIFI_STATE, status);
+  }
+}
+
+// Restore the lifetime pulse count and the settings from the flash log
+void ICACHE_FLASH_ATTR restorePersistentValues(){
+  uint32_t values[FLASH_LOG_VALUES];
+  values[FLASH_LOG_PULSE_TOTAL] = 0;
+  values[FLASH_LOG_REFRESH_RATE] = refresh_rate / 60000; // defaults, used if the log is empty or unreadable
+  if (!flashLogBegin(values)){
+    Serial.println(F("No flash log found; using defaults"));
+  }
+  pulse_total_restored = values[FLASH_LOG_PULSE_TOTAL];
+  if (values[FLASH_LOG_REFRESH_RATE] >= REFRESH_RATE_MIN && values[FLASH_LOG_REFRESH_RATE] <= REFRESH_RATE_MAX){
+    refresh_rate = values[FLASH_LOG_REFRESH_RATE] * 60000;
+  }
 }
 
 void ICACHE_FLASH_ATTR indicateMQTTProblem(byte return_code){
-  Serial.println(F("ERROR: MQTT problem!"));
+  Serial.print(F("ERROR: MQTT problem! code "));
+  Serial.println(return_code);
 }
 
 // populate list of topics to subscribe to
 std::vector<std::string> ICACHE_FLASH_ATTR getAllSubscriptionTopics(){  
-  std::vector<std::string> topics = { }; 
+  std::vector<std::string> topics = { REFRESH_RATE_SET_TOPIC, TRACE_COMMAND_TOPIC }; 
   return topics;
 }
 
@@ -252,14 +1094,22 @@ void ICACHE_FLASH_ATTR assertConnectivity(){
     do{
       if(assertNetworkConnectivity(LOCAL_ENV_WIFI_SSID, LOCAL_ENV_WIFI_PASSWORD)){ // will block until connected, waiting WIFI_ATTEMPT_COOLDOWN between attempts 
         // new connection established, ASSUME need to re-initialize MQTT client
-        initMQTTClient(LOCAL_ENV_MQTT_BROKER_HOST, LOCAL_ENV_MQTT_BROKER_PORT, AVAILABILITY_TOPIC.c_str());          
+        initMQTTClient(LOCAL_ENV_MQTT_BROKER_HOST, LOCAL_ENV_MQTT_BROKER_PORT, AVAILABILITY_TOPIC.c_str(), linkclient);
         mqttclient.disconnect();  // necessary after init?       
         subscription_required = true;  
+        invalidateDiagnosticFacts(); // IP address may have changed
         delay(100); // yield to allow for mqtt client activity post initialization
       }         
+      traceWiFiState();
+      bool attempt = !mqttclient.connected();
+      if(attempt){
+        delay(mqttReconnectDelay());  // jittered from the first reconnect on, backing off after failures; yields to network and mqtt client activity
+        mqttclient.setKeepAlive(linkclient.keepAlive()); // short on a flaky link, long on a stable one
+      }
       mqtt_connected = connectMQTTBroker(DEVICE_ID, LOCAL_ENV_MQTT_USERNAME, LOCAL_ENV_MQTT_PASSWORD);
-      if(!mqtt_connected){
-        delay(MQTT_ATTEMPT_COOLDOWN);  // yield to allow for network and mqtt client activity between broker connection attempts   
+      if(attempt){
+        traceEvent(TRACE_BROKER_CONNECT, mqtt_connected ? 1 : 0);
+        subscription_required |= mqtt_connected; // a clean session starts without subscriptions
       }
     } 
     while(!mqtt_connected); // will try once to connect to broker
@@ -297,50 +1147,111 @@ void ICACHE_FLASH_ATTR setup()
   Serial.println(DEVICE_NAME);
   Serial.println(F("************************************"));
 
+  traceBegin();
+  restorePersistentValues();
   initRadiationWatch();
 
   Serial.println(F("************************************"));
 
   // Connect to wifi & mqtt & subscribe
+  beginNetworkEvents(); // connection loss is reported by the SDK, so loop() does not have to poll for it
+  timebaseBegin(wallclock, LOCAL_ENV_NTP_SERVER); // SNTP starts as soon as the network is up
+#ifdef MQTTSN_GATEWAY_PORT
+  mqttsnBegin(LOCAL_ENV_MQTTSN_GATEWAY_HOST, MQTTSN_GATEWAY_PORT);
+#endif
   assertConnectivity();  // Runs until network and broker connectivity established and all subscriptions successful
+  network_ready_millis = millis();
   printNetworkDetails();
+#ifdef METRICS_PORT
+  metricsServerBegin(METRICS_PORT, writeMetric);
+#endif
 
   Serial.println(F("************************************"));
 
+  diag_fields = getDiagnosticFields(DIAG_FIELDS, DIAG_FIELD_COUNT); // diagnostic discovery metadata is generated from the registry
+
+  // Everything built for discovery comes out of one arena block, handed back in one piece once discovery is done.
+  // What discovery leaves behind for good is allocated first: above the block it would split the heap once that is freed
+  getMAC(); // cached for good
+  heap_block_before_discovery = ESP.getMaxFreeBlockSize();
+  phaseArenaBegin();
+
   // This metadata is assembled into HA-compatible discovery topics and payloads
   discovery_metadata_list = getAllDiscoveryMessagesMetadata(); 
   discovery_config_metadata_list = getAllDiscoveryConfigMessagesMetadata();
   discovery_measured_diagnostic_metadata_list = getAllDiscoveryMeasuredDiagnosticMessagesMetadata();
   discovery_fact_diagnostic_metadata_list = getAllDiscoveryFactDiagnosticMessagesMetadata();
+  discovery_binary_metadata_list = getAllDiscoveryBinaryMessagesMetadata();
   
   // Must successfully publish all discovery messages before proceding
 
+  // A fleet that boots together (ie. after a power outage) would otherwise send all its retained discovery messages at the 
+  // same moment; spread them out by a fixed per-device offset derived from the MAC address
+  delay(deviceSeed() % DISCOVERY_JITTER_MAX);
+
+  unsigned long discovery_start = millis();
+  discovery_messages = discovery_metadata_list.size() + discovery_config_metadata_list.size() + discovery_measured_diagnostic_metadata_list.size() + discovery_fact_diagnostic_metadata_list.size() + discovery_binary_metadata_list.size();
   int discovery_messages_pending_publication;
   do {
     discovery_messages_pending_publication = publishDiscoveryMessages(); // Create the discovery messages and publish for each topic. Update published flag upon successful publication.
+    if(discovery_messages_pending_publication != 0){
+      assertConnectivity(); // a failed publish closes the broker connection; the rest would fail at once without it
+    }
   }
   while(discovery_messages_pending_publication != 0);
+  discovery_millis = millis() - discovery_start;
 
   // no longer need discovery metadata, so purge it from memory
   purgeDiscoveryMetadata();
+  phaseArenaEnd();
+  heap_block_after_discovery = ESP.getMaxFreeBlockSize();
+  Serial.printf("Largest free heap block %lu before discovery, %lu after (arena peak %u bytes, %lu overflows)\n", heap_block_before_discovery, heap_block_after_discovery, (unsigned)phaseArenaPeak(), phaseArenaOverflows());
 
   // Publish availability online message (just once after all discovery messages have been successfully published)
   publishOnline(AVAILABILITY_TOPIC.c_str());
+  ready_millis = millis();
+  processAlarm();
+  processRefreshRate();
   publishDiagnosticData();  
 }
 
-unsigned long refresh_rate = 60000*5; // 5 minutes; frequency of sensor updates in milliseconds
-unsigned long lastMillis = 0;
 void ICACHE_FLASH_ATTR loop()
 {
-  radiationWatch.loop(); // potential call to onRadiationPulse(), onNoise()
-  mqttclient.loop(); // potential call to messageReceived()
-  assertConnectivity(); // Runs until network and broker connectivity established and all subscriptions successful
+  unsigned long loop_start = millis();
+  dualDetectorLoop(micros(), millis()); // potential call to onRadiationPulse(), onNoise()
+  processAlarm(); // alarm fast path, ahead of everything else
+  processPulses(); // publish any reading captured by onRadiationPulse()
+  processRollups(); // publish any completed minute/hour/day window
+  processIntervalHistograms(); // publish and clear the interval histograms every INTERVAL_HIST_PERIOD
+#ifdef METRICS_PORT
+  metricsServerLoop(millis()); // one step of a pending /metrics scrape, if any
+#endif
+  bool broker_connected = mqttclient.loop(); // potential call to messageReceived(); false once the broker connection is lost
+  if(!broker_connected || !networkUp()){
+    assertConnectivity(); // Runs until network and broker connectivity established and all subscriptions successful
+    publishOnline(AVAILABILITY_TOPIC.c_str()); // the broker published the will ("offline") when the connection was lost
+    lastMillis = millis();
+  }
+  publishDiagnosticData(); // only publishes diagnostics that changed
+  processRefreshRate(); // apply and persist a refresh rate change received by messageReceived()
+  processTraceDump(); // send the next chunk of a requested trace dump
+
+  flashLogSet(FLASH_LOG_PULSE_TOTAL, pulse_total_restored + sensorPulses(), false);
+  flashLogLoop(millis()); // coalesced; writes at most once per FLASH_LOG_INTERVAL
 
   if (millis() - lastMillis > refresh_rate) {   
     lastMillis = millis();
     
     publishOnline(AVAILABILITY_TOPIC.c_str());
-    publishDiagnosticData();
+  }
+
+  unsigned long loop_time = millis() - loop_start;
+  if (loop_time > LOOP_OVERRUN_MS){
+    traceEvent(TRACE_OVERRUN, std::min(loop_time, 65535UL));
+  }
+
+  loop_iterations++;
+  if (!workPending()){
+    idle();
   }
 }
\ No newline at end of file
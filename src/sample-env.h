@@ -15,4 +15,10 @@
 #define LOCAL_ENV_MQTT_BROKER_HOST IPAddress(10,0,0,2)
 #define LOCAL_ENV_MQTT_BROKER_PORT 1883
 
+// Time server for the readings' timestamps; optional, defaults to pool.ntp.org
+//#define LOCAL_ENV_NTP_SERVER "10.0.0.1"
+
+// MQTT-SN gateway, only used with MQTTSN_GATEWAY_PORT (see radthing.h); optional, defaults to the broker host
+//#define LOCAL_ENV_MQTTSN_GATEWAY_HOST IPAddress(10,0,0,2)
+
 #endif
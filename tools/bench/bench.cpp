@@ -0,0 +1,158 @@
+/*
+  Host benchmarks of the firmware hot paths. Built and run by tools/bench/run.py (see there, and README "Benchmarks").
+
+  The firmware is included as a single translation unit, so its file scope declarations (SENSOR_FIELDS, DIAG_FIELDS,
+  the topics) are reachable without changing it; lib/ and the Arduino stand-ins in host/ are linked as they are.
+  Each benchmark repeats its operation for at least --min-time (after one warm-up call), in BENCH_BATCHES batches, and
+  reports the nanoseconds per operation of the fastest batch, and heap allocations and bytes allocated per operation.
+  Allocations are counted by host/alloc-count.cpp, so the phase arena's block is counted too.
+  Host timings do not translate into ESP8266 cycles; they are meant for comparing one revision with another.
+
+  Output: one JSON object on stdout, {"benchmarks": [{"name", "iterations", "ns_per_op", "allocs_per_op", "bytes_per_op"}]}
+*/
+#include "../../src/radthing.cpp"
+#include "host/alloc-count.h"
+
+#include <chrono>
+
+// *********************************************************************************************************************
+// *** Subjects ***
+static volatile size_t sink; // keeps results alive
+
+// The discovery phase of setup(): metadata, every message built and published, metadata purged, arena released
+static void benchDiscovery(){
+  phaseArenaBegin();
+  discovery_metadata_list = getAllDiscoveryMessagesMetadata();
+  discovery_config_metadata_list = getAllDiscoveryConfigMessagesMetadata();
+  discovery_measured_diagnostic_metadata_list = getAllDiscoveryMeasuredDiagnosticMessagesMetadata();
+  discovery_fact_diagnostic_metadata_list = getAllDiscoveryFactDiagnosticMessagesMetadata();
+  discovery_binary_metadata_list = getAllDiscoveryBinaryMessagesMetadata();
+  sink = publishDiscoveryMessages();
+  purgeDiscoveryMetadata();
+  phaseArenaEnd();
+}
+
+// A pulse from the interrupt to its published reading
+static void benchPulse(){
+  onRadiationPulse(micros());
+  processPulses();
+}
+
+struct benchmark{
+  const char* name;
+  void (*op)();
+};
+
+const benchmark BENCHMARKS[] = {
+  { "publishSensorData", []{ sink = publishSensorData(); } },
+  { "pulse_pipeline", benchPulse },
+  { "publishDiscoveryMessages", benchDiscovery },
+  { "to_string/double", []{ sink = to_string(readFrequency(), "%2.4f").size(); } },
+  { "to_string/timestamp", []{ sink = to_string(1760000000.123, "%.3f").size(); } },
+  { "to_string/int", []{ sink = to_string((int)refresh_rate).size(); } },
+  { "buildStateTopic", []{ sink = buildStateTopic("sensor", DEVICE_ID).size(); } },
+  { "buildAvailabilityTopic", []{ sink = buildAvailabilityTopic("sensor", DEVICE_ID).size(); } },
+  { "buildDiagnosticTopic", []{ sink = buildDiagnosticTopic("sensor", DEVICE_ID).size(); } },
+  { "buildFactTopic", []{ sink = buildFactTopic("sensor", DEVICE_ID).size(); } },
+  { "buildEntityStateTopic", []{ sink = buildEntityStateTopic("binary_sensor", DEVICE_ID, ALARM_SENSOR_ID).size(); } },
+  { "buildSetterTopic", []{ sink = buildSetterTopic("number", DEVICE_ID, REFRESH_RATE_CONTROL).size(); } },
+  { "buildGetterTopic", []{ sink = buildGetterTopic("number", DEVICE_ID, REFRESH_RATE_CONTROL).size(); } },
+  { "buildDiscoveryTopic", []{ sink = buildDiscoveryTopic("sensor", DEVICE_ID, "dose").size(); } },
+};
+
+// *********************************************************************************************************************
+// *** Runner ***
+// The measuring time is split into batches and the fastest one counts: other processes and interrupts only ever add
+// time, so the fastest batch is the closest to the cost of the code itself
+const int BENCH_BATCHES = 5;
+
+struct result{
+  unsigned long long iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+};
+
+static result run(const benchmark &b, double min_time_ns){
+  b.op(); // warm-up: first-call allocations and cold caches
+  unsigned long long iterations = 1;
+  for (double elapsed = 0; elapsed < min_time_ns / BENCH_BATCHES; iterations *= 2)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long long i = 0; i < iterations; i++)
+    {
+      b.op();
+    }
+    elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  unsigned long long allocs = alloc_count;
+  unsigned long long bytes = alloc_bytes;
+  double fastest = 0;
+  for (int batch = 0; batch < BENCH_BATCHES; batch++)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long long i = 0; i < iterations; i++)
+    {
+      b.op();
+    }
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    fastest = batch == 0 ? elapsed : std::min(fastest, elapsed);
+  }
+  unsigned long long total = iterations * BENCH_BATCHES;
+  return { total, fastest / iterations, (double)(alloc_count - allocs) / total, (double)(alloc_bytes - bytes) / total };
+}
+
+// The parts of setup() the subjects depend on, without waiting for a network. The clock is simulated, so five minutes
+// of pulses at a few tens of CPM (irregular, so the rate is not round) give the readings plausible values
+static void benchSetup(){
+  hostClockBegin(1000000);
+  hostPinWrite(SIG_PIN, HIGH);
+  initRadiationWatch();
+  for (unsigned int i = 0; i < 150; i++)
+  {
+    hostClockAdvance(1000000 + (i * 7919) % 2000000);
+    hostPinWrite(SIG_PIN, LOW);
+    hostPinWrite(SIG_PIN, HIGH);
+    dualDetectorLoop(micros(), millis());
+  }
+  initMQTTClient(LOCAL_ENV_MQTT_BROKER_HOST, LOCAL_ENV_MQTT_BROKER_PORT, AVAILABILITY_TOPIC.c_str(), linkclient);
+  mqttclient.connect(DEVICE_ID, LOCAL_ENV_MQTT_USERNAME, LOCAL_ENV_MQTT_PASSWORD);
+  timebaseSync(wallclock, 1760000000000000ULL, micros64()); // readings carry a timestamp, as once SNTP has answered
+  diag_fields = getDiagnosticFields(DIAG_FIELDS, DIAG_FIELD_COUNT);
+}
+
+int main(int argc, char** argv){
+  const char* filter = nullptr;
+  double min_time_ms = 100;
+  for (int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc){
+      filter = argv[++i];
+    }
+    else if(strcmp(argv[i], "--min-time") == 0 && i + 1 < argc){
+      min_time_ms = atof(argv[++i]);
+    }
+    else {
+      fprintf(stderr, "usage: %s [--filter SUBSTRING] [--min-time MILLISECONDS]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  benchSetup();
+  printf("{\"benchmarks\": [");
+  bool first = true;
+  for (const benchmark &b : BENCHMARKS)
+  {
+    if(filter != nullptr && strstr(b.name, filter) == nullptr){
+      continue;
+    }
+    result r = run(b, min_time_ms * 1e6);
+    printf("%s\n  {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+      first ? "" : ",", b.name, r.iterations, r.ns_per_op, r.allocs_per_op, r.bytes_per_op);
+    fflush(stdout);
+    first = false;
+  }
+  printf("\n]}\n");
+  return 0;
+}
@@ -0,0 +1,206 @@
+/*
+  Broker scenario tests: the real setup() and loop() against the in-process broker (host/fake-broker.h) over each
+  network profile of lib/fault-client (good, weak WiFi, flaky), on simulated time. Per profile, in a process of its own
+  so that every run starts from a fresh boot:
+  - boot: connect time, discovery time and rate, time to online; every discovery config retained at the broker, the
+    device online, the command topics subscribed
+  - steady state: Poisson pulses on the sensor's pin; state messages the client published against those the broker
+    received, messages and bytes per minute at the broker, keep-alive pings
+  - command round trip: a refresh rate set by another client, until the device's retained answer reaches the broker
+  - broker restart: every connection broken; the will marks the device offline, then how long until it is back online
+  Checks: the above hold on every profile, nothing the client counted as published is missing at the broker beyond
+  what was in flight when a connection broke, and the device is back online within RECOVERY_LIMIT_MS of every break.
+
+  tools/bench/harness.py broker-scenarios -- [--profile good|weak-wifi|flaky] [--minutes M] [--cpm R] [--seed N]
+*/
+#include "../../src/radthing.cpp"
+#include "host/fake-broker.h"
+#include "host/pulse-simulator.h"
+#include "harness.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct scenario_profile{
+  const char *name;
+  network_profile network;
+};
+
+const scenario_profile PROFILES[] = {
+  { "good", NETWORK_PROFILE_GOOD },
+  { "weak-wifi", NETWORK_PROFILE_WEAK_WIFI },
+  { "flaky", NETWORK_PROFILE_FLAKY },
+};
+
+const uint64_t LOOP_PASS_US = 100;                  // simulated time a loop() pass takes, on top of its idle
+const unsigned long COMMAND_AT_MS = 60000;          // into the steady state
+const unsigned long RESTART_AT_MS = 120000;
+const unsigned long RECOVERY_LIMIT_MS = 30000;      // back online after a break, at the latest
+
+static pulse_simulator sim;
+
+struct scenario_run{
+  unsigned long published = 0;                      // state messages the client published
+  unsigned long received = 0;                       // ...and the broker received
+  unsigned long messages = 0;                       // everything the broker received in the steady state
+  unsigned long long bytes = 0;
+  uint64_t command_us = 0;                          // refresh rate set by another client
+  uint64_t answered_us = 0;                         // the device's answer arrived at the broker
+  uint64_t offline_us = 0;                          // the will arrived; 0 while online
+  unsigned int offline = 0;                         // times marked offline, while online
+  std::vector<double> recovery_s;                   // offline to online again
+};
+
+static scenario_run run;
+
+static host_link linkOf(const network_profile &p){
+  return { p.rtt_ms, p.bytes_per_sec, p.loss_percent, p.disconnect_every_ms, FAULT_RETRANSMIT_MS };
+}
+
+static void firePulse(uint64_t at){
+  if(at > micros64()){
+    hostClockAdvance(at - micros64());
+  }
+  hostPinWrite(SIG_PIN, LOW);   // active low
+  hostPinWrite(SIG_PIN, HIGH);
+}
+
+static void pulsesDue(uint64_t until_us){
+  pulseSimulatorLoop(sim, until_us);
+}
+
+static void onPublished(const char *topic, const char *, int){
+  run.published += STATE_TOPIC == topic ? 1 : 0;
+}
+
+static void onBrokerMessage(const fake_broker_message &m){
+  run.messages++;
+  run.bytes += m.topic.length() + m.payload.length();
+  run.received += m.topic == STATE_TOPIC ? 1 : 0;
+  if(m.topic == REFRESH_RATE_GET_TOPIC && run.command_us > 0 && run.answered_us == 0){
+    run.answered_us = m.at_us;
+  }
+  if(m.topic == AVAILABILITY_TOPIC){
+    if(m.payload == "offline"){
+      run.offline += run.offline_us == 0 ? 1 : 0;
+      run.offline_us = run.offline_us == 0 ? m.at_us : run.offline_us; // from the first will until online again
+    }
+    else if(run.offline_us > 0){
+      run.recovery_s.push_back((m.at_us - run.offline_us) / 1e6);
+      run.offline_us = 0;
+    }
+  }
+}
+
+static void runUntil(uint64_t until_us){
+  while(micros64() < until_us){
+    loop();
+    hostClockAdvance(LOOP_PASS_US);
+    fakeBrokerPoll();
+  }
+}
+
+static bool retainedIs(const std::string &topic, const char *payload){
+  auto r = fakeBrokerRetained().find(topic);
+  return r != fakeBrokerRetained().end() && r->second.payload == payload;
+}
+
+static void scenario(const scenario_profile &p, unsigned int minutes, float cpm){
+  const host_link link = linkOf(p.network);
+  printf("%s: rtt %lu ms, %lu B/s, %u%% loss, breaks every %lu s\n", p.name, link.rtt_ms, link.bytes_per_sec,
+    link.loss_percent, link.disconnect_every_ms / 1000);
+  fakeBrokerLink(link);
+  fakeBrokerOnMessage(onBrokerMessage);
+  MQTTClient::onPublished(onPublished);
+
+  // Boot
+  const unsigned long boot_ms = millis();
+  setup();
+  unsigned long configs = 0;
+  for (const auto &r : fakeBrokerRetained())
+  {
+    configs += r.first.size() > 7 && r.first.compare(r.first.size() - 7, 7, "/config") == 0 ? 1 : 0;
+  }
+  unsigned long jitter_ms = deviceSeed() % DISCOVERY_JITTER_MAX;
+  printf("  boot: connected %lu ms, %lu discovery messages in %lu ms (%.1f msg/s), online %lu ms (%lu ms of jitter); %lu connection breaks\n",
+    network_ready_millis - boot_ms, discovery_messages, discovery_millis,
+    discovery_millis > 0 ? discovery_messages * 1000.0 / discovery_millis : 0.0, ready_millis - boot_ms, jitter_ms,
+    fakeBrokerStats().wills);
+  check(configs == discovery_messages, "%s: every discovery config retained at the broker (%lu of %lu)", p.name, configs, discovery_messages);
+  check(retainedIs(AVAILABILITY_TOPIC, "online"), "%s: online after boot", p.name);
+  check(fakeBrokerSubscribed(REFRESH_RATE_SET_TOPIC.c_str()) && fakeBrokerSubscribed(TRACE_COMMAND_TOPIC.c_str()),
+    "%s: command topics subscribed", p.name);
+
+  // Steady state, with a command from another client and a broker restart on the way
+  const fake_broker_stats before = fakeBrokerStats();
+  run = scenario_run();
+  const uint64_t start_us = micros64();
+  const uint64_t end_us = start_us + minutes * 60000000ULL;
+  sim = pulseSimulatorPoisson(cpm);
+  pulseSimulatorBegin(sim, firePulse, start_us);
+  hostClockOnAdvance(pulsesDue);
+  runUntil(start_us + COMMAND_AT_MS * 1000ULL);
+  run.command_us = micros64();
+  fakeBrokerPublish(REFRESH_RATE_SET_TOPIC.c_str(), "2");
+  runUntil(start_us + RESTART_AT_MS * 1000ULL);
+  fakeBrokerDrop();
+  runUntil(end_us);
+  sim.callback = nullptr;
+  runUntil(end_us + 10000000); // let what is in flight arrive
+  const fake_broker_stats &after = fakeBrokerStats();
+
+  unsigned long breaks = after.wills - before.wills;
+  unsigned long lost = run.published > run.received ? run.published - run.received : 0;
+  double worst = run.recovery_s.empty() ? 0 : *std::max_element(run.recovery_s.begin(), run.recovery_s.end());
+  printf("  steady: %lu state messages published, %lu received; %.1f messages/min, %.0f B/min at the broker; %lu pings\n",
+    run.published, run.received, run.messages / (double)minutes, run.bytes / (double)minutes, after.pings - before.pings);
+  printf("  command round trip %.3f s; %lu connection breaks, %lu reconnects, back online after %.2f s at worst\n",
+    run.answered_us > 0 ? (run.answered_us - run.command_us) / 1e6 : -1.0, breaks, after.connects - before.connects, worst);
+  check(run.answered_us > 0 && retainedIs(REFRESH_RATE_GET_TOPIC, "2"), "%s: refresh rate command answered", p.name);
+  check(fakeBrokerSubscribed(REFRESH_RATE_SET_TOPIC.c_str()) && fakeBrokerSubscribed(TRACE_COMMAND_TOPIC.c_str()),
+    "%s: command topics subscribed again after the restart", p.name);
+  check(lost <= breaks, "%s: state messages missing at the broker (%lu) only where a connection broke (%lu)", p.name, lost, breaks);
+  check(run.offline >= 1 && run.recovery_s.size() == run.offline, "%s: online again every time it went offline (%u of %u)",
+    p.name, (unsigned)run.recovery_s.size(), run.offline);
+  check(worst * 1000 <= RECOVERY_LIMIT_MS, "%s: back online within %lu ms of a break (%.0f ms)", p.name, RECOVERY_LIMIT_MS, worst * 1000);
+  check(fakeBrokerSessions() == 1 && retainedIs(AVAILABILITY_TOPIC, "online"), "%s: connected and online at the end", p.name);
+}
+
+int main(int argc, char **argv){
+  const char *only = nullptr;
+  unsigned int minutes = 30;
+  float cpm = 30;
+  unsigned long seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--profile") == 0) only = argv[i + 1];
+    else if(strcmp(argv[i], "--minutes") == 0) minutes = std::max(3UL, strtoul(argv[i + 1], nullptr, 10));
+    else if(strcmp(argv[i], "--cpm") == 0) cpm = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+  }
+
+  // A boot per profile: each runs in a child, with the firmware's globals as they are before setup()
+  int failed = 0;
+  for (const scenario_profile &p : PROFILES)
+  {
+    if(only != nullptr && strcmp(only, p.name) != 0){
+      continue;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0){
+      randomSeed(seed);
+      hostClockBegin(1000000);
+      hostPinWrite(SIG_PIN, HIGH);
+      scenario(p, minutes, cpm);
+      int result = harnessResult();
+      fflush(stdout);
+      _exit(result);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    failed += WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+  }
+  check(failed == 0, "every profile passed (%d failed)", failed);
+  return harnessResult();
+}
@@ -0,0 +1,260 @@
+/*
+  Burst alarm replay benchmark (lib/burst-detector): how often the normal 2 to 5 CPM background trips the alarm, and
+  how long a real spike takes to.
+  - false alarms: years of Poisson background replayed straight into the detector (the detector alone, so decades
+    take seconds), against the estimate of burst-detector.h, r * P(Poisson(r*T) >= N-1) * seconds/yr; and the fused
+    stream of two sensors at 5 CPM each, against the doubled threshold
+  - detection latency: the real setup() and loop() on simulated time, 3 CPM background on the sensor's pin with a one
+    minute spike every 3 minutes; latency runs from the start of a spike until the alarm's ON went to the MQTT client,
+    so it covers the pin interrupt, the detector window, the burst window and the loop() pass. Median, mean, 95th
+    percentile and worst per spike rate.
+  Checks: false alarms within Poisson bounds of the estimate, every spike alarmed within the spike and cleared before
+  the next one, no alarm in between.
+
+  tools/bench/harness.py burst-replay -- [--years Y] [--trials N] [--seed N] [--trace FILE]
+  --trace: replay a recorded trace instead (inter-arrival times in microseconds, one per line) through the firmware
+           once, and list the alarms it raises
+*/
+#include "../../src/radthing.cpp"
+#include "host/pulse-simulator.h"
+#include "harness.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+const double SECONDS_PER_YEAR = 365.25 * 24 * 3600;
+const float BACKGROUND_CPM[] = { 2, 3, 4, 5 };
+const float SPIKE_CPM[] = { 100, 300, 1000 };
+const float LATENCY_BACKGROUND_CPM = 3;
+const unsigned long SPIKE_MS = 60000;               // each spike lasts a minute...
+const unsigned long SPIKE_PERIOD_MS = 180000;       // ...and starts every 3 minutes, time for the alarm to clear
+const uint64_t LOOP_PASS_US = 100;                  // simulated time a loop() pass takes, on top of its idle
+
+static std::mt19937_64 rng;
+static pulse_simulator sim;
+
+// *********************************************************************************************************************
+// *** False alarms ***
+// Estimate of burst-detector.h: the rate of pulses that find at least N-1 others within the window before them
+static double expectedFalseAlarmsPerYear(double cpm, unsigned int pulses){
+  double r = cpm / 60;
+  double mu = r * BURST_WINDOW_MS / 1000.0;
+  double term = exp(-mu);                           // P(Poisson(mu) = k), from k = 0 up to pulses - 1
+  for (unsigned int k = 0; k + 1 < pulses; k++)
+  {
+    term *= mu / (k + 1);
+  }
+  double tail = 0;
+  for (unsigned int k = pulses - 1; k < pulses + 60; k++)
+  {
+    tail += term;
+    term *= mu / (k + 1);
+  }
+  return r * tail * SECONDS_PER_YEAR;
+}
+
+// Alarms raised by years of background at cpm (the fused rate of sensors); millis() timestamps, as the firmware's
+static unsigned long replayBackground(double cpm, uint8_t sensors, double years){
+  burst_detector d;
+  burstDetectorReset(d, sensors);
+  std::exponential_distribution<double> interval(cpm / 60000.0);
+  const double end = years * SECONDS_PER_YEAR * 1000;
+  unsigned long alarms = 0;
+  for (double t = interval(rng); t < end; t += interval(rng))
+  {
+    unsigned long now = (unsigned long)t;
+    burstDetectorExpired(d, now);
+    alarms += burstDetectorPulse(d, now) ? 1 : 0;
+  }
+  return alarms;
+}
+
+static void checkFalseAlarms(double years){
+  printf("false alarms, %.0f years of background per rate\n", years);
+  printf("%10s %8s | %10s %10s | %12s\n", "CPM", "sensors", "alarms", "expected", "per year");
+  for (uint8_t sensors = 1; sensors <= BURST_SENSORS_MAX; sensors++)
+  {
+    for (float cpm : BACKGROUND_CPM)
+    {
+      if(sensors > 1 && cpm != BURST_EXPECTED_CPM){
+        continue; // fused: just the upper end of the background
+      }
+      unsigned long alarms = replayBackground(cpm * sensors, sensors, years);
+      double expected = expectedFalseAlarmsPerYear(cpm * sensors, BURST_PULSES * sensors) * years;
+      printf("%10.0f %8u | %10lu %10.2f | %12.4f\n", cpm, sensors, alarms, expected, alarms / years);
+      check(fabs(alarms - expected) <= 4 * sqrt(expected) + 2, "%.0f CPM, %u sensor(s): %lu false alarms in %.0f years, %.2f expected",
+        cpm, sensors, alarms, years, expected);
+    }
+  }
+}
+
+// *********************************************************************************************************************
+// *** Detection latency ***
+struct latency_run{
+  float spike_cpm;
+  uint64_t start_us;
+  std::vector<double> latency_s;                    // per detected spike
+  std::vector<bool> detected;                       // per spike
+  unsigned int false_alarms = 0;                    // ON outside a spike
+  unsigned int cleared = 0;                         // OFF
+  unsigned int uncleared = 0;                       // spikes that began with the alarm still on
+};
+
+static latency_run* current = nullptr;
+static bool alarm_on = false;
+
+static void firePulse(uint64_t at){
+  if(at > micros64()){
+    hostClockAdvance(at - micros64());
+  }
+  hostPinWrite(SIG_PIN, LOW);   // active low
+  hostPinWrite(SIG_PIN, HIGH);
+}
+
+static void pulsesDue(uint64_t until_us){
+  pulseSimulatorLoop(sim, until_us);
+}
+
+static void onPublished(const char* topic, const char* payload, int length){
+  if(ALARM_TOPIC != topic){
+    return;
+  }
+  alarm_on = length == 2 && strncmp(payload, "ON", 2) == 0;
+  double at_s = (micros64() - sim.start_us) / 1e6;
+  if(current == nullptr){
+    printf("%12.3f s  %s\n", at_s, alarm_on ? "ON" : "OFF");
+    return;
+  }
+  if(!alarm_on){
+    current->cleared++;
+    return;
+  }
+  uint64_t elapsed_us = micros64() - current->start_us;
+  size_t spike = elapsed_us / (SPIKE_PERIOD_MS * 1000ULL);
+  double offset_s = (elapsed_us % (SPIKE_PERIOD_MS * 1000ULL)) / 1e6;
+  if(spike < current->detected.size() && offset_s < SPIKE_MS / 1000.0 && !current->detected[spike]){
+    current->detected[spike] = true;
+    current->latency_s.push_back(offset_s);
+  }
+  else {
+    current->false_alarms++;
+  }
+}
+
+static void runUntil(uint64_t until_us){
+  while(micros64() < until_us){
+    loop();
+    hostClockAdvance(LOOP_PASS_US);
+  }
+}
+
+static double percentile(std::vector<double> v, double p){
+  if(v.empty()){
+    return 0;
+  }
+  size_t i = std::min(v.size() - 1, (size_t)(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+static void checkLatency(unsigned int trials){
+  printf("detection latency, %u spikes of a minute per rate on a %.0f CPM background\n", trials, LATENCY_BACKGROUND_CPM);
+  printf("%10s | %8s %8s | %8s %8s %8s %8s\n", "spike CPM", "spikes", "alarmed", "median s", "mean s", "p95 s", "worst s");
+  for (float spike_cpm : SPIKE_CPM)
+  {
+    latency_run run;
+    run.spike_cpm = spike_cpm;
+    run.start_us = micros64();
+    run.detected.assign(trials, false);
+    current = &run;
+    sim = pulseSimulatorBurst(LATENCY_BACKGROUND_CPM, spike_cpm, SPIKE_MS, SPIKE_PERIOD_MS);
+    pulseSimulatorBegin(sim, firePulse, run.start_us);
+    for (unsigned int spike = 0; spike < trials; spike++)
+    {
+      if(alarm_on){
+        run.uncleared++;
+      }
+      runUntil(run.start_us + (spike + 1) * SPIKE_PERIOD_MS * 1000ULL);
+    }
+    sim.callback = nullptr;
+    current = nullptr;
+
+    double mean = 0;
+    for (double l : run.latency_s)
+    {
+      mean += l / run.latency_s.size();
+    }
+    double worst = run.latency_s.empty() ? 0 : *std::max_element(run.latency_s.begin(), run.latency_s.end());
+    printf("%10.0f | %8u %8u | %8.2f %8.2f %8.2f %8.2f\n", spike_cpm, trials, (unsigned)run.latency_s.size(),
+      percentile(run.latency_s, 0.5), mean, percentile(run.latency_s, 0.95), worst);
+    check(run.latency_s.size() == trials, "%.0f CPM: every spike alarmed within the spike (%u of %u)", spike_cpm, (unsigned)run.latency_s.size(), trials);
+    check(run.cleared == run.latency_s.size() && run.uncleared == 0, "%.0f CPM: the alarm cleared after every spike (%u)", spike_cpm, run.cleared);
+    check(run.false_alarms == 0, "%.0f CPM: no alarm between spikes (%u)", spike_cpm, run.false_alarms);
+  }
+}
+
+// *********************************************************************************************************************
+// *** Recorded trace ***
+static std::vector<uint32_t> readTrace(const char* path){
+  std::vector<uint32_t> trace;
+  FILE* f = fopen(path, "r");
+  if(f == nullptr){
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  unsigned long interval;
+  while(fscanf(f, "%lu", &interval) == 1){
+    trace.push_back(interval);
+  }
+  fclose(f);
+  return trace;
+}
+
+static void replayTrace(const char* path){
+  std::vector<uint32_t> trace = readTrace(path);
+  uint64_t length_us = 0;
+  for (uint32_t interval : trace)
+  {
+    length_us += interval;
+  }
+  printf("%s: %u pulses over %.1f s, %.2f CPM\n", path, (unsigned)trace.size(), length_us / 1e6,
+    length_us > 0 ? trace.size() / (length_us / 60e6) : 0.0);
+  sim = pulseSimulatorReplay(trace.data(), trace.size());
+  pulseSimulatorBegin(sim, firePulse, micros64());
+  uint64_t end = sim.start_us + length_us;
+  runUntil(end + 1);
+  sim.callback = nullptr; // the trace would repeat; let the alarm clear
+  runUntil(end + BURST_HOLD_MS * 1000ULL + 1000000);
+}
+
+int main(int argc, char** argv){
+  double years = 50;
+  unsigned int trials = 100;
+  unsigned long seed = 1;
+  const char* trace_path = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--years") == 0) years = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--trials") == 0) trials = strtoul(argv[i + 1], nullptr, 10);
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+    else if(strcmp(argv[i], "--trace") == 0) trace_path = argv[i + 1];
+  }
+  rng.seed(seed);
+  randomSeed(seed);
+
+  hostClockBegin(1000000);
+  hostPinWrite(SIG_PIN, HIGH);
+  setup();
+  MQTTClient::onPublished(onPublished);
+  hostClockOnAdvance(pulsesDue);
+
+  if(trace_path != nullptr){
+    replayTrace(trace_path);
+    return harnessResult();
+  }
+  printf("burst: %u pulses within %u ms, held %u ms (seed %lu)\n", BURST_PULSES, BURST_WINDOW_MS, BURST_HOLD_MS, seed);
+  checkFalseAlarms(years);
+  checkLatency(trials);
+  return harnessResult();
+}
@@ -0,0 +1,201 @@
+/*
+  Two sensor simulator for lib/dual-detector, built with SIG2_PIN/NS2_PIN (see harness.py). Two independent Poisson
+  sources at the same rate feed the sensors' pins, with correlated noise on top:
+  - shocks that reach both boards, a pulse on each within a few milliseconds: rejected by the coincidence window
+  - knocks that reach one board, a pulse while its NS pin is active: discarded by the noise gate
+  The pulses go through the real interrupt handlers, dualDetectorLoop() and onRadiationPulse(), on simulated time
+  (a loop() pass every PASS_US, the rollups once a second), and the checks compare the outcome with what the statistics say:
+  - the fused stream counts at twice the rate of one sensor, and the rate per sensor comes out right
+  - the rate estimate's relative spread is ~1.4x (sqrt 2) tighter than one sensor's over the same integration time
+  - every shock and knock is rejected; genuine pulses lost to chance coincidences match 2 * r1 * r2 * window
+  - the lifetime dose and the rollups are per sensor, not doubled
+  - the burst alarm never fires on the background, and fires on a spike
+
+  tools/bench/harness.py coincidence-sim -- [--hours H] [--cpm CPM] [--seed N]
+*/
+#include "../../src/radthing.cpp"
+#include "harness.h"
+
+#include <cmath>
+#include <deque>
+#include <random>
+
+enum sim_event_kind { SIM_PULSE, SIM_NOISE_ON, SIM_NOISE_OFF };
+
+struct sim_event{
+  uint64_t at;                    // microseconds
+  sim_event_kind kind;
+  uint8_t sensor;
+  bool genuine;                   // a gamma ray (as opposed to a shock or knock)
+  bool operator<(const sim_event &o) const { return at < o.at; }
+};
+
+const uint8_t SIG_PINS[2] = { SIG_PIN, SIG2_PIN };
+const uint8_t NS_PINS[2] = { NS_PIN, NS2_PIN };
+const double SHOCKS_PER_HOUR = 20;        // reach both boards
+const double KNOCKS_PER_HOUR = 20;        // reach one board, with its NS pin active
+const uint64_t SHOCK_SPREAD_US = 5000;    // the two pulses of a shock arrive this far apart at most
+const uint64_t KNOCK_US = 30000;          // NS pin active for this long
+const uint64_t SAMPLE_US = 300000000ULL;  // rate estimates compared every 5 minutes (DUAL_SLOTS * DUAL_SLOT_MS)
+const uint64_t PASS_US = 10000;           // dualDetectorLoop() this often; shorter than the window, so when it runs does not matter
+
+static std::mt19937_64 rng;
+
+static void poisson(std::vector<sim_event> &events, uint64_t from, uint64_t to, double per_hour, sim_event_kind kind, uint8_t sensor, bool genuine){
+  std::exponential_distribution<double> interval(per_hour / 3600e6);
+  for (double t = from + interval(rng); t < to; t += interval(rng))
+  {
+    events.push_back({ (uint64_t)t, kind, sensor, genuine });
+  }
+}
+
+static void fire(const sim_event &e){
+  switch(e.kind){
+    case SIM_PULSE:   // active low
+      hostPinWrite(SIG_PINS[e.sensor], LOW);
+      hostPinWrite(SIG_PINS[e.sensor], HIGH);
+      break;
+    case SIM_NOISE_ON:
+      hostPinWrite(NS_PINS[e.sensor], HIGH);
+      break;
+    case SIM_NOISE_OFF:
+      hostPinWrite(NS_PINS[e.sensor], LOW);
+      break;
+  }
+}
+
+struct moments{
+  double n = 0, sum = 0, sum2 = 0;
+  void add(double x){ n++; sum += x; sum2 += x * x; }
+  double mean() const { return sum / n; }
+  double relativeSpread() const { return sqrt(std::max(sum2 / n - mean() * mean(), 0.0)) / mean(); }
+};
+
+int main(int argc, char** argv){
+  double hours = 100;
+  double cpm = 3;
+  unsigned long seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--hours") == 0) hours = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--cpm") == 0) cpm = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+  }
+  rng.seed(seed);
+
+  hostClockBegin(1000000);
+  for (uint8_t pin : SIG_PINS)
+  {
+    hostPinWrite(pin, HIGH);
+  }
+  initRadiationWatch();
+
+  // Background with correlated noise, then a one minute spike at 100 CPM per sensor
+  const uint64_t start = micros64();
+  const uint64_t end = start + (uint64_t)(hours * 3600e6);
+  const uint64_t spike_end = end + 60000000ULL;
+  std::vector<sim_event> events;
+  uint64_t pulses[2] = { 0, 0 };
+  for (uint8_t sensor = 0; sensor < 2; sensor++)
+  {
+    poisson(events, start, end, cpm * 60, SIM_PULSE, sensor, true);
+    poisson(events, end, spike_end, 100 * 60, SIM_PULSE, sensor, true);
+  }
+  std::uniform_int_distribution<uint64_t> spread(0, SHOCK_SPREAD_US);
+  std::vector<sim_event> shocks, knocks;
+  poisson(shocks, start, end, SHOCKS_PER_HOUR, SIM_PULSE, 0, false);
+  for (const sim_event &s : shocks)
+  {
+    events.push_back(s);
+    events.push_back({ s.at + spread(rng), SIM_PULSE, 1, false });
+  }
+  poisson(knocks, start, end, KNOCKS_PER_HOUR, SIM_NOISE_ON, 0, false);
+  for (const sim_event &k : knocks)
+  {
+    uint8_t sensor = rng() % 2;
+    events.push_back({ k.at, SIM_NOISE_ON, sensor, false });
+    events.push_back({ k.at + KNOCK_US / 2, SIM_PULSE, sensor, false });
+    events.push_back({ k.at + KNOCK_US, SIM_NOISE_OFF, sensor, false });
+  }
+  std::sort(events.begin(), events.end());
+
+  // loop() passes every PASS_US, interrupts in between
+  moments single, dual;
+  std::deque<uint64_t> sensor0_pulses;      // for the single sensor estimate over the same integration time
+  unsigned int false_alarms = 0;
+  uint64_t spike_detected = 0;
+  bool alarm = false;
+  uint64_t next_sample = start + SAMPLE_US;
+  size_t next_event = 0;
+  for (uint64_t now = start; now < spike_end + 1000000; now += PASS_US)
+  {
+    for (; next_event < events.size() && events[next_event].at <= now; next_event++)
+    {
+      const sim_event &e = events[next_event];
+      hostClockAdvance(e.at - micros64());
+      fire(e);
+      if(e.kind == SIM_PULSE && e.genuine && e.at < end){
+        pulses[e.sensor]++;
+        if(e.sensor == 0){
+          sensor0_pulses.push_back(e.at);
+        }
+      }
+    }
+    hostClockAdvance(now - micros64());
+    dualDetectorLoop(micros(), millis());
+    if(now % 1000000 == 0){
+      processRollups(); // once a second is plenty; the broker is not connected, so nothing is published
+    }
+    burstDetectorExpired(burst, millis());
+    if(burst.active && !alarm){
+      if(now < end){
+        false_alarms++;
+      }
+      else if(spike_detected == 0){
+        spike_detected = now;
+      }
+    }
+    alarm = burst.active;
+
+    if(now >= next_sample && now < end){
+      next_sample += SAMPLE_US;
+      uint64_t window = dualDetectorIntegrationTime() * 1000ULL;
+      while(!sensor0_pulses.empty() && sensor0_pulses.front() < now - window){
+        sensor0_pulses.pop_front();
+      }
+      single.add(sensor0_pulses.size() / (window / 60e6));
+      dual.add(readCpm());
+    }
+    if(now == end - end % PASS_US){
+      // end of the background: the totals before the spike
+      double minutes = (end - start) / 60e6;
+      double expected_chance = 2 * (cpm / 60e6) * (cpm / 60e6) * COINCIDENCE_WINDOW_US * (end - start); // pairs
+      uint32_t chance = dualDetectorCoincidences() - shocks.size();
+      double per_sensor = (pulses[0] + pulses[1]) / 2.0;
+      printf("%.0f hours at %.1f CPM per sensor (seed %lu): %llu + %llu pulses, %u shocks, %u knocks\n", hours, cpm, seed,
+        (unsigned long long)pulses[0], (unsigned long long)pulses[1], (unsigned)shocks.size(), (unsigned)knocks.size());
+      printf("  fused %lu pulses (%.3f CPM), coincidences %u (chance %u, expected %.1f), noise gated %u, queue overflows %u\n",
+        pulse_count, pulse_count / minutes, dualDetectorCoincidences(), chance, expected_chance, dualDetectorNoiseGated(), dualDetectorOverflows());
+      printf("  5 minute rate estimates: single sensor %.3f +- %.1f%%, fused %.3f +- %.1f%% (%u samples)\n",
+        single.mean(), 100 * single.relativeSpread(), dual.mean(), 100 * dual.relativeSpread(), (unsigned)dual.n);
+
+      check(fabs(pulse_count / minutes - 2 * cpm) <= 2 * cpm * 0.02, "fused stream counts at twice the rate of one sensor: %.3f CPM", pulse_count / minutes);
+      check(fabs(pulse_count - (double)(pulses[0] + pulses[1])) <= 2 * expected_chance + 5 * sqrt(2 * expected_chance) + 2,
+        "fused pulses %lu = genuine pulses %llu less chance coincidences", pulse_count, (unsigned long long)(pulses[0] + pulses[1]));
+      double ratio = single.relativeSpread() / dual.relativeSpread();
+      check(ratio > 1.3 && ratio < 1.55, "rate estimate spread %.2fx tighter than one sensor (sqrt 2 = 1.41)", ratio);
+      check(dualDetectorCoincidences() >= shocks.size(), "every shock rejected (%u coincidences for %u shocks)", dualDetectorCoincidences(), (unsigned)shocks.size());
+      check(fabs(chance - expected_chance) <= 5 * sqrt(expected_chance) + 2, "chance coincidences %u, expected %.1f", chance, expected_chance);
+      check(dualDetectorNoiseGated() >= knocks.size() && dualDetectorNoiseGated() <= knocks.size() + 5 * sqrt(knocks.size()) + 2,
+        "every knock discarded (%u noise gated for %u knocks)", dualDetectorNoiseGated(), (unsigned)knocks.size());
+      double dose = readDoseTotal();
+      double expected_dose = per_sensor / (CPM_PER_USVH * 60);
+      check(fabs(dose - expected_dose) <= expected_dose * 0.01, "lifetime dose %.4f uSv is per sensor (%.4f uSv expected)", dose, expected_dose);
+      float rollup_cpm = rollupMeanCpm(rollups.tiers[ROLLUP_HOUR]);
+      check(fabs(rollup_cpm - cpm) <= cpm * 0.25, "last hour rollup %.2f CPM is per sensor", rollup_cpm);
+      check(false_alarms == 0, "no burst alarm on the background (%u)", false_alarms);
+    }
+  }
+  check(spike_detected != 0, "burst alarm on a 100 CPM per sensor spike, after %.1f s", spike_detected != 0 ? (spike_detected - end) / 1e6 : 0.0);
+  return harnessResult();
+}
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+Compare two benchmark results written by tools/bench/run.py and flag regressions.
+
+  python3 tools/bench/compare.py before.json after.json
+  python3 tools/bench/compare.py before.json after.json --threshold 10 --size-threshold 0
+
+Timings are noisy, so each benchmark is judged on the median of its runs, and a change only counts when it is both
+  - larger than --threshold percent of the baseline median, and
+  - larger than --mad-k times the combined spread of the two sets of runs: the median absolute deviation (MAD, scaled
+    by 1.4826 to estimate a standard deviation) of each, added in quadrature.
+The MAD test needs at least MIN_RUNS runs on each side; with fewer only the threshold applies (and a warning says so).
+Allocations and bytes allocated per operation are deterministic up to the varying payload lengths, so only the
+threshold applies to them; an operation that did not allocate before and does now is always a regression.
+Section sizes (when both results have them) are exact: growth beyond --size-threshold bytes is a regression.
+
+Exits with 1 if anything regressed, so it can gate a build.
+"""
+import argparse
+import json
+import math
+import statistics
+import sys
+
+MIN_RUNS = 3
+MAD_SCALE = 1.4826  # MAD of a normal distribution times this estimates its standard deviation
+ALLOC_EPSILON = 0.01  # allocations (or bytes) per operation below which a difference is rounding
+
+
+def median_and_mad(samples):
+    m = statistics.median(samples)
+    return m, MAD_SCALE * statistics.median(abs(x - m) for x in samples)
+
+
+def judge_timing(base, cand, threshold, mad_k):
+    """(verdict, delta percent, noise band as percent of the baseline)"""
+    b, b_mad = median_and_mad(base)
+    c, c_mad = median_and_mad(cand)
+    delta = c - b
+    percent = 100.0 * delta / b if b else math.inf
+    noise = mad_k * math.hypot(b_mad, c_mad) if len(base) >= MIN_RUNS and len(cand) >= MIN_RUNS else 0.0
+    noise_percent = 100.0 * noise / b if b else 0.0
+    if abs(percent) <= threshold or abs(delta) <= noise:
+        return "", percent, noise_percent
+    return ("REGRESSION" if delta > 0 else "improved"), percent, noise_percent
+
+
+def judge_count(base, cand, threshold):
+    b = statistics.median(base)
+    c = statistics.median(cand)
+    delta = c - b
+    if abs(delta) <= ALLOC_EPSILON:
+        return "", 0.0
+    if b <= ALLOC_EPSILON:
+        return ("REGRESSION" if delta > 0 else "improved"), math.inf
+    percent = 100.0 * delta / b
+    if abs(percent) <= threshold:
+        return "", percent
+    return ("REGRESSION" if delta > 0 else "improved"), percent
+
+
+def format_percent(percent):
+    return "%+.1f%%" % percent if math.isfinite(percent) else "new"
+
+
+def compare_sizes(base, cand, size_threshold, rows):
+    regressions = 0
+    scopes = [("firmware", base["total"], cand["total"])]
+    scopes += [(name, base["functions"][name], cand["functions"][name]) for name in sorted(cand["functions"]) if name in base["functions"]]
+    for name, b, c in scopes:
+        for region in ("IRAM", "DRAM", "FLASH"):
+            delta = c[region] - b[region]
+            verdict = ""
+            if delta > size_threshold:
+                verdict = "REGRESSION"
+                regressions += 1
+            elif delta < 0:
+                verdict = "improved"
+            if delta or verdict:
+                rows.append((name, region + " bytes", "%d" % b[region], "%d" % c[region], "%+d" % delta, "", verdict))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flag regressions between two benchmark results (median/MAD test)")
+    parser.add_argument("baseline", help="results of the reference revision (run.py --output)")
+    parser.add_argument("candidate", help="results of the revision under test")
+    parser.add_argument("--threshold", type=float, default=5.0, metavar="PERCENT", help="smallest change that counts (default 5%%)")
+    parser.add_argument("--mad-k", type=float, default=3.0, metavar="K", help="a timing change must exceed K times the combined MAD (default 3)")
+    parser.add_argument("--size-threshold", type=int, default=0, metavar="BYTES", help="section growth allowed without a regression (default 0)")
+    parser.add_argument("--all", action="store_true", help="list unchanged metrics too")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        base = json.load(f)
+    with open(args.candidate) as f:
+        cand = json.load(f)
+
+    print("baseline  %s (%s, %d runs)" % (base["git"]["describe"], base["date"], base["repeat"]))
+    print("candidate %s (%s, %d runs)" % (cand["git"]["describe"], cand["date"], cand["repeat"]))
+    if base["host"] != cand["host"]:
+        print("warning: measured on different hosts or compilers; timings are not comparable", file=sys.stderr)
+    if min(base["repeat"], cand["repeat"]) < MIN_RUNS:
+        print("warning: fewer than %d runs, timings are judged on --threshold alone" % MIN_RUNS, file=sys.stderr)
+
+    rows = []
+    regressions = 0
+    for name in sorted(set(base["benchmarks"]) | set(cand["benchmarks"])):
+        if name not in cand["benchmarks"]:
+            rows.append((name, "", "", "", "", "", "removed"))
+            continue
+        if name not in base["benchmarks"]:
+            rows.append((name, "", "", "", "", "", "new"))
+            continue
+        b, c = base["benchmarks"][name], cand["benchmarks"][name]
+        verdict, percent, noise = judge_timing(b["ns_per_op"], c["ns_per_op"], args.threshold, args.mad_k)
+        if verdict or args.all:
+            rows.append((name, "ns/op", "%.1f" % statistics.median(b["ns_per_op"]), "%.1f" % statistics.median(c["ns_per_op"]),
+                         format_percent(percent), "+-%.1f%%" % noise, verdict))
+        regressions += verdict == "REGRESSION"
+        for metric, label in (("allocs_per_op", "allocs/op"), ("bytes_per_op", "bytes/op")):
+            verdict, percent = judge_count(b[metric], c[metric], args.threshold)
+            if verdict or args.all:
+                rows.append((name, label, "%.2f" % statistics.median(b[metric]), "%.2f" % statistics.median(c[metric]),
+                             format_percent(percent), "", verdict))
+            regressions += verdict == "REGRESSION"
+
+    if base.get("sections") and cand.get("sections"):
+        regressions += compare_sizes(base["sections"], cand["sections"], args.size_threshold, rows)
+    elif base.get("sections") or cand.get("sections"):
+        print("note: only one of the results has section sizes (run.py --map); sizes not compared", file=sys.stderr)
+
+    header = ("benchmark", "metric", "baseline", "candidate", "change", "noise", "")
+    widths = [max(len(str(r[i])) for r in rows + [header]) for i in range(len(header))]
+    for row in [header] + rows:
+        print("  ".join(str(v).ljust(w) if i < 2 or i == 6 else str(v).rjust(w) for i, (v, w) in enumerate(zip(row, widths))).rstrip())
+    if not rows:
+        print("no changes beyond the thresholds")
+    print("%d regression%s" % (regressions, "" if regressions == 1 else "s"))
+    sys.exit(1 if regressions else 0)
+
+
+if __name__ == "__main__":
+    main()
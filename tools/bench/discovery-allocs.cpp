@@ -0,0 +1,115 @@
+/*
+  Discovery allocations: what building and publishing each discovery message allocates, through the v2 builders the
+  firmware uses (buildDiscoveryMessage() into a reused discovery_config, append*() into it) and through the v1 ones
+  kept for other callers (std::string in and out: buildDevicePayload(), getDiscovery*Message()).
+  - per message type: allocations to build a message with v2 (the firmware's getDiscoveryMessage()) and with v1 (a v1
+    caller's device payload and getDiscovery*Message()), counted with no arena phase active so that every one of them
+    reaches the heap counter
+  - publishDiscoveryMessages() over every message, connected to the in-process broker: allocations per message without
+    the arena, and heap allocations per message with it, as setup() runs it
+  Checks: every v1 message is byte-identical to its v2 one, v2 allocates less than v1 for every type, and with the arena
+  publishing discovery makes no heap allocation.
+
+  tools/bench/harness.py discovery-allocs
+*/
+#include "../../src/radthing.cpp"
+#include "host/alloc-count.h"
+#include "harness.h"
+
+struct type_allocs{
+  unsigned long messages = 0;
+  unsigned long long v2 = 0, v1 = 0;
+  unsigned long identical = 0;
+};
+
+static std::string v1DevicePayload(bool full){
+  return full ? buildDevicePayload(DEVICE_NAME, getMAC(), DEVICE_MANUFACTURER, DEVICE_MODEL, DEVICE_VERSION)
+    : buildShortDevicePayload(DEVICE_NAME, getMAC());
+}
+
+// Each message of list built with v2 and with v1 (v1(metadata, device payload)), and the allocations of each
+template <class Metadata, class V1>
+static type_allocs measure(const phase_vector<Metadata> &list, bool full_device, V1 v1){
+  type_allocs r;
+  for (const Metadata &m : list)
+  {
+    unsigned long long before = alloc_count;
+    discovery_config built = getDiscoveryMessage(m);
+    r.v2 += alloc_count - before;
+    before = alloc_count;
+    discovery_config old = v1(m, v1DevicePayload(full_device));
+    r.v1 += alloc_count - before;
+    r.messages++;
+    r.identical += old.topic == built.topic && old.payload == built.payload ? 1 : 0;
+  }
+  return r;
+}
+
+static void fillMetadata(){
+  discovery_metadata_list = getAllDiscoveryMessagesMetadata();
+  discovery_config_metadata_list = getAllDiscoveryConfigMessagesMetadata();
+  discovery_measured_diagnostic_metadata_list = getAllDiscoveryMeasuredDiagnosticMessagesMetadata();
+  discovery_fact_diagnostic_metadata_list = getAllDiscoveryFactDiagnosticMessagesMetadata();
+  discovery_binary_metadata_list = getAllDiscoveryBinaryMessagesMetadata();
+}
+
+static void report(const char *type, const type_allocs &r){
+  printf("%-20s | %8lu | %8.1f %8.1f | %9lu\n", type, r.messages, r.messages > 0 ? (double)r.v2 / r.messages : 0.0,
+    r.messages > 0 ? (double)r.v1 / r.messages : 0.0, r.identical);
+  check(r.identical == r.messages, "%s: v1 messages identical to v2 (%lu of %lu)", type, r.identical, r.messages);
+  check(r.v2 < r.v1, "%s: v2 allocates less than v1 (%llu, %llu)", type, r.v2, r.v1);
+}
+
+// Allocations per message of one publishDiscoveryMessages() over the whole set
+static double publishAllocations(bool with_arena, unsigned long &messages){
+  if(with_arena){
+    phaseArenaBegin();
+  }
+  fillMetadata();
+  messages = discovery_metadata_list.size() + discovery_config_metadata_list.size() + discovery_measured_diagnostic_metadata_list.size() + discovery_fact_diagnostic_metadata_list.size() + discovery_binary_metadata_list.size();
+  unsigned long long before = alloc_count;
+  int pending = publishDiscoveryMessages();
+  unsigned long long allocations = alloc_count - before;
+  purgeDiscoveryMetadata();
+  if(with_arena){
+    phaseArenaEnd();
+  }
+  return pending == 0 && messages > 0 ? (double)allocations / messages : -1;
+}
+
+int main(){
+  hostClockBegin(1000000);
+  setup(); // connected to the broker, the MAC cached
+  fillMetadata();
+  type_allocs sensor = measure(discovery_metadata_list, true, [](const discovery_metadata &m, const std::string &device){
+    return getDiscoveryMessage(m, DEVICE_ID, device, AVAILABILITY_TOPIC, m.state_topic.empty() ? STATE_TOPIC : m.state_topic.c_str());
+  });
+  type_allocs control = measure(discovery_config_metadata_list, true, [](const discovery_config_metadata &m, const std::string &device){
+    return getDiscoveryConfigMessage(m, DEVICE_ID, device, AVAILABILITY_TOPIC);
+  });
+  type_allocs measured = measure(discovery_measured_diagnostic_metadata_list, false, [](const discovery_measured_diagnostic_metadata &m, const std::string &device){
+    return getDiscoveryMeasuredDiagnosticMessage(m, DEVICE_ID, device, AVAILABILITY_TOPIC, DIAGNOSTIC_TOPIC);
+  });
+  type_allocs fact = measure(discovery_fact_diagnostic_metadata_list, false, [](const discovery_fact_diagnostic_metadata &m, const std::string &device){
+    return getDiscoveryFactDiagnosticMessage(m, DEVICE_ID, device, AVAILABILITY_TOPIC, FACT_TOPIC);
+  });
+  type_allocs binary = measure(discovery_binary_metadata_list, false, [](const discovery_binary_metadata &m, const std::string &device){
+    return getDiscoveryBinaryMessage(m, DEVICE_ID, device, AVAILABILITY_TOPIC);
+  });
+  purgeDiscoveryMetadata();
+  unsigned long messages = 0;
+  double heap_only = publishAllocations(false, messages);
+  double arena = publishAllocations(true, messages);
+
+  printf("%-20s | %8s | %8s %8s | %9s\n", "allocations/message", "messages", "v2", "v1", "identical");
+  report("sensor", sensor);
+  report("control", control);
+  report("measured diagnostic", measured);
+  report("fact diagnostic", fact);
+  report("binary sensor", binary);
+  printf("publishDiscoveryMessages(), %lu messages: %.1f allocations per message without the arena, %.1f heap allocations with it\n",
+    messages, heap_only, arena);
+  check(heap_only >= 0 && arena >= 0, "every discovery message published");
+  check(arena == 0, "with the arena, publishing discovery makes no heap allocation (%.1f per message)", arena);
+  return harnessResult();
+}
@@ -0,0 +1,186 @@
+/*
+  Discovery compact: every discovery message the firmware retains at the broker, with HA_DISCOVERY_COMPACT=1 (as
+  shipped) against a reference build with HA_DISCOVERY_COMPACT=0 (verbose keys, no "~"). harness.py builds both and
+  passes the reference as --reference; run with --dump, a build prints its messages ("topic\tpayload" lines) instead.
+  Each compact payload is expanded as Home Assistant does it (the abbreviated keys, and "~" in the topics) and
+  compared, parsed, with the verbose payload of the same topic.
+  Reported per message: verbose and compact bytes and the saving; in total too. Checks: both builds publish the same
+  topics, the reference's payloads are verbose, every expanded compact payload equals its verbose one, and none is
+  larger than it.
+
+  tools/bench/harness.py discovery-compact
+*/
+#include "../../src/radthing.cpp"
+#include "host/fake-broker.h"
+#include "harness.h"
+#include "json.h"
+
+#include <map>
+
+// Home Assistant's abbreviations of the keys the builders write (homeassistant/components/mqtt/abbreviations.py)
+const std::map<std::string, std::string> ABBREVIATIONS = {
+  { "avty_t", "availability_topic" }, { "cmd_t", "command_topic" }, { "dev", "device" }, { "dev_cla", "device_class" },
+  { "ent_cat", "entity_category" }, { "ic", "icon" }, { "json_attr_t", "json_attributes_topic" },
+  { "json_attr_tpl", "json_attributes_template" }, { "stat_cla", "state_class" }, { "stat_t", "state_topic" }, { "uniq_id", "unique_id" },
+  { "unit_of_meas", "unit_of_measurement" }, { "val_tpl", "value_template" },
+};
+// ...and of the keys of the device block
+const std::map<std::string, std::string> DEVICE_ABBREVIATIONS = {
+  { "ids", "identifiers" }, { "mf", "manufacturer" }, { "mdl", "model" }, { "sw", "sw_version" },
+};
+
+static std::string fullKey(const std::map<std::string, std::string> &abbreviations, const std::string &key){
+  auto a = abbreviations.find(key);
+  return a == abbreviations.end() ? key : a->second;
+}
+
+static bool isTopicKey(const std::string &key){
+  return key.size() > 6 && key.compare(key.size() - 6, 6, "_topic") == 0;
+}
+
+// As Home Assistant reads a discovery payload: keys in full, "~" at either end of a topic replaced by the base topic
+static json_value expand(const json_value &payload){
+  json_value full;
+  full.type = json_value::OBJECT;
+  auto tilde = payload.members.find("~");
+  for (const auto &m : payload.members)
+  {
+    if(m.first == "~"){
+      continue;
+    }
+    std::string key = fullKey(ABBREVIATIONS, m.first);
+    json_value value = m.second;
+    if(key == "device" && value.type == json_value::OBJECT){
+      value.members.clear();
+      for (const auto &d : m.second.members)
+      {
+        value.members[fullKey(DEVICE_ABBREVIATIONS, d.first)] = d.second;
+      }
+    }
+    if(tilde != payload.members.end() && isTopicKey(key) && value.type == json_value::STRING && !value.text.empty()){
+      if(value.text.front() == '~'){
+        value.text = tilde->second.text + value.text.substr(1);
+      }
+      else if(value.text.back() == '~'){
+        value.text = value.text.substr(0, value.text.size() - 1) + tilde->second.text;
+      }
+    }
+    full.members[key] = value;
+  }
+  return full;
+}
+
+// No abbreviated key at the top level, no "~"
+static bool isVerbose(const json_value &payload){
+  for (const auto &m : payload.members)
+  {
+    if(m.first == "~" || ABBREVIATIONS.count(m.first) != 0){
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool equal(const json_value &a, const json_value &b){
+  if(a.type != b.type || a.text != b.text || a.members.size() != b.members.size()){
+    return false;
+  }
+  for (const auto &m : a.members)
+  {
+    auto other = b.members.find(m.first);
+    if(other == b.members.end() || !equal(m.second, other->second)){
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every discovery message of one boot, by topic
+static std::map<std::string, std::string> bootMessages(){
+  randomSeed(1);
+  hostClockBegin(1000000);
+  setup();
+  std::map<std::string, std::string> messages;
+  for (const auto &r : fakeBrokerRetained())
+  {
+    if(r.first.size() > 7 && r.first.compare(r.first.size() - 7, 7, "/config") == 0){
+      messages[r.first] = r.second.payload;
+    }
+  }
+  return messages;
+}
+
+// The reference build's messages, from its --dump
+static std::map<std::string, std::string> referenceMessages(const char *reference){
+  std::map<std::string, std::string> messages;
+  std::string command = std::string(reference) + " --dump";
+  FILE *out = popen(command.c_str(), "r");
+  if(out == nullptr){
+    return messages;
+  }
+  std::string line;
+  for (int c = fgetc(out); c != EOF; c = fgetc(out))
+  {
+    if(c != '\n'){
+      line += (char)c;
+      continue;
+    }
+    size_t tab = line.find('\t');
+    if(tab != std::string::npos){
+      messages[line.substr(0, tab)] = line.substr(tab + 1);
+    }
+    line.clear();
+  }
+  pclose(out);
+  return messages;
+}
+
+int main(int argc, char **argv){
+  const char *reference = nullptr;
+  bool dump = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--dump") == 0) dump = true;
+    else if(strcmp(argv[i], "--reference") == 0 && i + 1 < argc) reference = argv[++i];
+  }
+  std::map<std::string, std::string> own = bootMessages();
+  if(dump){
+    for (const auto &m : own)
+    {
+      printf("%s\t%s\n", m.first.c_str(), m.second.c_str());
+    }
+    return 0;
+  }
+
+  check(HA_DISCOVERY_COMPACT && reference != nullptr, "compact build, with a verbose reference build");
+  std::map<std::string, std::string> verbose = reference != nullptr ? referenceMessages(reference) : std::map<std::string, std::string>();
+  check(!verbose.empty() && verbose.size() == own.size(), "both builds publish %u discovery messages (%u)", (unsigned)own.size(), (unsigned)verbose.size());
+
+  printf("%-60s | %7s %7s | %6s\n", "discovery topic", "verbose", "compact", "saving");
+  unsigned long verbose_total = 0, compact_total = 0, matching = 0, larger = 0;
+  for (const auto &m : own)
+  {
+    auto v = verbose.find(m.first);
+    if(v == verbose.end()){
+      check(false, "%s: in the verbose build too", m.first.c_str());
+      continue;
+    }
+    json_value compact = parseJson(m.second), full = parseJson(v->second);
+    bool same = compact.type == json_value::OBJECT && full.type == json_value::OBJECT && isVerbose(full)
+      && equal(expand(compact), expand(full));
+    if(!same){
+      check(false, "%s: expanded compact payload equals the verbose one\n    %s\n    %s", m.first.c_str(), m.second.c_str(), v->second.c_str());
+    }
+    matching += same ? 1 : 0;
+    larger += m.second.size() > v->second.size() ? 1 : 0;
+    verbose_total += v->second.size();
+    compact_total += m.second.size();
+    printf("%-60s | %7u %7u | %5.1f%%\n", m.first.c_str() + HA_TOPIC_BASE.size() + 1, (unsigned)v->second.size(),
+      (unsigned)m.second.size(), 100.0 * (v->second.size() - (double)m.second.size()) / v->second.size());
+  }
+  printf("%-60s | %7lu %7lu | %5.1f%%\n", "total", verbose_total, compact_total,
+    verbose_total > 0 ? 100.0 * (verbose_total - (double)compact_total) / verbose_total : 0.0);
+  check(matching == own.size(), "every expanded compact payload equals its verbose one (%lu of %u)", matching, (unsigned)own.size());
+  check(larger == 0 && compact_total < verbose_total, "no compact payload larger than its verbose one (%lu are)", larger);
+  return harnessResult();
+}
@@ -0,0 +1,224 @@
+/*
+  Discovery heap: the real setup() against a model of the ESP8266's heap, fed with every allocation and free the
+  firmware makes on the host (host/alloc-count.h). The model is umm_malloc's: 8 byte blocks, a 4 byte header per
+  allocation, best fit, a freed block merged with its free neighbours. ESP.getMaxFreeBlockSize() and the other heap
+  figures come from the model, so heap_block_pre/heap_block_post are its figures too.
+  Discovery runs twice, each time in a process of its own from a fresh boot:
+  - arena: as the firmware does it, out of one PHASE_ARENA_SIZE block (lib/phase-arena)
+  - heap: with a zero sized arena, so that everything falls back to the heap as before user-043, for reference
+  Reported per run: heap allocations and frees during discovery, the arena's peak and overflows, the free heap and the
+  largest free block before, at the lowest during, and after discovery. Checks, on the arena run: the heap is handed
+  back as it was found (the same largest free block after as before), nothing allocated from the heap during discovery
+  outlives it (it would sit above the block and split the heap once the block is freed), and there are fewer heap
+  allocations than with the heap run.
+  Sizes are the host's (64 bit pointers, its std::string), larger than the device's; the order of allocations and
+  frees is the firmware's. A peak above PHASE_ARENA_SIZE here need not overflow on the device.
+
+  tools/bench/harness.py discovery-heap -- [--heap BYTES]
+*/
+#include "../../src/radthing.cpp"
+#include "host/alloc-count.h"
+#include "harness.h"
+
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <sys/wait.h>
+#include <unistd.h>
+
+const uint32_t HEAP_BLOCK = 8;                      // umm_malloc's block
+const uint32_t HEAP_HEADER = 4;                     // ...and what an allocated block spends on its header
+
+struct heap_model{
+  std::map<uint32_t, uint32_t> free_runs;           // first block: blocks
+  struct allocation{ uint32_t first, blocks; unsigned long number; };
+  std::unordered_map<void*, allocation> allocated;
+  unsigned long allocations = 0;
+  unsigned long frees = 0;
+  unsigned long failed = 0;                         // did not fit
+  uint32_t lowest_max_block = UINT32_MAX;           // since the last snapshot
+};
+
+struct heap_snapshot{
+  unsigned long allocations, frees, failed;
+  uint32_t free, max_block, lowest_max_block;
+  uint8_t fragmentation;
+};
+
+static heap_model heap;
+static heap_snapshot snapshots[4];                  // one per ESP heap query; setup() makes two, around discovery
+static unsigned int snapshot_count = 0;
+
+static uint32_t maxRun(){
+  uint32_t largest = 0;
+  for (const auto &run : heap.free_runs)
+  {
+    largest = std::max(largest, run.second);
+  }
+  return largest;
+}
+
+static void heapAllocate(void* p, size_t size){
+  uint32_t blocks = std::max<uint32_t>(1, (size + HEAP_HEADER + HEAP_BLOCK - 1) / HEAP_BLOCK);
+  auto best = heap.free_runs.end();
+  for (auto run = heap.free_runs.begin(); run != heap.free_runs.end(); run++)
+  {
+    if(run->second >= blocks && (best == heap.free_runs.end() || run->second < best->second)){
+      best = run;
+    }
+  }
+  if(best == heap.free_runs.end()){
+    heap.failed++;
+    return;
+  }
+  uint32_t first = best->first;
+  uint32_t rest = best->second - blocks;
+  heap.free_runs.erase(best);
+  if(rest > 0){
+    heap.free_runs[first + blocks] = rest;
+  }
+  heap.allocations++;
+  heap.allocated[p] = { first, blocks, heap.allocations };
+}
+
+static void heapFree(void* p){
+  auto a = heap.allocated.find(p);
+  if(a == heap.allocated.end()){
+    return; // from before the model, or not the firmware's
+  }
+  uint32_t first = a->second.first, blocks = a->second.blocks;
+  heap.allocated.erase(a);
+  heap.frees++;
+  auto next = heap.free_runs.lower_bound(first);
+  if(next != heap.free_runs.end() && next->first == first + blocks){
+    blocks += next->second;
+    next = heap.free_runs.erase(next);
+  }
+  if(next != heap.free_runs.begin()){
+    auto previous = std::prev(next);
+    if(previous->first + previous->second == first){
+      previous->second += blocks;
+      return;
+    }
+  }
+  heap.free_runs[first] = blocks;
+}
+
+static void onAllocation(void* allocated, void* freed, size_t size){
+  if(freed != nullptr){
+    heapFree(freed);
+  }
+  if(allocated != nullptr){
+    heapAllocate(allocated, size);
+  }
+  heap.lowest_max_block = std::min(heap.lowest_max_block, maxRun() * HEAP_BLOCK);
+}
+
+// As umm_malloc reports them; each query is a snapshot of the model
+static void heapStats(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation){
+  uint64_t blocks = 0;
+  double squares = 0;
+  for (const auto &run : heap.free_runs)
+  {
+    blocks += run.second;
+    squares += (double)run.second * run.second;
+  }
+  *free = blocks * HEAP_BLOCK;
+  *max_block = maxRun() * HEAP_BLOCK;
+  *fragmentation = blocks > 0 ? 100 - (uint8_t)(std::sqrt(squares) * 100 / blocks) : 0;
+  if(snapshot_count < sizeof(snapshots) / sizeof(snapshots[0])){
+    snapshots[snapshot_count++] = { heap.allocations, heap.frees, heap.failed, *free, *max_block,
+      std::min(heap.lowest_max_block, *max_block), *fragmentation };
+  }
+  heap.lowest_max_block = *max_block;
+}
+
+struct discovery_run{
+  unsigned long allocations, frees, failed;
+  unsigned long outliving;                          // heap allocations of discovery still there after it
+  uint32_t free_before, free_after;
+  uint32_t block_before, block_lowest, block_after;
+  uint8_t fragmentation_after;
+  size_t peak;
+  unsigned long overflows;
+};
+
+// A fresh boot with the heap model in place; with_arena false runs discovery out of the heap instead
+static discovery_run boot(bool with_arena, uint32_t heap_size){
+  heap.free_runs[0] = heap_size / HEAP_BLOCK;
+  hostHeapStats(heapStats);
+  alloc_observer = onAllocation;
+  randomSeed(1);
+  hostClockBegin(1000000);
+  if(!with_arena){
+    phaseArenaBegin(0); // every allocation of the phase overflows to the heap; setup() carries on with this block
+  }
+  setup();
+  alloc_observer = nullptr;
+  discovery_run r = {};
+  if(snapshot_count >= 2){
+    const heap_snapshot &before = snapshots[0], &after = snapshots[1];
+    unsigned long outliving = 0;
+    for (const auto &a : heap.allocated)
+    {
+      outliving += a.second.number > before.allocations && a.second.number <= after.allocations ? 1 : 0;
+    }
+    r = { after.allocations - before.allocations, after.frees - before.frees, after.failed - before.failed, outliving,
+      before.free, after.free, before.max_block, after.lowest_max_block, after.max_block, after.fragmentation,
+      phaseArenaPeak(), phaseArenaOverflows() };
+  }
+  return r;
+}
+
+static void report(const char *name, const discovery_run &r){
+  printf("%-6s | %6lu %6lu | %6u %6lu | %7u %7u | %7u %7u %7u | %5u%%\n", name, r.allocations, r.frees,
+    (unsigned)r.peak, r.overflows, r.free_before, r.free_after, r.block_before, r.block_lowest, r.block_after,
+    r.fragmentation_after);
+}
+
+int main(int argc, char **argv){
+  uint32_t heap_size = 48 * 1024;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--heap") == 0) heap_size = strtoul(argv[i + 1], nullptr, 10);
+  }
+
+  // A boot per run, in a child, with the firmware's globals as they are before setup(); the result comes back by pipe
+  discovery_run runs[2] = {};
+  for (int with_arena = 1; with_arena >= 0; with_arena--)
+  {
+    int result[2];
+    if(pipe(result) != 0){
+      return 2;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0){
+      close(result[0]);
+      discovery_run r = boot(with_arena, heap_size);
+      bool sent = write(result[1], &r, sizeof(r)) == sizeof(r);
+      _exit(sent && snapshot_count >= 2 ? 0 : 1);
+    }
+    close(result[1]);
+    bool received = read(result[0], &runs[with_arena], sizeof(discovery_run)) == sizeof(discovery_run);
+    close(result[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    check(received && WIFEXITED(status) && WEXITSTATUS(status) == 0, "%s run: discovery completed, heap queried around it",
+      with_arena ? "arena" : "heap");
+  }
+
+  printf("%u byte heap model, PHASE_ARENA_SIZE %u\n", (unsigned)heap_size, (unsigned)PHASE_ARENA_SIZE);
+  printf("%-6s | %6s %6s | %6s %6s | %7s %7s | %7s %7s %7s | %6s\n", "run", "allocs", "frees", "peak", "overfl",
+    "free", "after", "block", "lowest", "after", "frag");
+  report("arena", runs[1]);
+  report("heap", runs[0]);
+  const discovery_run &arena = runs[1], &reference = runs[0];
+  check(arena.failed == 0 && reference.failed == 0, "every allocation fit the heap model (%lu, %lu did not)", arena.failed, reference.failed);
+  check(arena.block_after == arena.block_before, "arena: largest free block after discovery as before (%u, %u)",
+    arena.block_after, arena.block_before);
+  check(arena.outliving == 0, "arena: no heap allocation of discovery outlives it, above the block (%lu do)", arena.outliving);
+  check(arena.allocations < reference.allocations, "arena: fewer heap allocations than without it (%lu, %lu)",
+    arena.allocations, reference.allocations);
+  return harnessResult();
+}
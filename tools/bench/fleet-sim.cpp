@@ -0,0 +1,283 @@
+/*
+  Fleet reconnect simulator: hundreds of devices on one broker (host/fake-broker.h), on simulated time, and the
+  connection and publish rates the broker sees when they all lose it at once.
+  Each virtual device has its own MQTT client and connection, a MAC address and the random state deviceSeed() derives
+  from it, and follows the firmware's policies: mqttBackoffDelay() before each broker connection attempt, the
+  deviceSeed() % DISCOVERY_JITTER_MAX offset before discovery, then its discovery messages (the firmware's own, taken
+  from one real setup(), under the device's id) and "online". Between events it runs its client every LOOP_US, as
+  loop() does, and so notices a lost connection.
+  - power restore: the fleet boots together; each device joins the network DHCP_US to DHCP_US * 2 in
+  - broker restart: every connection dropped; once as before user-032 (the first reconnect at once), for reference,
+    then with the jittered first attempt
+  Reported per scenario: peak connections and publishes per second at the broker, and the time until every device is
+  online again. Checks: the jittered reconnects peak at no more than twice the fleet's mean rate over
+  MQTT_ATTEMPT_COOLDOWN, every device is back (online, subscribed) within an idle loop() pass, MQTT_ATTEMPT_COOLDOWN
+  and a second, and every discovery message of every device is retained.
+
+  tools/bench/harness.py fleet-sim -- [--devices N] [--seed N]
+*/
+#include "../../src/radthing.cpp"
+#include "host/fake-broker.h"
+#include "harness.h"
+
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+const uint64_t LOOP_US = LOOP_IDLE_MAX_MS * 1000;   // a device's loop() pass, idle between (no pulses)
+const uint64_t PUBLISH_US = 20000;                  // a device's time per discovery message (~50 msg/s)
+const uint64_t DHCP_US = 2000000;                   // joining the network after power is restored takes 2 to 4 s
+
+struct virtual_device{
+  std::string id;
+  uint32_t seed;                                    // deviceSeed() of its MAC address
+  uint32_t rng_state;                               // the backoff's, seeded with it
+  WiFiClient net;
+  MQTTClient mqtt{ MQTT_READ_BUFFER_SIZE, MQTT_WRITE_BUFFER_SIZE };
+  std::string availability;
+  unsigned int failed_attempts = 0;
+  bool connected_since_boot = false;
+  bool booting = true;
+  size_t discovery_next = 0;                        // next discovery message, while booting
+  enum { CONNECTING, DISCOVERY, RUNNING } state = CONNECTING;
+  uint64_t next_us = 0;
+};
+
+struct discovery_message{
+  std::string topic, payload;
+};
+
+struct rate_counter{
+  std::vector<unsigned long> per_second;
+  uint64_t start_us = 0;
+  void count(uint64_t at_us){
+    size_t s = (at_us - start_us) / 1000000;
+    if(s >= per_second.size()){
+      per_second.resize(s + 1, 0);
+    }
+    per_second[s]++;
+  }
+  unsigned long peak() const {
+    return per_second.empty() ? 0 : *std::max_element(per_second.begin(), per_second.end());
+  }
+};
+
+static std::vector<std::unique_ptr<virtual_device>> fleet;
+static std::vector<discovery_message> discovery;    // as published by DEVICE_ID
+static rate_counter connects, publishes;
+static bool jittered = true;                        // false: the first reconnect goes at once, as before user-032
+static size_t running = 0;                          // devices online
+
+static std::string forDevice(std::string s, const std::string &id){
+  for (size_t at = s.find(DEVICE_ID); at != std::string::npos; at = s.find(DEVICE_ID, at + id.length()))
+  {
+    s.replace(at, strlen(DEVICE_ID), id);
+  }
+  return s;
+}
+
+static void onBrokerMessage(const fake_broker_message &m){
+  publishes.count(m.at_us);
+}
+
+// The real discovery set, from one boot of the firmware
+static void captureDiscovery(){
+  hostClockBegin(1000000);
+  setup();
+  for (const auto &r : fakeBrokerRetained())
+  {
+    if(r.first.size() > 7 && r.first.compare(r.first.size() - 7, 7, "/config") == 0){
+      discovery.push_back({ r.first, r.second.payload });
+    }
+  }
+  mqttclient.disconnect();
+  fakeBrokerReset();
+}
+
+static void schedule(virtual_device &d, uint64_t at_us){
+  d.next_us = at_us;
+}
+
+static void enter(virtual_device &d, decltype(virtual_device::state) state){
+  running += (state == virtual_device::RUNNING) - (d.state == virtual_device::RUNNING);
+  d.state = state;
+}
+
+static void attempt(virtual_device &d){
+  unsigned long before = fakeBrokerStats().connects;
+  bool ok = d.mqtt.connect(d.id.c_str());
+  if(fakeBrokerStats().connects > before){
+    connects.count(micros64());
+  }
+  if(!ok){
+    d.failed_attempts++;
+    schedule(d, micros64() + mqttBackoffDelay(d.failed_attempts, d.connected_since_boot, d.rng_state) * 1000ULL);
+    return;
+  }
+  d.failed_attempts = 0;
+  d.connected_since_boot = true;
+  for (const std::string &topic : getAllSubscriptionTopics())
+  {
+    d.mqtt.subscribe(forDevice(topic, d.id).c_str());
+  }
+  if(d.booting){
+    enter(d, virtual_device::DISCOVERY);
+    schedule(d, micros64() + (d.seed % DISCOVERY_JITTER_MAX) * 1000ULL);
+    return;
+  }
+  d.mqtt.publish(d.availability.c_str(), "online", RETAINED, QOS_1);
+  enter(d, virtual_device::RUNNING);
+  schedule(d, micros64() + LOOP_US);
+}
+
+static void step(virtual_device &d){
+  switch(d.state){
+    case virtual_device::CONNECTING:
+      attempt(d);
+      return;
+    case virtual_device::DISCOVERY:
+      if(d.discovery_next < discovery.size()){
+        const discovery_message &m = discovery[d.discovery_next];
+        if(d.mqtt.publish(forDevice(m.topic, d.id).c_str(), forDevice(m.payload, d.id).c_str(), RETAINED, QOS_1)){
+          d.discovery_next++;
+        }
+        schedule(d, micros64() + PUBLISH_US);
+        return;
+      }
+      d.booting = false;
+      d.mqtt.publish(d.availability.c_str(), "online", RETAINED, QOS_1);
+      enter(d, virtual_device::RUNNING);
+      schedule(d, micros64() + LOOP_US);
+      return;
+    case virtual_device::RUNNING:
+      if(!d.mqtt.loop()){
+        enter(d, virtual_device::CONNECTING);
+        unsigned long wait_ms = jittered ? mqttBackoffDelay(0, true, d.rng_state) : 0;
+        schedule(d, micros64() + wait_ms * 1000ULL);
+        return;
+      }
+      schedule(d, micros64() + LOOP_US);
+      return;
+  }
+}
+
+// Runs the fleet, in order of its events, until every device is online or until limit_us; returns when that was
+static uint64_t runUntilOnline(uint64_t limit_us){
+  typedef std::pair<uint64_t, size_t> event;
+  std::priority_queue<event, std::vector<event>, std::greater<event>> events;
+  for (size_t i = 0; i < fleet.size(); i++)
+  {
+    events.push({ fleet[i]->next_us, i });
+  }
+  uint64_t online_us = 0;
+  bool all_online = false;
+  while(!events.empty() && micros64() < limit_us){
+    event e = events.top();
+    events.pop();
+    virtual_device &d = *fleet[e.second];
+    if(e.first > micros64()){
+      hostClockAdvance(e.first - micros64());
+    }
+    step(d);
+    events.push({ d.next_us, e.second });
+    if(!all_online && running == fleet.size()){
+      all_online = fakeBrokerSessions() == fleet.size();
+      online_us = micros64();
+    }
+    if(all_online && micros64() >= online_us + 2000000){
+      break; // and a little more, to see nothing else happen
+    }
+  }
+  return all_online ? online_us : UINT64_MAX;
+}
+
+static bool allRetained(){
+  unsigned long online = 0, configs = 0;
+  for (const auto &r : fakeBrokerRetained())
+  {
+    online += r.second.payload == "online" ? 1 : 0;
+    configs += r.first.size() > 7 && r.first.compare(r.first.size() - 7, 7, "/config") == 0 ? 1 : 0;
+  }
+  return online == fleet.size() && configs == fleet.size() * discovery.size();
+}
+
+static void report(const char *scenario, uint64_t start_us, uint64_t online_us){
+  printf("%-28s | %10lu %12lu | %12.2f\n", scenario, connects.peak(), publishes.peak(),
+    online_us == UINT64_MAX ? -1.0 : (online_us - start_us) / 1e6);
+}
+
+static uint64_t beginScenario(){
+  connects = rate_counter();
+  publishes = rate_counter();
+  connects.start_us = publishes.start_us = micros64();
+  return micros64();
+}
+
+int main(int argc, char **argv){
+  unsigned int devices = 500;
+  unsigned long seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--devices") == 0) devices = std::max(1UL, strtoul(argv[i + 1], nullptr, 10));
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+  }
+  std::mt19937_64 rng(seed);
+  randomSeed(seed);
+  captureDiscovery();
+  fakeBrokerOnMessage(onBrokerMessage);
+
+  for (unsigned int i = 0; i < devices; i++)
+  {
+    auto d = std::make_unique<virtual_device>();
+    uint8_t mac[6] = { 0x5C, 0xCF, 0x7F, (uint8_t)(i >> 16), (uint8_t)(i >> 8), (uint8_t)i };
+    uint32_t h = hash32(mac, sizeof(mac));
+    d->seed = d->rng_state = h != 0 ? h : 1; // as deviceSeed()
+    d->id = std::string(DEVICE_ID) + "-" + std::to_string(i);
+    d->availability = forDevice(AVAILABILITY_TOPIC, d->id);
+    d->mqtt.begin(IPAddress(), LOCAL_ENV_MQTT_BROKER_PORT, d->net);
+    d->mqtt.setWill(d->availability.c_str(), "offline", RETAINED, QOS_1);
+    d->mqtt.setTimeout(MQTT_COMMAND_TIMEOUT);
+    fleet.push_back(std::move(d));
+  }
+  printf("%u devices, %u discovery messages each; first reconnect spread over %u ms (seed %lu)\n", devices,
+    (unsigned)discovery.size(), MQTT_ATTEMPT_COOLDOWN, seed);
+  printf("%-28s | %10s %12s | %12s\n", "scenario", "connects/s", "publishes/s", "all online s");
+
+  // Power restore
+  uint64_t start = beginScenario();
+  std::uniform_int_distribution<uint64_t> dhcp(DHCP_US, 2 * DHCP_US);
+  for (auto &d : fleet)
+  {
+    schedule(*d, start + dhcp(rng));
+  }
+  uint64_t online = runUntilOnline(start + 600000000ULL);
+  report("power restore", start, online);
+  check(online != UINT64_MAX && allRetained(), "power restore: every device online with all %u discovery messages retained", (unsigned)discovery.size());
+
+  // Broker restart, without and then with the jittered first reconnect
+  const double mean_rate = devices * 1000.0 / MQTT_ATTEMPT_COOLDOWN;
+  for (bool jitter : { false, true })
+  {
+    jittered = jitter;
+    start = beginScenario();
+    fakeBrokerDrop();
+    online = runUntilOnline(start + 600000000ULL);
+    report(jitter ? "broker restart" : "broker restart, no jitter", start, online);
+    if(!jitter){
+      continue; // the herd, for reference
+    }
+    check(connects.peak() <= 2 * mean_rate, "broker restart: at most %.0f connects/s (twice the mean over the cooldown), %lu",
+      2 * mean_rate, connects.peak());
+    const unsigned long limit_ms = LOOP_IDLE_MAX_MS + MQTT_ATTEMPT_COOLDOWN + 1000;
+    check(online != UINT64_MAX && online - start <= limit_ms * 1000ULL, "broker restart: every device online within %.1f s (%.2f s)",
+      limit_ms / 1000.0, online == UINT64_MAX ? -1.0 : (online - start) / 1e6);
+    bool subscribed = true;
+    for (auto &d : fleet)
+    {
+      subscribed &= fakeBrokerSubscribed(forDevice(REFRESH_RATE_SET_TOPIC, d->id).c_str());
+    }
+    check(subscribed && allRetained(), "broker restart: every device subscribed and online again");
+  }
+  return harnessResult();
+}
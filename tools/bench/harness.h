@@ -0,0 +1,31 @@
+/*
+  Shared by the host harnesses (see harness.py): each one includes the firmware as a single translation unit, like
+  bench.cpp, prints its report on stdout and returns harnessResult() from main(), so a failed check fails the run.
+*/
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+static unsigned int harness_checks = 0;
+static unsigned int harness_failures = 0;
+
+// Count a check and print it, ie. check(length <= max, "payload %u <= %u bytes", length, max)
+static void __attribute__((format(printf, 2, 3))) check(bool ok, const char* format, ...){
+  harness_checks++;
+  harness_failures += ok ? 0 : 1;
+  printf("%s ", ok ? "  ok  " : "  FAIL");
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  printf("\n");
+}
+
+static int harnessResult(){
+  printf("%u of %u checks passed\n", harness_checks - harness_failures, harness_checks);
+  return harness_failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""
+Build and run the host harnesses: scenario tests and simulators that run the firmware (src/radthing.cpp and lib/)
+against the Arduino/ESP8266 stand-ins in tools/bench/host, built the same way as the benchmarks (see run.py).
+
+  python3 tools/bench/harness.py                       # every harness
+  python3 tools/bench/harness.py schema-roundtrip      # just one
+  python3 tools/bench/harness.py pulse-load -- --minutes 5    # arguments after -- go to the harness
+
+Each harness prints its report and exits non-zero when one of its checks fails; so does this script.
+"""
+import argparse
+import os
+import subprocess
+import sys
+
+import run
+
+# name: (source in tools/bench, preprocessor definitions, what it shows)
+HARNESSES = {
+    "schema-roundtrip": ("schema-roundtrip.cpp", (), "state payload parses and every discovery value template finds its field"),
+    "coincidence-sim": ("coincidence-sim.cpp", ("SIG2_PIN=13", "NS2_PIN=14"),
+                        "two Poisson sensors with correlated noise through the coincidence window and noise gate"),
+    "burst-replay": ("burst-replay.cpp", (), "burst alarm false alarms at a 2 to 5 CPM background and detection latency of a spike"),
+    "pulse-load": ("pulse-load.cpp", (), "throughput, losses and latency per stage of the pulse path from 1 to 10,000 CPM"),
+    "metrics-scrape": ("metrics-scrape.cpp", (), "an HTTP client scraping /metrics while pulses arrive: format, values, a slow LAN, odd requests"),
+    "fleet-sim": ("fleet-sim.cpp", (), "peak connection and publish rates at the broker when hundreds of devices boot or reconnect together"),
+    "discovery-heap": ("discovery-heap.cpp", (), "heap allocations and the largest free block around discovery, with the phase arena and without"),
+    "discovery-allocs": ("discovery-allocs.cpp", (), "allocations per discovery message through the v2 builders and the v1 ones, and publishing with the arena"),
+    "broker-scenarios": ("broker-scenarios.cpp", (), "boot, steady state, a command and a broker restart against the in-process broker per network profile"),
+    "link-monitor": ("link-monitor.cpp", (), "measured broker round trip against injected latency, and the keep-alive as the link degrades and recovers"),
+    "discovery-compact": ("discovery-compact.cpp", (), "compact discovery payloads expanded back against the verbose ones, and the bytes saved per message"),
+}
+
+# Harnesses that compare the firmware with a second build of it: name: preprocessor definitions of that build, which is
+# passed to the harness as --reference BINARY
+REFERENCES = {
+    "discovery-compact": ("HA_DISCOVERY_COMPACT=0",),
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and run the host harnesses")
+    parser.add_argument("names", nargs="*", metavar="NAME", help="harnesses to run (default: all); one of %s" % ", ".join(HARNESSES))
+    parser.add_argument("--list", action="store_true", help="list the harnesses and exit")
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "g++"))
+    parser.add_argument("--build-dir", default=os.path.join(run.ROOT, ".pio", "build", "bench"))
+    argv = sys.argv[1:]
+    split = argv.index("--") if "--" in argv else len(argv)
+    args = parser.parse_args(argv[:split])
+    harness_args = argv[split + 1:]
+
+    if args.list:
+        for name, (_, _, what) in HARNESSES.items():
+            print("%-20s %s" % (name, what))
+        return
+    unknown = [n for n in args.names if n not in HARNESSES]
+    if unknown:
+        sys.exit("Unknown harness %s; see --list" % ", ".join(unknown))
+
+    failed = []
+    for name in args.names or HARNESSES:
+        source, defines, what = HARNESSES[name]
+        print("*** %s: %s" % (name, what), flush=True)
+        command = [run.build(args.cxx, args.build_dir, source, defines, observer=True)]
+        if name in REFERENCES:
+            reference_dir = os.path.join(args.build_dir, "reference")
+            command += ["--reference", run.build(args.cxx, reference_dir, source, REFERENCES[name], observer=True)]
+        if subprocess.run(command + harness_args).returncode != 0:
+            failed.append(name)
+    if failed:
+        sys.exit("Failed: %s" % ", ".join(failed))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,164 @@
+#ifndef BENCH_HOST_ARDUINO_H
+#define BENCH_HOST_ARDUINO_H
+
+/*
+  Host (Linux) stand-in for the parts of the ESP8266 Arduino core the firmware uses, so that src/radthing.cpp and lib/
+  build unchanged for tools/bench. Flash attributes are dropped, output goes nowhere (but is still formatted, as it is
+  on the device), time comes from the host's monotonic clock. Definitions are in host.cpp.
+  The harnesses can switch to simulated time and drive the pins (see "Host only" below).
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+typedef uint8_t byte;
+
+#define ICACHE_FLASH_ATTR
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define F(x) (x)
+#define PSTR(x) (x)
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define LED_BUILTIN 5
+#define digitalPinToInterrupt(p) (p)
+
+class __FlashStringHelper;
+
+class String {
+  public:
+    String() {}
+    String(const char *s) : _s(s ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+    String(double v, unsigned char decimals = 2);
+
+    const char *c_str() const { return _s.c_str(); }
+    unsigned length() const { return _s.length(); }
+    bool equals(const String &o) const { return _s == o._s; }
+    bool equals(const char *o) const { return _s == o; }
+    bool startsWith(const char *prefix) const { return _s.rfind(prefix, 0) == 0; }
+    bool endsWith(const char *suffix) const;
+    long toInt() const { return strtol(_s.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(_s.c_str(), nullptr); }
+    bool operator==(const char *o) const { return _s == o; }
+    bool operator==(const String &o) const { return _s == o._s; }
+    String operator+(const String &o) const { return String(_s + o._s); }
+    String operator+(const char *o) const { return String(_s + o); }
+    friend String operator+(const char *a, const String &b) { return String(a + b._s); }
+
+  private:
+    std::string _s;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t write(const char *s, size_t size) { return write((const uint8_t *)s, size); }
+    virtual int availableForWrite() { return 0; }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(signed char v) { return printf("%d", v); }
+    size_t print(unsigned char v) { return printf("%u", v); }
+    size_t print(short v) { return printf("%d", v); }
+    size_t print(unsigned short v) { return printf("%u", v); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(long long v) { return printf("%lld", v); }
+    size_t print(unsigned long long v) { return printf("%llu", v); }
+    size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+    template <class T> size_t print(const T &v) { return print(v.toString()); }
+    template <class T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    size_t println(double v, int decimals) { size_t n = print(v, decimals); return n + println(); }
+    size_t println() { return write("\r\n"); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+struct HardwareSerial : public Print {
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t *, size_t size) override { return size; }
+  using Print::write;
+  void begin(unsigned long) {}
+  operator bool() { return true; }
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+uint64_t micros64();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+template <class T> T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+
+void configTime(int timezone, int daylightOffset_sec, const char *server1, const char *server2 = nullptr, const char *server3 = nullptr);
+
+// *** Host only ***
+// Simulated time: after hostClockBegin() the clock only moves with hostClockAdvance(), delay() and esp_delay(), so a
+// harness can run hours of pulses in a second and wait for nothing
+void hostClockBegin(uint64_t start_us = 0);
+void hostClockAdvance(uint64_t us);
+// Called with the time the clock is about to move to, by delay() and hostClockAdvance(), so that a harness can fire
+// the pins due on the way at their own times (moving the clock to each with hostClockAdvance()), as interrupts would
+// arrive in the middle of a delay() on the device
+void hostClockOnAdvance(void (*events)(uint64_t until_us));
+// True once an event has called esp_schedule() during an esp_delay(), which then ends at that event's time; an event
+// source stops there, as the rest of its events are due after the firmware has woken up
+bool hostClockWoken();
+// Pin levels; a change runs the handler attached to the pin when the edge matches its mode, as the interrupt would
+void hostPinWrite(uint8_t pin, int level);
+// Where ESP's heap figures come from: fixed ones (40000 bytes free, 30000 in the largest block) unless a harness models
+// the device heap, nullptr to go back to those
+void hostHeapStats(void (*stats)(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation));
+
+struct EspClass {
+  uint32_t getCycleCount();   // host clock at the nominal 80 MHz
+  uint8_t getCpuFreqMHz() { return 80; }
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+  uint32_t getChipId() { return 0xBE0C4; }
+  void getHeapStats(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation);
+  bool flashRead(uint32_t address, uint32_t *data, size_t size);   // no flash on the host: always fails
+  bool flashWrite(uint32_t address, const uint32_t *data, size_t size);
+  bool flashEraseSector(uint32_t sector);
+};
+extern EspClass ESP;
+
+#endif
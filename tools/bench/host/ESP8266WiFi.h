@@ -0,0 +1,111 @@
+#ifndef BENCH_HOST_ESP8266WIFI_H
+#define BENCH_HOST_ESP8266WIFI_H
+
+#include <functional>
+#include <memory>
+#include <Arduino.h>
+#include <IPAddress.h>
+#include "host-net.h"
+
+// The station connects as soon as WiFi.begin() is called, as setup() expects of a station that starts disconnected;
+// sockets are in-process connections (host-net.h), to the fake broker (fake-broker.h) or a harness
+
+enum wl_status_t { WL_NO_SHIELD = 255, WL_IDLE_STATUS = 0, WL_NO_SSID_AVAIL, WL_SCAN_COMPLETED, WL_CONNECTED, WL_CONNECT_FAILED, WL_CONNECTION_LOST, WL_DISCONNECTED };
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP, WIFI_LIGHT_SLEEP, WIFI_MODEM_SLEEP };
+
+struct WiFiEventStationModeConnected {};
+struct WiFiEventStationModeGotIP { IPAddress ip; IPAddress mask; IPAddress gw; };
+struct WiFiEventStationModeDisconnected { uint8_t reason; };
+typedef std::shared_ptr<void> WiFiEventHandler;
+
+struct ESP8266WiFiClass {
+  wl_status_t status() { return _connected ? WL_CONNECTED : WL_DISCONNECTED; }
+  bool isConnected() { return _connected; }
+  bool mode(WiFiMode_t) { return true; }
+  bool setSleepMode(WiFiSleepType_t, uint8_t = 0) { return true; }
+  bool setAutoReconnect(bool) { return true; }
+  wl_status_t begin(const char *, const char *);
+  String SSID() { return "bench"; }
+  String BSSIDstr() { return "00:00:00:00:00:00"; }
+  const char *getHostname() { return "esp-bench"; }
+  IPAddress localIP() { return IPAddress(10, 0, 0, 48); }
+  IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+  IPAddress gatewayIP() { return IPAddress(10, 0, 0, 1); }
+  IPAddress broadcastIP() { return IPAddress(10, 0, 0, 255); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(10, 0, 0, 1); }
+  String macAddress() { return "5C:CF:7F:AE:DE:0A"; }
+  uint8_t *macAddress(uint8_t *mac);
+  int8_t RSSI() { return -67; }
+  WiFiEventHandler onStationModeConnected(std::function<void(const WiFiEventStationModeConnected &)>) { return nullptr; }
+  WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP &)> handler) { _got_ip = handler; return nullptr; }
+  WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected &)>) { return nullptr; }
+
+  private:
+    bool _connected = false;
+    std::function<void(const WiFiEventStationModeGotIP &)> _got_ip;
+};
+extern ESP8266WiFiClass WiFi;
+
+class Client : public Print {
+  public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+    using Print::write;
+};
+
+// Connected through the in-process TCP of host-net.h
+class WiFiClient : public Client {
+  public:
+    WiFiClient() {}
+    WiFiClient(std::shared_ptr<host_connection> connection, uint8_t side) : _connection(connection), _side(side) {}
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t b) override { return write(&b, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+    int availableForWrite() override;
+    void setNoDelay(bool) {}
+    void setTimeout(unsigned long ms) { _timeout = ms; }
+    IPAddress remoteIP() { return IPAddress(); }
+
+  private:
+    std::shared_ptr<host_connection> _connection;
+    uint8_t _side = 0;
+    unsigned long _timeout = 5000;    // milliseconds a write waits for room in the send buffer
+};
+
+class WiFiServer {
+  public:
+    WiFiServer(uint16_t port) : _port(port), _pending(std::make_shared<std::deque<WiFiClient>>()) {}
+    void begin();
+    void stop();
+    void setNoDelay(bool) {}
+    bool hasClient() { return !_pending->empty(); }
+    WiFiClient available() { return accept(); }
+    WiFiClient accept();
+
+  private:
+    uint16_t _port;
+    std::shared_ptr<std::deque<WiFiClient>> _pending;   // accepted, not yet handed out
+};
+
+#endif
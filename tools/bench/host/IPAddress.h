@@ -0,0 +1,21 @@
+#ifndef BENCH_HOST_IPADDRESS_H
+#define BENCH_HOST_IPADDRESS_H
+
+#include <Arduino.h>
+
+class IPAddress {
+  public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+    IPAddress(uint32_t address) : _address(address) {}
+
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int index) const { return (_address >> (8 * index)) & 0xFF; }
+    bool isSet() const { return _address != 0; }
+    String toString() const;
+
+  private:
+    uint32_t _address;   // network byte order, as on the device
+};
+
+#endif
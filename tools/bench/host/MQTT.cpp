@@ -0,0 +1,360 @@
+#include <MQTT.h>
+
+// MQTT 3.1.1 control packet types
+enum { CONNECT = 1, CONNACK, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK, PINGREQ, PINGRESP, DISCONNECT };
+
+void (*MQTTClient::_published)(const char *, const char *, int) = nullptr;
+
+MQTTClient::MQTTClient(int readBufSize, int writeBufSize)
+  : _read_buffer(new uint8_t[readBufSize]), _read_buffer_size(readBufSize),
+    _write_buffer(new uint8_t[writeBufSize]), _write_buffer_size(writeBufSize) {}
+
+MQTTClient::~MQTTClient(){
+  delete[] _read_buffer;
+  delete[] _write_buffer;
+}
+
+void MQTTClient::setWill(const char *topic, const char *payload, bool retained, int qos){
+  _will_topic = topic;
+  _will_payload = payload;
+  _will_retained = retained;
+  _will_qos = qos;
+}
+
+// *********************************************************************************************************************
+// *** Encoding ***
+struct packet_writer{
+  uint8_t *start, *p, *end;
+  bool overflow = false;
+
+  void byte(uint8_t b){
+    if(p < end) *p++ = b; else overflow = true;
+  }
+  void u16(uint16_t v){
+    byte(v >> 8);
+    byte(v & 0xFF);
+  }
+  void bytes(const void *data, size_t length){
+    if((size_t)(end - p) < length){
+      overflow = true;
+      return;
+    }
+    memcpy(p, data, length);
+    p += length;
+  }
+  void string(const char *s, size_t length){
+    u16(length);
+    bytes(s, length);
+  }
+};
+
+static size_t varintLength(size_t remaining){
+  return 1 + (remaining > 127) + (remaining > 16383) + (remaining > 2097151);
+}
+
+// Fixed header and remaining length at the start of buf; returns the writer for the rest, or one that has overflowed
+static packet_writer packet(uint8_t *buf, size_t size, uint8_t header, size_t remaining){
+  packet_writer w = { buf, buf, buf + size };
+  if(1 + varintLength(remaining) + remaining > size){
+    w.overflow = true;
+    return w;
+  }
+  w.byte(header);
+  do {
+    uint8_t b = remaining % 128;
+    remaining /= 128;
+    w.byte(b | (remaining > 0 ? 0x80 : 0));
+  } while(remaining > 0);
+  return w;
+}
+
+// *********************************************************************************************************************
+// *** Transport ***
+bool MQTTClient::send(size_t length){
+  if(_client->write(_write_buffer, length) != length){
+    _error = LWMQTT_NETWORK_FAILED_WRITE;
+    close();
+    return false;
+  }
+  _last_sent = millis();
+  return true;
+}
+
+// Next packet into the read buffer, waiting for it up to timeout; the body is _read_buffer[0.._read_length)
+bool MQTTClient::receive(uint8_t &header, unsigned long timeout){
+  unsigned long start = millis();
+  auto wait = [&](){
+    while(_client->available() == 0){
+      if(!_client->connected()){
+        _error = LWMQTT_NETWORK_FAILED_READ;
+        return false;
+      }
+      if(millis() - start >= timeout){
+        _error = LWMQTT_NETWORK_TIMEOUT;
+        return false;
+      }
+      delay(1);
+    }
+    return true;
+  };
+  if(!wait()){
+    return false;
+  }
+  header = _client->read();
+  size_t remaining = 0;
+  for (unsigned int shift = 0; ; shift += 7)
+  {
+    if(!wait()){
+      return false;
+    }
+    int b = _client->read();
+    remaining |= (size_t)(b & 0x7F) << shift;
+    if((b & 0x80) == 0){
+      break;
+    }
+  }
+  if(remaining > _read_buffer_size){
+    _error = LWMQTT_BUFFER_TOO_SHORT;
+    return false;
+  }
+  for (size_t n = 0; n < remaining; )
+  {
+    if(!wait()){
+      return false;
+    }
+    n += _client->read(_read_buffer + n, remaining - n);
+  }
+  _read_length = remaining;
+  return true;
+}
+
+// Wait for the acknowledgement of type (with packet_id, if not 0), handling whatever else arrives meanwhile
+bool MQTTClient::await(uint8_t type, uint16_t packet_id){
+  unsigned long start = millis();
+  while(true){
+    unsigned long elapsed = millis() - start;
+    uint8_t header;
+    if(elapsed >= (unsigned long)_timeout){
+      _error = LWMQTT_NETWORK_TIMEOUT;
+      return false;
+    }
+    if(!receive(header, _timeout - elapsed)){
+      return false;
+    }
+    bool id_matches = packet_id == 0 || (_read_length >= 2 && ((_read_buffer[0] << 8) | _read_buffer[1]) == packet_id);
+    if((header >> 4) == type && id_matches){
+      return true;
+    }
+    dispatch(header);
+  }
+}
+
+void MQTTClient::dispatch(uint8_t header){
+  switch(header >> 4){
+    case PUBLISH: {
+      if(_read_length < 2){
+        return;
+      }
+      size_t topic_length = (_read_buffer[0] << 8) | _read_buffer[1];
+      int qos = (header >> 1) & 3;
+      size_t payload_start = 2 + topic_length + (qos > 0 ? 2 : 0);
+      if(payload_start > _read_length){
+        return;
+      }
+      String topic(std::string((const char *)_read_buffer + 2, topic_length));
+      String payload(std::string((const char *)_read_buffer + payload_start, _read_length - payload_start));
+      if(qos > 0){
+        uint16_t id = (_read_buffer[2 + topic_length] << 8) | _read_buffer[3 + topic_length];
+        packet_writer w = packet(_write_buffer, _write_buffer_size, PUBACK << 4, 2);
+        w.u16(id);
+        send(w.p - w.start);
+      }
+      if(_callback != nullptr){
+        _callback(topic, payload);
+      }
+      break;
+    }
+    case PINGRESP:
+      _ping_outstanding = false;
+      break;
+    default:
+      break;
+  }
+}
+
+void MQTTClient::close(){
+  _connected = false;
+  _ping_outstanding = false;
+  if(_client != nullptr){
+    _client->stop();
+  }
+}
+
+// *********************************************************************************************************************
+// *** Operations ***
+bool MQTTClient::connect(const char *client_id, const char *username, const char *password, bool skip){
+  if(_client == nullptr){
+    return false;
+  }
+  if(!skip){
+    _client->stop();
+    if(!_client->connect(IPAddress(), _port)){
+      _error = LWMQTT_NETWORK_FAILED_CONNECT;
+      return false;
+    }
+  }
+  bool will = !_will_topic.empty();
+  size_t remaining = 10 + 2 + strlen(client_id);
+  remaining += will ? 4 + _will_topic.length() + _will_payload.length() : 0;
+  remaining += username != nullptr ? 2 + strlen(username) : 0;
+  remaining += password != nullptr ? 2 + strlen(password) : 0;
+  packet_writer w = packet(_write_buffer, _write_buffer_size, CONNECT << 4, remaining);
+  w.string("MQTT", 4);
+  w.byte(4); // protocol level 3.1.1
+  w.byte((username != nullptr ? 0x80 : 0) | (password != nullptr ? 0x40 : 0) | (will && _will_retained ? 0x20 : 0)
+    | (will ? 0x04 | (_will_qos << 3) : 0) | (_clean_session ? 0x02 : 0));
+  w.u16(_keep_alive);
+  w.string(client_id, strlen(client_id));
+  if(will){
+    w.string(_will_topic.c_str(), _will_topic.length());
+    w.string(_will_payload.c_str(), _will_payload.length());
+  }
+  if(username != nullptr){
+    w.string(username, strlen(username));
+  }
+  if(password != nullptr){
+    w.string(password, strlen(password));
+  }
+  if(w.overflow){
+    _error = LWMQTT_BUFFER_TOO_SHORT;
+    close();
+    return false;
+  }
+  if(!send(w.p - w.start) || !await(CONNACK, 0)){
+    close();
+    return false;
+  }
+  _return_code = _read_length >= 2 && _read_buffer[1] <= 5 ? (lwmqtt_return_code_t)_read_buffer[1] : LWMQTT_UNKNOWN_RETURN_CODE;
+  if(_return_code != LWMQTT_CONNECTION_ACCEPTED){
+    _error = LWMQTT_CONNECTION_DENIED;
+    close();
+    return false;
+  }
+  _error = LWMQTT_SUCCESS;
+  _connected = true;
+  return true;
+}
+
+bool MQTTClient::publish(const char *topic, const char *payload, int length, bool retained, int qos){
+  if(!connected()){
+    _error = LWMQTT_NETWORK_FAILED_CONNECT;
+    return false;
+  }
+  size_t topic_length = strlen(topic);
+  packet_writer w = packet(_write_buffer, _write_buffer_size, (PUBLISH << 4) | (qos << 1) | (retained ? 1 : 0),
+    2 + topic_length + (qos > 0 ? 2 : 0) + length);
+  w.string(topic, topic_length);
+  uint16_t id = 0;
+  if(qos > 0){
+    id = ++_packet_id == 0 ? ++_packet_id : _packet_id;
+    w.u16(id);
+  }
+  w.bytes(payload, length);
+  if(w.overflow){
+    _error = LWMQTT_BUFFER_TOO_SHORT;
+    close();
+    return false;
+  }
+  if(!send(w.p - w.start)){
+    return false;
+  }
+  if(qos > 0 && !await(PUBACK, id)){
+    close();
+    return false;
+  }
+  _error = LWMQTT_SUCCESS;
+  if(_published != nullptr){
+    _published(topic, payload, length);
+  }
+  return true;
+}
+
+bool MQTTClient::subscribe(const char *topic, int qos){
+  if(!connected()){
+    return false;
+  }
+  size_t topic_length = strlen(topic);
+  packet_writer w = packet(_write_buffer, _write_buffer_size, (SUBSCRIBE << 4) | 0x02, 2 + 2 + topic_length + 1);
+  uint16_t id = ++_packet_id == 0 ? ++_packet_id : _packet_id;
+  w.u16(id);
+  w.string(topic, topic_length);
+  w.byte(qos);
+  if(w.overflow){
+    _error = LWMQTT_BUFFER_TOO_SHORT;
+    close();
+    return false;
+  }
+  if(!send(w.p - w.start) || !await(SUBACK, id)){
+    close();
+    return false;
+  }
+  if(_read_length < 3 || _read_buffer[2] == 0x80){
+    _error = LWMQTT_FAILED_SUBSCRIPTION;
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool MQTTClient::unsubscribe(const char *topic){
+  if(!connected()){
+    return false;
+  }
+  size_t topic_length = strlen(topic);
+  packet_writer w = packet(_write_buffer, _write_buffer_size, (UNSUBSCRIBE << 4) | 0x02, 2 + 2 + topic_length);
+  uint16_t id = ++_packet_id == 0 ? ++_packet_id : _packet_id;
+  w.u16(id);
+  w.string(topic, topic_length);
+  if(w.overflow || !send(w.p - w.start) || !await(UNSUBACK, id)){
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool MQTTClient::loop(){
+  if(!connected()){
+    return false;
+  }
+  while(_client->available() > 0){
+    uint8_t header;
+    if(!receive(header, _timeout)){
+      close();
+      return false;
+    }
+    dispatch(header);
+  }
+  if(_keep_alive > 0 && millis() - _last_sent >= (unsigned long)_keep_alive * 1000){
+    if(_ping_outstanding){
+      _error = LWMQTT_PONG_TIMEOUT;
+      close();
+      return false;
+    }
+    packet_writer w = packet(_write_buffer, _write_buffer_size, PINGREQ << 4, 0);
+    if(!send(w.p - w.start)){
+      return false;
+    }
+    _ping_outstanding = true;
+  }
+  return _connected;
+}
+
+bool MQTTClient::disconnect(){
+  if(!connected()){
+    return false;
+  }
+  packet_writer w = packet(_write_buffer, _write_buffer_size, DISCONNECT << 4, 0);
+  bool sent = _client->write(w.start, w.p - w.start) == (size_t)(w.p - w.start);
+  close();
+  return sent;
+}
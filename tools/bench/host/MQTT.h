@@ -0,0 +1,97 @@
+#ifndef BENCH_HOST_MQTT_H
+#define BENCH_HOST_MQTT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/*
+  Stand-in for the 256dpi MQTT client, speaking MQTT 3.1.1 over the network client like lwmqtt: a packet is encoded
+  into the write buffer and written in one piece, one that does not fit fails with LWMQTT_BUFFER_TOO_SHORT.
+  connect() waits for the CONNACK, subscribe() for the SUBACK and a QoS 1 publish for its PUBACK, up to the timeout
+  (setTimeout(), default 1000 ms), polling the client on the simulated clock; loop() handles incoming packets and sends
+  PINGREQ once the keep-alive has passed. As in the library, any error closes the connection.
+  The broker on the other end is normally the fake one (fake-broker.h).
+*/
+
+typedef enum {
+  LWMQTT_SUCCESS = 0,
+  LWMQTT_BUFFER_TOO_SHORT = -1,
+  LWMQTT_NETWORK_FAILED_CONNECT = -3,
+  LWMQTT_NETWORK_TIMEOUT = -4,
+  LWMQTT_NETWORK_FAILED_READ = -5,
+  LWMQTT_NETWORK_FAILED_WRITE = -6,
+  LWMQTT_MISSING_OR_WRONG_PACKET = -9,
+  LWMQTT_CONNECTION_DENIED = -10,
+  LWMQTT_FAILED_SUBSCRIPTION = -11,
+  LWMQTT_PONG_TIMEOUT = -13,
+} lwmqtt_err_t;
+
+typedef enum {
+  LWMQTT_CONNECTION_ACCEPTED = 0,
+  LWMQTT_UNKNOWN_RETURN_CODE = 6,
+} lwmqtt_return_code_t;
+
+typedef void (*MQTTClientCallbackSimple)(String &topic, String &payload);
+
+class MQTTClient {
+  public:
+    explicit MQTTClient(int bufSize = 128) : MQTTClient(bufSize, bufSize) {}
+    MQTTClient(int readBufSize, int writeBufSize);
+    ~MQTTClient();
+
+    void begin(Client &client) { _client = &client; }
+    void begin(IPAddress, int port, Client &client) { _client = &client; _port = port; }
+    void begin(const char *, int port, Client &client) { _client = &client; _port = port; }
+    void onMessage(MQTTClientCallbackSimple cb) { _callback = cb; }
+    void setWill(const char *topic, const char *payload, bool retained, int qos);
+    void setKeepAlive(int keepAlive) { _keep_alive = keepAlive; }
+    void setTimeout(int timeout) { _timeout = timeout; }
+    void setCleanSession(bool cleanSession) { _clean_session = cleanSession; }
+
+    bool connect(const char *client_id, const char *username = nullptr, const char *password = nullptr, bool skip = false);
+    bool publish(const char *topic, const char *payload, int length, bool retained, int qos);
+    bool publish(const char *topic, const char *payload, bool retained = false, int qos = 0) { return publish(topic, payload, strlen(payload), retained, qos); }
+    bool publish(const String &topic, const String &payload, bool retained = false, int qos = 0) { return publish(topic.c_str(), payload.c_str(), payload.length(), retained, qos); }
+    bool subscribe(const char *topic, int qos = 0);
+    bool unsubscribe(const char *topic);
+    bool loop();
+    bool connected() { return _client != nullptr && _client->connected() && _connected; }
+    bool disconnect();
+    lwmqtt_err_t lastError() { return _error; }
+    lwmqtt_return_code_t returnCode() { return _return_code; }
+
+    // Host only: called for every publish that went out (for QoS 1, once acknowledged), so a harness can see what goes
+    // out and when
+    static void onPublished(void (*published)(const char *topic, const char *payload, int length)) { _published = published; }
+
+  private:
+    bool send(size_t length);
+    bool receive(uint8_t &header, unsigned long timeout);
+    bool await(uint8_t type, uint16_t packet_id);
+    void dispatch(uint8_t header);
+    void close();
+
+    static void (*_published)(const char *topic, const char *payload, int length);
+    Client *_client = nullptr;
+    int _port = 1883;
+    MQTTClientCallbackSimple _callback = nullptr;
+    uint8_t *_read_buffer;
+    size_t _read_buffer_size;
+    size_t _read_length = 0;          // body of the last packet received
+    uint8_t *_write_buffer;
+    size_t _write_buffer_size;
+    std::string _will_topic, _will_payload;
+    bool _will_retained = false;
+    int _will_qos = 0;
+    int _keep_alive = 10;             // seconds
+    int _timeout = 1000;              // milliseconds
+    bool _clean_session = true;
+    uint16_t _packet_id = 0;
+    unsigned long _last_sent = 0;     // millis()
+    bool _ping_outstanding = false;
+    bool _connected = false;
+    lwmqtt_err_t _error = LWMQTT_SUCCESS;
+    lwmqtt_return_code_t _return_code = LWMQTT_CONNECTION_ACCEPTED;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef BENCH_HOST_WIFIUDP_H
+#define BENCH_HOST_WIFIUDP_H
+
+#include <ESP8266WiFi.h>
+
+class WiFiUDP : public Print {
+  public:
+    uint8_t begin(uint16_t) { return 1; }
+    int beginPacket(IPAddress, uint16_t) { return 1; }
+    int endPacket() { return 1; }
+    size_t write(uint8_t) override { return 1; }
+    size_t write(const uint8_t *, size_t size) override { return size; }
+    using Print::write;
+    int parsePacket() { return 0; }
+    int read() { return -1; }
+    int read(uint8_t *, size_t) { return 0; }
+    void stop() {}
+};
+
+#endif
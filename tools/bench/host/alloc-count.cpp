@@ -0,0 +1,85 @@
+#include <cstdlib>
+#include <new>
+#include "alloc-count.h"
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_calloc(size_t count, size_t size);
+extern "C" void* __real_realloc(void* p, size_t size);
+
+unsigned long long alloc_count = 0;
+unsigned long long alloc_bytes = 0;
+unsigned int alloc_uncounted = 0;
+void (*alloc_observer)(void* allocated, void* freed, size_t size) = nullptr;
+
+static void count(size_t size){
+  if(alloc_uncounted == 0){
+    alloc_count++;
+    alloc_bytes += size;
+  }
+}
+
+// A free is observed even where allocations are not counted, so that the observer never keeps a block gone for good
+static inline void* observe(void* allocated, void* freed, size_t size){
+#ifdef HOST_ALLOC_OBSERVER
+  if(alloc_observer != nullptr && (freed != nullptr || (allocated != nullptr && alloc_uncounted == 0))){
+    auto observer = alloc_observer;
+    alloc_observer = nullptr;
+    alloc_uncounted++;
+    observer(allocated, freed, size);
+    alloc_uncounted--;
+    alloc_observer = observer;
+  }
+#else
+  (void)freed;
+  (void)size;
+#endif
+  return allocated;
+}
+
+static void* countedAlloc(size_t size){
+  count(size);
+  void* p = __real_malloc(size ? size : 1);
+  if(p == nullptr){
+    throw std::bad_alloc();
+  }
+  return observe(p, nullptr, size);
+}
+
+extern "C" void* __wrap_malloc(size_t size){
+  count(size);
+  return observe(__real_malloc(size), nullptr, size);
+}
+
+extern "C" void* __wrap_calloc(size_t count, size_t size){
+  ::count(count * size);
+  return observe(__real_calloc(count, size), nullptr, count * size);
+}
+
+extern "C" void* __wrap_realloc(void* p, size_t size){
+  count(size);
+  void* moved = __real_realloc(p, size);
+  if(p != nullptr && (moved != nullptr || size == 0)){
+    observe(nullptr, p, 0);
+  }
+  return observe(moved, nullptr, size);
+}
+
+#ifdef HOST_ALLOC_OBSERVER
+extern "C" void __real_free(void* p);
+
+extern "C" void __wrap_free(void* p){
+  if(p != nullptr){
+    observe(nullptr, p, 0);
+  }
+  __real_free(p);
+}
+#endif
+
+void* operator new(size_t size){ return countedAlloc(size); }
+void* operator new[](size_t size){ return countedAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { count(size); return observe(__real_malloc(size ? size : 1), nullptr, size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { count(size); return observe(__real_malloc(size ? size : 1), nullptr, size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
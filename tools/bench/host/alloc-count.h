@@ -0,0 +1,22 @@
+#ifndef BENCH_HOST_ALLOC_COUNT_H
+#define BENCH_HOST_ALLOC_COUNT_H
+
+// Heap allocations (and bytes requested) since start: the global operator new is replaced and malloc, calloc and
+// realloc are wrapped (-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc), so the phase arena's block is counted too
+extern unsigned long long alloc_count;
+extern unsigned long long alloc_bytes;
+
+// Called with each counted allocation (allocated, nullptr, size) and each free (nullptr, freed, 0), a realloc being a
+// free and an allocation, ie. to replay them into a model of the device heap; its own allocations are not observed.
+// Only in builds with HOST_ALLOC_OBSERVER defined and free wrapped as well, as harness.py's are (run.build(observer=True)).
+extern void (*alloc_observer)(void* allocated, void* freed, size_t size);
+
+// Allocations made by the host stand-ins themselves (the in-process network and broker) are not the firmware's and
+// are left out while one of these is in scope
+extern unsigned int alloc_uncounted;
+struct host_alloc_uncounted{
+  host_alloc_uncounted(){ alloc_uncounted++; }
+  ~host_alloc_uncounted(){ alloc_uncounted--; }
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef BENCH_HOST_COREDECLS_H
+#define BENCH_HOST_COREDECLS_H
+
+#include <functional>
+#include <stdint.h>
+
+void settimeofday_cb(const std::function<void()> &cb);   // never called back; the host clock is not set over SNTP
+
+// As the core's: esp_delay() suspends loop() until the time is up or esp_schedule() is called (ie. from an interrupt);
+// the predicate versions go back to sleep while blocked() holds
+void esp_delay(unsigned long ms);
+void esp_schedule();
+bool esp_try_delay(const uint32_t start_ms, const uint32_t timeout_ms, const uint32_t intvl_ms);
+
+unsigned long millis();
+
+template <typename T> inline void esp_delay(const uint32_t timeout_ms, T &&blocked, const uint32_t intvl_ms){
+  const uint32_t start_ms = millis();
+  while(!esp_try_delay(start_ms, timeout_ms, intvl_ms) && blocked()){
+  }
+}
+
+template <typename T> inline void esp_delay(const uint32_t timeout_ms, T &&blocked){
+  esp_delay(timeout_ms, std::forward<T>(blocked), timeout_ms);
+}
+
+#endif
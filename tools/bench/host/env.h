@@ -0,0 +1,2 @@
+// Used when there is no src/env.h; the bench never connects anywhere
+#include "../../../src/sample-env.h"
@@ -0,0 +1,402 @@
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <env.h>
+#include "alloc-count.h"
+#include "fake-broker.h"
+
+// MQTT 3.1.1 control packet types
+enum { CONNECT = 1, CONNACK, PUBLISH, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK, PINGREQ, PINGRESP, DISCONNECT };
+
+struct broker_session{
+  std::shared_ptr<host_connection> connection;
+  std::string buffer;                       // received, not yet a whole packet
+  bool connected = false;                   // CONNECT received
+  bool closed = false;
+  std::string client_id;
+  std::string will_topic, will_payload;
+  bool will_retained = false;
+  unsigned int keep_alive = 0;              // seconds
+  uint64_t last_packet_us = 0;
+  std::vector<std::string> filters;
+};
+
+static uint16_t broker_port = 0;
+static host_link broker_link = HOST_LINK_LOCAL;
+static std::vector<std::shared_ptr<broker_session>> sessions;
+static std::map<std::string, fake_broker_message> retained;
+static fake_broker_stats stats;
+static void (*on_message)(const fake_broker_message &) = nullptr;
+
+// Listening from the start, like the broker the firmware expects to find
+static struct fake_broker_autostart{
+  fake_broker_autostart(){ fakeBrokerBegin(LOCAL_ENV_MQTT_BROKER_PORT); }
+} autostart;
+
+static bool matches(const std::string &filter, const std::string &topic){
+  size_t f = 0, t = 0;
+  while(f < filter.length()){
+    if(filter[f] == '#'){
+      return true;
+    }
+    if(filter[f] == '+'){
+      while(t < topic.length() && topic[t] != '/'){
+        t++;
+      }
+      f++;
+      continue;
+    }
+    if(t >= topic.length() || filter[f] != topic[t]){
+      return false;
+    }
+    f++;
+    t++;
+  }
+  return t == topic.length();
+}
+
+// *********************************************************************************************************************
+// *** Packets ***
+static void send(broker_session &s, const std::string &packet, uint64_t at_us){
+  hostSend(*s.connection, 1, (const uint8_t *)packet.data(), packet.length(), at_us);
+}
+
+static std::string packet(uint8_t header, const std::string &body){
+  std::string p(1, (char)header);
+  size_t remaining = body.length();
+  do {
+    uint8_t b = remaining % 128;
+    remaining /= 128;
+    p += (char)(b | (remaining > 0 ? 0x80 : 0));
+  } while(remaining > 0);
+  return p + body;
+}
+
+static std::string u16(uint16_t v){
+  return std::string({ (char)(v >> 8), (char)(v & 0xFF) });
+}
+
+static std::string field(const std::string &s){
+  return u16(s.length()) + s;
+}
+
+// Reads a length prefixed field at pos; false if the body ends first
+static bool readField(std::string_view body, size_t &pos, std::string &out){
+  if(pos + 2 > body.length()){
+    return false;
+  }
+  size_t length = ((uint8_t)body[pos] << 8) | (uint8_t)body[pos + 1];
+  if(pos + 2 + length > body.length()){
+    return false;
+  }
+  out.assign(body.substr(pos + 2, length));
+  pos += 2 + length;
+  return true;
+}
+
+// Sent without the retain flag, which is only set on the messages sent for a new subscription
+static void deliver(const fake_broker_message &m){
+  std::string p;
+  for (auto &s : sessions)
+  {
+    if(s->closed || !s->connected){
+      continue;
+    }
+    for (const std::string &filter : s->filters)
+    {
+      if(matches(filter, m.topic)){
+        if(p.empty()){
+          p = packet(PUBLISH << 4, field(m.topic) + m.payload);
+        }
+        send(*s, p, m.at_us);
+        break;
+      }
+    }
+  }
+}
+
+static void publish(const fake_broker_message &m){
+  if(on_message != nullptr){
+    on_message(m);
+  }
+  if(m.retained){
+    if(m.payload.empty()){
+      retained.erase(m.topic);
+    }
+    else {
+      retained[m.topic] = m;
+    }
+  }
+  deliver(m);
+}
+
+// The connection ended without a DISCONNECT
+static void lost(broker_session &s, uint64_t at_us){
+  if(s.closed){
+    return;
+  }
+  s.closed = true;
+  hostClose(*s.connection);
+  if(s.connected && !s.will_topic.empty()){
+    stats.wills++;
+    publish({ s.will_topic, s.will_payload, s.will_retained, 0, at_us });
+  }
+}
+
+static void handle(broker_session &s, uint8_t header, std::string_view body, uint64_t at_us){
+  size_t pos = 0;
+  s.last_packet_us = at_us;
+  switch(header >> 4){
+    case CONNECT: {
+      std::string protocol;
+      if(!readField(body, pos, protocol) || pos + 4 > body.length()){
+        lost(s, at_us);
+        return;
+      }
+      uint8_t flags = body[pos + 1];
+      s.keep_alive = ((uint8_t)body[pos + 2] << 8) | (uint8_t)body[pos + 3];
+      pos += 4;
+      readField(body, pos, s.client_id);
+      if(flags & 0x04){
+        readField(body, pos, s.will_topic);
+        readField(body, pos, s.will_payload);
+        s.will_retained = (flags & 0x20) != 0;
+      }
+      for (auto &other : sessions)
+      {
+        if(other.get() != &s && !other->closed && other->connected && other->client_id == s.client_id){
+          lost(*other, at_us); // taken over
+        }
+      }
+      s.connected = true;
+      stats.connects++;
+      send(s, packet(CONNACK << 4, u16(0)), at_us);
+      break;
+    }
+    case PUBLISH: {
+      fake_broker_message m;
+      int qos = (header >> 1) & 3;
+      if(!readField(body, pos, m.topic) || (qos > 0 && pos + 2 > body.length())){
+        lost(s, at_us);
+        return;
+      }
+      uint16_t id = 0;
+      if(qos > 0){
+        id = ((uint8_t)body[pos] << 8) | (uint8_t)body[pos + 1];
+        pos += 2;
+      }
+      m.payload.assign(body.substr(pos));
+      m.retained = (header & 1) != 0;
+      m.qos = qos;
+      m.at_us = at_us;
+      stats.publishes++;
+      if(qos > 0){
+        stats.acknowledged++;
+        send(s, packet(PUBACK << 4, u16(id)), at_us);
+      }
+      publish(m);
+      break;
+    }
+    case SUBSCRIBE: {
+      if(pos + 2 > body.length()){
+        lost(s, at_us);
+        return;
+      }
+      std::string ack(body.substr(0, 2));
+      std::vector<std::string> added;
+      pos += 2;
+      std::string filter;
+      while(readField(body, pos, filter) && pos < body.length()){
+        uint8_t qos = body[pos++];
+        s.filters.push_back(filter);
+        added.push_back(filter);
+        ack += (char)std::min<uint8_t>(qos, 1);
+        stats.subscribes++;
+      }
+      send(s, packet(SUBACK << 4, ack), at_us);
+      for (const auto &r : retained)
+      {
+        for (const std::string &f : added)
+        {
+          if(matches(f, r.first)){
+            send(s, packet((PUBLISH << 4) | 1, field(r.first) + r.second.payload), at_us);
+            break;
+          }
+        }
+      }
+      break;
+    }
+    case UNSUBSCRIBE: {
+      std::string ack(body.substr(0, std::min<size_t>(2, body.length())));
+      pos += 2;
+      std::string filter;
+      while(readField(body, pos, filter)){
+        s.filters.erase(std::remove(s.filters.begin(), s.filters.end(), filter), s.filters.end());
+      }
+      send(s, packet(UNSUBACK << 4, ack), at_us);
+      break;
+    }
+    case PINGREQ:
+      stats.pings++;
+      send(s, packet(PINGRESP << 4, ""), at_us);
+      break;
+    case DISCONNECT:
+      stats.disconnects++;
+      s.closed = true; // the will is discarded
+      hostClose(*s.connection);
+      break;
+    default:
+      lost(s, at_us);
+      break;
+  }
+}
+
+// Next whole packet in data from offset on, which it moves past it; false once the rest is incomplete
+static bool nextPacket(std::string_view data, size_t &offset, uint8_t &header, std::string_view &body){
+  size_t remaining = 0, pos = offset + 1;
+  for (unsigned int shift = 0; ; shift += 7)
+  {
+    if(pos >= data.length()){
+      return false;
+    }
+    uint8_t b = data[pos++];
+    remaining |= (size_t)(b & 0x7F) << shift;
+    if((b & 0x80) == 0){
+      break;
+    }
+  }
+  if(pos + remaining > data.length()){
+    return false;
+  }
+  header = data[offset];
+  body = data.substr(pos, remaining);
+  offset = pos + remaining;
+  return true;
+}
+
+static void run(broker_session &s){
+  if(s.closed){
+    return;
+  }
+  host_connection &c = *s.connection;
+  host_segment segment;
+  while(!s.closed && hostReceive(c, 1, segment)){
+    stats.bytes += segment.bytes.length();
+    // a segment is usually one whole packet; only what is left of one is kept for the next
+    std::string &data = s.buffer.empty() ? segment.bytes : s.buffer.append(segment.bytes);
+    size_t offset = 0;
+    uint8_t header;
+    std::string_view body;
+    while(!s.closed && nextPacket(data, offset, header, body)){
+      handle(s, header, body, segment.due_us);
+    }
+    s.buffer = data.substr(offset);
+  }
+  if(s.closed){
+    return;
+  }
+  if(!hostOpen(c)){
+    lost(s, c.closed_us);
+    return;
+  }
+  uint64_t silent_until = s.last_packet_us + s.keep_alive * 1500000ULL; // 1.5 keep-alives
+  if(s.connected && s.keep_alive > 0 && micros64() >= silent_until){
+    lost(s, silent_until);
+  }
+}
+
+// *********************************************************************************************************************
+// *** Harness interface ***
+// Sessions go, and their connections no longer run them
+template <class P> static void forget(P which){
+  auto gone = std::stable_partition(sessions.begin(), sessions.end(), [&](const std::shared_ptr<broker_session> &s){ return !which(*s); });
+  for (auto s = gone; s != sessions.end(); s++)
+  {
+    (*s)->connection->peer = nullptr;
+  }
+  sessions.erase(gone, sessions.end());
+}
+
+void fakeBrokerBegin(uint16_t port){
+  broker_port = port;
+  hostListen(port, [](std::shared_ptr<host_connection> c){
+    forget([](const broker_session &s){ return s.closed; });
+    auto s = std::make_shared<broker_session>();
+    s->connection = c;
+    s->last_packet_us = micros64();
+    broker_session *session = s.get(); // the session owns the connection, not the other way around
+    c->peer = [session](host_connection &){ run(*session); };
+    sessions.push_back(s);
+  }, broker_link);
+}
+
+void fakeBrokerLink(const host_link &link){
+  broker_link = link;
+  hostListenLink(broker_port, link);
+}
+
+void fakeBrokerPoll(){
+  host_alloc_uncounted uncounted;
+  for (size_t i = 0; i < sessions.size(); i++)
+  {
+    run(*sessions[i]);
+  }
+}
+
+void fakeBrokerDrop(){
+  host_alloc_uncounted uncounted;
+  for (auto &s : sessions)
+  {
+    lost(*s, micros64());
+  }
+}
+
+void fakeBrokerPublish(const char *topic, const char *payload, bool retain){
+  host_alloc_uncounted uncounted;
+  publish({ topic, payload, retain, 0, micros64() });
+}
+
+void fakeBrokerOnMessage(void (*received)(const fake_broker_message &message)){
+  on_message = received;
+}
+
+void fakeBrokerReset(){
+  host_alloc_uncounted uncounted;
+  fakeBrokerDrop();
+  forget([](const broker_session &){ return true; });
+  retained.clear();
+  stats = fake_broker_stats();
+}
+
+const fake_broker_stats &fakeBrokerStats(){
+  return stats;
+}
+
+const std::map<std::string, fake_broker_message> &fakeBrokerRetained(){
+  return retained;
+}
+
+bool fakeBrokerSubscribed(const char *topic){
+  for (auto &s : sessions)
+  {
+    if(s->closed){
+      continue;
+    }
+    for (const std::string &filter : s->filters)
+    {
+      if(matches(filter, topic)){
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+unsigned int fakeBrokerSessions(){
+  unsigned int open = 0;
+  for (auto &s : sessions)
+  {
+    open += !s->closed && s->connected ? 1 : 0;
+  }
+  return open;
+}
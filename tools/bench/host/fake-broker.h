@@ -0,0 +1,53 @@
+#ifndef BENCH_HOST_FAKE_BROKER_H
+#define BENCH_HOST_FAKE_BROKER_H
+
+#include <map>
+#include <string>
+#include "host-net.h"
+
+/*
+  In-process MQTT 3.1.1 broker for the host harnesses. It listens on LOCAL_ENV_MQTT_BROKER_PORT from the start, so
+  the firmware finds it where it would find the real one. It speaks enough of the protocol for the 256dpi client:
+    - CONNECT (client id, will, keep-alive, credentials) / CONNACK; a second CONNECT with the same client id takes over
+    - PUBLISH at QoS 0 and 1 / PUBACK; retained messages are kept per topic (an empty one clears it)
+    - SUBSCRIBE (with + and # filters) / SUBACK, with the retained messages that match; UNSUBSCRIBE / UNSUBACK
+    - PINGREQ / PINGRESP, DISCONNECT
+  Messages are forwarded at QoS 0 to every session with a matching subscription. The will of a session is published
+  when its connection ends without a DISCONNECT: broken by the link, taken over, or silent for 1.5 keep-alives.
+  The network between broker and client is the host_link of each connection (see host-net.h), set with
+  fakeBrokerLink() for the connections made from then on. The broker runs whenever the client uses its connection;
+  fakeBrokerPoll() runs it from a harness (ie. to notice a keep-alive that has run out).
+*/
+
+struct fake_broker_stats{
+  unsigned long connects = 0;           // CONNACKs sent
+  unsigned long disconnects = 0;        // clean: DISCONNECT received
+  unsigned long wills = 0;              // wills published
+  unsigned long publishes = 0;          // PUBLISH received
+  unsigned long acknowledged = 0;       // PUBACKs sent
+  unsigned long long bytes = 0;         // received
+  unsigned long subscribes = 0;         // topic filters subscribed
+  unsigned long pings = 0;              // PINGREQs answered
+};
+
+struct fake_broker_message{
+  std::string topic;
+  std::string payload;
+  bool retained;
+  int qos;
+  uint64_t at_us;                       // arrival at the broker
+};
+
+void fakeBrokerBegin(uint16_t port);
+void fakeBrokerLink(const host_link &link);
+void fakeBrokerPoll();
+void fakeBrokerDrop();                                    // break every connection, as a broker restart would
+void fakeBrokerPublish(const char *topic, const char *payload, bool retained = false); // as if from another client
+void fakeBrokerOnMessage(void (*published)(const fake_broker_message &message));     // every message: received, will or from fakeBrokerPublish()
+void fakeBrokerReset();                                   // forget sessions, retained messages and statistics
+const fake_broker_stats &fakeBrokerStats();
+const std::map<std::string, fake_broker_message> &fakeBrokerRetained();
+bool fakeBrokerSubscribed(const char *topic);             // an open session has a subscription matching topic
+unsigned int fakeBrokerSessions();                        // open connections that have sent their CONNECT
+
+#endif
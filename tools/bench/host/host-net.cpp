@@ -0,0 +1,286 @@
+#include <map>
+#include <ESP8266WiFi.h>
+#include "alloc-count.h"
+#include "host-net.h"
+
+struct host_listener{
+  host_accept accept;
+  host_link link;
+};
+
+// Constructed on first use, so that stand-ins can listen from their static initializers
+static std::map<uint16_t, host_listener> &listeners(){
+  static std::map<uint16_t, host_listener> ports;
+  return ports;
+}
+
+// Segment loss has its own generator, so that the firmware's random() sequence does not depend on the traffic
+static uint32_t loss_state = 1;
+
+static bool lost(uint8_t loss_percent){
+  loss_state = loss_state * 1103515245 + 12345;
+  return loss_percent > 0 && (loss_state >> 16) % 100 < loss_percent;
+}
+
+void hostListen(uint16_t port, host_accept accept, const host_link &link){
+  listeners()[port] = { accept, link };
+}
+
+void hostUnlisten(uint16_t port){
+  listeners().erase(port);
+}
+
+void hostListenLink(uint16_t port, const host_link &link){
+  auto listener = listeners().find(port);
+  if(listener != listeners().end()){
+    listener->second.link = link;
+  }
+}
+
+std::shared_ptr<host_connection> hostConnect(uint16_t port){
+  host_alloc_uncounted uncounted;
+  auto listener = listeners().find(port);
+  if(listener == listeners().end()){
+    return nullptr;
+  }
+  auto c = std::make_shared<host_connection>();
+  c->link = listener->second.link;
+  c->opened_us = micros64();
+  c->link_free_us[0] = c->link_free_us[1] = c->opened_us;
+  listener->second.accept(c);
+  delay(c->link.rtt_ms); // SYN, SYN-ACK
+  return c;
+}
+
+bool hostOpen(host_connection &c){
+  uint64_t now = micros64();
+  if(c.link.disconnect_every_ms > 0 && c.closed_us == UINT64_MAX){
+    uint64_t breaks = c.opened_us + c.link.disconnect_every_ms * 1000ULL;
+    if(now >= breaks){
+      c.closed_us = breaks;
+    }
+  }
+  return now < c.closed_us;
+}
+
+void hostClose(host_connection &c){
+  if(!hostOpen(c)){
+    return;
+  }
+  // an orderly close: the FIN follows whatever is still on its way
+  uint64_t fin = micros64();
+  for (const std::deque<host_segment> &toward : c.toward)
+  {
+    if(!toward.empty()){
+      fin = std::max(fin, toward.back().due_us);
+    }
+  }
+  c.closed_us = fin;
+}
+
+size_t hostWritable(host_connection &c, uint8_t side){
+  uint64_t now = micros64();
+  size_t in_flight = 0;
+  while(!c.unacked[side].empty() && c.unacked[side].front().first <= now){
+    c.unacked[side].pop_front();
+  }
+  for (const auto &segment : c.unacked[side])
+  {
+    in_flight += segment.second;
+  }
+  return in_flight < HOST_SEND_BUFFER ? HOST_SEND_BUFFER - in_flight : 0;
+}
+
+size_t hostSend(host_connection &c, uint8_t side, const uint8_t *buf, size_t size, uint64_t at_us){
+  host_alloc_uncounted uncounted;
+  if(!hostOpen(c)){
+    return 0;
+  }
+  size_t n = std::min(size, hostWritable(c, side));
+  if(n == 0){
+    return 0;
+  }
+  uint8_t to = 1 - side;
+  uint64_t at = at_us == UINT64_MAX ? micros64() : at_us;
+  uint64_t start = std::max(at, c.link_free_us[to]);
+  uint64_t clocked = c.link.bytes_per_sec > 0 ? n * 1000000ULL / c.link.bytes_per_sec : 0;
+  c.link_free_us[to] = start + clocked;
+  uint64_t one_way = c.link.rtt_ms * 500ULL;
+  uint64_t due = start + clocked + one_way + (lost(c.link.loss_percent) ? c.link.retransmit_ms * 1000ULL : 0);
+  if(!c.toward[to].empty()){
+    due = std::max(due, c.toward[to].back().due_us); // in order
+  }
+  c.toward[to].push_back({ due, std::string((const char *)buf, n) });
+  c.unacked[side].push_back({ due + one_way, n });
+  return n;
+}
+
+// Segments that have arrived at side by now: before the connection closed, that is
+static bool arrived(host_connection &c, uint8_t side){
+  hostOpen(c);
+  return !c.toward[side].empty() && c.toward[side].front().due_us <= micros64() && c.toward[side].front().due_us <= c.closed_us;
+}
+
+int hostAvailable(host_connection &c, uint8_t side){
+  int n = 0;
+  uint64_t now = micros64();
+  for (const host_segment &segment : c.toward[side])
+  {
+    if(segment.due_us > now || segment.due_us > c.closed_us){
+      break;
+    }
+    n += segment.bytes.length();
+  }
+  return n - (n > 0 ? c.read_offset[side] : 0);
+}
+
+int hostRead(host_connection &c, uint8_t side, uint8_t *buf, size_t size){
+  size_t n = 0;
+  while(n < size && arrived(c, side)){
+    const std::string &bytes = c.toward[side].front().bytes;
+    size_t part = std::min(size - n, bytes.length() - c.read_offset[side]);
+    memcpy(buf + n, bytes.data() + c.read_offset[side], part);
+    n += part;
+    c.read_offset[side] += part;
+    if(c.read_offset[side] == bytes.length()){
+      c.toward[side].pop_front();
+      c.read_offset[side] = 0;
+    }
+  }
+  return n;
+}
+
+int hostPeek(host_connection &c, uint8_t side){
+  return arrived(c, side) ? (uint8_t)c.toward[side].front().bytes[c.read_offset[side]] : -1;
+}
+
+bool hostReceive(host_connection &c, uint8_t side, host_segment &segment){
+  host_alloc_uncounted uncounted;
+  if(!arrived(c, side)){
+    return false;
+  }
+  segment = std::move(c.toward[side].front());
+  segment.bytes.erase(0, c.read_offset[side]);
+  c.toward[side].pop_front();
+  c.read_offset[side] = 0;
+  return true;
+}
+
+void hostService(host_connection &c){
+  if(!c.peer || c.peer_closed){
+    return;
+  }
+  host_alloc_uncounted uncounted;
+  bool open = hostOpen(c);
+  c.peer(c); // also when nothing has arrived: a peer may have timers of its own
+  c.peer_closed = !open;
+}
+
+// *********************************************************************************************************************
+// *** WiFiClient, WiFiServer ***
+int WiFiClient::connect(IPAddress, uint16_t port){
+  stop();
+  _connection = hostConnect(port);
+  _side = 0;
+  return _connection != nullptr;
+}
+
+int WiFiClient::connect(const char *, uint16_t port){
+  return connect(IPAddress(), port);
+}
+
+// Like lwIP's, a write waits (up to the client's timeout) for room in the send buffer until it has written everything
+size_t WiFiClient::write(const uint8_t *buf, size_t size){
+  if(_connection == nullptr){
+    return 0;
+  }
+  size_t sent = 0;
+  unsigned long start = millis();
+  while(sent < size && hostOpen(*_connection)){
+    sent += hostSend(*_connection, _side, buf + sent, size - sent);
+    hostService(*_connection);
+    if(sent < size){
+      if(millis() - start >= _timeout){
+        break;
+      }
+      delay(1);
+    }
+  }
+  return sent;
+}
+
+// The peer runs only when there is nothing left to read, ie. when the caller is waiting on it
+int WiFiClient::available(){
+  if(_connection == nullptr){
+    return 0;
+  }
+  int n = hostAvailable(*_connection, _side);
+  if(n > 0){
+    return n;
+  }
+  hostService(*_connection);
+  return hostAvailable(*_connection, _side);
+}
+
+int WiFiClient::read(){
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size){
+  if(_connection == nullptr){
+    return 0;
+  }
+  if(hostAvailable(*_connection, _side) == 0){
+    hostService(*_connection);
+  }
+  return hostRead(*_connection, _side, buf, size);
+}
+
+int WiFiClient::peek(){
+  if(_connection == nullptr){
+    return -1;
+  }
+  hostService(*_connection);
+  return hostPeek(*_connection, _side);
+}
+
+void WiFiClient::stop(){
+  if(_connection != nullptr){
+    hostClose(*_connection);
+    hostService(*_connection);
+    _connection = nullptr;
+  }
+}
+
+// As on the ESP8266, a closed connection counts as connected while there is data left to read
+uint8_t WiFiClient::connected(){
+  if(_connection == nullptr){
+    return 0;
+  }
+  hostService(*_connection);
+  return hostOpen(*_connection) || hostAvailable(*_connection, _side) > 0;
+}
+
+int WiFiClient::availableForWrite(){
+  return _connection != nullptr && hostOpen(*_connection) ? hostWritable(*_connection, _side) : 0;
+}
+
+void WiFiServer::begin(){
+  std::shared_ptr<std::deque<WiFiClient>> pending = _pending;
+  hostListen(_port, [pending](std::shared_ptr<host_connection> c){ pending->push_back(WiFiClient(c, 1)); });
+}
+
+void WiFiServer::stop(){
+  hostUnlisten(_port);
+  _pending->clear();
+}
+
+WiFiClient WiFiServer::accept(){
+  if(_pending->empty()){
+    return WiFiClient();
+  }
+  WiFiClient client = _pending->front();
+  _pending->pop_front();
+  return client;
+}
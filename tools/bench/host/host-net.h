@@ -0,0 +1,70 @@
+#ifndef BENCH_HOST_NET_H
+#define BENCH_HOST_NET_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <Arduino.h>
+
+/*
+  In-process TCP for the host stand-ins: WiFiClient and WiFiServer (ESP8266WiFi.h) connect through it, and so do
+  in-process peers such as the fake broker (fake-broker.h).
+  A connection carries bytes both ways over a simulated link (host_link), on the simulated clock:
+    - a write is one segment; it arrives rtt/2 after it has been clocked onto the link at bytes_per_sec (0: no limit),
+      in order with the segments before it
+    - loss_percent of the segments are lost once and arrive retransmit_ms late, as TCP would deliver them
+    - the connection breaks disconnect_every_ms after it was opened (0: never); both sides see it closed
+    - the send buffer (HOST_SEND_BUFFER) holds the bytes written but not yet acknowledged, ie. until they have arrived
+      and the ack has come back; a write takes only what fits
+  A connect takes a round trip and is refused if nothing is listening on the port. Side 0 of a connection is the one
+  that connected, side 1 the one that accepted.
+*/
+
+#define HOST_SEND_BUFFER 2920       // lwIP's TCP_SND_BUF on the ESP8266
+
+struct host_link{
+  unsigned long rtt_ms;
+  unsigned long bytes_per_sec;
+  uint8_t loss_percent;
+  unsigned long disconnect_every_ms;
+  unsigned long retransmit_ms;
+};
+
+const host_link HOST_LINK_LOCAL = { 0, 0, 0, 0, 0 };
+
+struct host_segment{
+  uint64_t due_us;                  // arrival at the other side
+  std::string bytes;
+};
+
+struct host_connection{
+  host_link link;
+  std::deque<host_segment> toward[2];                 // toward[s]: segments on their way to side s
+  size_t read_offset[2] = { 0, 0 };                   // bytes of toward[s].front() side s has read
+  std::deque<std::pair<uint64_t, size_t>> unacked[2]; // unacked[s]: (ack time, bytes) written by side s
+  uint64_t link_free_us[2] = { 0, 0 };                // the link toward side s is busy clocking out until then
+  uint64_t opened_us = 0;
+  uint64_t closed_us = UINT64_MAX;
+  std::function<void(host_connection &)> peer;        // in-process side 1: run whenever side 0 uses the connection
+  bool peer_closed = false;                           // peer has been told of the close
+};
+
+typedef std::function<void(std::shared_ptr<host_connection>)> host_accept;
+
+void hostListen(uint16_t port, host_accept accept, const host_link &link = HOST_LINK_LOCAL);
+void hostUnlisten(uint16_t port);
+void hostListenLink(uint16_t port, const host_link &link);  // link of the connections accepted from now on
+std::shared_ptr<host_connection> hostConnect(uint16_t port); // takes a round trip; nullptr if refused
+
+bool hostOpen(host_connection &c);
+void hostClose(host_connection &c);
+size_t hostSend(host_connection &c, uint8_t side, const uint8_t *buf, size_t size, uint64_t at_us = UINT64_MAX); // at_us: default now
+int hostAvailable(host_connection &c, uint8_t side);
+int hostRead(host_connection &c, uint8_t side, uint8_t *buf, size_t size);
+int hostPeek(host_connection &c, uint8_t side);
+bool hostReceive(host_connection &c, uint8_t side, host_segment &segment); // next whole segment that has arrived, for peers
+size_t hostWritable(host_connection &c, uint8_t side);
+void hostService(host_connection &c);                // runs the in-process peer, until it has seen the close
+
+#endif
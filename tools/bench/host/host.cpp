@@ -0,0 +1,255 @@
+#include <chrono>
+#include <thread>
+#include <stdarg.h>
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <coredecls.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+char *__brkval = nullptr;   // utils.cpp freeMemory()
+extern "C" { uint32_t _EEPROM_start = 0; } // flash-log.cpp; placed by the linker script on the device
+
+static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+static bool simulated = false;      // hostClockBegin() called
+static uint64_t simulated_us = 0;
+
+uint64_t micros64(){
+  if(simulated){
+    return simulated_us;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot).count();
+}
+
+void hostClockBegin(uint64_t start_us){
+  simulated = true;
+  simulated_us = start_us;
+}
+
+static void (*clock_events)(uint64_t until_us) = nullptr;
+static bool in_clock_events = false;
+static bool wakeable = false;       // within esp_delay()
+static bool woken = false;          // ...and esp_schedule() was called
+
+void hostClockOnAdvance(void (*events)(uint64_t until_us)){
+  clock_events = events;
+}
+
+// The events due on the way run first, each at its own time; while they run the clock moves without them.
+// An esp_delay() ends at the event that woke it.
+static void advanceTo(uint64_t until_us){
+  if(clock_events != nullptr && !in_clock_events){
+    in_clock_events = true;
+    clock_events(until_us);
+    in_clock_events = false;
+  }
+  if(!woken){
+    simulated_us = std::max(simulated_us, until_us);
+  }
+}
+
+bool hostClockWoken(){
+  return woken;
+}
+
+void hostClockAdvance(uint64_t us){
+  advanceTo(simulated_us + us);
+}
+
+unsigned long micros(){
+  return (unsigned long)micros64();
+}
+
+unsigned long millis(){
+  return (unsigned long)(micros64() / 1000);
+}
+
+void delay(unsigned long ms){
+  if(simulated){
+    advanceTo(simulated_us + ms * 1000ULL);
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void esp_delay(unsigned long ms){
+  if(!simulated){
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return;
+  }
+  wakeable = true;
+  advanceTo(simulated_us + ms * 1000ULL);
+  wakeable = false;
+  woken = false;
+}
+
+void esp_schedule(){
+  woken = woken || wakeable;
+}
+
+bool esp_try_delay(const uint32_t start_ms, const uint32_t timeout_ms, const uint32_t intvl_ms){
+  uint32_t expired = millis() - start_ms;
+  if(expired >= timeout_ms){
+    return true;
+  }
+  esp_delay(std::min(timeout_ms - expired, intvl_ms));
+  return false;
+}
+
+void delayMicroseconds(unsigned int us){
+  if(simulated){
+    advanceTo(simulated_us + us);
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield(){}
+void pinMode(uint8_t, uint8_t){}
+void digitalWrite(uint8_t, uint8_t){}
+const uint8_t HOST_PINS = 32;
+static int pin_levels[HOST_PINS];
+static void (*pin_handlers[HOST_PINS])(void);
+static int pin_modes[HOST_PINS];
+
+int digitalRead(uint8_t pin){
+  return pin < HOST_PINS ? pin_levels[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode){
+  if(pin < HOST_PINS){
+    pin_handlers[pin] = handler;
+    pin_modes[pin] = mode;
+  }
+}
+
+void detachInterrupt(uint8_t pin){
+  if(pin < HOST_PINS){
+    pin_handlers[pin] = nullptr;
+  }
+}
+
+void hostPinWrite(uint8_t pin, int level){
+  if(pin >= HOST_PINS || pin_levels[pin] == level){
+    return;
+  }
+  pin_levels[pin] = level;
+  int edge = level == HIGH ? RISING : FALLING;
+  if(pin_handlers[pin] != nullptr && (pin_modes[pin] == CHANGE || pin_modes[pin] == edge)){
+    pin_handlers[pin]();
+  }
+}
+void noInterrupts(){}
+void interrupts(){}
+
+static uint32_t random_state = 1;
+
+long random(long howbig){
+  random_state = random_state * 1103515245 + 12345;
+  return howbig > 0 ? (long)((random_state >> 1) % howbig) : 0;
+}
+
+long random(long howsmall, long howbig){
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed){
+  random_state = seed;
+}
+
+void configTime(int, int, const char *, const char *, const char *){}
+void settimeofday_cb(const std::function<void()> &){}
+
+uint32_t EspClass::getCycleCount(){
+  return (uint32_t)(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - boot).count() * 80 / 1000);
+}
+
+static void (*heap_stats)(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation) = nullptr;
+
+void hostHeapStats(void (*stats)(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation)){
+  heap_stats = stats;
+}
+
+void EspClass::getHeapStats(uint32_t *free, uint32_t *max_block, uint8_t *fragmentation){
+  if(heap_stats != nullptr){
+    heap_stats(free, max_block, fragmentation);
+    return;
+  }
+  *free = 40000;
+  *max_block = 30000;
+  *fragmentation = 0;
+}
+
+uint32_t EspClass::getFreeHeap(){
+  uint32_t free, max_block;
+  uint8_t fragmentation;
+  getHeapStats(&free, &max_block, &fragmentation);
+  return free;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize(){
+  uint32_t free, max_block;
+  uint8_t fragmentation;
+  getHeapStats(&free, &max_block, &fragmentation);
+  return max_block;
+}
+
+uint8_t EspClass::getHeapFragmentation(){
+  uint32_t free, max_block;
+  uint8_t fragmentation;
+  getHeapStats(&free, &max_block, &fragmentation);
+  return fragmentation;
+}
+
+bool EspClass::flashRead(uint32_t, uint32_t *, size_t){ return false; }
+bool EspClass::flashWrite(uint32_t, const uint32_t *, size_t){ return false; }
+bool EspClass::flashEraseSector(uint32_t){ return false; }
+
+String::String(double v, unsigned char decimals){
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+  _s = buf;
+}
+
+bool String::endsWith(const char *suffix) const {
+  size_t n = strlen(suffix);
+  return _s.length() >= n && _s.compare(_s.length() - n, n, suffix) == 0;
+}
+
+size_t Print::write(const uint8_t *buf, size_t size){
+  size_t n = 0;
+  while(size--){
+    n += write(*buf++);
+  }
+  return n;
+}
+
+size_t Print::printf(const char *format, ...){
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  return n > 0 ? write((const uint8_t *)buf, std::min((size_t)n, sizeof(buf) - 1)) : 0;
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(buf);
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char *, const char *){
+  _connected = true;
+  if(_got_ip){
+    _got_ip(WiFiEventStationModeGotIP{ localIP(), subnetMask(), gatewayIP() });
+  }
+  return WL_CONNECTED;
+}
+
+uint8_t *ESP8266WiFiClass::macAddress(uint8_t *mac){
+  static const uint8_t station[6] = { 0x5C, 0xCF, 0x7F, 0xAE, 0xDE, 0x0A };
+  memcpy(mac, station, sizeof(station));
+  return mac;
+}
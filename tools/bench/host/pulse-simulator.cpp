@@ -0,0 +1,144 @@
+#include <cmath>
+#include "pulse-simulator.h"
+
+static pulse_simulator pulseSimulator(pulse_sim_mode mode){
+  pulse_simulator sim;
+  sim.mode = mode;
+  sim.cpm = 0;
+  sim.step_cpm = nullptr;
+  sim.step_count = 0;
+  sim.step_ms = 0;
+  sim.burst_cpm = 0;
+  sim.burst_ms = 0;
+  sim.burst_period_ms = 0;
+  sim.trace = nullptr;
+  sim.trace_length = 0;
+  sim.callback = nullptr;
+  sim.start_us = 0;
+  sim.next_pulse_us = 0;
+  sim.trace_index = 0;
+  sim.pulses = 0;
+  return sim;
+}
+
+pulse_simulator pulseSimulatorPoisson(float cpm){
+  pulse_simulator sim = pulseSimulator(PULSE_SIM_POISSON);
+  sim.cpm = cpm;
+  return sim;
+}
+
+pulse_simulator pulseSimulatorSteps(const float* step_cpm, size_t step_count, unsigned long step_ms){
+  pulse_simulator sim = pulseSimulator(PULSE_SIM_STEPS);
+  sim.step_cpm = step_cpm;
+  sim.step_count = step_count;
+  sim.step_ms = step_ms;
+  return sim;
+}
+
+pulse_simulator pulseSimulatorBurst(float cpm, float burst_cpm, unsigned long burst_ms, unsigned long burst_period_ms){
+  pulse_simulator sim = pulseSimulator(PULSE_SIM_BURST);
+  sim.cpm = cpm;
+  sim.burst_cpm = burst_cpm;
+  sim.burst_ms = burst_ms;
+  sim.burst_period_ms = burst_period_ms;
+  return sim;
+}
+
+pulse_simulator pulseSimulatorReplay(const uint32_t* trace, size_t trace_length){
+  pulse_simulator sim = pulseSimulator(PULSE_SIM_REPLAY);
+  sim.trace = trace;
+  sim.trace_length = trace_length;
+  return sim;
+}
+
+float pulseSimulatorRate(const pulse_simulator &sim, uint64_t now_us){
+  unsigned long elapsed_ms = (unsigned long)((now_us - sim.start_us) / 1000);
+  switch(sim.mode){
+    case PULSE_SIM_STEPS:
+      if(sim.step_count == 0 || sim.step_ms == 0){
+        return 0;
+      }
+      return sim.step_cpm[(elapsed_ms / sim.step_ms) % sim.step_count];
+    case PULSE_SIM_BURST:
+      if(sim.burst_period_ms > 0 && elapsed_ms % sim.burst_period_ms < sim.burst_ms){
+        return sim.burst_cpm;
+      }
+      return sim.cpm;
+    default:
+      return sim.cpm;
+  }
+}
+
+// Time of the next change of rate after now_us; none for a constant rate
+static uint64_t nextRateChange(const pulse_simulator &sim, uint64_t now_us){
+  uint64_t elapsed_us = now_us - sim.start_us;
+  switch(sim.mode){
+    case PULSE_SIM_STEPS:
+      if(sim.step_ms == 0){
+        return UINT64_MAX;
+      }
+      return sim.start_us + (elapsed_us / (sim.step_ms * 1000ULL) + 1) * sim.step_ms * 1000ULL;
+    case PULSE_SIM_BURST: {
+      if(sim.burst_period_ms == 0){
+        return UINT64_MAX;
+      }
+      uint64_t period_start = now_us - elapsed_us % (sim.burst_period_ms * 1000ULL);
+      uint64_t burst_end = period_start + sim.burst_ms * 1000ULL;
+      return now_us < burst_end ? burst_end : period_start + sim.burst_period_ms * 1000ULL;
+    }
+    default:
+      return UINT64_MAX;
+  }
+}
+
+// Time until the next pulse in microseconds
+static uint64_t nextInterval(pulse_simulator &sim, uint64_t now_us){
+  if(sim.mode == PULSE_SIM_REPLAY){
+    if(sim.trace_length == 0){
+      return 60000000ULL;
+    }
+    uint32_t interval = sim.trace[sim.trace_index];
+    sim.trace_index = (sim.trace_index + 1) % sim.trace_length;
+    return interval;
+  }
+
+  // An interval drawn at one rate must not run past a change of rate (a quiet background would step over the start of
+  // a burst): draw again from the change, which is exact for a Poisson process since it has no memory
+  uint64_t at = now_us;
+  while(true){
+    float cpm = pulseSimulatorRate(sim, at);
+    uint64_t change = nextRateChange(sim, at);
+    if(cpm > 0){
+      // exponential inter-arrival time: -ln(U) / rate, U uniform in (0,1]
+      float u = (random(1, 1000001)) / 1000000.0f;
+      uint64_t interval = (uint64_t)(-logf(u) * 60000000.0f / cpm);
+      if(at + interval < change){
+        return at + interval - now_us;
+      }
+    }
+    if(change == UINT64_MAX){
+      return UINT64_MAX - now_us; // no pulses at a rate of 0, ever
+    }
+    at = change;
+  }
+}
+
+void pulseSimulatorBegin(pulse_simulator &sim, void (*callback)(uint64_t), uint64_t now_us){
+  sim.callback = callback;
+  sim.start_us = now_us;
+  sim.trace_index = 0;
+  sim.pulses = 0;
+  sim.next_pulse_us = now_us + nextInterval(sim, now_us);
+}
+
+// Stops early at a pulse that woke the firmware from its idle; the rest are fired on the clock's next move
+unsigned int pulseSimulatorLoop(pulse_simulator &sim, uint64_t now_us){
+  unsigned int fired = 0;
+  while(sim.callback != nullptr && now_us >= sim.next_pulse_us && !hostClockWoken()){
+    sim.callback(sim.next_pulse_us);
+    sim.pulses++;
+    fired++;
+    sim.next_pulse_us = sim.next_pulse_us + nextInterval(sim, sim.next_pulse_us);
+  }
+  return fired;
+}
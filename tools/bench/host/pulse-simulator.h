@@ -0,0 +1,50 @@
+#ifndef BENCH_HOST_PULSE_SIMULATOR_H
+#define BENCH_HOST_PULSE_SIMULATOR_H
+
+#include <Arduino.h>
+
+/*
+  Synthetic pulse source for load testing the pulse pipeline on the host (see pulse-load.cpp).
+  The callback is given the simulated time each pulse is due; the harness moves the clock there and fires the sensor's
+  pin, so the pulse takes the interrupt, detector, alarm and publishing path a sensor's pulse would.
+
+  Modes:
+    PULSE_SIM_POISSON : exponential inter-arrival times at a constant rate (cpm)
+    PULSE_SIM_STEPS   : Poisson, cycling through a table of rates, step_ms per step (ie. 1, 10, 100 ... 10000 CPM)
+    PULSE_SIM_BURST   : Poisson background (cpm) with a burst at burst_cpm for burst_ms every burst_period_ms
+    PULSE_SIM_REPLAY  : replays a recorded trace of inter-arrival times (microseconds), then repeats it
+  A change of rate (STEPS, BURST) takes effect at the moment it happens, as it would for a real source.
+*/
+
+enum pulse_sim_mode { PULSE_SIM_POISSON, PULSE_SIM_STEPS, PULSE_SIM_BURST, PULSE_SIM_REPLAY };
+
+struct pulse_simulator{
+  pulse_sim_mode mode;
+  float cpm;                      // POISSON rate, BURST background rate
+  const float* step_cpm;          // STEPS: table of rates
+  size_t step_count;              // STEPS: entries in step_cpm
+  unsigned long step_ms;          // STEPS: milliseconds spent at each rate
+  float burst_cpm;                // BURST: rate during a burst
+  unsigned long burst_ms;         // BURST: burst duration
+  unsigned long burst_period_ms;  // BURST: time between burst starts
+  const uint32_t* trace;          // REPLAY: inter-arrival times in microseconds
+  size_t trace_length;            // REPLAY: entries in trace
+
+  // runtime state
+  void (*callback)(uint64_t);     // fires a pulse due at the given time (microseconds)
+  uint64_t start_us;              // time the simulation started
+  uint64_t next_pulse_us;         // time the next pulse is due
+  size_t trace_index;             // REPLAY: next trace entry
+  unsigned long pulses;           // pulses generated
+};
+
+pulse_simulator pulseSimulatorPoisson(float cpm);
+pulse_simulator pulseSimulatorSteps(const float* step_cpm, size_t step_count, unsigned long step_ms);
+pulse_simulator pulseSimulatorBurst(float cpm, float burst_cpm, unsigned long burst_ms, unsigned long burst_period_ms);
+pulse_simulator pulseSimulatorReplay(const uint32_t* trace, size_t trace_length);
+
+void pulseSimulatorBegin(pulse_simulator &sim, void (*callback)(uint64_t), uint64_t now_us);
+unsigned int pulseSimulatorLoop(pulse_simulator &sim, uint64_t now_us); // fires every pulse due by now_us, returns how many
+float pulseSimulatorRate(const pulse_simulator &sim, uint64_t now_us);  // rate (cpm) currently being generated
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef BENCH_HOST_SPI_FLASH_H
+#define BENCH_HOST_SPI_FLASH_H
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+#endif
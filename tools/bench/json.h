@@ -0,0 +1,96 @@
+/*
+  Shared by the host harnesses that read the firmware's json back (schema-roundtrip, discovery-compact).
+*/
+#ifndef BENCH_JSON_H
+#define BENCH_JSON_H
+
+#include <map>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+// Just enough of a parser for the firmware's payloads: objects, strings without escapes, numbers, null and booleans
+struct json_value{
+  enum { INVALID, OBJECT, STRING, NUMBER, LITERAL } type = INVALID;
+  std::string text;                        // string contents, number or literal as written
+  std::map<std::string, json_value> members;
+};
+
+static void skipSpace(const char* &p){
+  while(*p == ' ' || *p == '\n' || *p == '\t'){
+    p++;
+  }
+}
+
+static json_value parseValue(const char* &p){
+  json_value v;
+  skipSpace(p);
+  if(*p == '{'){
+    p++;
+    skipSpace(p);
+    if(*p == '}'){
+      p++;
+      v.type = json_value::OBJECT;
+      return v;
+    }
+    while(true){
+      json_value key = parseValue(p);
+      skipSpace(p);
+      if(key.type != json_value::STRING || *p != ':' || v.members.count(key.text) != 0){
+        return json_value();
+      }
+      p++;
+      json_value member = parseValue(p);
+      if(member.type == json_value::INVALID){
+        return member;
+      }
+      v.members[key.text] = member;
+      skipSpace(p);
+      if(*p == '}'){
+        p++;
+        v.type = json_value::OBJECT;
+        return v;
+      }
+      if(*p != ','){
+        return json_value();
+      }
+      p++;
+    }
+  }
+  if(*p == '"'){
+    const char* end = strchr(p + 1, '"');
+    if(end == nullptr){
+      return v;
+    }
+    v.type = json_value::STRING;
+    v.text.assign(p + 1, end - p - 1);
+    p = end + 1;
+    return v;
+  }
+  for (const char* literal : { "null", "true", "false" })
+  {
+    if(strncmp(p, literal, strlen(literal)) == 0){
+      v.type = json_value::LITERAL;
+      v.text = literal;
+      p += strlen(literal);
+      return v;
+    }
+  }
+  char* end;
+  strtod(p, &end);
+  if(end != p){
+    v.type = json_value::NUMBER;
+    v.text.assign(p, end - p);
+    p = end;
+  }
+  return v;
+}
+
+static json_value parseJson(const std::string &text){
+  const char* p = text.c_str();
+  json_value v = parseValue(p);
+  skipSpace(p);
+  return *p == '\0' ? v : json_value();
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*
+  Link monitor: the real setup() and loop() against the in-process broker (host/fake-broker.h), on simulated time, with
+  the latency of the broker link (host/host-net.h) changed from one connection to the next. Each connection is ended
+  with fakeBrokerDrop() once it has run its course, so that LinkMonitorClient::keepAlive() (lib/link-monitor) judges it
+  as the firmware reconnects:
+  - good: a fast link; every connection outlasts LINK_STABLE_MS, so the keep-alive climbs from LINK_KEEPALIVE_INITIAL
+    to LINK_KEEPALIVE_MAX
+  - poor: a slow one, past LINK_RTT_POOR_MS; once that connection ends the keep-alive drops to LINK_KEEPALIVE_MIN
+  - recovered: fast again; the keep-alive climbs back to LINK_KEEPALIVE_MAX, doubling with each stable connection
+  - flaky: fast but broken long before LINK_STABLE_MS; the keep-alive drops to LINK_KEEPALIVE_MIN again
+  Each connection that is held lasts long enough for the smoothed round trip to settle (3 * LINK_RTT_EWMA_WEIGHT
+  samples, at a ping per LINK_KEEPALIVE_MAX at worst).
+  Reported per connection: the injected round trip, the smoothed one LinkMonitorClient measured and its samples, and
+  the keep-alive the connection ran with and the one picked for the next. Checks: the smoothed round trip tracks the
+  injected one (within RTT_TOLERANCE), also at the shortest keep-alive, whose pings are answered while loop() idles,
+  and the keep-alive takes the levels above in that order.
+
+  tools/bench/harness.py link-monitor -- [--good-rtt MS] [--poor-rtt MS]
+*/
+#include "../../src/radthing.cpp"
+#include "host/fake-broker.h"
+#include "harness.h"
+
+const uint64_t LOOP_PASS_US = 100;                  // simulated time a loop() pass takes, on top of its idle
+const float RTT_TOLERANCE = 0.15;                   // of the injected round trip, and at least RTT_TOLERANCE_MS
+const float RTT_TOLERANCE_MS = 5;
+const unsigned long RECONNECT_LIMIT_MS = 60000;     // back after a drop, at the latest
+
+struct link_phase{
+  const char *name;
+  host_link link;
+  unsigned long hold_ms;                            // before the connection is dropped; 0: until the link breaks it
+  uint16_t keep_alive_after;                        // expected for the next connection
+};
+
+static void runUntil(uint64_t until_us){
+  while(micros64() < until_us){
+    loop();
+    hostClockAdvance(LOOP_PASS_US);
+    fakeBrokerPoll();
+  }
+}
+
+// Runs until the firmware has connected again (after the connect count moved past connects); false if it did not
+static bool runUntilReconnected(unsigned long connects, unsigned long limit_ms){
+  const uint64_t limit_us = micros64() + limit_ms * 1000ULL;
+  while(micros64() < limit_us){
+    runUntil(micros64() + 1000);
+    if(fakeBrokerStats().connects > connects && mqttclient.connected()){
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool tracks(float measured_ms, unsigned long injected_ms){
+  return std::fabs(measured_ms - injected_ms) <= std::max(RTT_TOLERANCE_MS, injected_ms * RTT_TOLERANCE);
+}
+
+// One connection over p.link, from its connect until the firmware is connected again over the next phase's link
+static void connection(const link_phase &p, const host_link &next){
+  const uint16_t keep_alive = linkclient.currentKeepAlive();
+  const unsigned long samples = linkclient.rttSamples();
+  fakeBrokerLink(next); // for the reconnection; the open connection keeps its link
+  const unsigned long connects = fakeBrokerStats().connects;
+  if(p.hold_ms > 0){
+    runUntil(micros64() + p.hold_ms * 1000ULL);
+    fakeBrokerDrop();
+  }
+  const float rtt = linkclient.rttMillis();
+  const unsigned long taken = linkclient.rttSamples() - samples;
+  bool back = runUntilReconnected(connects, (p.hold_ms > 0 ? 0 : p.link.disconnect_every_ms) + RECONNECT_LIMIT_MS);
+  printf("%-10s | %8lu | %8.1f %7lu | %10u %6u\n", p.name, p.link.rtt_ms, rtt, taken, keep_alive,
+    linkclient.currentKeepAlive());
+  check(back, "%s: connected again", p.name);
+  if(p.hold_ms > 0){
+    check(taken >= 3 * LINK_RTT_EWMA_WEIGHT && tracks(rtt, p.link.rtt_ms), "%s: smoothed round trip %.1f ms over %lu samples tracks the injected %lu ms",
+      p.name, rtt, taken, p.link.rtt_ms);
+  }
+  check(linkclient.currentKeepAlive() == p.keep_alive_after, "%s: next keep-alive %u s (%u s)", p.name, p.keep_alive_after,
+    linkclient.currentKeepAlive());
+}
+
+int main(int argc, char **argv){
+  unsigned long good_rtt = 20, poor_rtt = 800;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--good-rtt") == 0) good_rtt = strtoul(argv[i + 1], nullptr, 10);
+    else if(strcmp(argv[i], "--poor-rtt") == 0) poor_rtt = strtoul(argv[i + 1], nullptr, 10);
+  }
+  const host_link good = { good_rtt, 0, 0, 0, 0 };
+  const host_link poor = { poor_rtt, 0, 0, 0, 0 };
+  const host_link flaky = { good_rtt, 0, 0, 120000, 0 };
+  // Stable, and long enough for the smoothed round trip to settle on the link at the slowest keep-alive's pings
+  const unsigned long hold_ms = std::max<unsigned long>(LINK_STABLE_MS, 3 * LINK_RTT_EWMA_WEIGHT * LINK_KEEPALIVE_MAX * 1000UL) + 60000;
+  const link_phase PHASES[] = {
+    { "good", good, hold_ms, LINK_KEEPALIVE_INITIAL * 2 },
+    { "good", good, hold_ms, LINK_KEEPALIVE_MAX },
+    { "good", good, hold_ms, LINK_KEEPALIVE_MAX },
+    { "poor", poor, hold_ms, LINK_KEEPALIVE_MIN },
+    { "recovered", good, hold_ms, LINK_KEEPALIVE_MIN * 2 },
+    { "recovered", good, hold_ms, LINK_KEEPALIVE_MIN * 4 },
+    { "recovered", good, hold_ms, LINK_KEEPALIVE_MIN * 8 },
+    { "recovered", good, hold_ms, LINK_KEEPALIVE_MAX },
+    { "flaky", flaky, 0, LINK_KEEPALIVE_MIN },
+  };
+  const size_t phase_count = sizeof(PHASES) / sizeof(PHASES[0]);
+
+  randomSeed(1);
+  hostClockBegin(1000000);
+  fakeBrokerLink(good);
+  setup();
+  check(mqttclient.connected() && linkclient.currentKeepAlive() == LINK_KEEPALIVE_INITIAL, "boot: connected with a %u s keep-alive (%u s)",
+    LINK_KEEPALIVE_INITIAL, linkclient.currentKeepAlive());
+  printf("%-10s | %8s | %8s %7s | %10s %6s\n", "link", "rtt ms", "smoothed", "samples", "keep-alive", "next");
+  for (size_t i = 0; i < phase_count; i++)
+  {
+    connection(PHASES[i], i + 1 < phase_count ? PHASES[i + 1].link : good);
+  }
+  return harnessResult();
+}
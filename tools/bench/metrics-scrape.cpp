@@ -0,0 +1,370 @@
+/*
+  Local HTTP client test of the /metrics endpoint (lib/metrics-server): the real setup() and loop() serve it on
+  METRICS_PORT while Poisson pulses arrive on the sensor's pin, and a client on the host network (host/host-net.h)
+  scrapes it like Prometheus would, on simulated time.
+  - GET /metrics: 200 with the Prometheus text format (0.0.4); every line parses, every sample belongs to a family
+    declared by # HELP and # TYPE, all the families of writeMetric() are there, and the values agree with the counters
+  - over a slow LAN (SLOW_LINK): the response is spread over many loop() passes, none of which waits on the socket,
+    and no pulse is lost meanwhile, at SLOW_LINK_CPM
+  - a scrape allocates nothing: the body is printed from the counters straight into the socket
+  - another path or method: 404; a request line that arrives in pieces; a client that never sends its request is
+    dropped after METRICS_CLIENT_TIMEOUT; a second client waits for the first and is then served
+
+  tools/bench/harness.py metrics-scrape -- [--cpm R] [--seed N]
+*/
+#include "../../src/radthing.cpp"
+#include "host/alloc-count.h"
+#include "host/pulse-simulator.h"
+#include "harness.h"
+
+#include <climits>
+#include <map>
+
+const uint64_t LOOP_PASS_US = 100;                  // simulated time a loop() pass takes, on top of its idle
+const host_link SLOW_LINK = { 20, 2000, 0, 0, 0 };  // 20 ms round trip, 2 kB/s
+const float SLOW_LINK_CPM = 3000;                   // pulses while the slow scrape goes on
+const char *const FAMILIES[] = {
+  "radthing_pulses_total", "radthing_lifetime_pulses_total", "radthing_cpm", "radthing_window_cpm", "radthing_dose_usvh",
+  "radthing_dose_error_usvh", "radthing_wifi_rssi_dbm", "radthing_heap_free_bytes", "radthing_heap_max_block_bytes",
+  "radthing_state_updates_total", "radthing_uptime_seconds", "radthing_broker_rtt_ms", "radthing_broker_reconnects_total",
+};
+
+static pulse_simulator sim;
+static unsigned long pulses_fired = 0;
+
+struct http_response{
+  bool closed = false;                              // by the server: the end of an HTTP/1.0 response
+  std::string status;                               // status line
+  std::string content_type;
+  std::string body;
+  unsigned long passes = 0;                         // loop() passes from the request to the close
+  uint64_t longest_pass_us = 0;
+  uint64_t took_us = 0;
+};
+
+static void firePulse(uint64_t at){
+  if(at > micros64()){
+    hostClockAdvance(at - micros64());
+  }
+  hostPinWrite(SIG_PIN, LOW);   // active low
+  hostPinWrite(SIG_PIN, HIGH);
+  pulses_fired++;
+}
+
+static void pulsesDue(uint64_t until_us){
+  pulseSimulatorLoop(sim, until_us);
+}
+
+// One loop() pass; returns how long it was busy on the simulated clock, its idle aside
+static uint64_t pass(){
+  uint64_t start = micros64();
+  unsigned long long idle_before = idle_micros;
+  unsigned long period = idle_rate.start_millis;
+  loop();
+  unsigned long long idled = idle_micros - idle_before + (idle_rate.start_millis != period ? idle_rate.sampled : 0); // less what publishing the idle diagnostic took off
+  hostClockAdvance(LOOP_PASS_US);
+  return micros64() - start - LOOP_PASS_US - idled;
+}
+
+static void drain(WiFiClient &http, std::string &received){
+  uint8_t buf[256];
+  while(http.available() > 0){
+    int n = http.read(buf, sizeof(buf));
+    received.append((const char *)buf, n);
+  }
+}
+
+static http_response parse(const std::string &received){
+  http_response r;
+  size_t head_end = received.find("\r\n\r\n");
+  if(head_end == std::string::npos){
+    r.status = received.substr(0, received.find("\r\n"));
+    return r;
+  }
+  size_t line_end = received.find("\r\n");
+  r.status = received.substr(0, line_end);
+  for (size_t at = line_end + 2; at < head_end; )
+  {
+    size_t end = received.find("\r\n", at);
+    std::string header = received.substr(at, end - at);
+    if(header.compare(0, 14, "Content-Type: ") == 0){
+      r.content_type = header.substr(14);
+    }
+    at = end + 2;
+  }
+  r.body = received.substr(head_end + 4);
+  return r;
+}
+
+// Sends request (in pieces of split bytes, a loop() pass apart, if split > 0) and runs loop() until the server closes
+static http_response scrape(const std::string &request, const host_link &link = HOST_LINK_LOCAL, size_t split = 0){
+  hostListenLink(METRICS_PORT, link);
+  WiFiClient http;
+  std::string received;
+  http_response r;
+  if(!http.connect(IPAddress(), METRICS_PORT)){
+    return r;
+  }
+  uint64_t start = micros64();
+  for (size_t at = 0; at < request.length(); at += split > 0 ? split : request.length())
+  {
+    http.write((const uint8_t *)request.data() + at, std::min(request.length() - at, split > 0 ? split : request.length()));
+    pass();
+  }
+  unsigned long passes = 0;
+  uint64_t longest = 0;
+  while(http.connected() && micros64() - start < 60000000){
+    longest = std::max(longest, pass());
+    passes++;
+    drain(http, received);
+  }
+  drain(http, received);
+  r = parse(received);
+  r.closed = !http.connected();
+  r.passes = passes;
+  r.longest_pass_us = longest;
+  r.took_us = micros64() - start;
+  return r;
+}
+
+static const char *const GET_METRICS = "GET /metrics HTTP/1.1\r\nHost: radthing\r\nUser-Agent: Prometheus/2.45.0\r\nAccept: text/plain\r\n\r\n";
+
+// *********************************************************************************************************************
+// *** Prometheus text format ***
+static bool validName(const std::string &name){
+  if(name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_' || name[0] == ':')){
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c){ return isalnum((unsigned char)c) || c == '_' || c == ':'; });
+}
+
+static bool validLabels(const std::string &labels){
+  size_t at = 0;
+  while(at < labels.length()){
+    size_t eq = labels.find('=', at);
+    if(eq == std::string::npos || !validName(labels.substr(at, eq - at)) || eq + 1 >= labels.length() || labels[eq + 1] != '"'){
+      return false;
+    }
+    size_t close = labels.find('"', eq + 2);
+    if(close == std::string::npos){
+      return false;
+    }
+    at = close + 1;
+    if(at < labels.length()){
+      if(labels[at] != ','){
+        return false;
+      }
+      at++;
+    }
+  }
+  return true;
+}
+
+// Parses the exposition into samples ("name{labels}" -> value) and the families declared; error says what is wrong
+static bool parseExposition(const std::string &body, std::map<std::string, double> &samples, std::map<std::string, std::string> &types,
+  std::string &error){
+  if(body.empty() || body.back() != '\n'){
+    error = "the body does not end with a newline";
+    return false;
+  }
+  std::map<std::string, bool> helped;
+  for (size_t at = 0, end; at < body.length(); at = end + 1)
+  {
+    end = body.find('\n', at);
+    std::string line = body.substr(at, end - at);
+    if(line.compare(0, 7, "# HELP ") == 0 || line.compare(0, 7, "# TYPE ") == 0){
+      size_t space = line.find(' ', 7);
+      std::string name = line.substr(7, space - 7);
+      std::string rest = space == std::string::npos ? "" : line.substr(space + 1);
+      if(!validName(name) || rest.empty()){
+        error = "bad comment: " + line;
+        return false;
+      }
+      if(line[2] == 'H'){
+        helped[name] = true;
+        continue;
+      }
+      if(types.count(name) > 0 || (rest != "counter" && rest != "gauge" && rest != "histogram" && rest != "summary" && rest != "untyped")){
+        error = "bad or repeated TYPE: " + line;
+        return false;
+      }
+      types[name] = rest;
+      continue;
+    }
+    size_t name_end = line.find_first_of("{ ");
+    std::string name = line.substr(0, name_end);
+    std::string key = name;
+    size_t value_at = name_end;
+    if(name_end != std::string::npos && line[name_end] == '{'){
+      size_t close = line.find('}', name_end);
+      if(close == std::string::npos || !validLabels(line.substr(name_end + 1, close - name_end - 1))){
+        error = "bad labels: " + line;
+        return false;
+      }
+      key = line.substr(0, close + 1);
+      value_at = close + 1;
+    }
+    if(!validName(name) || value_at == std::string::npos || line[value_at] != ' '){
+      error = "bad sample: " + line;
+      return false;
+    }
+    if(types.count(name) == 0 || !helped[name]){
+      error = "sample of an undeclared family: " + line;
+      return false;
+    }
+    char *parsed_end;
+    std::string value = line.substr(value_at + 1);
+    double v = strtod(value.c_str(), &parsed_end);
+    if(value.empty() || *parsed_end != '\0' || samples.count(key) > 0){
+      error = "bad or repeated value: " + line;
+      return false;
+    }
+    samples[key] = v;
+  }
+  return true;
+}
+
+// *********************************************************************************************************************
+// *** Scenarios ***
+static void checkScrape(){
+  unsigned long pulses_before = pulse_count;
+  unsigned long published_before = state_published;
+  http_response r = scrape(GET_METRICS);
+  std::map<std::string, double> samples;
+  std::map<std::string, std::string> types;
+  std::string error;
+  bool valid = parseExposition(r.body, samples, types, error);
+  printf("GET /metrics: %s, %u bytes, %u samples in %u families, %lu loop() passes\n", r.status.c_str(),
+    (unsigned)r.body.length(), (unsigned)samples.size(), (unsigned)types.size(), r.passes);
+  check(r.closed && r.status == "HTTP/1.0 200 OK", "200 and the connection closed (%s)", r.status.c_str());
+  check(r.content_type == "text/plain; version=0.0.4", "Prometheus text format (%s)", r.content_type.c_str());
+  check(valid, "every line parses%s%s", valid ? "" : ": ", error.c_str());
+  bool all = true;
+  for (const char *family : FAMILIES)
+  {
+    all &= types.count(family) > 0;
+  }
+  check(all && types.size() == sizeof(FAMILIES) / sizeof(FAMILIES[0]), "all %u families of writeMetric() (%u)",
+    (unsigned)(sizeof(FAMILIES) / sizeof(FAMILIES[0])), (unsigned)types.size());
+  bool counters = true;
+  for (const auto &t : types)
+  {
+    counters &= t.second != "counter" || t.first.size() < 6 || t.first.compare(t.first.size() - 6, 6, "_total") == 0
+      || t.first == "radthing_uptime_seconds";
+  }
+  check(counters, "counters are named *_total");
+  double pulses = samples["radthing_pulses_total"];
+  check(pulses >= pulses_before && pulses <= pulse_count, "radthing_pulses_total %.0f within the counter before and after (%lu..%lu)",
+    pulses, pulses_before, (unsigned long)pulse_count);
+  double published = samples["radthing_state_updates_total{outcome=\"published\"}"];
+  check(published >= published_before && published <= state_published, "state updates published %.0f within the counter before and after (%lu..%lu)",
+    published, published_before, state_published);
+  check(samples["radthing_wifi_rssi_dbm"] == WiFi.RSSI() && fabs(samples["radthing_uptime_seconds"] - millis() / 1000) <= 1,
+    "RSSI and uptime as the device has them");
+}
+
+static void checkSlowLink(){
+  sim.callback = nullptr;
+  while(dualDetectorDueIn(micros()) != ULONG_MAX){
+    pass(); // nothing left in the detector's window from before
+  }
+  sim = pulseSimulatorPoisson(SLOW_LINK_CPM);
+  pulseSimulatorBegin(sim, firePulse, micros64());
+  unsigned long fired_before = pulses_fired, counted_before = pulse_count;
+  http_response r = scrape(GET_METRICS, SLOW_LINK);
+  sim.callback = nullptr;
+  for (int i = 0; i < 1000; i++)
+  {
+    pass(); // the last pulses reach the counter
+  }
+  unsigned long fired = pulses_fired - fired_before, counted = pulse_count - counted_before;
+  printf("over %lu ms / %lu B/s: %u bytes in %.2f s, %lu loop() passes, the longest %.3f ms; %lu pulses fired, %lu counted\n",
+    SLOW_LINK.rtt_ms, SLOW_LINK.bytes_per_sec, (unsigned)r.body.length(), r.took_us / 1e6, r.passes, r.longest_pass_us / 1000.0,
+    fired, counted);
+  std::map<std::string, double> samples;
+  std::map<std::string, std::string> types;
+  std::string error;
+  check(r.closed && r.status == "HTTP/1.0 200 OK" && parseExposition(r.body, samples, types, error), "slow link: the whole response");
+  check(r.passes > 10, "slow link: served over many loop() passes (%lu)", r.passes);
+  check(r.longest_pass_us < SLOW_LINK.rtt_ms * 500ULL, "slow link: no loop() pass waited on the socket (longest %.3f ms)", r.longest_pass_us / 1000.0);
+  check(counted == fired, "slow link: every pulse counted meanwhile (%lu of %lu)", counted, fired);
+}
+
+// The body, driven straight through metricsServerLoop() so that loop()'s own publishing does not count
+static void checkAllocations(){
+  WiFiClient http;
+  hostListenLink(METRICS_PORT, HOST_LINK_LOCAL);
+  http.connect(IPAddress(), METRICS_PORT);
+  http.write((const uint8_t *)GET_METRICS, strlen(GET_METRICS));
+  std::string received;
+  received.reserve(16384); // the client's own buffer, not counted against the server
+  unsigned long long before = alloc_count;
+  for (int i = 0; i < 1000 && http.connected(); i++)
+  {
+    metricsServerLoop(millis());
+    hostClockAdvance(LOOP_PASS_US);
+    drain(http, received);
+  }
+  unsigned long long allocations = alloc_count - before;
+  check(!http.connected() && received.length() > 0 && allocations == 0, "a scrape allocates nothing (%llu allocations)", allocations);
+}
+
+static void checkRequests(){
+  check(scrape("GET /other HTTP/1.1\r\n\r\n").status == "HTTP/1.0 404 Not Found", "another path: 404");
+  check(scrape("POST /metrics HTTP/1.1\r\n\r\n").status == "HTTP/1.0 404 Not Found", "another method: 404");
+  check(scrape(GET_METRICS, HOST_LINK_LOCAL, 5).status == "HTTP/1.0 200 OK", "a request line in pieces: 200");
+
+  // A client that connects and says nothing holds the endpoint until it times out...
+  WiFiClient idle;
+  idle.connect(IPAddress(), METRICS_PORT);
+  uint64_t start = micros64();
+  while(idle.connected() && micros64() - start < 2 * METRICS_CLIENT_TIMEOUT * 1000ULL){
+    pass();
+  }
+  uint64_t held_ms = (micros64() - start) / 1000;
+  check(!idle.connected() && held_ms <= LOOP_IDLE_MAX_MS + METRICS_CLIENT_TIMEOUT + 100, "a silent client dropped after %u ms, once accepted (%llu ms)",
+    METRICS_CLIENT_TIMEOUT, (unsigned long long)held_ms);
+
+  // ...and a second client waits for the first
+  WiFiClient first, second;
+  first.connect(IPAddress(), METRICS_PORT);
+  second.connect(IPAddress(), METRICS_PORT);
+  first.write((const uint8_t *)GET_METRICS, strlen(GET_METRICS));
+  second.write((const uint8_t *)GET_METRICS, strlen(GET_METRICS));
+  std::string a, b;
+  start = micros64();
+  while((first.connected() || second.connected()) && micros64() - start < 10000000){
+    pass();
+    drain(first, a);
+    drain(second, b);
+  }
+  check(parse(a).status == "HTTP/1.0 200 OK" && parse(b).status == "HTTP/1.0 200 OK", "two clients at once: both served");
+}
+
+int main(int argc, char **argv){
+  float cpm = 120;
+  unsigned long seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--cpm") == 0) cpm = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+  }
+  randomSeed(seed);
+  hostClockBegin(1000000);
+  hostPinWrite(SIG_PIN, HIGH);
+  setup();
+  sim = pulseSimulatorPoisson(cpm);
+  pulseSimulatorBegin(sim, firePulse, micros64());
+  hostClockOnAdvance(pulsesDue);
+  for (uint64_t end = micros64() + 120000000; micros64() < end; )
+  {
+    pass(); // two minutes of pulses, so that the counters and rollups have something in them
+  }
+
+  printf("metrics on port %u, %.0f CPM on the sensor (seed %lu)\n", METRICS_PORT, cpm, seed);
+  checkScrape();
+  checkSlowLink();
+  checkAllocations();
+  checkRequests();
+  return harnessResult();
+}
@@ -0,0 +1,242 @@
+/*
+  Pulse load test: what rate the firmware sustains. Synthetic pulses (host/pulse-simulator.h) are fired on the sensor's
+  pin while the real setup() and loop() run on simulated time, so each one takes the interrupt, the detector, the
+  alarm and the state publish like a sensor's pulse would. By default the rate steps through 1, 10, 100, 1000, 3000
+  and 10,000 CPM, 5 minutes each. Reported per 5 minutes:
+  - throughput: pulses fired, counted, lost to a full detector queue; state updates published and pulses merged
+  - latency per stage, median and worst: detector (from the pin until a loop() pass releases the pulse, after the
+    coincidence/noise window) and publish (from then until the state update carrying it went to the MQTT client)
+  - the rate read back (readCpm), and CPU: host microseconds per loop() pass and the share of the time loop() was busy
+  The simulated clock stands still while firmware code runs; after each loop() pass it moves on by the host time the
+  pass took times --cpu-scale. Host time is not ESP8266 time: raise the scale to see where a slower CPU falls behind.
+  Checks: every pulse is counted and published, none is held longer than the detector window and one loop() pass,
+  the readings and the lifetime dose follow the pulses.
+
+  tools/bench/harness.py pulse-load -- [--mode steps|poisson|burst|replay] [--cpm CPM] [--minutes M] [--trace FILE]
+                                       [--cpu-scale K] [--seed N]
+  --trace: inter-arrival times in microseconds, one per line (replay)
+*/
+#include "../../src/radthing.cpp"
+#include "host/pulse-simulator.h"
+#include "harness.h"
+
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+const float STEP_CPM[] = { 1, 10, 100, 1000, 3000, 10000 };
+const size_t STEP_COUNT = sizeof(STEP_CPM) / sizeof(STEP_CPM[0]);
+const unsigned long REPORT_MS = 300000;           // one report line per 5 minutes, the length of a step
+const uint64_t DRAIN_US = 2000000;                // after the last pulse, time for everything to be published
+
+static pulse_simulator sim;
+static bool firing = true;
+static uint64_t fired = 0;
+static uint64_t lost = 0;
+static std::deque<uint64_t> captured;             // pin times of pulses not yet released by the detector
+static std::deque<uint64_t> released;             // release times of pulses not yet published
+static unsigned long counted = 0;                 // pulse_count as far as it has been accounted for
+static uint64_t pass_start = 0;                   // simulated time the current loop() pass started
+
+struct report_window{
+  uint64_t fired = 0, lost = 0, published = 0;
+  unsigned long counted = 0, merged = 0;
+  std::vector<double> detector_ms, publish_ms;
+  double busy_us = 0;                             // simulated time spent in loop() passes
+  unsigned long passes = 0;
+};
+static report_window window;
+
+static void firePulse(uint64_t at){
+  if(!firing){
+    return;
+  }
+  if(at > micros64()){
+    hostClockAdvance(at - micros64());
+  }
+  uint32_t overflows = dualDetectorOverflows();
+  hostPinWrite(SIG_PIN, LOW);   // active low
+  hostPinWrite(SIG_PIN, HIGH);
+  fired++;
+  window.fired++;
+  if(dualDetectorOverflows() != overflows){
+    lost++;
+    window.lost++;
+  }
+  else {
+    captured.push_back(micros64());
+  }
+}
+
+static void pulsesDue(uint64_t until_us){
+  pulseSimulatorLoop(sim, until_us);
+}
+
+// Pulses counted since the last call were released at the start of the current pass, oldest first
+static void accountReleased(){
+  for (; counted < pulse_count && !captured.empty(); counted++)
+  {
+    window.detector_ms.push_back((pass_start - captured.front()) / 1000.0);
+    released.push_back(pass_start);
+    captured.pop_front();
+    window.counted++;
+  }
+}
+
+static void onPublished(const char* topic, const char*, int){
+  if(STATE_TOPIC != topic){
+    return;
+  }
+  accountReleased();
+  uint64_t now = micros64();
+  for (uint64_t release : released)
+  {
+    window.publish_ms.push_back((now - release) / 1000.0);
+  }
+  window.published += released.empty() ? 0 : 1;
+  released.clear();
+}
+
+static double percentile(std::vector<double> &v, double p){
+  if(v.empty()){
+    return 0;
+  }
+  size_t i = std::min(v.size() - 1, (size_t)(p * v.size()));
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+static double worst(const std::vector<double> &v){
+  return v.empty() ? 0 : *std::max_element(v.begin(), v.end());
+}
+
+static std::vector<uint32_t> readTrace(const char* path){
+  std::vector<uint32_t> trace;
+  FILE* f = fopen(path, "r");
+  if(f == nullptr){
+    fprintf(stderr, "cannot read %s\n", path);
+    exit(2);
+  }
+  unsigned long interval;
+  while(fscanf(f, "%lu", &interval) == 1){
+    trace.push_back(interval);
+  }
+  fclose(f);
+  return trace;
+}
+
+int main(int argc, char** argv){
+  const char* mode = "steps";
+  float cpm = 100;
+  double minutes = 30;
+  const char* trace_path = nullptr;
+  double cpu_scale = 1;
+  unsigned long seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--mode") == 0) mode = argv[i + 1];
+    else if(strcmp(argv[i], "--cpm") == 0) cpm = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--minutes") == 0) minutes = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--trace") == 0) trace_path = argv[i + 1];
+    else if(strcmp(argv[i], "--cpu-scale") == 0) cpu_scale = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "--seed") == 0) seed = strtoul(argv[i + 1], nullptr, 10);
+  }
+
+  std::vector<uint32_t> trace;
+  if(strcmp(mode, "steps") == 0){
+    sim = pulseSimulatorSteps(STEP_CPM, STEP_COUNT, REPORT_MS);
+    minutes = STEP_COUNT * REPORT_MS / 60000.0;
+  }
+  else if(strcmp(mode, "poisson") == 0){
+    sim = pulseSimulatorPoisson(cpm);
+  }
+  else if(strcmp(mode, "burst") == 0){
+    sim = pulseSimulatorBurst(cpm, 1000, 10000, REPORT_MS); // 10s at 1000 CPM every 5 minutes
+  }
+  else if(strcmp(mode, "replay") == 0 && trace_path != nullptr){
+    trace = readTrace(trace_path);
+    sim = pulseSimulatorReplay(trace.data(), trace.size());
+  }
+  else {
+    fprintf(stderr, "usage: %s [--mode steps|poisson|burst|replay] [--cpm CPM] [--minutes M] [--trace FILE] [--cpu-scale K] [--seed N]\n", argv[0]);
+    return 2;
+  }
+
+  randomSeed(seed);
+  hostClockBegin(1000000);
+  hostPinWrite(SIG_PIN, HIGH);
+  setup();
+  MQTTClient::onPublished(onPublished);
+  hostClockOnAdvance(pulsesDue);
+  counted = pulse_count;
+
+  const uint64_t start = micros64();
+  const uint64_t end = start + (uint64_t)(minutes * 60e6);
+  pulseSimulatorBegin(sim, firePulse, start);
+  uint64_t report_start = start;
+  unsigned long merged_before = state_merged;
+  unsigned int alarms = 0;
+  bool alarm = false;
+  double rate_error_max = 0;     // worst readCpm miss in a steps report, in standard deviations
+  double detector_worst = 0;
+  double pass_worst_us = 0;
+
+  printf("%s, %.0f minutes, cpu scale %.1f (seed %lu)\n", mode, minutes, cpu_scale, seed);
+  printf("%9s %8s %8s %5s %8s %8s | %-15s %-15s | %9s | %8s %5s %6s\n", "rate CPM", "fired", "counted", "lost", "updates",
+    "merged", "detector ms", "publish ms", "read CPM", "us/pass", "busy", "alarms");
+  printf("%9s %8s %8s %5s %8s %8s | %-15s %-15s | %9s | %8s %5s %6s\n", "", "", "", "", "", "", "median  worst", "median  worst",
+    "", "", "%", "");
+  while(micros64() < end + DRAIN_US){
+    firing = micros64() < end;
+    pass_start = micros64();
+    auto host_start = std::chrono::steady_clock::now();
+    loop();
+    double host_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - host_start).count();
+    accountReleased();
+    hostClockAdvance((uint64_t)(host_us * cpu_scale));
+    window.busy_us += host_us * cpu_scale;
+    window.passes++;
+    pass_worst_us = std::max(pass_worst_us, host_us * cpu_scale);
+    if(burst.active && !alarm){
+      alarms++;
+    }
+    alarm = burst.active;
+
+    uint64_t now = micros64();
+    if(now - report_start >= REPORT_MS * 1000ULL || now >= end + DRAIN_US){
+      double window_minutes = (now - report_start) / 60e6;
+      double offered = window.fired / window_minutes;
+      double read = readCpm();
+      window.merged = state_merged - merged_before;
+      detector_worst = std::max(detector_worst, worst(window.detector_ms));
+      if(strcmp(mode, "steps") == 0 && report_start < end){
+        // the detector's 5 minute history covers just this step
+        float step = STEP_CPM[((report_start - start) / 1000 / REPORT_MS) % STEP_COUNT];
+        double sigma = sqrt(step * 5.0) / 5.0;
+        rate_error_max = std::max(rate_error_max, fabs(read - step) / sigma);
+      }
+      printf("%9.1f %8llu %8lu %5llu %8llu %8lu | %6.1f %7.1f %6.1f %7.1f | %9.2f | %8.1f %5.1f %6u\n", offered,
+        (unsigned long long)window.fired, window.counted, (unsigned long long)window.lost, (unsigned long long)window.published,
+        window.merged, percentile(window.detector_ms, 0.5), worst(window.detector_ms), percentile(window.publish_ms, 0.5),
+        worst(window.publish_ms), read, window.busy_us / window.passes, 100 * window.busy_us / (now - report_start), alarms);
+      report_start = now;
+      merged_before = state_merged;
+      window = report_window();
+      alarms = 0;
+    }
+  }
+
+  check(lost == 0, "no pulse lost to a full detector queue (%llu of %llu)", (unsigned long long)lost, (unsigned long long)fired);
+  check(pulse_count == fired - lost && captured.empty(), "every pulse counted (%lu of %llu)", pulse_count, (unsigned long long)(fired - lost));
+  check(released.empty() && !pulse_pending, "every counted pulse published in a state update");
+  double held_ms = COINCIDENCE_WINDOW_US / 1000.0 + 1 + pass_worst_us / 1000.0; // the idle ends within a millisecond of the window
+  check(detector_worst <= held_ms, "no pulse held longer than the detector window and a loop() pass: worst %.1f ms, bound %.1f ms", detector_worst, held_ms);
+  if(strcmp(mode, "steps") == 0){
+    check(rate_error_max <= 4, "readings follow each rate step, worst within %.1f standard deviations", rate_error_max);
+  }
+  double expected_dose = pulse_count / (CPM_PER_USVH * 60.0);
+  check(fabs(readDoseTotal() - pulse_total_restored / (CPM_PER_USVH * 60.0) - expected_dose) <= 1e-9 + expected_dose * 1e-6,
+    "lifetime dose follows the pulses (%.4f uSv)", expected_dose);
+  return harnessResult();
+}
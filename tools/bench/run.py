@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""
+Build and run the host benchmarks of the firmware hot paths (bench.cpp) and store the results as JSON.
+
+  python3 tools/bench/run.py --output before.json
+  ...make changes...
+  python3 tools/bench/run.py --output after.json
+  python3 tools/bench/compare.py before.json after.json
+
+The firmware sources (src/radthing.cpp and lib/) are compiled for Linux with g++ against the Arduino/ESP8266
+stand-ins in tools/bench/host; nothing else is needed. The benchmark binary is run --repeat times and every run is kept,
+so compare.py can tell a change from noise. Each result is tagged with the git revision (and whether the tree had
+uncommitted changes).
+
+With the linker map of a firmware build (-Wl,-Map in platformio.ini; picked up from .pio/build/thingdev/firmware.map
+when present, or given with --map) the IRAM/DRAM/flash size of the whole firmware and of each benchmarked function
+is recorded too, using the map parser of tools/memory-report.py.
+"""
+import argparse
+import datetime
+import glob
+import importlib.util
+import json
+import os
+import platform
+import re
+import subprocess
+import sys
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+BENCH_DIR = os.path.join(ROOT, "tools", "bench")
+DEFAULT_MAP = os.path.join(ROOT, ".pio", "build", "thingdev", "firmware.map")
+CXXFLAGS = ["-std=gnu++17", "-O2", "-DARDUINO=10819", "-DESP8266", "-Wall", "-Wextra"]
+LDFLAGS = ["-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc"]  # allocation counting, see host/alloc-count.cpp
+OBSERVER_FLAGS = ["-DHOST_ALLOC_OBSERVER", "-Wl,--wrap=free"]  # alloc_observer, for the harnesses; the benchmarks don't pay for it
+METRICS = ("ns_per_op", "allocs_per_op", "bytes_per_op")
+
+# Firmware functions each benchmark exercises, for the section sizes; a benchmark named <function>[/<variant>] that is
+# not listed here is sized by <function>
+SECTION_SYMBOLS = {
+    "pulse_pipeline": ("onRadiationPulse", "processPulses"),
+    "publishDiscoveryMessages": ("publishDiscoveryMessages", "getDiscoveryMessage", "buildDiscoveryMessage",
+                                 "publishDiscoveryConfig"),
+}
+
+
+def git(*args):
+    result = subprocess.run(["git", "-C", ROOT] + list(args), capture_output=True, text=True)
+    return result.stdout.strip() if result.returncode == 0 else None
+
+
+def build(cxx, build_dir, main="bench.cpp", defines=(), observer=False):
+    """Compile main (in tools/bench) with the firmware, lib/ and the host stand-ins; returns the binary."""
+    sources = [os.path.join(BENCH_DIR, main)] + sorted(glob.glob(os.path.join(BENCH_DIR, "host", "*.cpp")))
+    sources += sorted(glob.glob(os.path.join(ROOT, "lib", "*", "*.cpp")))
+    includes = ["-I" + os.path.join(BENCH_DIR, "host"), "-I" + os.path.join(ROOT, "include")]
+    includes += ["-I" + d for d in sorted(glob.glob(os.path.join(ROOT, "lib", "*", "")))]
+    binary = os.path.join(build_dir, os.path.splitext(main)[0])
+    os.makedirs(build_dir, exist_ok=True)
+    command = [cxx] + CXXFLAGS + ["-D" + d for d in defines] + includes + sources + LDFLAGS
+    command += (OBSERVER_FLAGS if observer else []) + ["-o", binary]
+    print("Building %s" % os.path.relpath(binary, ROOT), file=sys.stderr)
+    if subprocess.run(command).returncode != 0:
+        sys.exit("Build failed")
+    return binary
+
+
+def compiler_version(cxx):
+    result = subprocess.run([cxx, "--version"], capture_output=True, text=True)
+    return result.stdout.splitlines()[0] if result.returncode == 0 and result.stdout else cxx
+
+
+def load_memory_report():
+    spec = importlib.util.spec_from_file_location("memory_report", os.path.join(ROOT, "tools", "memory-report.py"))
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def section_sizes(map_path, benchmark_names):
+    """Whole firmware and per benchmarked function IRAM/DRAM/FLASH bytes from the linker map."""
+    report = load_memory_report()
+    usage = report.parse_map(map_path, by_symbol=True)
+    if not usage:
+        sys.exit("No sections found in %s; was it produced with -Wl,-Map?" % map_path)
+    functions = {}
+    for name in benchmark_names:
+        base = name.split("/")[0]
+        wanted = SECTION_SYMBOLS.get(base, (base,))
+        regions = {"IRAM": 0, "DRAM": 0, "FLASH": 0}
+        for key, sizes in usage.items():
+            symbol = key.split(":", 1)[1]
+            if re.match(r"(%s)\(" % "|".join(re.escape(w) for w in wanted), symbol):
+                for region in regions:
+                    regions[region] += sizes[region]
+        functions[base] = regions
+    map_name = os.path.abspath(map_path)
+    if map_name.startswith(ROOT + os.sep):
+        map_name = os.path.relpath(map_name, ROOT)
+    return {"map": map_name, "total": report.totals(usage), "functions": functions}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build and run the host benchmarks, write the results as JSON")
+    parser.add_argument("--output", "-o", metavar="JSON", help="write the results here (default: stdout)")
+    parser.add_argument("--repeat", type=int, default=10, help="runs of the benchmark binary (default 10)")
+    parser.add_argument("--min-time", type=float, default=100, metavar="MS", help="minimum measuring time per benchmark and run (default 100)")
+    parser.add_argument("--filter", metavar="SUBSTRING", help="only run benchmarks whose name contains SUBSTRING")
+    parser.add_argument("--map", metavar="FILE", help="firmware linker map for section sizes (default: %s, if present)" % os.path.relpath(DEFAULT_MAP, ROOT))
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "g++"))
+    parser.add_argument("--build-dir", default=os.path.join(ROOT, ".pio", "build", "bench"))
+    args = parser.parse_args()
+
+    binary = build(args.cxx, args.build_dir)
+    command = [binary, "--min-time", str(args.min_time)] + (["--filter", args.filter] if args.filter else [])
+    benchmarks = {}
+    for run in range(args.repeat):
+        print("Run %d/%d" % (run + 1, args.repeat), file=sys.stderr)
+        result = subprocess.run(command, capture_output=True, text=True)
+        if result.returncode != 0:
+            sys.exit("Benchmark run failed:\n" + result.stderr)
+        for b in json.loads(result.stdout)["benchmarks"]:
+            entry = benchmarks.setdefault(b["name"], {m: [] for m in METRICS + ("iterations",)})
+            for m in METRICS + ("iterations",):
+                entry[m].append(b[m])
+
+    map_path = args.map or (DEFAULT_MAP if os.path.exists(DEFAULT_MAP) else None)
+    results = {
+        "git": {"rev": git("rev-parse", "HEAD"), "describe": git("describe", "--always", "--dirty"),
+                "dirty": bool(git("status", "--porcelain", "--untracked-files=no"))},
+        "date": datetime.datetime.now(datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+        "host": {"machine": platform.machine(), "system": platform.platform(), "compiler": compiler_version(args.cxx),
+                 "flags": " ".join(CXXFLAGS)},
+        "repeat": args.repeat,
+        "min_time_ms": args.min_time,
+        "benchmarks": benchmarks,
+        "sections": section_sizes(map_path, benchmarks) if map_path else None,
+    }
+
+    text = json.dumps(results, indent=2, sort_keys=True)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+        print("Results (%s) written to %s" % (results["git"]["describe"], args.output), file=sys.stderr)
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()
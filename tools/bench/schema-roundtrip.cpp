@@ -0,0 +1,138 @@
+/*
+  Round trip of the sensor schema (lib/sensor-schema): SENSOR_FIELDS -> state payload -> parsed json, read back through
+  the value templates of the generated discovery entities, as Home Assistant would.
+  - the payload is valid json, within STATE_PAYLOAD_MAX_LENGTH, and built in a single allocation
+  - every entity's value_template (and json_attributes_template) resolves to a field of the payload
+  - every field of the payload is either an entity or declared as not one
+  - a test schema with known values checks formatting: precision per field, nesting, and null for a missing value
+    or one wider than its declared width
+  Run by harness.py.
+*/
+#include "../../src/radthing.cpp"
+#include "host/alloc-count.h"
+#include "harness.h"
+#include "json.h"
+
+// Value at a dotted path ("frequency_details.cpm"); nullptr if there is none
+static const json_value* lookup(const json_value &root, const std::string &path){
+  const json_value* v = &root;
+  size_t start = 0;
+  while(true){
+    size_t dot = path.find('.', start);
+    auto member = v->members.find(path.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+    if(v->type != json_value::OBJECT || member == v->members.end()){
+      return nullptr;
+    }
+    v = &member->second;
+    if(dot == std::string::npos){
+      return v;
+    }
+    start = dot + 1;
+  }
+}
+
+// Path out of a template "{{ value_json.<path><suffix> }}"; empty if the template has another form
+static std::string templatePath(const std::string &tpl, const std::string &suffix){
+  const std::string head = "{{ value_json.";
+  const std::string tail = suffix + " }}";
+  if(tpl.compare(0, head.length(), head) != 0 || tpl.length() < head.length() + tail.length()
+    || tpl.compare(tpl.length() - tail.length(), tail.length(), tail) != 0){
+    return std::string();
+  }
+  return tpl.substr(head.length(), tpl.length() - head.length() - tail.length());
+}
+
+// Member of a discovery payload under its verbose or abbreviated key
+static const json_value* discoveryMember(const json_value &payload, const char* verbose, const char* abbreviated){
+  auto member = payload.members.find(HA_DISCOVERY_COMPACT ? abbreviated : verbose);
+  return member == payload.members.end() ? nullptr : &member->second;
+}
+
+// *********************************************************************************************************************
+// *** SENSOR_FIELDS ***
+static void checkStatePayload(const char* clock){
+  unsigned long long allocs = alloc_count;
+  std::string payload = buildSchemaPayload(SENSOR_FIELDS, SENSOR_FIELD_COUNT);
+  check(alloc_count - allocs == 1, "state payload (%s) built in %llu allocation(s)", clock, alloc_count - allocs);
+  check(payload.length() <= STATE_PAYLOAD_MAX_LENGTH, "state payload (%s) %u bytes, STATE_PAYLOAD_MAX_LENGTH %u",
+    clock, (unsigned)payload.length(), (unsigned)STATE_PAYLOAD_MAX_LENGTH);
+  json_value state = parseJson(payload);
+  check(state.type == json_value::OBJECT, "state payload (%s) parses: %s", clock, payload.c_str());
+  if(state.type != json_value::OBJECT){
+    return;
+  }
+
+  // every declared field is in the payload, where the schema says
+  for (const sensor_field &f : SENSOR_FIELDS)
+  {
+    std::string path = f.parent == nullptr ? f.key : std::string(f.parent) + "_details." + f.key;
+    const json_value* v = lookup(state, path);
+    check(v != nullptr && (v->type == json_value::NUMBER || v->text == "null"), "%s: field %s is a number or null", clock, path.c_str());
+  }
+
+  // every entity's templates resolve against the payload, and every value of the payload is read by one
+  phase_vector<discovery_metadata> entities = getSchemaDiscoveryMetadata(SENSOR_FIELDS, SENSOR_FIELD_COUNT);
+  std::map<std::string, bool> read;
+  for (const discovery_metadata &m : entities)
+  {
+    discovery_config disc = getDiscoveryMessage(m);
+    json_value config = parseJson(std::string(disc.payload.c_str()));
+    check(config.type == json_value::OBJECT, "%s: discovery payload of %s parses", clock, m.json_attr.c_str());
+    const json_value* value_tpl = discoveryMember(config, "value_template", "val_tpl");
+    std::string path = value_tpl != nullptr ? templatePath(value_tpl->text, "") : "";
+    const json_value* v = path.empty() ? nullptr : lookup(state, path);
+    check(v != nullptr && v->type != json_value::OBJECT, "%s: value template of %s (%s) finds a value", clock, m.json_attr.c_str(), path.c_str());
+    read[path] = true;
+
+    const json_value* attr_tpl = discoveryMember(config, "json_attributes_template", "json_attr_tpl");
+    if(m.has_sub_attr){
+      std::string attr_path = attr_tpl != nullptr ? templatePath(attr_tpl->text, " | tojson") : "";
+      const json_value* attrs = attr_path.empty() ? nullptr : lookup(state, attr_path);
+      check(attrs != nullptr && attrs->type == json_value::OBJECT, "%s: attributes template of %s (%s) finds an object", clock, m.json_attr.c_str(), attr_path.c_str());
+    }
+    else {
+      check(attr_tpl == nullptr, "%s: %s has no attributes template", clock, m.json_attr.c_str());
+    }
+  }
+  for (const sensor_field &f : SENSOR_FIELDS)
+  {
+    std::string path = f.parent == nullptr ? f.key : std::string(f.parent) + "_details." + f.key;
+    check(read.count(path) == (f.entity ? 1u : 0u), "%s: field %s %s by a value template", clock, path.c_str(), f.entity ? "is read" : "is not read");
+  }
+}
+
+// *********************************************************************************************************************
+// *** Formatting ***
+static double readPi(){ return 3.14159265; }
+static double readLarge(){ return 123456789.0; }
+static double readMissing(){ return NAN; }
+
+constexpr sensor_field TEST_FIELDS[] = {
+  { "pi",      nullptr, "%.3f", 5, readPi,      true,  "", "measurement", "", "" },
+  { "pi_1",    "pi",    "%.1f", 4, readPi,      true,  "", "measurement", "", "" },
+  { "pi_4",    "pi",    "%.4f", 6, readPi,      true,  "", "measurement", "", "" },
+  { "large",   nullptr, "%.2f", 8, readLarge,   true,  "", "measurement", "", "" },
+  { "missing", nullptr, "%.1f", 4, readMissing, false, "", "",            "", "" },
+};
+constexpr size_t TEST_FIELD_COUNT = sizeof(TEST_FIELDS) / sizeof(TEST_FIELDS[0]);
+static_assert(validSchema(TEST_FIELDS, TEST_FIELD_COUNT), "TEST_FIELDS");
+
+static void checkFormatting(){
+  std::string payload = buildSchemaPayload(TEST_FIELDS, TEST_FIELD_COUNT);
+  const char* expected = "{\"pi\": 3.142, \"pi_details\": {\"pi_1\": 3.1, \"pi_4\": 3.1416}, \"large\": null, \"missing\": null}";
+  check(payload == expected, "test schema payload %s", payload.c_str());
+  check(payload.length() <= schemaPayloadMaxLength(TEST_FIELDS, TEST_FIELD_COUNT), "test schema payload %u bytes, bound %u",
+    (unsigned)payload.length(), (unsigned)schemaPayloadMaxLength(TEST_FIELDS, TEST_FIELD_COUNT));
+  json_value state = parseJson(payload);
+  const json_value* pi_4 = lookup(state, "pi_details.pi_4");
+  check(pi_4 != nullptr && pi_4->text == "3.1416", "pi_details.pi_4 reads back as 3.1416");
+}
+
+int main(){
+  initMQTTClient(LOCAL_ENV_MQTT_BROKER_HOST, LOCAL_ENV_MQTT_BROKER_PORT, AVAILABILITY_TOPIC.c_str(), linkclient);
+  checkStatePayload("clock not set");
+  timebaseSync(wallclock, 1760000000000000ULL, micros64());
+  checkStatePayload("clock set");
+  checkFormatting();
+  return harnessResult();
+}
@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""
+Report IRAM / DRAM / flash usage per module (or per symbol) from the GNU ld map file produced by the firmware build.
+
+The map file is enabled in platformio.ini (build_flags = -Wl,-Map,...) and ends up in the build directory:
+
+  python3 tools/memory-report.py .pio/build/thingdev/firmware.map
+  python3 tools/memory-report.py .pio/build/thingdev/firmware.map --save before.json
+  python3 tools/memory-report.py .pio/build/thingdev/firmware.map --baseline before.json
+  python3 tools/memory-report.py .pio/build/thingdev/firmware.map --symbols --module utils --top 20
+
+With --symbols every function and variable is listed on its own (the framework is built with -ffunction-sections and
+-fdata-sections, so each one sits in an input section named after it); against a baseline saved with --symbols this
+shows exactly which symbols a change added, grew or reclaimed.
+
+A module is a project source file, a project library (lib/<name>) or a framework/SDK archive.
+Regions are classified by load address (ESP8266 memory map):
+
+  IRAM  : 0x40100000 - 0x4010FFFF  instruction RAM (hot code: ISRs, IRAM_ATTR functions)
+  DRAM  : 0x3FFE8000 - 0x3FFFFFFF  data RAM (.data + .rodata + .bss)
+  FLASH : 0x40200000 - 0x402FFFFF  memory mapped SPI flash (cold code: .irom0.text, ICACHE_FLASH_ATTR)
+"""
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+REGIONS = (
+    ("IRAM", 0x40100000, 0x40110000),
+    ("DRAM", 0x3FFE8000, 0x40000000),
+    ("FLASH", 0x40200000, 0x40300000),
+)
+
+# An input section line looks like either of:
+#  .irom0.text    0x40201010       0x40 .pio/build/thingdev/src/radthing.cpp.o
+#  .irom0.text._Z13publishSensorDatav
+#                 0x40201050       0x9c .pio/build/thingdev/src/radthing.cpp.o
+SECTION_RE = re.compile(r"^ (\.\S+)\s*$")
+
+# Per-function/per-variable input sections are named <output section prefix>.<symbol>; .literal.<symbol> holds the
+# constants of function <symbol> and is counted with it
+SYMBOL_SECTION_PREFIXES = (".irom0.text.", ".irom.text.", ".iram.text.", ".iram0.text.", ".text.", ".literal.",
+                           ".rodata.", ".data.", ".bss.")
+NAME_WIDTH = 72  # longer (demangled) names are shortened in the listing
+ENTRY_RE = re.compile(r"^ (\.\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+
+
+def region_of(address):
+    for name, start, end in REGIONS:
+        if start <= address < end:
+            return name
+    return None
+
+
+def module_of(obj):
+    """Collapse an object file path into a module name."""
+    obj = obj.strip()
+    archive = re.match(r"(.*?)\((.*)\)$", obj)
+    if archive:
+        lib = os.path.basename(archive.group(1))
+        member = archive.group(2)
+        # project libraries are archived as lib<name>.a by PlatformIO; report them by source file
+        if "/lib" in archive.group(1).replace("\\", "/") and ".pio" in archive.group(1):
+            return re.sub(r"\.(c|cpp|S)\.o$", "", member)
+        return lib
+    name = os.path.basename(obj)
+    return re.sub(r"\.(c|cpp|S)\.o$", "", name)
+
+
+def symbol_of(section):
+    """Symbol an input section was generated for, or the bare section name in brackets."""
+    for prefix in SYMBOL_SECTION_PREFIXES:
+        if section.startswith(prefix) and len(section) > len(prefix):
+            return section[len(prefix):]
+    return "(%s)" % section
+
+
+def demangle(names):
+    """Demangle C++ names in one c++filt run, if the tool is available."""
+    tool = shutil.which("xtensa-lx106-elf-c++filt") or shutil.which("c++filt")
+    mangled = sorted(n for n in names if n.startswith("_Z"))
+    if not tool or not mangled:
+        return {}
+    result = subprocess.run([tool], input="\n".join(mangled), capture_output=True, text=True)
+    if result.returncode != 0:
+        return {}
+    return dict(zip(mangled, result.stdout.splitlines()))
+
+
+def parse_map(path, by_symbol=False):
+    usage = {}
+    in_map = False
+    pending_section = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not in_map:
+                in_map = line.startswith("Linker script and memory map")
+                continue
+            if line.startswith("/DISCARD/"):
+                break
+            m = SECTION_RE.match(line)
+            if m:
+                pending_section = m.group(1)  # section name wrapped onto its own line
+                continue
+            m = ENTRY_RE.match(line)
+            if not m:
+                pending_section = None
+                continue
+            section = m.group(1) or pending_section
+            pending_section = None
+            if section is None or m.group(4).startswith(("0x", "*", "[")):
+                continue
+            address, size = int(m.group(2), 16), int(m.group(3), 16)
+            region = region_of(address)
+            if size == 0 or region is None:
+                continue
+            key = module_of(m.group(4))
+            if by_symbol:
+                key = (key, symbol_of(section))
+            usage.setdefault(key, {"IRAM": 0, "DRAM": 0, "FLASH": 0})[region] += size
+    if by_symbol:
+        names = demangle(set(symbol for _, symbol in usage))
+        usage = {"%s:%s" % (module, names.get(symbol, symbol)): regions for (module, symbol), regions in usage.items()}
+    return usage
+
+
+def totals(usage):
+    t = {"IRAM": 0, "DRAM": 0, "FLASH": 0}
+    for regions in usage.values():
+        for r in t:
+            t[r] += regions[r]
+    return t
+
+
+def shorten(name):
+    return name if len(name) <= NAME_WIDTH else name[:NAME_WIDTH - 3] + "..."
+
+
+def print_report(usage, baseline=None, limit=None, label="module"):
+    rows = sorted(usage.items(), key=lambda kv: -(kv[1]["IRAM"] + kv[1]["DRAM"] + kv[1]["FLASH"]))
+    if limit:
+        rows = rows[:limit]
+
+    def cell(module, region, value):
+        if baseline is None:
+            return "%8d" % value
+        delta = value - baseline.get(module, {}).get(region, 0)
+        return "%8d %+6d" % (value, delta) if delta else "%8d %6s" % (value, "")
+
+    removed = sorted(set(baseline) - set(usage)) if baseline is not None else []
+    width = max([len(shorten(m)) for m, _ in rows] + [len(shorten(m)) for m in removed] + [len("TOTAL")])
+    header = " ".join("%8s %6s" % (r, "") if baseline else "%8s" % r for r in ("IRAM", "DRAM", "FLASH"))
+    print("%-*s %s" % (width, label, header))
+    for module, regions in rows:
+        print("%-*s %s" % (width, shorten(module), " ".join(cell(module, r, regions[r]) for r in ("IRAM", "DRAM", "FLASH"))))
+    for module in removed:
+        regions = baseline[module]
+        print("%-*s (removed: %s)" % (width, shorten(module), ", ".join("%s %d" % (r, regions[r]) for r in ("IRAM", "DRAM", "FLASH") if regions[r])))
+    t = totals(usage)
+    base_t = totals(baseline) if baseline is not None else None
+    print("%-*s %s" % (width, "TOTAL", " ".join(
+        ("%8d %+6d" % (t[r], t[r] - base_t[r])) if base_t else "%8d" % t[r] for r in ("IRAM", "DRAM", "FLASH"))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Per-module IRAM/DRAM/flash usage from a linker map file")
+    parser.add_argument("map", help="linker map file (firmware.map)")
+    parser.add_argument("--save", metavar="JSON", help="write the per-module usage to a json file")
+    parser.add_argument("--baseline", metavar="JSON", help="show the change against a previously saved report")
+    parser.add_argument("--top", type=int, metavar="N", help="only list the N largest modules (or symbols)")
+    parser.add_argument("--symbols", action="store_true", help="report per symbol (module:symbol) instead of per module")
+    parser.add_argument("--module", metavar="NAME", help="only report modules whose name contains NAME")
+    args = parser.parse_args()
+
+    usage = parse_map(args.map, args.symbols)
+    if not usage:
+        sys.exit("No sections found in %s; was it produced with -Wl,-Map?" % args.map)
+
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    if args.module:
+        def wanted(key):
+            return args.module in (key.split(":", 1)[0] if args.symbols else key)
+        usage = {k: v for k, v in usage.items() if wanted(k)}
+        if baseline is not None:
+            baseline = {k: v for k, v in baseline.items() if wanted(k)}
+
+    print_report(usage, baseline, args.top, "symbol" if args.symbols else "module")
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(usage, f, indent=2, sort_keys=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,496 @@
+#!/usr/bin/env python3
+"""
+Host-side stand-in for an MQTT-SN gateway, for the MQTTSN_GATEWAY_PORT transport (see lib/mqttsn-client).
+
+The device sends its state and diagnostic updates as MQTT-SN 1.2 PUBLISH datagrams with QoS -1 and predefined topic
+ids. The gateway maps each id back to its topic and publishes the payload to the broker over an ordinary MQTT 3.1.1
+connection (QoS 0, not retained), so Home Assistant sees the same messages as with the TCP transport:
+
+  python3 tools/mqttsn-gateway.py --broker 10.0.0.2:1883 --username gateway --password secret \\
+      --topic 1=homeassistant/sensor/esp8266thing/state --topic 2=homeassistant/sensor/esp8266thing/diagnostics
+
+Without --broker it only prints what arrives. When a payload carries "ts" (epoch seconds, see SENSOR_FIELDS) its
+delivery latency is printed too; that needs the host clock NTP synced like the device's.
+
+--compare measures the two transports against each other on this host. An emulated device sends the same stream of
+state updates once as MQTT-SN datagrams through this gateway and once as MQTT PUBLISH packets over TCP to a broker
+stand-in, both across an emulated link with the latency, bandwidth and loss of one of the NETWORK_PROFILE_* of
+lib/fault-client:
+
+  python3 tools/mqttsn-gateway.py --compare --profile weak-wifi --messages 300 --interval 50
+
+Like the firmware, the TCP sender skips an update while the send buffer (TCP_SEND_BUFFER, unacknowledged bytes) has no
+room for it (hasPublishCapacity) instead of blocking. A lost TCP segment holds up the stream behind it for
+RETRANSMIT_MS; a lost datagram is just gone.
+"""
+import argparse
+import heapq
+import json
+import random
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+
+MQTTSN_PUBLISH = 0x0C
+MQTTSN_FLAG_QOS_M1 = 0x60
+MQTTSN_TOPIC_TYPE_MASK = 0x03
+MQTTSN_TOPIC_PREDEFINED = 0x01
+
+MQTT_CONNECT = 0x10
+MQTT_CONNACK = 0x20
+MQTT_PUBLISH = 0x30
+MQTT_PINGREQ = 0xC0
+MQTT_DISCONNECT = 0xE0
+
+# Link emulation; rtt_ms, bytes_per_sec (0 = unlimited), loss_percent as the NETWORK_PROFILE_* in fault-client.h
+PROFILES = {
+    "good": (0, 0, 0),
+    "weak-wifi": (150, 20000, 5),
+    "flaky": (300, 5000, 10),
+}
+RETRANSMIT_MS = 1000     # FAULT_RETRANSMIT_MS
+TCP_SEND_BUFFER = 2920   # lwIP TCP_SND_BUF (2 * TCP_MSS) of the ESP8266 core
+TCP_MSS = 1460
+UDP_QUEUE_MS = 500       # a datagram that would wait longer than this for the emulated link is dropped (transmit queue full)
+IP_HEADER = 20
+UDP_HEADER = 8
+TCP_HEADER = 20
+
+
+# *** MQTT-SN ***
+
+def mqttsn_publish(topic_id, payload):
+    """PUBLISH datagram as built by mqttsnPublish()."""
+    length = len(payload) + 7
+    header = bytes([length]) if length <= 255 else struct.pack("!BH", 0x01, length + 2)
+    return header + struct.pack("!BBHH", MQTTSN_PUBLISH, MQTTSN_FLAG_QOS_M1 | MQTTSN_TOPIC_PREDEFINED, topic_id, 0) + payload
+
+
+def mqttsn_decode(datagram):
+    """(message type, flags, topic id, data) of a PUBLISH; (message type, None, None, None) for anything else; None if malformed."""
+    if len(datagram) < 2:
+        return None
+    if datagram[0] == 0x01:
+        if len(datagram) < 4:
+            return None
+        length, offset = struct.unpack("!H", datagram[1:3])[0], 3
+    else:
+        length, offset = datagram[0], 1
+    if length != len(datagram):
+        return None
+    msg_type = datagram[offset]
+    if msg_type != MQTTSN_PUBLISH:
+        return msg_type, None, None, None
+    if len(datagram) < offset + 6:
+        return None
+    flags, topic_id, _msg_id = struct.unpack("!BHH", datagram[offset + 1:offset + 6])
+    return msg_type, flags, topic_id, datagram[offset + 6:]
+
+
+# *** MQTT 3.1.1, just enough to publish at QoS 0 ***
+
+def mqtt_string(s):
+    data = s.encode() if isinstance(s, str) else s
+    return struct.pack("!H", len(data)) + data
+
+
+def mqtt_packet(header, body):
+    length, encoded = len(body), bytearray()
+    while True:
+        digit, length = length % 128, length // 128
+        encoded.append(digit | (0x80 if length > 0 else 0))
+        if length == 0:
+            return bytes([header]) + bytes(encoded) + body
+
+
+def mqtt_connect(client_id, username=None, password=None, keep_alive=60):
+    flags = 0x02 | (0x80 if username else 0) | (0x40 if password else 0)  # clean session
+    body = mqtt_string("MQTT") + bytes([4, flags]) + struct.pack("!H", keep_alive) + mqtt_string(client_id)
+    if username:
+        body += mqtt_string(username)
+    if password:
+        body += mqtt_string(password)
+    return mqtt_packet(MQTT_CONNECT, body)
+
+
+def mqtt_publish(topic, payload):
+    return mqtt_packet(MQTT_PUBLISH, mqtt_string(topic) + payload)
+
+
+class MqttReader:
+    """Splits a byte stream into (fixed header, body) packets."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.buffer += data
+        packets = []
+        while len(self.buffer) >= 2:
+            length, multiplier, i = 0, 1, 1
+            while True:
+                if i >= len(self.buffer):
+                    return packets
+                length += (self.buffer[i] & 0x7F) * multiplier
+                multiplier *= 128
+                i += 1
+                if not self.buffer[i - 1] & 0x80:
+                    break
+            if len(self.buffer) < i + length:
+                return packets
+            packets.append((self.buffer[0], bytes(self.buffer[i:i + length])))
+            del self.buffer[:i + length]
+        return packets
+
+
+def read_connack(sock):
+    reader = MqttReader()
+    while True:
+        data = sock.recv(64)
+        if not data:
+            raise ConnectionError("broker closed the connection")
+        for header, body in reader.feed(data):
+            if header & 0xF0 == MQTT_CONNACK:
+                if len(body) < 2 or body[1] != 0:
+                    raise ConnectionError("broker refused the connection (return code %d)" % (body[1] if len(body) > 1 else -1))
+                return
+
+
+class BrokerConnection:
+    """Forwarding connection of the gateway to the broker."""
+
+    def __init__(self, host, port, client_id, username, password, keep_alive=60):
+        self.keep_alive = keep_alive
+        self.sock = socket.create_connection((host, port))
+        self.sock.sendall(mqtt_connect(client_id, username, password, keep_alive))
+        read_connack(self.sock)
+        self.last_sent = time.monotonic()
+        threading.Thread(target=self._drain, daemon=True).start()
+
+    def _drain(self):
+        while self.sock.recv(256):  # PINGRESP; nothing is subscribed
+            pass
+
+    def publish(self, topic, payload):
+        self.sock.sendall(mqtt_publish(topic, payload))
+        self.last_sent = time.monotonic()
+
+    def idle(self):
+        if time.monotonic() - self.last_sent > self.keep_alive / 2:
+            self.sock.sendall(mqtt_packet(MQTT_PINGREQ, b""))
+            self.last_sent = time.monotonic()
+
+
+# *** Gateway ***
+
+def latency_of(payload, arrival):
+    """Seconds from the reading's "ts" to its arrival; None if the payload has no (set) timestamp."""
+    try:
+        ts = json.loads(payload).get("ts")
+    except (ValueError, AttributeError):
+        return None
+    return arrival - ts if isinstance(ts, (int, float)) else None
+
+
+class Gateway:
+    def __init__(self, topics, broker=None, on_publish=None):
+        self.topics = topics
+        self.broker = broker
+        self.on_publish = on_publish
+        self.received = 0
+        self.unknown = 0
+        self.malformed = 0
+
+    def handle(self, datagram, arrival):
+        decoded = mqttsn_decode(datagram)
+        if decoded is None:
+            self.malformed += 1
+            return
+        msg_type, flags, topic_id, data = decoded
+        if msg_type != MQTTSN_PUBLISH or flags & MQTTSN_TOPIC_TYPE_MASK != MQTTSN_TOPIC_PREDEFINED:
+            self.unknown += 1  # only predefined QoS -1 publishes are supported; nothing else gets an answer
+            return
+        topic = self.topics.get(topic_id)
+        if topic is None:
+            if self.unknown == 0:
+                print("unknown topic id %d (see --topic)" % topic_id, file=sys.stderr)
+            self.unknown += 1
+            return
+        self.received += 1
+        if self.broker:
+            self.broker.publish(topic, data)
+        if self.on_publish:
+            self.on_publish(topic, data, arrival)
+
+
+def print_publish(topic, data, arrival):
+    latency = latency_of(data, arrival)
+    suffix = "" if latency is None else "  (%.0f ms after ts)" % (latency * 1000)
+    print("%s %s%s" % (topic, data.decode(errors="replace"), suffix), flush=True)
+
+
+def serve(args, topics):
+    broker = None
+    if args.broker:
+        host, _, port = args.broker.partition(":")
+        broker = BrokerConnection(host, int(port or 1883), args.client_id, args.username, args.password)
+    gateway = Gateway(topics, broker, None if args.quiet else print_publish)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(1.0)
+    print("MQTT-SN gateway on %s:%d, topics %s" % (args.bind, args.port, topics), file=sys.stderr)
+    while True:
+        try:
+            datagram, _ = sock.recvfrom(65535)
+            gateway.handle(datagram, time.time())
+        except socket.timeout:
+            pass
+        if broker:
+            broker.idle()
+
+
+# *** Transport comparison ***
+
+class DelayLine:
+    """Runs callbacks at their due time, in order."""
+
+    def __init__(self):
+        self.queue = []
+        self.sequence = 0
+        self.condition = threading.Condition()
+        threading.Thread(target=self._run, daemon=True).start()
+
+    def at(self, due, callback):
+        with self.condition:
+            heapq.heappush(self.queue, (due, self.sequence, callback))
+            self.sequence += 1
+            self.condition.notify()
+
+    def _run(self):
+        while True:
+            with self.condition:
+                while not self.queue or self.queue[0][0] > time.monotonic():
+                    self.condition.wait(None if not self.queue else self.queue[0][0] - time.monotonic())
+                _, _, callback = heapq.heappop(self.queue)
+            callback()
+
+
+class Link:
+    def __init__(self, profile, seed):
+        self.rtt, self.rate, self.loss = profile[0] / 1000.0, profile[1], profile[2]
+        self.rng = random.Random(seed)
+        self.delay = DelayLine()
+        self.busy_until = 0.0
+
+    def lost(self):
+        return self.loss > 0 and self.rng.random() * 100 < self.loss
+
+    def serialize(self, wire_bytes):
+        """Queue wire_bytes behind what the link is still sending; returns when the last byte leaves."""
+        start = max(time.monotonic(), self.busy_until)
+        self.busy_until = start + (wire_bytes / self.rate if self.rate else 0)
+        return self.busy_until
+
+
+def udp_link(link, device_side, gateway_address, stats):
+    """Device datagrams -> gateway: dropped on loss or a full queue, otherwise delayed by transmission and rtt / 2."""
+    out = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    while True:
+        datagram, _ = device_side.recvfrom(65535)
+        wire = len(datagram) + UDP_HEADER + IP_HEADER
+        if link.lost() or max(link.busy_until - time.monotonic(), 0) > UDP_QUEUE_MS / 1000.0:
+            stats["link_drops"] += 1
+            continue
+        sent = link.serialize(wire)
+        link.delay.at(sent + link.rtt / 2, lambda d=datagram: out.sendto(d, gateway_address))
+
+
+def tcp_link(link, listener, sink_address, acked):
+    """Device stream -> broker stand-in, one segment at a time: a lost segment stalls the stream for RETRANSMIT_MS,
+    every segment is delayed by transmission and rtt / 2 and acknowledged rtt / 2 after it arrives."""
+    device, _ = listener.accept()
+    broker = socket.create_connection(sink_address)
+
+    def backwards():
+        while True:
+            data = broker.recv(4096)
+            if not data:
+                return
+            link.delay.at(time.monotonic() + link.rtt / 2, lambda d=data: device.sendall(d))
+
+    threading.Thread(target=backwards, daemon=True).start()
+    while True:
+        segment = device.recv(TCP_MSS)
+        if not segment:
+            return
+        if link.lost():
+            time.sleep(RETRANSMIT_MS / 1000.0)
+        sent = link.serialize(len(segment) + TCP_HEADER + IP_HEADER)
+        time.sleep(max(sent - time.monotonic(), 0))  # the stream does not move on until the segment is out
+
+        def arrive(s=segment):
+            broker.sendall(s)
+            link.delay.at(time.monotonic() + link.rtt / 2, lambda n=len(s): acked.__setitem__(0, acked[0] + n))
+
+        link.delay.at(sent + link.rtt / 2, arrive)
+
+
+def broker_sink(listener, latencies):
+    """Accepts the device's CONNECT and records the arrival of each PUBLISH."""
+    conn, _ = listener.accept()
+    reader = MqttReader()
+    while True:
+        data = conn.recv(4096)
+        if not data:
+            return
+        for header, body in reader.feed(data):
+            kind = header & 0xF0
+            if kind == MQTT_CONNECT:
+                conn.sendall(bytes([MQTT_CONNACK, 2, 0, 0]))
+            elif kind == MQTT_PUBLISH:
+                topic_length = struct.unpack("!H", body[:2])[0]
+                latencies.append(latency_of(body[2 + topic_length:], time.time()))
+
+
+def state_payload(rng, sequence):
+    """A state update shaped like the device's (see SENSOR_FIELDS), stamped with the current time."""
+    cpm = rng.uniform(2, 40)
+    return json.dumps({
+        "frequency": round(cpm / 60, 4),
+        "frequency_details": {"dose": round(cpm / 53.032, 2), "dose_err": 0.01, "dose_high": round(cpm / 53.032 + 0.01, 2),
+                              "dose_low": round(cpm / 53.032 - 0.01, 2), "cpm": round(cpm, 2)},
+        "dose_total": round(12.3456 + sequence / 10000.0, 4),
+        "ts": round(time.time(), 3),
+    }).encode()
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(int(len(ordered) * p / 100.0), len(ordered) - 1)] if ordered else float("nan")
+
+
+def run_transport(kind, args, profile, topic):
+    link = Link(profile, args.seed)
+    rng = random.Random(args.seed)
+    latencies, stats = [], {"link_drops": 0, "skipped": 0, "wire": 0}
+    if kind == "udp":
+        gateway_side = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        gateway_side.bind(("127.0.0.1", 0))
+        gateway = Gateway({1: topic}, on_publish=lambda t, d, arrival: latencies.append(latency_of(d, arrival)))
+
+        def serve_gateway():
+            while True:
+                datagram, _ = gateway_side.recvfrom(65535)
+                gateway.handle(datagram, time.time())
+
+        threading.Thread(target=serve_gateway, daemon=True).start()
+        device_side = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        device_side.bind(("127.0.0.1", 0))
+        threading.Thread(target=udp_link, args=(link, device_side, gateway_side.getsockname(), stats), daemon=True).start()
+        device = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        device.connect(device_side.getsockname())
+    else:
+        sink = socket.socket()
+        sink.bind(("127.0.0.1", 0))
+        sink.listen(1)
+        threading.Thread(target=broker_sink, args=(sink, latencies), daemon=True).start()
+        proxy = socket.socket()
+        proxy.bind(("127.0.0.1", 0))
+        proxy.listen(1)
+        acked = [0]
+        threading.Thread(target=tcp_link, args=(link, proxy, sink.getsockname(), acked), daemon=True).start()
+        device = socket.create_connection(proxy.getsockname())
+        device.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        connect = mqtt_connect("esp8266thing")
+        device.sendall(connect)
+        read_connack(device)
+        written = len(connect)
+
+    start = time.monotonic()
+    for i in range(args.messages):
+        time.sleep(max(start + i * args.interval / 1000.0 - time.monotonic(), 0))
+        payload = state_payload(rng, i)
+        if kind == "udp":
+            packet = mqttsn_publish(1, payload)
+            device.send(packet)
+            stats["wire"] += len(packet) + UDP_HEADER + IP_HEADER
+        else:
+            packet = mqtt_publish(topic, payload)
+            if TCP_SEND_BUFFER - (written - acked[0]) < len(packet):  # hasPublishCapacity()
+                stats["skipped"] += 1
+                continue
+            device.sendall(packet)
+            written += len(packet)
+            stats["wire"] += len(packet) + TCP_HEADER + IP_HEADER + (TCP_HEADER + IP_HEADER) / 2  # delayed ACK every other segment
+    sent_for = time.monotonic() - start
+    deadline = time.monotonic() + profile[0] / 1000.0 + 3 * RETRANSMIT_MS / 1000.0 + UDP_QUEUE_MS / 1000.0
+    while time.monotonic() < deadline and len(latencies) < args.messages - stats["skipped"] - stats["link_drops"]:
+        time.sleep(0.05)
+    time.sleep(0.2)
+    delivered = [x * 1000 for x in latencies if x is not None]
+    offered = args.messages - stats["skipped"]
+    return {
+        "sent": offered,
+        "skipped": stats["skipped"],
+        "delivered": len(delivered),
+        "lost": offered - len(delivered),
+        "rate": len(delivered) / sent_for,
+        "p50": percentile(delivered, 50),
+        "p90": percentile(delivered, 90),
+        "p99": percentile(delivered, 99),
+        "max": max(delivered) if delivered else float("nan"),
+        "wire": stats["wire"] / offered if offered else 0,
+    }
+
+
+def compare(args):
+    profile = PROFILES[args.profile]
+    topic = "homeassistant/sensor/esp8266thing/state"
+    print("profile %s: rtt %d ms, %s, loss %d%%; %d state updates every %d ms" % (
+        args.profile, profile[0], "%d B/s" % profile[1] if profile[1] else "unlimited", profile[2], args.messages, args.interval))
+    rows = [("MQTT/TCP", run_transport("tcp", args, profile, topic)), ("MQTT-SN/UDP", run_transport("udp", args, profile, topic))]
+    print("%-12s %6s %8s %10s %6s %9s %8s %8s %8s %8s %10s" % (
+        "transport", "sent", "skipped", "delivered", "lost", "upd/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "wire B/upd"))
+    for name, r in rows:
+        print("%-12s %6d %8d %10d %6d %9.1f %8.0f %8.0f %8.0f %8.0f %10.0f" % (
+            name, r["sent"], r["skipped"], r["delivered"], r["lost"], r["rate"], r["p50"], r["p90"], r["p99"], r["max"], r["wire"]))
+    print("skipped: not sent for lack of send buffer (hasPublishCapacity), the device publishes a newer reading later; "
+          "lost: sent but never arrived; latency from the reading's ts to its arrival")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MQTT-SN gateway stand-in (predefined topic ids, QoS -1) and transport comparison")
+    parser.add_argument("--port", type=int, default=1885, help="UDP port (MQTTSN_GATEWAY_PORT)")
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--topic", action="append", default=[], metavar="ID=TOPIC", help="predefined topic id, ie. 1=homeassistant/sensor/esp8266thing/state")
+    parser.add_argument("--broker", metavar="HOST[:PORT]", help="forward to this broker (otherwise only print)")
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--client-id", default="mqttsn-gateway")
+    parser.add_argument("--quiet", action="store_true", help="do not print the messages")
+    parser.add_argument("--compare", action="store_true", help="compare MQTT-SN/UDP with MQTT/TCP over an emulated link")
+    parser.add_argument("--profile", choices=sorted(PROFILES), default="weak-wifi")
+    parser.add_argument("--messages", type=int, default=300)
+    parser.add_argument("--interval", type=int, default=50, help="milliseconds between state updates")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    if args.compare:
+        compare(args)
+        return
+    topics = {}
+    for entry in args.topic:
+        topic_id, _, topic = entry.partition("=")
+        if not topic_id.isdigit() or not topic:
+            parser.error("--topic takes ID=TOPIC")
+        topics[int(topic_id)] = topic
+    if not topics:
+        parser.error("at least one --topic is needed")
+    serve(args, topics)
+
+
+if __name__ == "__main__":
+    main()
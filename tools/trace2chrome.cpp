@@ -0,0 +1,199 @@
+/*
+  Convert an event trace dump from the device into Chrome trace_event JSON, for chrome://tracing or https://ui.perfetto.dev
+
+  Capture the dump messages (binary, so without the trailing newline mosquitto_sub adds by default), then request a dump:
+
+    mosquitto_sub -h <broker> -t homeassistant/sensor/esp8266thing/trace/get -N > dump.bin &
+    mosquitto_pub -h <broker> -t homeassistant/sensor/esp8266thing/trace/set -m dump
+
+  Build and run on the host:
+
+    g++ -std=c++11 -O2 -Ilib/event-trace -o trace2chrome tools/trace2chrome.cpp
+    ./trace2chrome dump.bin > trace.json
+
+  Timestamps are microseconds since boot; with --epoch (and a device whose clock was set) microseconds since 1970,
+  so a trace lines up with the timestamps ("ts") of the published readings and with logs from other machines. The cycle counter gives sub-microsecond resolution between neighbouring
+  events; across gaps longer than the counter wraps (~53s at 80MHz) the millis() stamp is used instead.
+  If the input holds more than one dump, only the last complete one is converted.
+*/
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <vector>
+#include "trace-format.h"
+
+struct dump{
+  uint32_t id;
+  uint64_t epoch_us;
+  uint8_t cpu_mhz;
+  uint16_t chunks;
+  std::vector<bool> received;
+  std::vector<std::vector<trace_record>> records; // per chunk
+};
+
+static const char* eventName(uint8_t event){
+  switch(event){
+    case TRACE_PULSE: return "pulse";
+    case TRACE_NOISE: return "noise";
+    case TRACE_PUBLISH_BEGIN:
+    case TRACE_PUBLISH_END: return "publish";
+    case TRACE_PUBACK: return "puback";
+    case TRACE_WIFI_STATE: return "wifi";
+    case TRACE_BROKER_CONNECT: return "broker connect";
+    case TRACE_OVERRUN: return "loop overrun";
+  }
+  return "unknown";
+}
+
+static const char* channelName(uint16_t channel){
+  switch(channel & ~TRACE_PUBLISH_FAILED){
+    case TRACE_CHANNEL_STATE: return "state";
+    case TRACE_CHANNEL_ALARM: return "alarm";
+    case TRACE_CHANNEL_ROLLUP: return "rollup";
+    case TRACE_CHANNEL_DIAGNOSTICS: return "diagnostics";
+    case TRACE_CHANNEL_INTERVALS: return "intervals";
+  }
+  return "other";
+}
+
+// one row (thread) per kind of event in the viewer
+static int trackOf(uint8_t event){
+  switch(event){
+    case TRACE_PULSE:
+    case TRACE_NOISE: return 1;
+    case TRACE_PUBLISH_BEGIN:
+    case TRACE_PUBLISH_END:
+    case TRACE_PUBACK: return 2;
+    case TRACE_WIFI_STATE:
+    case TRACE_BROKER_CONNECT: return 3;
+  }
+  return 4;
+}
+
+static bool complete(const dump &d){
+  for (size_t i = 0; i < d.received.size(); i++)
+  {
+    if(!d.received[i]){
+      return false;
+    }
+  }
+  return !d.received.empty();
+}
+
+int main(int argc, char **argv){
+  bool epoch = argc == 3 && strcmp(argv[1], "--epoch") == 0;
+  if(argc != (epoch ? 3 : 2)){
+    fprintf(stderr, "usage: %s [--epoch] <dump.bin>\n", argv[0]);
+    return 2;
+  }
+  const char *path = argv[argc - 1];
+  FILE *in = fopen(path, "rb");
+  if(in == nullptr){
+    perror(path);
+    return 1;
+  }
+
+  std::vector<dump> dumps;
+  trace_dump_header header;
+  while(fread(&header, sizeof(header), 1, in) == 1){
+    if(header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.chunk >= header.chunks){
+      fprintf(stderr, "not a version %d trace dump (or truncated)\n", TRACE_VERSION);
+      return 1;
+    }
+    if(dumps.empty() || dumps.back().id != header.dump_id){
+      dump d;
+      d.id = header.dump_id;
+      d.epoch_us = header.dump_epoch_us;
+      d.cpu_mhz = header.cpu_mhz;
+      d.chunks = header.chunks;
+      d.received.assign(header.chunks, false);
+      d.records.resize(header.chunks);
+      dumps.push_back(d);
+    }
+    dump &d = dumps.back();
+    std::vector<trace_record> chunk(header.records);
+    if(header.records > 0 && fread(chunk.data(), sizeof(trace_record), header.records, in) != header.records){
+      fprintf(stderr, "truncated chunk %d of dump %u\n", header.chunk, header.dump_id);
+      return 1;
+    }
+    d.records[header.chunk] = chunk;
+    d.received[header.chunk] = true;
+  }
+  fclose(in);
+
+  const dump *last = nullptr;
+  for (size_t i = 0; i < dumps.size(); i++)
+  {
+    if(complete(dumps[i])){
+      last = &dumps[i];
+    }
+  }
+  if(last == nullptr){
+    fprintf(stderr, "no complete dump found\n");
+    return 1;
+  }
+
+  // milliseconds the cycle counter can be trusted for, with some margin for the millis() granularity
+  const uint32_t wrap_ms = (uint32_t)(4294967296.0 / (last->cpu_mhz * 1000.0)) - 1000;
+
+  if(epoch && last->epoch_us == 0){
+    fprintf(stderr, "the device clock was not set when the dump was taken; timestamps stay relative to boot\n");
+  }
+  // added to the microseconds since boot; the epoch of millis() == 0
+  const double offset = epoch && last->epoch_us != 0 ? last->epoch_us - last->id * 1000.0 : 0;
+
+  char taken[32] = "";
+  if(last->epoch_us != 0){
+    time_t seconds = (time_t)(last->epoch_us / 1000000);
+    strftime(taken, sizeof(taken), ", %Y-%m-%d %H:%M:%S UTC", gmtime(&seconds));
+  }
+  printf("{\"traceEvents\": [\n");
+  printf("  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"radthing (dump at %u ms%s)\"}}", last->id, taken);
+  const char* tracks[] = { "", "sensor", "mqtt", "network", "scheduler" };
+  for (int t = 1; t <= 4; t++)
+  {
+    printf(",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", t, tracks[t]);
+  }
+
+  bool first = true;
+  double ts = 0;
+  trace_record previous;
+  for (size_t c = 0; c < last->records.size(); c++)
+  {
+    for (size_t i = 0; i < last->records[c].size(); i++)
+    {
+      const trace_record &r = last->records[c][i];
+      if(first){
+        ts = r.millis * 1000.0 + offset;
+        first = false;
+      }
+      else {
+        uint32_t elapsed_ms = r.millis - previous.millis;
+        ts += elapsed_ms < wrap_ms ? (uint32_t)(r.cycles - previous.cycles) / (double)last->cpu_mhz : elapsed_ms * 1000.0;
+      }
+      previous = r;
+
+      int tid = trackOf(r.event);
+      const char* name = eventName(r.event);
+      switch(r.event){
+        case TRACE_PUBLISH_BEGIN:
+          printf(",\n  {\"name\": \"%s %s\", \"ph\": \"B\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}", name, channelName(r.arg), ts, tid);
+          break;
+        case TRACE_PUBLISH_END:
+          printf(",\n  {\"ph\": \"E\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"ok\": %s}}", ts, tid, (r.arg & TRACE_PUBLISH_FAILED) ? "false" : "true");
+          break;
+        case TRACE_OVERRUN: // stamped at the end of the pass; draw it as a span
+          printf(",\n  {\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"ms\": %u}}", name, ts - r.arg * 1000.0, r.arg * 1000.0, tid, r.arg);
+          break;
+        case TRACE_PUBACK:
+          printf(",\n  {\"name\": \"%s %s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d}", name, channelName(r.arg), ts, tid);
+          break;
+        default:
+          printf(",\n  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"arg\": %u}}", name, ts, tid, r.arg);
+          break;
+      }
+    }
+  }
+  printf("\n], \"displayTimeUnit\": \"ms\"}\n");
+  return 0;
+}